@@ -0,0 +1,63 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "CpuDispatch.hpp"
+
+static CpuLevel DetectLevel()
+{
+#ifdef CPU_DISPATCH
+    __builtin_cpu_init();
+    if( !__builtin_cpu_supports( "sse4.2" ) || !__builtin_cpu_supports( "popcnt" ) ) return CpuLevel::Scalar;
+    if( !__builtin_cpu_supports( "avx2" ) || !__builtin_cpu_supports( "bmi" ) || !__builtin_cpu_supports( "bmi2" ) ) return CpuLevel::SSE42;
+    if( !__builtin_cpu_supports( "avx512f" ) ||
+        !__builtin_cpu_supports( "avx512bw" ) ||
+        !__builtin_cpu_supports( "avx512vl" ) ||
+        !__builtin_cpu_supports( "avx512vpopcntdq" ) ||
+        !__builtin_cpu_supports( "avx512vbmi2" ) ) return CpuLevel::AVX2;
+    return CpuLevel::AVX512;
+#else
+    return CpuLevel::Scalar;
+#endif
+}
+
+CpuLevel CpuDispatch::Level()
+{
+    static const CpuLevel level = [] {
+        auto level = DetectLevel();
+        const char* env = getenv( "UAT_CPU" );
+        if( env )
+        {
+            CpuLevel limit;
+            if( strcmp( env, "scalar" ) == 0 ) limit = CpuLevel::Scalar;
+            else if( strcmp( env, "sse4.2" ) == 0 ) limit = CpuLevel::SSE42;
+            else if( strcmp( env, "avx2" ) == 0 ) limit = CpuLevel::AVX2;
+            else if( strcmp( env, "avx512" ) == 0 ) limit = CpuLevel::AVX512;
+            else
+            {
+                fprintf( stderr, "Unknown UAT_CPU value: %s\n", env );
+                limit = level;
+            }
+            if( limit < level ) level = limit;
+        }
+        return level;
+    }();
+    return level;
+}
+
+const char* CpuDispatch::Name( CpuLevel level )
+{
+    switch( level )
+    {
+    case CpuLevel::Scalar:
+        return "scalar";
+    case CpuLevel::SSE42:
+        return "SSE4.2";
+    case CpuLevel::AVX2:
+        return "AVX2";
+    case CpuLevel::AVX512:
+        return "AVX-512";
+    default:
+        return "unknown";
+    }
+}
@@ -0,0 +1,43 @@
+#ifndef __CPUDISPATCH_HPP__
+#define __CPUDISPATCH_HPP__
+
+// Hot kernels are compiled in several variants, using per-function target
+// attributes, so that binaries built on one machine can run on any other.
+#if ( defined __GNUC__ || defined __clang__ ) && defined __x86_64__
+#  define CPU_DISPATCH
+#  define CPU_TARGET_SSE42 __attribute__(( target( "sse4.2,popcnt" ) ))
+#  define CPU_TARGET_AVX2 __attribute__(( target( "avx2,bmi,bmi2,popcnt" ) ))
+#  define CPU_TARGET_AVX512 __attribute__(( target( "avx512f,avx512bw,avx512vl,avx512vpopcntdq,avx512vbmi2,bmi,bmi2,popcnt" ) ))
+#endif
+
+enum class CpuLevel
+{
+    Scalar,
+    SSE42,
+    AVX2,
+    AVX512      // Ice Lake feature set: F, BW, VL, VPOPCNTDQ, VBMI2
+};
+
+class CpuDispatch
+{
+public:
+    CpuDispatch() = delete;
+
+    // Detected once. May be lowered with UAT_CPU environment variable (scalar, sse4.2, avx2, avx512).
+    static CpuLevel Level();
+    static const char* Name( CpuLevel level );
+    static const char* Name() { return Name( Level() ); }
+
+    // Picks the best variant supported by the CPU. Unavailable variants may be passed as nullptr.
+    template<typename F>
+    static F Select( F scalar, F sse42, F avx2, F avx512 )
+    {
+        const auto level = Level();
+        if( avx512 && level >= CpuLevel::AVX512 ) return avx512;
+        if( avx2 && level >= CpuLevel::AVX2 ) return avx2;
+        if( sse42 && level >= CpuLevel::SSE42 ) return sse42;
+        return scalar;
+    }
+};
+
+#endif
@@ -0,0 +1,100 @@
+#ifndef __DAYHISTOGRAM_HPP__
+#define __DAYHISTOGRAM_HPP__
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+// Number of messages posted on each day, counted in days since epoch. Messages
+// without date are not counted. On disk the first day is followed by counts of
+// each consecutive day.
+class DayHistogram
+{
+public:
+    enum { DaySeconds = 60 * 60 * 24 };
+
+    DayHistogram() = default;
+    DayHistogram( const uint32_t* data, size_t size )
+    {
+        if( size < 2 ) return;
+        m_first = data[0];
+        m_count.assign( data+1, data+size );
+    }
+
+    void AddDate( uint32_t epoch )
+    {
+        if( epoch == 0 ) return;
+        Add( epoch / DaySeconds, 1 );
+    }
+
+    void Add( uint32_t day, uint32_t cnt )
+    {
+        if( m_count.empty() )
+        {
+            m_first = day;
+            m_count.emplace_back( cnt );
+            return;
+        }
+        if( day < m_first )
+        {
+            m_count.insert( m_count.begin(), m_first - day, 0 );
+            m_first = day;
+        }
+        else if( day - m_first >= m_count.size() )
+        {
+            m_count.resize( day - m_first + 1 );
+        }
+        m_count[day - m_first] += cnt;
+    }
+
+    void Add( const DayHistogram& other )
+    {
+        for( size_t i=0; i<other.m_count.size(); i++ )
+        {
+            if( other.m_count[i] != 0 ) Add( other.m_first + i, other.m_count[i] );
+        }
+    }
+
+    // Calls func( day, count ) for each day with messages.
+    template<class T>
+    void ForEachDay( T&& func ) const
+    {
+        for( size_t i=0; i<m_count.size(); i++ )
+        {
+            if( m_count[i] != 0 ) func( uint32_t( m_first + i ), m_count[i] );
+        }
+    }
+
+    bool Empty() const { return m_count.empty(); }
+    uint32_t FirstDay() const { return m_first; }
+    uint32_t LastDay() const { return m_first + m_count.size() - 1; }
+
+    bool operator==( const DayHistogram& other ) const { return m_first == other.m_first && m_count == other.m_count; }
+
+    // Empty histogram removes the file. Returns false, if the file can't be completely written.
+    bool Write( const std::string& fn ) const
+    {
+        if( m_count.empty() )
+        {
+            remove( fn.c_str() );
+            return true;
+        }
+        FILE* f = fopen( fn.c_str(), "wb" );
+        if( !f )
+        {
+            fprintf( stderr, "Cannot open %s for writing.\n", fn.c_str() );
+            exit( 1 );
+        }
+        bool ok = fwrite( &m_first, 1, sizeof( m_first ), f ) == sizeof( m_first );
+        ok = ok && fwrite( m_count.data(), 1, sizeof( uint32_t ) * m_count.size(), f ) == sizeof( uint32_t ) * m_count.size();
+        return fclose( f ) == 0 && ok;
+    }
+
+private:
+    uint32_t m_first = 0;
+    std::vector<uint32_t> m_count;
+};
+
+#endif
@@ -3,6 +3,8 @@
 
 #ifdef _WIN32
 #  include <direct.h>
+#  include <fcntl.h>
+#  include <io.h>
 #  include <windows.h>
 #else
 #  include <dirent.h>
@@ -12,6 +14,7 @@
 #  include <errno.h>
 #endif
 
+#include <stdio.h>
 #include <string.h>
 
 bool CreateDirStruct( const std::string& path )
@@ -137,6 +140,28 @@ void CopyFile( const std::string& from, const std::string& to )
     fclose( dst );
 }
 
+bool MoveReplace( const std::string& from, const std::string& to )
+{
+#ifdef _WIN32
+    return MoveFileExA( from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING ) != 0;
+#else
+    return rename( from.c_str(), to.c_str() ) == 0;
+#endif
+}
+
+bool TruncateFile( const std::string& fn, uint64_t size )
+{
+#ifdef _WIN32
+    const auto fd = _open( fn.c_str(), _O_RDWR | _O_BINARY );
+    if( fd == -1 ) return false;
+    const bool ok = _chsize_s( fd, size ) == 0;
+    _close( fd );
+    return ok;
+#else
+    return truncate( fn.c_str(), size ) == 0;
+#endif
+}
+
 void CopyCommonFiles( const std::string& source, const std::string& target )
 {
     if( Exists( source + "name" ) ) CopyFile( source + "name", target + "name" );
@@ -14,6 +14,9 @@
 bool CreateDirStruct( const std::string& path );
 std::vector<std::string> ListDirectory( const std::string& path );
 void CopyFile( const std::string& from, const std::string& to );
+// Atomically replaces target file, if it exists.
+bool MoveReplace( const std::string& from, const std::string& to );
+bool TruncateFile( const std::string& fn, uint64_t size );
 
 void CopyCommonFiles( const std::string& source, const std::string& target );
 
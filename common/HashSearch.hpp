@@ -17,77 +17,73 @@ class HashSearch
         uint32_t idx;
     };
 
+    // Used when data doesn't fit in 32 bit offsets. Same layout as in HashSearchBig.
+    struct DataWide
+    {
+        uint64_t offset;
+        uint64_t idx;
+    };
+
 public:
-    HashSearch( const std::string& data, const std::string& hash, const std::string& hashdata )
+    HashSearch( const std::string& data, const std::string& hash, const std::string& hashdata, bool wide = false )
         : m_data( data )
         , m_hash( hash )
-        , m_mask( m_hash.DataSize() - 1 )
+        , m_mask( m_hash.Size() / ( wide ? sizeof( DataWide ) : sizeof( Data ) ) - 1 )
+        , m_wide( wide )
     {
         FileMap<char> distfile( hashdata );
         m_distmax = distfile[0];
     }
 
-    HashSearch( const FileMapPtrs& data, const FileMapPtrs& hash, const FileMapPtrs& hashdata )
+    HashSearch( const FileMapPtrs& data, const FileMapPtrs& hash, const FileMapPtrs& hashdata, bool wide = false )
         : m_data( data )
         , m_hash( hash )
-        , m_mask( m_hash.DataSize() - 1 )
+        , m_mask( m_hash.Size() / ( wide ? sizeof( DataWide ) : sizeof( Data ) ) - 1 )
+        , m_wide( wide )
     {
         FileMap<char> distfile( hashdata );
         m_distmax = distfile[0];
     }
 
-    int Search( const T* str, XXH32_hash_t _hash ) const;
-    int Search( const T* str ) const;
-
-private:
-    FileMap<T> m_data;
-    FileMap<Data> m_hash;
-    uint32_t m_mask;
-    uint8_t m_distmax;
-};
-
-template<>
-inline int HashSearch<uint8_t>::Search( const uint8_t* str, XXH32_hash_t _hash ) const
-{
-    auto hash = _hash & m_mask;
-    uint8_t dist = 0;
-    for(;;)
+    int Search( const T* str, XXH32_hash_t _hash ) const
     {
-        auto& h = m_hash[hash];
-        if( h.offset == 0 ) return -1;
-        if( strcmp( (const char*)str, (const char*)(const uint8_t*)m_data + h.offset ) == 0 ) return h.idx;
-        dist++;
-        if( dist > m_distmax ) return -1;
-        hash = (hash+1) & m_mask;
+        if( m_wide )
+        {
+            return Search( (const DataWide*)(const char*)m_hash, str, _hash );
+        }
+        else
+        {
+            return Search( (const Data*)(const char*)m_hash, str, _hash );
+        }
     }
-}
 
-template<>
-inline int HashSearch<char>::Search( const char* str, XXH32_hash_t _hash ) const
-{
-    auto hash = _hash & m_mask;
-    uint8_t dist = 0;
-    for(;;)
+    int Search( const T* str ) const
     {
-        auto& h = m_hash[hash];
-        if( h.offset == 0 ) return -1;
-        if( strcmp( str, m_data + h.offset ) == 0 ) return h.idx;
-        dist++;
-        if( dist > m_distmax ) return -1;
-        hash = (hash+1) & m_mask;
+        return Search( str, XXH32( str, strlen( (const char*)str ), 0 ) );
     }
-}
 
-template<>
-inline int HashSearch<uint8_t>::Search( const uint8_t* str ) const
-{
-    return Search( str, XXH32( str, strlen( (const char*)str ), 0 ) );
-}
+private:
+    template<class D>
+    int Search( const D* table, const T* str, XXH32_hash_t _hash ) const
+    {
+        auto hash = _hash & m_mask;
+        uint8_t dist = 0;
+        for(;;)
+        {
+            auto& h = table[hash];
+            if( h.offset == 0 ) return -1;
+            if( strcmp( (const char*)str, (const char*)(const T*)m_data + h.offset ) == 0 ) return h.idx;
+            dist++;
+            if( dist > m_distmax ) return -1;
+            hash = (hash+1) & m_mask;
+        }
+    }
 
-template<>
-inline int HashSearch<char>::Search( const char* str ) const
-{
-    return Search( str, XXH32( str, strlen( str ), 0 ) );
-}
+    FileMap<T> m_data;
+    FileMap<char> m_hash;
+    uint32_t m_mask;
+    uint8_t m_distmax;
+    bool m_wide;
+};
 
 #endif
@@ -1,14 +1,13 @@
 #include <assert.h>
 #include <unicode/locid.h>
 #include <unicode/brkiter.h>
+#include <unicode/uchar.h>
 #include <unicode/unistr.h>
+#include <unicode/ustring.h>
+#include <unicode/utext.h>
 
 #include "ICU.hpp"
 #include "LexiconTypes.hpp"
-#include "Slab.hpp"
-
-UErrorCode wordItErr = U_ZERO_ERROR;
-auto wordIt = icu::BreakIterator::createWordInstance( icu::Locale::getEnglish(), wordItErr );
 
 static inline bool _isalpha( char c )
 {
@@ -25,6 +24,11 @@ static inline bool _isalnum( char c )
     return _isalpha( c ) || _isdigit( c );
 }
 
+static inline bool _isupper( char c )
+{
+    return c >= 'A' && c <= 'Z';
+}
+
 static inline bool IsUtf( const char* begin, const char* end )
 {
     assert( begin <= end );
@@ -38,99 +42,132 @@ static inline bool IsUtf( const char* begin, const char* end )
     return false;
 }
 
-static void SplitICU( const char* ptr, const char* end, std::vector<std::string>& out, bool toLower )
+// Letters from Latin-1 Supplement and Latin Extended-A blocks, which cover Central European
+// languages. Dotted capital I is excluded, as its full lowercase mapping has two characters.
+static inline bool IsLatinLetter( uint32_t c )
 {
-    assert( ptr != end );
+    return c >= 0xC0 && c <= 0x17F && c != 0xD7 && c != 0xF7 && c != 0x130;
+}
 
-    auto us = icu::UnicodeString::fromUTF8( icu::StringPiece( ptr, end-ptr ) );
-    icu::UnicodeString lower;
+// Characters which may join letters or digits into a single word.
+static inline bool IsMidWord( char c )
+{
+    return c == '.' || c == ',' || c == ';' || c == ':' || c == '\'';
+}
 
-    if( toLower )
-    {
-        lower = us.toLower( icu::Locale::getEnglish() );
-        wordIt->setText( lower );
-    }
-    else
-    {
-        wordIt->setText( us );
-    }
+static inline bool IsWordByte( char c )
+{
+    return ( c & 0x80 ) || _isalnum( c );
+}
 
-    const icu::UnicodeString& data = toLower ? lower : us;
 
-    int32_t p0 = 0;
-    int32_t p1 = wordIt->first();
-    while( p1 != icu::BreakIterator::DONE )
-    {
-        auto part = data.tempSubStringBetween( p0, p1 );
-        auto len = part.countChar32();
-        if( len >= LexiconMinLen )
-        {
-            std::string str;
-            part.toUTF8String( str );
+Tokenizer::Tokenizer()
+    : m_wordIt( nullptr )
+    , m_text( nullptr )
+    , m_stats {}
+{
+}
 
-            auto start = str.c_str();
-            auto end = start + str.size();
+Tokenizer::~Tokenizer()
+{
+    delete m_wordIt;
+    if( m_text ) utext_close( m_text );
+}
+
+const std::vector<std::string_view>& Tokenizer::Split( const char* ptr, const char* end, bool toLower )
+{
+    m_tokens.clear();
+    m_words.clear();
+    m_buf.clear();
+    if( ptr == end ) return m_words;
 
-            auto origlen = len;
-            while( *start == '_' )
+    if( IsUtf( ptr, end ) )
+    {
+        while( ptr <= end )
+        {
+            auto putf = ptr;
+            while( putf < end && ( *putf & 0x80 ) == 0 ) putf++;
+            if( putf == end )
             {
-                start++;
-                len--;
+                if( ptr != end )
+                {
+                    SplitASCII( ptr, end, toLower );
+                }
+                break;
+            }
+            auto split = putf;
+            while( split > ptr && *split != ' ' && *split != '\t' ) split--;
+            if( split > ptr )
+            {
+                SplitASCII( ptr, split, toLower );
+                ptr = split+1;
             }
-            while( end > start && *(end-1) == '_' )
+            while( putf < end && *putf != ' ' && *putf != '\t' ) putf++;
+            if( !SplitLatin( ptr, putf, toLower ) )
             {
-                end--;
-                len--;
+                SplitICU( ptr, putf, toLower );
             }
+            ptr = putf + 1;
+        }
+    }
+    else
+    {
+        SplitASCII( ptr, end, toLower );
+    }
 
-            if( len >= LexiconMinLen && len <= LexiconMaxLen )
+    m_words.reserve( m_tokens.size() );
+    for( auto& t : m_tokens )
+    {
+        m_words.emplace_back( ( t.ptr ? t.ptr : m_buf.data() ) + t.offset, t.len );
+    }
+    return m_words;
+}
+
+void Tokenizer::AddSource( const char* ptr, const char* end, bool toLower )
+{
+    if( toLower )
+    {
+        auto test = ptr;
+        while( test < end && !_isupper( *test ) && ( *test & 0x80 ) == 0 ) test++;
+        if( test != end )
+        {
+            const auto offset = m_buf.size();
+            while( ptr < end )
             {
-                if( origlen == len )
+                if( _isupper( *ptr ) )
+                {
+                    m_buf.emplace_back( *ptr++ - 'A' + 'a' );
+                }
+                else if( *ptr & 0x80 )
                 {
-                    out.emplace_back( std::move( str ) );
+                    // Only valid IsLatinLetter() two byte sequences get here
+                    const uint32_t c = u_tolower( ( ( ptr[0] & 0x1F ) << 6 ) | ( ptr[1] & 0x3F ) );
+                    assert( c >= 0x80 && c < 0x800 );
+                    m_buf.emplace_back( char( 0xC0 | ( c >> 6 ) ) );
+                    m_buf.emplace_back( char( 0x80 | ( c & 0x3F ) ) );
+                    ptr += 2;
                 }
                 else
                 {
-                    out.emplace_back( start, end-start );
+                    m_buf.emplace_back( *ptr++ );
                 }
             }
+            m_tokens.emplace_back( Token { nullptr, uint32_t( offset ), uint32_t( m_buf.size() - offset ) } );
+            return;
         }
-        p0 = p1;
-        p1 = wordIt->next();
     }
+    m_tokens.emplace_back( Token { ptr, 0, uint32_t( end - ptr ) } );
 }
 
-static void SplitASCII( const char* ptr, const char* end, std::vector<std::string>& out, bool toLower )
+void Tokenizer::SplitASCII( const char* ptr, const char* end, bool toLower )
 {
-    static Slab<256*1024> tmpSlab;
-
     assert( ptr != end );
+    m_stats.ascii++;
 
-    const auto size = end - ptr;
-    const char* bptr;
-    if( toLower )
-    {
-        tmpSlab.Reset();
-        auto buf = (char*)tmpSlab.Alloc( size );
-        auto lc = buf;
-        for( int i=0; i<size; i++ )
-        {
-            if( *ptr >= 'A' && *ptr <= 'Z' )
-            {
-                *lc++ = *ptr++ - 'A' + 'a';
-            }
-            else
-            {
-                *lc++ = *ptr++;
-            }
-        }
-        bptr = buf;
-    }
-    else
-    {
-        bptr = ptr;
-    }
-    const char* bend = bptr + size;
+    // Character classes are case insensitive, so words are found in source text
+    // and lowercased only when needed.
+    const char* bptr = ptr;
+    const char* bend = end;
     for(;;)
     {
         while( bptr < bend && !_isalnum( *bptr ) ) bptr++;
@@ -143,47 +180,145 @@ static void SplitASCII( const char* ptr, const char* end, std::vector<std::strin
         auto len = e - bptr;
         if( len >= LexiconMinLen && len <= LexiconMaxLen )
         {
-            out.emplace_back( bptr, e );
+            AddSource( bptr, e, toLower );
         }
         if( e >= bend ) break;
         bptr = e+1;
     }
 }
 
-void SplitLine( const char* ptr, const char* end, std::vector<std::string>& out, bool toLower )
+// Fast path for words consisting of ASCII alphanumerics and Latin letters, separated
+// by ASCII punctuation. ICU word boundary rules always break on both sides of such
+// punctuation, except for underscores, at signs (ICU treats these as letters, to keep
+// e-mail addresses intact) and mid-word characters placed between two word characters.
+// These cases, and anything outside of the handled character set,
+// are left to ICU. Returns false if nothing was done.
+bool Tokenizer::SplitLatin( const char* ptr, const char* end, bool toLower )
 {
-    out.clear();
-    if( ptr == end ) return;
+    const auto tokens = m_tokens.size();
+    const auto buf = m_buf.size();
 
-    if( IsUtf( ptr, end ) )
+    auto p = ptr;
+    while( p < end )
     {
-        while( ptr <= end )
+        if( ( *p & 0x80 ) == 0 && !_isalnum( *p ) )
         {
-            auto putf = ptr;
-            while( putf < end && ( *putf & 0x80 ) == 0 ) putf++;
-            if( putf == end )
+            if( *p == '_' || *p == '@' ) break;
+            if( IsMidWord( *p ) && p > ptr && p < end-1 && IsWordByte( p[-1] ) && IsWordByte( p[1] ) ) break;
+            p++;
+            continue;
+        }
+
+        auto w = p;
+        int len = 0;
+        while( p < end )
+        {
+            if( ( *p & 0x80 ) == 0 )
             {
-                if( ptr != end )
-                {
-                    SplitASCII( ptr, end, out, toLower );
-                }
-                break;
+                if( !_isalnum( *p ) ) break;
+                p++;
             }
-            auto split = putf;
-            while( split > ptr && *split != ' ' && *split != '\t' ) split--;
-            if( split > ptr )
+            else
             {
-                SplitASCII( ptr, split, out, toLower );
-                ptr = split+1;
+                if( p+1 == end || ( p[0] & 0xE0 ) != 0xC0 || ( p[1] & 0xC0 ) != 0x80 ) break;
+                if( !IsLatinLetter( ( ( p[0] & 0x1F ) << 6 ) | ( p[1] & 0x3F ) ) ) break;
+                p += 2;
             }
-            while( putf < end && *putf != ' ' && *putf != '\t' ) putf++;
-            SplitICU( ptr, putf, out, toLower );
-            ptr = putf + 1;
+            len++;
+        }
+        if( p < end && ( *p & 0x80 ) ) break;
+        if( len >= LexiconMinLen && len <= LexiconMaxLen )
+        {
+            AddSource( w, p, toLower );
         }
     }
-    else
+
+    if( p != end )
     {
-        SplitASCII( ptr, end, out, toLower );
+        m_tokens.resize( tokens );
+        m_buf.resize( buf );
+        return false;
+    }
+    m_stats.latin++;
+    return true;
+}
+
+void Tokenizer::SplitICU( const char* ptr, const char* end, bool toLower )
+{
+    assert( ptr != end );
+    m_stats.icu++;
+
+    UErrorCode err = U_ZERO_ERROR;
+    if( !m_wordIt )
+    {
+        m_wordIt = icu::BreakIterator::createWordInstance( icu::Locale::getEnglish(), err );
+    }
+
+    // UTF-16 length never exceeds UTF-8 length
+    const int32_t size = end - ptr;
+    if( m_u16.size() < size ) m_u16.resize( size );
+    int32_t textLen;
+    u_strFromUTF8WithSub( m_u16.data(), m_u16.size(), &textLen, ptr, size, 0xFFFD, nullptr, &err );
+    assert( U_SUCCESS( err ) );
+    const UChar* data = m_u16.data();
+
+    if( toLower )
+    {
+        if( m_u16lower.size() < textLen ) m_u16lower.resize( textLen );
+        err = U_ZERO_ERROR;
+        auto lowerLen = u_strToLower( m_u16lower.data(), m_u16lower.size(), data, textLen, "en", &err );
+        if( err == U_BUFFER_OVERFLOW_ERROR )
+        {
+            m_u16lower.resize( lowerLen );
+            err = U_ZERO_ERROR;
+            lowerLen = u_strToLower( m_u16lower.data(), m_u16lower.size(), data, textLen, "en", &err );
+        }
+        assert( U_SUCCESS( err ) );
+        data = m_u16lower.data();
+        textLen = lowerLen;
+    }
+
+    m_text = utext_openUChars( m_text, data, textLen, &err );
+    m_wordIt->setText( m_text, err );
+
+    int32_t p0 = 0;
+    int32_t p1 = m_wordIt->first();
+    while( p1 != icu::BreakIterator::DONE )
+    {
+        auto len = u_countChar32( data + p0, p1 - p0 );
+        if( len >= LexiconMinLen )
+        {
+            const auto offset = m_buf.size();
+            const auto maxSize = ( p1 - p0 ) * 3;
+            m_buf.resize( offset + maxSize );
+            int32_t strSize;
+            u_strToUTF8WithSub( m_buf.data() + offset, maxSize, &strSize, data + p0, p1 - p0, 0xFFFD, nullptr, &err );
+
+            auto wstart = m_buf.data() + offset;
+            auto wend = wstart + strSize;
+            while( wstart < wend && *wstart == '_' )
+            {
+                wstart++;
+                len--;
+            }
+            while( wend > wstart && *(wend-1) == '_' )
+            {
+                wend--;
+                len--;
+            }
+
+            if( len >= LexiconMinLen && len <= LexiconMaxLen )
+            {
+                m_tokens.emplace_back( Token { nullptr, uint32_t( wstart - m_buf.data() ), uint32_t( wend - wstart ) } );
+                m_buf.resize( offset + strSize );
+            }
+            else
+            {
+                m_buf.resize( offset );
+            }
+        }
+        p0 = p1;
+        p1 = m_wordIt->next();
     }
 }
 
@@ -1,10 +1,68 @@
 #ifndef __ICU_HPP__
 #define __ICU_HPP__
 
+#include <stdint.h>
 #include <string>
+#include <string_view>
 #include <vector>
 
-void SplitLine( const char* ptr, const char* end, std::vector<std::string>& out, bool toLower = true );
+#include <unicode/uversion.h>
+
+U_NAMESPACE_BEGIN
+class BreakIterator;
+U_NAMESPACE_END
+
+struct UText;
+
+// Splits text into lexicon words. Each thread must use its own tokenizer.
+class Tokenizer
+{
+public:
+    struct Stats
+    {
+        uint64_t ascii;     // plain ASCII spans
+        uint64_t latin;     // non-ASCII words handled without ICU
+        uint64_t icu;       // non-ASCII words passed to ICU
+    };
+
+    Tokenizer();
+    ~Tokenizer();
+
+    Tokenizer( const Tokenizer& ) = delete;
+    Tokenizer& operator=( const Tokenizer& ) = delete;
+
+    // Returned words point either to the source text, or to the internal buffer.
+    // They are valid until the next call.
+    const std::vector<std::string_view>& Split( const char* ptr, const char* end, bool toLower = true );
+
+    const Stats& GetStats() const { return m_stats; }
+
+private:
+    struct Token
+    {
+        const char* ptr;    // nullptr if in buffer
+        uint32_t offset;
+        uint32_t len;
+    };
+
+    void SplitASCII( const char* ptr, const char* end, bool toLower );
+    bool SplitLatin( const char* ptr, const char* end, bool toLower );
+    void SplitICU( const char* ptr, const char* end, bool toLower );
+
+    void AddSource( const char* ptr, const char* end, bool toLower );
+
+    std::vector<Token> m_tokens;
+    std::vector<std::string_view> m_words;
+    std::vector<char> m_buf;
+
+    std::vector<UChar> m_u16;
+    std::vector<UChar> m_u16lower;
+    icu::BreakIterator* m_wordIt;
+    UText* m_text;
+
+    Stats m_stats;
+};
+
 std::string ToLower( const char* ptr, const char* end );
 
 #endif
@@ -0,0 +1,254 @@
+#include <string.h>
+
+#include "CpuDispatch.hpp"
+#include "Kernels.hpp"
+
+#ifdef CPU_DISPATCH
+#  include <immintrin.h>
+#endif
+
+static size_t StripCR_Scalar( const char* src, size_t size, char* dst )
+{
+    auto out = dst;
+    const auto end = src + size;
+    while( src < end )
+    {
+        const auto c = *src++;
+        if( c != '\r' ) *out++ = c;
+    }
+    return out - dst;
+}
+
+static size_t AsciiSpan_Scalar( const char* src, size_t size )
+{
+    size_t i = 0;
+    while( i < size && uint8_t( src[i] - 1 ) < 0x7F ) i++;
+    return i;
+}
+
+static inline int CountBits( uint64_t i )
+{
+    i = i - ( (i >> 1) & 0x5555555555555555 );
+    i = ( i & 0x3333333333333333 ) + ( (i >> 2) & 0x3333333333333333 );
+    i = ( (i + (i >> 4) ) & 0x0F0F0F0F0F0F0F0F );
+    return ( i * (0x0101010101010101) ) >> 56;
+}
+
+static uint32_t PopcountFilter_Scalar( const uint64_t* data, uint32_t size, uint64_t ref, int max, uint32_t* out )
+{
+    uint32_t num = 0;
+    for( uint32_t i=0; i<size; i++ )
+    {
+        if( CountBits( data[i] ^ ref ) <= max ) out[num++] = i;
+    }
+    return num;
+}
+
+#ifdef CPU_DISPATCH
+
+CPU_TARGET_SSE42 static size_t StripCR_SSE42( const char* src, size_t size, char* dst )
+{
+    auto out = dst;
+    const auto end = src + size;
+    const auto vcr = _mm_set1_epi8( '\r' );
+    while( end - src >= 16 )
+    {
+        const auto v = _mm_loadu_si128( (const __m128i*)src );
+        if( _mm_movemask_epi8( _mm_cmpeq_epi8( v, vcr ) ) == 0 )
+        {
+            _mm_storeu_si128( (__m128i*)out, v );
+            out += 16;
+        }
+        else
+        {
+            for( int i=0; i<16; i++ )
+            {
+                if( src[i] != '\r' ) *out++ = src[i];
+            }
+        }
+        src += 16;
+    }
+    return ( out - dst ) + StripCR_Scalar( src, end - src, out );
+}
+
+CPU_TARGET_AVX2 static size_t StripCR_AVX2( const char* src, size_t size, char* dst )
+{
+    auto out = dst;
+    const auto end = src + size;
+    const auto vcr = _mm256_set1_epi8( '\r' );
+    while( end - src >= 32 )
+    {
+        const auto v = _mm256_loadu_si256( (const __m256i*)src );
+        uint32_t mask = _mm256_movemask_epi8( _mm256_cmpeq_epi8( v, vcr ) );
+        if( mask == 0 )
+        {
+            _mm256_storeu_si256( (__m256i*)out, v );
+            out += 32;
+        }
+        else
+        {
+            int pos = 0;
+            do
+            {
+                const auto cr = _tzcnt_u32( mask );
+                memcpy( out, src + pos, cr - pos );
+                out += cr - pos;
+                pos = cr + 1;
+                mask = _blsr_u32( mask );
+            }
+            while( mask != 0 );
+            memcpy( out, src + pos, 32 - pos );
+            out += 32 - pos;
+        }
+        src += 32;
+    }
+    return ( out - dst ) + StripCR_Scalar( src, end - src, out );
+}
+
+CPU_TARGET_AVX512 static size_t StripCR_AVX512( const char* src, size_t size, char* dst )
+{
+    auto out = dst;
+    const auto end = src + size;
+    const auto vcr = _mm512_set1_epi8( '\r' );
+    while( src < end )
+    {
+        const auto left = end - src;
+        const __mmask64 load = left >= 64 ? ~__mmask64( 0 ) : _bzhi_u64( ~0ull, left );
+        const auto v = _mm512_maskz_loadu_epi8( load, src );
+        const __mmask64 keep = _mm512_mask_cmpneq_epi8_mask( load, v, vcr );
+        _mm512_mask_compressstoreu_epi8( out, keep, v );
+        out += _mm_popcnt_u64( keep );
+        src += 64;
+    }
+    return out - dst;
+}
+
+CPU_TARGET_SSE42 static size_t AsciiSpan_SSE42( const char* src, size_t size )
+{
+    const auto zero = _mm_setzero_si128();
+    size_t i = 0;
+    for( ; i+16<=size; i+=16 )
+    {
+        const auto v = _mm_loadu_si128( (const __m128i*)( src + i ) );
+        const uint32_t mask = _mm_movemask_epi8( _mm_or_si128( v, _mm_cmpeq_epi8( v, zero ) ) );
+        if( mask != 0 ) return i + __builtin_ctz( mask );
+    }
+    return i + AsciiSpan_Scalar( src + i, size - i );
+}
+
+CPU_TARGET_AVX2 static size_t AsciiSpan_AVX2( const char* src, size_t size )
+{
+    const auto zero = _mm256_setzero_si256();
+    size_t i = 0;
+    for( ; i+32<=size; i+=32 )
+    {
+        const auto v = _mm256_loadu_si256( (const __m256i*)( src + i ) );
+        const uint32_t mask = _mm256_movemask_epi8( _mm256_or_si256( v, _mm256_cmpeq_epi8( v, zero ) ) );
+        if( mask != 0 ) return i + _tzcnt_u32( mask );
+    }
+    return i + AsciiSpan_Scalar( src + i, size - i );
+}
+
+CPU_TARGET_AVX512 static size_t AsciiSpan_AVX512( const char* src, size_t size )
+{
+    const auto limit = _mm512_set1_epi8( 0x7F );
+    for( size_t i=0; i<size; i+=64 )
+    {
+        const auto left = size - i;
+        const __mmask64 load = left >= 64 ? ~__mmask64( 0 ) : _bzhi_u64( ~0ull, left );
+        const auto v = _mm512_maskz_loadu_epi8( load, src + i );
+        // Bytes 0x01-0x7F are the only ones with v - 1 < 0x7F, when compared as unsigned.
+        const __mmask64 stop = _mm512_mask_cmpge_epu8_mask( load, _mm512_sub_epi8( v, _mm512_set1_epi8( 1 ) ), limit );
+        if( stop != 0 ) return i + _tzcnt_u64( stop );
+    }
+    return size;
+}
+
+CPU_TARGET_SSE42 static uint32_t PopcountFilter_SSE42( const uint64_t* data, uint32_t size, uint64_t ref, int max, uint32_t* out )
+{
+    uint32_t num = 0;
+    for( uint32_t i=0; i<size; i++ )
+    {
+        if( int( _mm_popcnt_u64( data[i] ^ ref ) ) <= max ) out[num++] = i;
+    }
+    return num;
+}
+
+CPU_TARGET_AVX2 static uint32_t PopcountFilter_AVX2( const uint64_t* data, uint32_t size, uint64_t ref, int max, uint32_t* out )
+{
+    const auto vref = _mm256_set1_epi64x( ref );
+    const auto vmax = _mm256_set1_epi64x( max );
+    const auto vlow = _mm256_set1_epi8( 0x0F );
+    const auto vlut = _mm256_setr_epi8( 0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4, 0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4 );
+    uint32_t num = 0;
+    uint32_t i = 0;
+    for( ; i+4<=size; i+=4 )
+    {
+        const auto x = _mm256_xor_si256( _mm256_loadu_si256( (const __m256i*)( data + i ) ), vref );
+        const auto lo = _mm256_shuffle_epi8( vlut, _mm256_and_si256( x, vlow ) );
+        const auto hi = _mm256_shuffle_epi8( vlut, _mm256_and_si256( _mm256_srli_epi16( x, 4 ), vlow ) );
+        const auto cnt = _mm256_sad_epu8( _mm256_add_epi8( lo, hi ), _mm256_setzero_si256() );
+        uint32_t mask = ~_mm256_movemask_pd( _mm256_castsi256_pd( _mm256_cmpgt_epi64( cnt, vmax ) ) ) & 0xF;
+        while( mask != 0 )
+        {
+            out[num++] = i + _tzcnt_u32( mask );
+            mask = _blsr_u32( mask );
+        }
+    }
+    for( ; i<size; i++ )
+    {
+        if( int( _mm_popcnt_u64( data[i] ^ ref ) ) <= max ) out[num++] = i;
+    }
+    return num;
+}
+
+CPU_TARGET_AVX512 static uint32_t PopcountFilter_AVX512( const uint64_t* data, uint32_t size, uint64_t ref, int max, uint32_t* out )
+{
+    const auto vref = _mm512_set1_epi64( ref );
+    const auto vmax = _mm512_set1_epi64( max );
+    uint32_t num = 0;
+    for( uint32_t i=0; i<size; i+=8 )
+    {
+        const __mmask8 load = size - i >= 8 ? 0xFF : _bzhi_u32( 0xFF, size - i );
+        const auto x = _mm512_xor_si512( _mm512_maskz_loadu_epi64( load, data + i ), vref );
+        uint32_t mask = _mm512_mask_cmple_epu64_mask( load, _mm512_popcnt_epi64( x ), vmax );
+        while( mask != 0 )
+        {
+            out[num++] = i + _tzcnt_u32( mask );
+            mask = _blsr_u32( mask );
+        }
+    }
+    return num;
+}
+
+#else
+
+#  define AsciiSpan_SSE42 nullptr
+#  define AsciiSpan_AVX2 nullptr
+#  define AsciiSpan_AVX512 nullptr
+#  define StripCR_SSE42 nullptr
+#  define StripCR_AVX2 nullptr
+#  define StripCR_AVX512 nullptr
+#  define PopcountFilter_SSE42 nullptr
+#  define PopcountFilter_AVX2 nullptr
+#  define PopcountFilter_AVX512 nullptr
+
+#endif
+
+size_t StripCR( const char* src, size_t size, char* dst )
+{
+    static const auto fn = CpuDispatch::Select<decltype( &StripCR_Scalar )>( StripCR_Scalar, StripCR_SSE42, StripCR_AVX2, StripCR_AVX512 );
+    return fn( src, size, dst );
+}
+
+size_t AsciiSpan( const char* src, size_t size )
+{
+    static const auto fn = CpuDispatch::Select<decltype( &AsciiSpan_Scalar )>( AsciiSpan_Scalar, AsciiSpan_SSE42, AsciiSpan_AVX2, AsciiSpan_AVX512 );
+    return fn( src, size );
+}
+
+uint32_t PopcountFilter( const uint64_t* data, uint32_t size, uint64_t ref, int max, uint32_t* out )
+{
+    static const auto fn = CpuDispatch::Select<decltype( &PopcountFilter_Scalar )>( PopcountFilter_Scalar, PopcountFilter_SSE42, PopcountFilter_AVX2, PopcountFilter_AVX512 );
+    return fn( data, size, ref, max, out );
+}
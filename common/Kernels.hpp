@@ -0,0 +1,18 @@
+#ifndef __KERNELS_HPP__
+#define __KERNELS_HPP__
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Runtime dispatched variants are selected on first use, see CpuDispatch.
+
+// Copies src to dst, omitting all '\r' characters. Returns output size. Buffers may not overlap.
+size_t StripCR( const char* src, size_t size, char* dst );
+
+// Returns length of initial span of 7-bit characters, which ends at first NUL or byte with high bit set.
+size_t AsciiSpan( const char* src, size_t size );
+
+// Stores indices of all elements for which popcount( data[i] ^ ref ) <= max. Returns number of indices.
+uint32_t PopcountFilter( const uint64_t* data, uint32_t size, uint64_t ref, int max, uint32_t* out );
+
+#endif
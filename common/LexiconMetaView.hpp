@@ -0,0 +1,45 @@
+#ifndef __LEXICONMETAVIEW_HPP__
+#define __LEXICONMETAVIEW_HPP__
+
+#include <assert.h>
+#include <string>
+
+#include "FileMap.hpp"
+#include "LexiconTypes.hpp"
+
+// Access to lexmeta in either layout. Narrow entries are returned with zero hit base.
+class LexiconMetaView
+{
+public:
+    LexiconMetaView( const std::string& fn, bool wide )
+        : m_meta( fn )
+        , m_size( m_meta.Size() / ( wide ? sizeof( LexiconMetaPacketWide ) : sizeof( LexiconMetaPacket ) ) )
+        , m_wide( wide )
+    {
+    }
+
+    LexiconMetaView( const FileMapPtrs& ptrs, bool wide )
+        : m_meta( ptrs )
+        , m_size( m_meta.Size() / ( wide ? sizeof( LexiconMetaPacketWide ) : sizeof( LexiconMetaPacket ) ) )
+        , m_wide( wide )
+    {
+    }
+
+    LexiconMetaPacketWide operator[]( const size_t idx ) const
+    {
+        assert( idx < m_size );
+        if( m_wide ) return ((const LexiconMetaPacketWide*)(const char*)m_meta)[idx];
+        const auto& meta = ((const LexiconMetaPacket*)(const char*)m_meta)[idx];
+        return LexiconMetaPacketWide { meta.str, meta.dataSize, meta.data, 0 };
+    }
+
+    size_t Size() const { return m_size; }
+    bool IsWide() const { return m_wide; }
+
+private:
+    const FileMap<char> m_meta;
+    const size_t m_size;
+    const bool m_wide;
+};
+
+#endif
@@ -0,0 +1,37 @@
+#ifndef __LEXICONSINGLE_HPP__
+#define __LEXICONSINGLE_HPP__
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+// Words used in a single post are not stored in lexicon. They are kept in the lexsingle
+// file instead, so that lexicon merge can index them when they are used again. Each
+// record holds post id, number of hits, hits and zero terminated word.
+struct LexiconSingle
+{
+    uint32_t postid;
+    uint8_t hitnum;
+    const uint8_t* hits;
+    const char* word;
+};
+
+// Returns pointer to the next record.
+static inline const char* ReadLexiconSingle( const char* ptr, LexiconSingle& rec )
+{
+    memcpy( &rec.postid, ptr, sizeof( uint32_t ) );
+    rec.hitnum = ptr[sizeof( uint32_t )];
+    rec.hits = (const uint8_t*)ptr + sizeof( uint32_t ) + 1;
+    rec.word = (const char*)rec.hits + rec.hitnum;
+    return rec.word + strlen( rec.word ) + 1;
+}
+
+static inline void WriteLexiconSingle( const LexiconSingle& rec, FILE* f )
+{
+    fwrite( &rec.postid, 1, sizeof( uint32_t ), f );
+    fwrite( &rec.hitnum, 1, 1, f );
+    fwrite( rec.hits, 1, rec.hitnum, f );
+    fwrite( rec.word, 1, strlen( rec.word ) + 1, f );
+}
+
+#endif
@@ -86,6 +86,15 @@ struct LexiconMetaPacket
     uint32_t dataSize;
 };
 
+// Used in archives with wide lexicon. Hit offsets in data packets are relative to hit.
+struct LexiconMetaPacketWide
+{
+    uint32_t str;
+    uint32_t dataSize;
+    uint64_t data;
+    uint64_t hit;
+};
+
 struct LexiconDataPacket
 {
     uint32_t postid;
@@ -21,9 +21,15 @@ public:
 
     const char* operator[]( const size_t idx )
     {
-        assert( idx < m_meta.Size() );
+        return GetMessage( idx, m_eb );
+    }
+
+    // Thread safe, as long as each thread provides its own buffer.
+    const char* GetMessage( const size_t idx, ExpandingBuffer& eb ) const
+    {
+        assert( idx < Size() );
         const auto meta = m_meta[idx];
-        auto buf = m_eb.Request( meta.size + 1 );
+        auto buf = eb.Request( meta.size + 1 );
         const auto dec = LZ4_decompress_safe( m_data + meta.offset, buf, meta.compressedSize, meta.size );
         assert( dec == meta.size );
         buf[meta.size] = '\0';
@@ -41,4 +41,48 @@ private:
     const FileMap<Data> m_data;
 };
 
+// Meta holds either 32 or 64 bit offsets, as selected when the file was written.
+template<typename Data>
+class WideMetaView
+{
+public:
+    WideMetaView( const std::string& meta, const std::string& data, bool wide )
+        : m_meta( meta )
+        , m_data( data )
+        , m_size( m_meta.Size() / ( wide ? sizeof( uint64_t ) : sizeof( uint32_t ) ) )
+        , m_wide( wide )
+    {
+    }
+
+    WideMetaView( const FileMapPtrs& meta, const FileMapPtrs& data, bool wide )
+        : m_meta( meta )
+        , m_data( data )
+        , m_size( m_meta.Size() / ( wide ? sizeof( uint64_t ) : sizeof( uint32_t ) ) )
+        , m_wide( wide )
+    {
+    }
+
+    operator const Data*() const { return m_data; }
+
+    const Data* operator[]( const size_t idx ) const
+    {
+        assert( idx < m_size );
+        return m_data + Offset( idx ) / sizeof( Data );
+    }
+
+    uint64_t Offset( const size_t idx ) const
+    {
+        return m_wide ? ((const uint64_t*)(const char*)m_meta)[idx] : ((const uint32_t*)(const char*)m_meta)[idx];
+    }
+
+    size_t Size() const { return m_size; }
+    bool IsWide() const { return m_wide; }
+
+private:
+    const FileMap<char> m_meta;
+    const FileMap<Data> m_data;
+    const size_t m_size;
+    const bool m_wide;
+};
+
 #endif
@@ -34,7 +34,10 @@ static const PackMeta PackageContents[] = {
     { "lexdist", true },
     { "lexdistmeta", true },
     { "prefix", true },
-    { "msgid.codebook", false }
+    { "msgid.codebook", false },
+    { "wide", true },
+    { "conncol", true },
+    { "timechart", true }
 };
 
 struct PackageFile
@@ -65,6 +68,9 @@ struct PackageFile
         lexdistmeta,
         prefix,
         codebook,
+        wide,
+        conncol,
+        timechart,
         NUM_PACKAGE_FILE_TYPES
     };
 };
@@ -73,12 +79,37 @@ enum { PackageFiles = sizeof( PackageContents ) / sizeof( PackMeta ) };
 enum { AdditionalFilesV1 = 2 };
 enum { AdditionalFilesV2 = 1 };
 enum { AdditionalFilesV3 = 1 };
+enum { AdditionalFilesV4 = 3 };
 
-enum : char { PackageVersion = 3 };
+enum : char { PackageVersion = 4 };
+// Oldest version that can be accessed in place. Files added later are reported as empty.
+enum : char { PackageMinVersion = 3 };
 enum { PackageHeaderSize = 8 };
 enum { PackageMagicSize = PackageHeaderSize - 1 };
 static const char PackageHeader[PackageHeaderSize] = { '\0', 'U', 's', 'e', 'n', 'e', 't', PackageVersion };
 
+static inline int PackageNumberOfFiles( int version )
+{
+    int numfiles = PackageFiles;
+    if( version < 4 )
+    {
+        numfiles -= AdditionalFilesV4;
+        if( version < 3 )
+        {
+            numfiles -= AdditionalFilesV3;
+            if( version < 2 )
+            {
+                numfiles -= AdditionalFilesV2;
+                if( version < 1 )
+                {
+                    numfiles -= AdditionalFilesV1;
+                }
+            }
+        }
+    }
+    return numfiles;
+}
+
 static inline uint64_t PackageAlign( uint64_t offset ) { return ( ( offset + 7 ) / 8 ) * 8; }
 
 
@@ -39,8 +39,9 @@ inline bool ValidateMsgId( const char* begin, const char* end, char* dst )
 // Return message index of parent.
 //  -1 indicates no parent
 //  -2 indicates broken, unrecoverable reference information
-template<class Search>
-inline int GetParentFromReferences( const char* post, const StringCompress& compress, const Search& hash, char* tmp )
+// Packed references which were checked, but not found, are passed to the missing callback.
+template<class Search, class Missing>
+inline int GetParentFromReferences( const char* post, const StringCompress& compress, const Search& hash, char* tmp, Missing missing )
 {
     auto buf = FindReferences( post );
     if( *buf == '\n' ) return -1;
@@ -82,11 +83,18 @@ inline int GetParentFromReferences( const char* post, const StringCompress& comp
         {
             return idx;
         }
+        missing( pack );
 
         buf -= 2;
     }
 }
 
+template<class Search>
+inline int GetParentFromReferences( const char* post, const StringCompress& compress, const Search& hash, char* tmp )
+{
+    return GetParentFromReferences( post, compress, hash, tmp, [] ( const uint8_t* ) {} );
+}
+
 std::vector<std::string> GetAllReferences( const char* post, const StringCompress& compress )
 {
     std::vector<std::string> ret;
@@ -630,11 +630,33 @@ StringCompress::StringCompress( const FileMapPtrs& ptrs )
     memcpy( m_hostHash, f+offset, HashSize * sizeof( uint8_t ) );
 }
 
+StringCompress::StringCompress( const HostCount& hosts )
+{
+    Init( hosts );
+}
+
 StringCompress::~StringCompress()
 {
     delete[] m_data;
 }
 
+void StringCompress::CountHost( HostCount& hosts, const char* str )
+{
+    while( *str != '@' && *str != '\0' ) str++;
+    if( *str == '@' )
+    {
+        auto it = hosts.find( str+1 );
+        if( it == hosts.end() )
+        {
+            hosts.emplace( str+1, 1 );
+        }
+        else
+        {
+            it->second++;
+        }
+    }
+}
+
 static inline bool memcmp3( const char* l, const char* r )
 {
     if( l[0] < r[0] ) return true;
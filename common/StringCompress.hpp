@@ -21,8 +21,12 @@ class StringCompress
     enum { HostMax = 256 - HostReserve };
 
 public:
+    using HostCount = robin_hood::unordered_flat_map<std::string, uint64_t>;
+
     template<class T>
     StringCompress( const T& strings );
+    // Code book built from host occurrence counts, collected with CountHost().
+    StringCompress( const HostCount& hosts );
     StringCompress( const std::string& fn );
     StringCompress( const FileMapPtrs& ptrs );
     ~StringCompress();
@@ -33,6 +37,8 @@ public:
 
     void WriteData( const std::string& fn ) const;
 
+    static void CountHost( HostCount& hosts, const char* str );
+
 private:
     StringCompress( const StringCompress& ) = delete;
     StringCompress( StringCompress&& ) = delete;
@@ -40,6 +46,14 @@ private:
     StringCompress& operator=( const StringCompress& ) = delete;
     StringCompress& operator=( StringCompress&& ) = delete;
 
+    template<class T>
+    void Init( const T& hosts );
+
+    static size_t HostLength( const char* host ) { return strlen( host ); }
+    static size_t HostLength( const std::string& host ) { return host.size(); }
+    static const char* HostString( const char* host ) { return host; }
+    static const char* HostString( const std::string& host ) { return host.c_str(); }
+
     void BuildHostHash();
     void PackHost( uint8_t*& out, const char* host ) const;
 
@@ -75,19 +89,25 @@ StringCompress::StringCompress( const T& strings )
         }
     }
 
-    std::vector<robin_hood::unordered_flat_map<const char*, uint64_t, CharUtil::Hasher, CharUtil::Comparator>::iterator> hvec;
+    Init( hosts );
+}
+
+template<class T>
+void StringCompress::Init( const T& hosts )
+{
+    std::vector<typename T::const_iterator> hvec;
     hvec.reserve( hosts.size() );
     for( auto it = hosts.begin(); it != hosts.end(); ++it )
     {
         hvec.emplace_back( it );
     }
-    std::sort( hvec.begin(), hvec.end(), [] ( const auto& l, const auto& r ) { return l->second * ( strlen( l->first ) - 1 ) > r->second * ( strlen( r->first ) - 1 ); } );
+    std::sort( hvec.begin(), hvec.end(), [] ( const auto& l, const auto& r ) { return l->second * ( HostLength( l->first ) - 1 ) > r->second * ( HostLength( r->first ) - 1 ); } );
 
     m_dataLen = 0;
     m_maxHost = std::min<int>( hvec.size(), HostMax );
     for( int i=0; i<m_maxHost; i++ )
     {
-        m_dataLen += strlen( hvec[i]->first ) + 1;
+        m_dataLen += HostLength( hvec[i]->first ) + 1;
     }
 
     auto data = new char[m_dataLen];
@@ -95,8 +115,8 @@ StringCompress::StringCompress( const T& strings )
     for( int i=0; i<m_maxHost; i++ )
     {
         m_hostOffset[i] = ptr - data;
-        auto len = strlen( hvec[i]->first );
-        memcpy( ptr, hvec[i]->first, len+1 );
+        auto len = HostLength( hvec[i]->first );
+        memcpy( ptr, HostString( hvec[i]->first ), len+1 );
         ptr += len+1;
     }
     m_data = data;
@@ -105,7 +125,7 @@ StringCompress::StringCompress( const T& strings )
     {
         m_hostLookup[i] = i;
     }
-    std::sort( m_hostLookup, m_hostLookup+m_maxHost, [&hvec] ( const auto& l, const auto& r ) { return strcmp( hvec[l]->first, hvec[r]->first ) < 0; } );
+    std::sort( m_hostLookup, m_hostLookup+m_maxHost, [&hvec] ( const auto& l, const auto& r ) { return strcmp( HostString( hvec[l]->first ), HostString( hvec[r]->first ) ) < 0; } );
 
     BuildHostHash();
 }
@@ -1,7 +1,9 @@
 #include <ctype.h>
 #include <locale>
+#include <stdint.h>
 #include <wchar.h>
 
+#include "Kernels.hpp"
 #include "UTF8.hpp"
 
 size_t utflen( const char* str )
@@ -91,6 +93,54 @@ const char* utfendcrlfl( const char* str, int& len )
 
 static const std::locale utf8( "en_US.UTF-8" );
 
+bool utfvalid( const char* str, size_t size, bool& ascii )
+{
+    const auto end = (const uint8_t*)str + size;
+    auto ptr = (const uint8_t*)str + AsciiSpan( str, size );
+    ascii = ptr == end;
+    while( ptr < end )
+    {
+        const auto c = *ptr;
+        if( c == 0 ) return false;
+        if( c < 0x80 )
+        {
+            ptr += AsciiSpan( (const char*)ptr, end - ptr );
+            continue;
+        }
+
+        int len;
+        uint8_t min = 0x80, max = 0xBF;
+        if( c >= 0xC2 && c <= 0xDF )
+        {
+            len = 2;
+        }
+        else if( c >= 0xE0 && c <= 0xEF )
+        {
+            len = 3;
+            if( c == 0xE0 ) min = 0xA0;
+            else if( c == 0xED ) max = 0x9F;
+        }
+        else if( c >= 0xF0 && c <= 0xF4 )
+        {
+            len = 4;
+            if( c == 0xF0 ) min = 0x90;
+            else if( c == 0xF4 ) max = 0x8F;
+        }
+        else
+        {
+            return false;
+        }
+        if( end - ptr < len ) return false;
+        if( ptr[1] < min || ptr[1] > max ) return false;
+        for( int i=2; i<len; i++ )
+        {
+            if( !iscontinuationbyte( ptr[i] ) ) return false;
+        }
+        ptr += len;
+    }
+    return true;
+}
+
 bool utfisalpha( const char* c )
 {
     while( iscontinuationbyte( *c ) ) c--;
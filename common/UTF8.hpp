@@ -26,6 +26,9 @@ const char* utfendl( const char* str, int& len );
 const char* utfendcrlf( const char* str, int len );
 const char* utfendcrlfl( const char* str, int& len );
 
+// Strict validation: no overlong forms, surrogates, code points above U+10FFFF or NUL characters.
+bool utfvalid( const char* str, size_t size, bool& ascii );
+
 bool utfisalpha( const char* c );
 bool utfisalnum( const char* c );
 bool utfispunct( const char* c );
@@ -0,0 +1,82 @@
+#ifndef __WIDEOFFSETS_HPP__
+#define __WIDEOFFSETS_HPP__
+
+#include <limits>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+
+#include "FileMap.hpp"
+#include "Filesystem.hpp"
+
+// Archive files use 32 bit offsets. When data of a group of files grows beyond
+// that, the group is written with 64 bit offsets instead, which is recorded in
+// the optional "wide" file. Archives without this file are narrow everywhere.
+enum WideOffsets : uint32_t
+{
+    WideMsgId           = 1 << 0,   // midmeta, midhash
+    WideConnectivity    = 1 << 1,   // connmeta
+    WideStrings         = 1 << 2,   // strmeta
+    WideLexicon         = 1 << 3    // lexmeta, hit offsets in lexdata relative to word base
+};
+
+// Setting UAT_WIDE_OFFSETS environment variable forces wide files to be written.
+static inline bool NeedsWideOffsets( uint64_t size, uint64_t limit = std::numeric_limits<uint32_t>::max() )
+{
+    static const bool force = getenv( "UAT_WIDE_OFFSETS" ) != nullptr;
+    return force || size > limit;
+}
+
+static inline void WriteOffset( uint64_t offset, bool wide, FILE* f )
+{
+    if( wide )
+    {
+        fwrite( &offset, 1, sizeof( uint64_t ), f );
+    }
+    else
+    {
+        const uint32_t narrow = offset;
+        fwrite( &narrow, 1, sizeof( uint32_t ), f );
+    }
+}
+
+static inline uint32_t ReadWideOffsets( const std::string& base )
+{
+    if( !Exists( base + "wide" ) ) return 0;
+    FileMap<uint32_t> wide( base + "wide" );
+    return wide.DataSize() == 0 ? 0 : wide[0];
+}
+
+static inline uint32_t ReadWideOffsets( const FileMapPtrs& ptrs )
+{
+    return ptrs.size < sizeof( uint32_t ) ? 0 : *(const uint32_t*)ptrs.ptr;
+}
+
+static inline void WriteWideOffsets( const std::string& base, uint32_t group, bool wide )
+{
+    auto flags = ReadWideOffsets( base );
+    if( wide )
+    {
+        flags |= group;
+    }
+    else
+    {
+        flags &= ~group;
+    }
+    if( flags == 0 )
+    {
+        remove( ( base + "wide" ).c_str() );
+        return;
+    }
+    FILE* f = fopen( ( base + "wide" ).c_str(), "wb" );
+    if( !f )
+    {
+        fprintf( stderr, "Cannot open %s for writing.\n", ( base + "wide" ).c_str() );
+        exit( 1 );
+    }
+    fwrite( &flags, 1, sizeof( flags ), f );
+    fclose( f );
+}
+
+#endif
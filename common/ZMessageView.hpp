@@ -2,6 +2,7 @@
 #define __ZMESSAGEVIEW_HPP__
 
 #include <assert.h>
+#include <mutex>
 #include <stdlib.h>
 #include <string>
 
@@ -20,6 +21,7 @@ public:
         , m_data( data )
         , m_dictdata( dict )
         , m_ctx( nullptr )
+        , m_dict( nullptr )
     {
     }
 
@@ -28,25 +30,31 @@ public:
         , m_data( data )
         , m_dictdata( dict )
         , m_ctx( nullptr )
+        , m_dict( nullptr )
     {
     }
 
     ~ZMessageView()
     {
-        if( m_ctx )
-        {
-            ZSTD_freeDCtx( m_ctx );
-            ZSTD_freeDDict( m_dict );
-        }
+        if( m_ctx ) ZSTD_freeDCtx( m_ctx );
+        if( m_dict ) ZSTD_freeDDict( m_dict );
     }
 
     const char* GetMessage( const size_t idx, ExpandingBuffer& eb )
     {
-        if( !m_ctx ) InitZstd();
-        assert( idx < m_meta.Size() );
+        if( !m_ctx ) m_ctx = ZSTD_createDCtx();
+        return GetMessage( idx, eb, m_ctx );
+    }
+
+    // Thread safe, as long as each thread provides its own buffer and context.
+    // Dictionary is shared between all threads.
+    const char* GetMessage( const size_t idx, ExpandingBuffer& eb, ZSTD_DCtx* ctx ) const
+    {
+        std::call_once( m_dictInit, [this] { m_dict = ZSTD_createDDict_byReference( m_dictdata, m_dictdata.Size() ); } );
+        assert( idx < Size() );
         const auto meta = m_meta[idx];
         auto buf = eb.Request( meta.size + 1 );
-        const auto dec = ZSTD_decompress_usingDDict( m_ctx, buf, meta.size, m_data + meta.offset, meta.compressedSize, m_dict );
+        const auto dec = ZSTD_decompress_usingDDict( ctx, buf, meta.size, m_data + meta.offset, meta.compressedSize, m_dict );
         assert( dec == meta.size );
         buf[meta.size] = '\0';
         return buf;
@@ -83,19 +91,13 @@ public:
     }
 
 private:
-    void InitZstd()
-    {
-        assert( !m_ctx );
-        m_ctx = ZSTD_createDCtx();
-        m_dict = ZSTD_createDDict_byReference( m_dictdata, m_dictdata.Size() );
-    }
-
     const FileMap<RawImportMeta> m_meta;
     const FileMap<char> m_data;
     const FileMap<char> m_dictdata;
 
     ZSTD_DCtx* m_ctx;
-    ZSTD_DDict* m_dict;
+    mutable ZSTD_DDict* m_dict;
+    mutable std::once_flag m_dictInit;
 };
 
 #endif
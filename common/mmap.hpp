@@ -10,9 +10,11 @@
 #  define PROT_READ 1
 #  define PROT_WRITE 2
 #  define MAP_SHARED 0
+#  define MS_SYNC 4
 
 void* mmap( void* addr, size_t length, int prot, int flags, int fd, off_t offset );
 int munmap( void* addr, size_t length );
+int msync( void* addr, size_t length, int flags );
 
 #endif
 
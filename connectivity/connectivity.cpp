@@ -11,12 +11,14 @@
 #include <vector>
 
 #include "../contrib/martinus/robin_hood.h"
+#include "../common/DayHistogram.hpp"
 #include "../common/Filesystem.hpp"
 #include "../common/HashSearch.hpp"
 #include "../common/MessageView.hpp"
 #include "../common/ParseDate.hpp"
 #include "../common/ReferencesParent.hpp"
 #include "../common/StringCompress.hpp"
+#include "../common/WideOffsets.hpp"
 
 struct Message
 {
@@ -48,7 +50,7 @@ int main( int argc, char** argv )
     base.append( "/" );
 
     MessageView mview( base + "meta", base + "data" );
-    const HashSearch<uint8_t> hash( base + "middata", base + "midhash", base + "midhashdata" );
+    const HashSearch<uint8_t> hash( base + "middata", base + "midhash", base + "midhashdata", ReadWideOffsets( base ) & WideMsgId );
     const StringCompress compress( base + "msgid.codebook" );
 
     const auto size = mview.Size();
@@ -187,9 +189,17 @@ int main( int argc, char** argv )
     fwrite( toplevel.data(), 1, sizeof( uint32_t ) * toplevel.size(), tlout );
     fclose( tlout );
 
+    uint64_t datasize = 0;
+    for( uint32_t i=0; i<size; i++ )
+    {
+        datasize += sizeof( uint32_t ) * ( 4 + data[i].children.size() );
+    }
+    const bool wide = NeedsWideOffsets( datasize );
+    WriteWideOffsets( base, WideConnectivity, wide );
+
     FILE* cdata = fopen( ( base + "conndata" ).c_str(), "wb" );
     FILE* cmeta = fopen( ( base + "connmeta" ).c_str(), "wb" );
-    uint32_t offset = 0;
+    uint64_t offset = 0;
     for( uint32_t i=0; i<size; i++ )
     {
         if( ( i & 0x1FFF ) == 0 )
@@ -198,7 +208,7 @@ int main( int argc, char** argv )
             fflush( stdout );
         }
 
-        fwrite( &offset, 1, sizeof( uint32_t ), cmeta );
+        WriteOffset( offset, wide, cmeta );
 
         offset += fwrite( &data[i].epoch, 1, sizeof( Message::epoch ), cdata );
         offset += fwrite( &data[i].parent, 1, sizeof( Message::parent ), cdata );
@@ -213,6 +223,17 @@ int main( int argc, char** argv )
     fclose( cdata );
     fclose( cmeta );
 
+    // Columnar copy of the fixed fields, for linear scans over all messages.
+    FILE* ccol = fopen( ( base + "conncol" ).c_str(), "wb" );
+    for( uint32_t i=0; i<size; i++ ) fwrite( &data[i].epoch, 1, sizeof( Message::epoch ), ccol );
+    for( uint32_t i=0; i<size; i++ ) fwrite( &data[i].parent, 1, sizeof( Message::parent ), ccol );
+    for( uint32_t i=0; i<size; i++ ) fwrite( &data[i].childTotal, 1, sizeof( Message::childTotal ), ccol );
+    fclose( ccol );
+
+    DayHistogram chart;
+    for( uint32_t i=0; i<size; i++ ) chart.AddDate( data[i].epoch );
+    chart.Write( base + "timechart" );
+
     printf( "%zu/%zu\n", size, size );
 
     delete[] data;
@@ -15,6 +15,7 @@
 #include "../kyotocabinet/kchashdb.h"
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 
 #include "terminator_classifier_owv.h"
 
@@ -44,7 +45,30 @@ class Terminator {
   ~Terminator();
   double Predict(std::string email_content);
   void Train(std::string email_content, bool is_spam);
+
+  // Read-only access to the trained model
+  template<class F> void ForEachFeature(F&& f);
+  const double* GetClassifierWeights() const { return classifier_weights_; }
 };
 
+// Calls f(const char* feature, const node& value) for each stored feature
+template<class F>
+void Terminator::ForEachFeature(F&& f) {
+  kyotocabinet::HashDB::Cursor* cur = db_.cursor();
+  cur->jump();
+  size_t ksiz, vsiz;
+  const char* vbuf;
+  char* kbuf;
+  while ((kbuf = cur->get(&ksiz, &vbuf, &vsiz, true)) != NULL) {
+    if (ksiz == NGRAM && vsiz == sizeof(node)) {
+      node value;
+      memcpy(&value, vbuf, sizeof(node));
+      f(kbuf, value);
+    }
+    delete[] kbuf;
+  }
+  delete cur;
+}
+
 
 #endif
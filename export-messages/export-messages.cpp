@@ -9,6 +9,7 @@
 #include "../common/MessageView.hpp"
 #include "../common/MetaView.hpp"
 #include "../common/StringCompress.hpp"
+#include "../common/WideOffsets.hpp"
 
 int main( int argc, char** argv )
 {
@@ -34,7 +35,7 @@ int main( int argc, char** argv )
     base.append( "/" );
 
     MessageView mview( base + "meta", base + "data" );
-    const MetaView<uint32_t, uint8_t> mid( base + "midmeta", base + "middata" );
+    const WideMetaView<uint8_t> mid( base + "midmeta", base + "middata", ReadWideOffsets( base ) & WideMsgId );
     const StringCompress compress( base + "msgid.codebook" );
 
     const auto size = mview.Size();
@@ -19,6 +19,7 @@
 #include "../common/MsgIdHash.hpp"
 #include "../common/Slab.hpp"
 #include "../common/StringCompress.hpp"
+#include "../common/WideOffsets.hpp"
 
 void CreateDummyMsgId( const char*& begin, const char*& end, int idx )
 {
@@ -118,6 +119,7 @@ int main( int argc, char** argv )
 
     std::vector<const uint8_t*> msgidvec;
     msgidvec.reserve( size );
+    uint64_t datasize = 1;
     for( int i=0; i<size; i++ )
     {
         if( ( i & 0x3FFF ) == 0 )
@@ -131,9 +133,13 @@ int main( int argc, char** argv )
         assert( sz <= 2048 );
         slab.Unalloc( 2048 - sz );
         msgidvec.emplace_back( ptr );
+        datasize += sz + 1;
     }
     printf( "\n" );
 
+    const bool wide = NeedsWideOffsets( datasize );
+    WriteWideOffsets( base, WideMsgId, wide );
+
     auto hashbits = MsgIdHashBits( size, 90 );
     auto hashsize = MsgIdHashSize( hashbits );
     auto hashmask = MsgIdHashMask( hashbits );
@@ -181,9 +187,9 @@ int main( int argc, char** argv )
     FILE* strmeta = fopen( ( base + "midmeta" ).c_str(), "wb" );
 
     const uint32_t zero = 0;
-    uint32_t stroffset = fwrite( &zero, 1, 1, strdata );
+    uint64_t stroffset = fwrite( &zero, 1, 1, strdata );
 
-    auto msgidoffset = new uint32_t[size];
+    auto msgidoffset = new uint64_t[size];
 
     int cnt = 0;
     for( int i=0; i<hashsize; i++ )
@@ -196,13 +202,13 @@ int main( int argc, char** argv )
 
         if( distance[i] == 0xFF )
         {
-            fwrite( &zero, 1, sizeof( uint32_t ), data );
-            fwrite( &zero, 1, sizeof( uint32_t ), data );
+            WriteOffset( 0, wide, data );
+            WriteOffset( 0, wide, data );
         }
         else
         {
-            fwrite( &stroffset, 1, sizeof( uint32_t ), data );
-            fwrite( hashdata+i, 1, sizeof( uint32_t ), data );
+            WriteOffset( stroffset, wide, data );
+            WriteOffset( hashdata[i], wide, data );
 
             msgidoffset[hashdata[i]] = stroffset;
             cnt++;
@@ -212,7 +218,7 @@ int main( int argc, char** argv )
     }
 
     assert( cnt == size );
-    fwrite( msgidoffset, 1, size * sizeof( uint32_t ), strmeta );
+    for( size_t i=0; i<size; i++ ) WriteOffset( msgidoffset[i], wide, strmeta );
 
     fclose( data );
     fclose( strdata );
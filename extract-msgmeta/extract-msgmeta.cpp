@@ -1,5 +1,6 @@
 #include <algorithm>
 #include <assert.h>
+#include <inttypes.h>
 #include <limits>
 #include <stdint.h>
 #include <stdio.h>
@@ -12,6 +13,7 @@
 #include "../common/CharUtil.hpp"
 #include "../common/MessageView.hpp"
 #include "../common/String.hpp"
+#include "../common/WideOffsets.hpp"
 
 #include "tin.hpp"
 
@@ -125,9 +127,11 @@ int main( int argc, char** argv )
 
     std::vector<size_t> lengths;
     lengths.reserve( strings.size() );
+    size_t bufSize = 0;
     for( auto& v : strings )
     {
         lengths.emplace_back( v.size() );
+        bufSize += v.size() + 1;
     }
 
     std::vector<size_t> order;
@@ -139,14 +143,13 @@ int main( int argc, char** argv )
 
     std::sort( order.begin(), order.end(), [&lengths]( const auto& l, const auto& r ) { return lengths[l] > lengths[r]; } );
 
-    const int bufSize = 1024*1024*64;
     char* buf = new char[bufSize];
 
     robin_hood::unordered_flat_set<const char*, CharUtil::Hasher, CharUtil::Comparator> avail;
-    std::vector<uint32_t> outOffset( strings.size() );
+    std::vector<uint64_t> outOffset( strings.size() );
 
-    unsigned int savings = 0;
-    uint32_t offset = 0;
+    size_t savings = 0;
+    uint64_t offset = 0;
     for( int i=0; i<strings.size(); i++ )
     {
         if( ( i & 0x1FFF ) == 0 )
@@ -184,7 +187,7 @@ int main( int argc, char** argv )
         }
     }
 
-    printf( "\nOptimization savings: %iKB\n", savings / 1024 );
+    printf( "\nOptimization savings: %zuKB\n", savings / 1024 );
     printf( "Saving...\n" );
     fflush( stdout );
 
@@ -192,19 +195,18 @@ int main( int argc, char** argv )
     fwrite( buf, 1, offset, strout );
     fclose( strout );
 
-    printf( "Strings DB size: %iKB\n", offset / 1024 );
+    printf( "Strings DB size: %" PRIu64 "KB\n", offset / 1024 );
     fflush( stdout );
 
+    const bool wide = NeedsWideOffsets( offset );
+    WriteWideOffsets( base, WideStrings, wide );
+
     FILE* out = fopen( ( base + "strmeta" ).c_str(), "wb" );
     for( uint32_t i=0; i<size; i++ )
     {
-        uint32_t fo = outOffset[data[i].from];
-        uint32_t so = outOffset[data[i].subject];
-        uint32_t ro = outOffset[data[i].realname];
-
-        fwrite( &fo, 1, sizeof( fo ), out );
-        fwrite( &so, 1, sizeof( so ), out );
-        fwrite( &ro, 1, sizeof( ro ), out );
+        WriteOffset( outOffset[data[i].from], wide, out );
+        WriteOffset( outOffset[data[i].subject], wide, out );
+        WriteOffset( outOffset[data[i].realname], wide, out );
     }
     fclose( out );
 
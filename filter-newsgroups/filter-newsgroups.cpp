@@ -15,6 +15,7 @@
 #include "../common/MessageView.hpp"
 #include "../common/RawImportMeta.hpp"
 #include "../common/String.hpp"
+#include "../common/WideOffsets.hpp"
 
 int main( int argc, char** argv )
 {
@@ -40,7 +41,7 @@ int main( int argc, char** argv )
     MessageView mview( base + "meta", base + "data" );
     const auto size = mview.Size();
 
-    const MetaView<uint32_t, uint32_t> conn( base + "connmeta", base + "conndata" );
+    const WideMetaView<uint32_t> conn( base + "connmeta", base + "conndata", ReadWideOffsets( base ) & WideConnectivity );
 
     CreateDirStruct( argv[3] );
 
@@ -0,0 +1,196 @@
+#include <algorithm>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "SpamModel.hpp"
+
+// Parameters of the OWV classifier ensemble, as set up in Terminator.
+static constexpr double BWinnowThreshold = 1.0;
+static constexpr double BWinnowShift = 1;
+static constexpr double LogisticShift = 10;
+static constexpr double NbShift = 3200;
+static constexpr double NbSmooth = 1e-5;
+static constexpr double NsnbShift = 3200;
+static constexpr double NsnbSmooth = 1e-5;
+static constexpr double WinnowThreshold = 1.0;
+static constexpr double WinnowShift = 1;
+static constexpr double PaShift = 1.0;
+static constexpr double PamShift = 1.25;
+static constexpr double HitShift = 60;
+
+static constexpr char Magic[8] = { 'U', 'A', 'T', 'S', 'P', 'A', 'M', '\0' };
+static constexpr uint32_t Version = 1;
+
+static inline uint32_t Hash( uint32_t key )
+{
+    return key * 2654435761u;
+}
+
+SpamModel::SpamModel( Terminator& classifier )
+{
+    const auto totalSpam = TerminatorClassifierBase::TotalSpam;
+    const auto totalHam = TerminatorClassifierBase::TotalHam;
+
+    std::vector<Feature> features;
+    classifier.ForEachFeature( [&features, totalSpam, totalHam] ( const char* ngram, const node& n ) {
+        const uint32_t key = ( uint8_t( ngram[0] ) << 24 ) | ( uint8_t( ngram[1] ) << 16 ) | ( uint8_t( ngram[2] ) << 8 ) | uint8_t( ngram[3] );
+        if( key == 0 ) return;
+
+        // Expressions must be kept in sync with classifier implementations.
+        double nb = 0;
+        if( n.nb_spam != 0 || n.nb_ham != 0 )
+        {
+            nb = log( ( n.nb_spam + NbSmooth ) / ( n.nb_ham + NbSmooth ) * ( totalHam + 2 * NbSmooth ) / ( totalSpam + 2 * NbSmooth ) );
+        }
+        double nsnb = 0;
+        if( n.nsnb_spam != 0 || n.nsnb_ham != 0 )
+        {
+            nsnb = log( ( n.nsnb_spam + NsnbSmooth ) / ( n.nsnb_ham + NsnbSmooth ) * ( totalHam + 2 * NsnbSmooth ) / ( totalSpam + 2 * NsnbSmooth ) * n.nsnb_confidence );
+        }
+        features.emplace_back( Feature { key, n.bwinnow_upper - n.bwinnow_lower, n.logist, n.winnow, n.pa, n.pam, n.hit, nb, nsnb } );
+    } );
+
+    uint32_t bits = 10;
+    while( ( size_t( 1 ) << bits ) < features.size() * 2 ) bits++;
+    const size_t tableSize = size_t( 1 ) << bits;
+
+    m_buf.resize( ( sizeof( Header ) + tableSize * sizeof( Feature ) ) / sizeof( uint64_t ) );
+    auto header = (Header*)m_buf.data();
+    auto table = (Feature*)( header + 1 );
+
+    memcpy( header->magic, Magic, sizeof( Magic ) );
+    header->version = Version;
+    header->bits = bits;
+    header->features = features.size();
+    memcpy( header->weights, classifier.GetClassifierWeights(), sizeof( header->weights ) );
+    header->nbPrior = log( ( totalSpam + NbSmooth ) / ( totalHam + NbSmooth ) );
+    header->nsnbPrior = log( ( totalSpam + NsnbSmooth ) / ( totalHam + NsnbSmooth ) );
+
+    m_header = header;
+    m_table = table;
+    m_mask = uint32_t( tableSize - 1 );
+    m_shift = 32 - bits;
+
+    for( auto& f : features )
+    {
+        auto idx = Hash( f.key ) >> m_shift;
+        while( table[idx].key != 0 ) idx = ( idx + 1 ) & m_mask;
+        table[idx] = f;
+    }
+}
+
+SpamModel::SpamModel( const std::string& fn )
+    : m_file( std::make_unique<FileMap<char>>( fn ) )
+{
+    static_assert( sizeof( Header ) % sizeof( uint64_t ) == 0, "Header breaks table alignment" );
+    static_assert( sizeof( Feature ) % sizeof( uint64_t ) == 0, "Feature breaks table alignment" );
+
+    m_header = (const Header*)(const char*)*m_file;
+    if( m_file->Size() < sizeof( Header ) || memcmp( m_header->magic, Magic, sizeof( Magic ) ) != 0 )
+    {
+        fprintf( stderr, "%s is not a spam model.\n", fn.c_str() );
+        exit( 1 );
+    }
+    if( m_header->version != Version )
+    {
+        fprintf( stderr, "Spam model version %i is not supported. Export it again.\n", m_header->version );
+        exit( 1 );
+    }
+    if( m_header->bits < 10 || m_header->bits > 31 || m_file->Size() != sizeof( Header ) + ( size_t( 1 ) << m_header->bits ) * sizeof( Feature ) )
+    {
+        fprintf( stderr, "Spam model %s is damaged.\n", fn.c_str() );
+        exit( 1 );
+    }
+
+    m_table = (const Feature*)( m_header + 1 );
+    m_mask = uint32_t( ( size_t( 1 ) << m_header->bits ) - 1 );
+    m_shift = 32 - m_header->bits;
+}
+
+void SpamModel::Write( const std::string& fn ) const
+{
+    FILE* f = fopen( fn.c_str(), "wb" );
+    if( !f )
+    {
+        fprintf( stderr, "Cannot open %s for writing.\n", fn.c_str() );
+        exit( 1 );
+    }
+    fwrite( m_header, 1, sizeof( Header ), f );
+    fwrite( m_table, sizeof( Feature ), size_t( m_mask ) + 1, f );
+    fclose( f );
+}
+
+const SpamModel::Feature* SpamModel::Find( uint32_t key ) const
+{
+    // Values of features which were never seen during training
+    static const Feature Default = { 0, 2.f - 1.f, 0, 1.f, 0, 0, 0, 0, 0 };
+
+    auto idx = Hash( key ) >> m_shift;
+    for(;;)
+    {
+        const auto& f = m_table[idx];
+        if( f.key == key ) return &f;
+        if( f.key == 0 ) return &Default;
+        idx = ( idx + 1 ) & m_mask;
+    }
+}
+
+double SpamModel::Predict( const char* msg, std::vector<uint32_t>& features ) const
+{
+    features.clear();
+    uint32_t key = 0;
+    for( int i=0; i<MAX_READ_LEN && msg[i] != '\0'; i++ )
+    {
+        key = ( key << 8 ) | uint8_t( msg[i] );
+        if( i >= NGRAM-1 ) features.emplace_back( key );
+    }
+    if( features.empty() ) return 0;
+
+    // Terminator iterates over a std::map of n-grams. Summing in the same order
+    // gives the same rounding.
+    std::sort( features.begin(), features.end() );
+    const auto num = std::unique( features.begin(), features.end() ) - features.begin();
+
+    double bwinnow = 0, lr = 0, nb = 0, nsnb = 0, winnow = 0, pa = 0, pam = 0, hit = 0;
+    for( ptrdiff_t i=0; i<num; i++ )
+    {
+        auto f = Find( features[i] );
+        bwinnow += f->bwinnow;
+        lr += f->logist;
+        nb += f->nb;
+        nsnb += f->nsnb;
+        winnow += f->winnow;
+        pa += f->pa;
+        pam += f->pam;
+        hit += f->hit;
+    }
+
+    bwinnow /= size_t( num );
+    bwinnow -= BWinnowThreshold;
+    winnow /= size_t( num );
+    winnow -= WinnowThreshold;
+    nb += m_header->nbPrior;
+    nsnb += m_header->nsnbPrior;
+
+    const double scores[CLASSIFIER_NUMBER] = {
+        logist( bwinnow / BWinnowShift ),
+        logist( lr / LogisticShift ),
+        logist( nb / NbShift ),
+        logist( nsnb / NsnbShift ),
+        logist( winnow / WinnowShift ),
+        logist( pa / PaShift ),
+        logist( pam / PamShift ),
+        logist( hit / HitShift )
+    };
+
+    double score = 0;
+    double total = 0;
+    for( int i=0; i<CLASSIFIER_NUMBER; i++ )
+    {
+        score += scores[i] * m_header->weights[i];
+        total += m_header->weights[i];
+    }
+    return score / total;
+}
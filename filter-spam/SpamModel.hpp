@@ -0,0 +1,69 @@
+#ifndef __SPAMMODEL_HPP__
+#define __SPAMMODEL_HPP__
+
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "../common/FileMap.hpp"
+#include "../contrib/terminator/terminator.h"
+
+// Read-only copy of the spam database, held in an open addressed hash table.
+// Scores match Terminator::Predict(), but no allocations or database lookups
+// are made, so multiple threads may classify messages at the same time.
+// The table can be exported to a file, which is then used in place.
+class SpamModel
+{
+public:
+    SpamModel( Terminator& classifier );
+    SpamModel( const std::string& fn );
+
+    void Write( const std::string& fn ) const;
+
+    // Thread safe. Features vector is scratch space, which should be reused between calls.
+    double Predict( const char* msg, std::vector<uint32_t>& features ) const;
+
+    size_t Size() const { return m_header->features; }
+
+private:
+    struct Header
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t bits;
+        uint64_t features;
+        double weights[CLASSIFIER_NUMBER];
+        double nbPrior;
+        double nsnbPrior;
+    };
+
+    // Per-feature contributions of each classifier, with per-message independent
+    // terms already evaluated. Key is the n-gram in big endian byte order, zero
+    // marks an empty slot.
+    struct Feature
+    {
+        uint32_t key;
+        float bwinnow;
+        float logist;
+        float winnow;
+        float pa;
+        float pam;
+        float hit;
+        double nb;
+        double nsnb;
+    };
+
+    const Feature* Find( uint32_t key ) const;
+
+    // Header is followed by the table. Either of these holds the data.
+    std::vector<uint64_t> m_buf;
+    std::unique_ptr<FileMap<char>> m_file;
+
+    const Header* m_header;
+    const Feature* m_table;
+    uint32_t m_mask;
+    uint32_t m_shift;
+};
+
+#endif
@@ -4,6 +4,8 @@
 
 #include <algorithm>
 #include <assert.h>
+#include <atomic>
+#include <memory>
 #include <random>
 #include <stdint.h>
 #include <stdio.h>
@@ -23,8 +25,13 @@
 #include "../common/MetaView.hpp"
 #include "../common/RawImportMeta.hpp"
 #include "../common/StringCompress.hpp"
+#include "../common/System.hpp"
+#include "../common/TaskDispatch.hpp"
+#include "../common/WideOffsets.hpp"
 #include "../common/ZMessageView.hpp"
 
+#include "SpamModel.hpp"
+
 int main( int argc, char** argv )
 {
 #ifdef _WIN32
@@ -34,10 +41,30 @@ int main( int argc, char** argv )
     if( argc < 3 )
     {
         fprintf( stderr, "USAGE: %s database source [destination ( [--ask] | [--quiet] | [--size max] | [--kill msgid...] | [--thread threshold] )] | [-m msgid]\n", argv[0] );
+        fprintf( stderr, "       %s database --export\n", argv[0] );
         fprintf( stderr, "Omitting destination will start training mode.\n" );
         exit( 1 );
     }
 
+    if( argc == 3 && strcmp( argv[2], "--export" ) == 0 )
+    {
+        const std::string dbdir( argv[1] );
+        if( !Exists( dbdir + "/spamdb" ) )
+        {
+            fprintf( stderr, "Spam database not present.\n" );
+            exit( 1 );
+        }
+        std::unique_ptr<SpamModel> model;
+        {
+            Terminator classifier( dbdir + "/spamdb", 16*1024*1024 );
+            model = std::make_unique<SpamModel>( classifier );
+        }
+        // Database is written to when closed, which would make the model look out of date
+        model->Write( dbdir + "/spammodel" );
+        printf( "Exported %zu features.\n", model->Size() );
+        return 0;
+    }
+
     bool training = false;
     bool quiet = false;
     bool ask = false;
@@ -108,10 +135,11 @@ int main( int argc, char** argv )
     const auto size = mview.Size();
     const FileMap<uint32_t> toplevel( base + "toplevel" );
     auto topsize = toplevel.DataSize();
-    const MetaView<uint32_t, char> strings( base + "strmeta", base + "strings" );
-    const MetaView<uint32_t, uint32_t> conn( base + "connmeta", base + "conndata" );
-    const MetaView<uint32_t, uint8_t> msgid( base + "midmeta", base + "middata" );
-    const HashSearch<uint8_t> midhash( base + "middata", base + "midhash", base + "midhashdata" );
+    const auto wide = ReadWideOffsets( base );
+    const WideMetaView<char> strings( base + "strmeta", base + "strings", wide & WideStrings );
+    const WideMetaView<uint32_t> conn( base + "connmeta", base + "conndata", wide & WideConnectivity );
+    const WideMetaView<uint8_t> msgid( base + "midmeta", base + "middata", wide & WideMsgId );
+    const HashSearch<uint8_t> midhash( base + "middata", base + "midhash", base + "midhashdata", wide & WideMsgId );
     const StringCompress compress( base + "msgid.codebook" );
 
     const std::string dbdir( argv[1] );
@@ -120,8 +148,6 @@ int main( int argc, char** argv )
         CreateDirStruct( dbdir );
     }
 
-    auto classifier = std::make_unique<Terminator>( dbdir + "/spamdb", 16*1024*1024 );
-
     if( !training )
     {
         if( !Exists( argv[1] ) )
@@ -178,6 +204,72 @@ int main( int argc, char** argv )
 
         std::vector<Data> data;
 
+        std::vector<double> scores;
+        if( maxsize == -1 && !kill )
+        {
+            std::vector<uint32_t> todo;
+            for( uint32_t i=0; i<size; i++ )
+            {
+                auto cdata = conn[i];
+                if( cdata[1] == -1 )
+                {
+                    if( cdata[3] == 0 )
+                    {
+                        todo.emplace_back( i );
+                    }
+                    else if( thread )
+                    {
+                        for( uint32_t j=0; j<cdata[2]; j++ ) todo.emplace_back( i+j );
+                    }
+                }
+            }
+
+            std::unique_ptr<SpamModel> model;
+            const auto modelfn = dbdir + "/spammodel";
+            if( Exists( modelfn ) && GetFileMTime( modelfn.c_str() ) >= GetFileMTime( ( dbdir + "/spamdb" ).c_str() ) )
+            {
+                model = std::make_unique<SpamModel>( modelfn );
+            }
+            else
+            {
+                if( Exists( modelfn ) )
+                {
+                    printf( "Exported spam model is out of date, loading database.\n" );
+                }
+                Terminator classifier( dbdir + "/spamdb", 16*1024*1024 );
+                model = std::make_unique<SpamModel>( classifier );
+            }
+
+            const auto cpus = System::CPUCores();
+            printf( "Scoring %zu messages with %zu features (%i threads)\n", todo.size(), model->Size(), cpus );
+            fflush( stdout );
+
+            scores.resize( size );
+            TaskDispatch tasks( cpus-1 );
+            std::atomic<uint32_t> cnt( 0 );
+            for( int t=0; t<cpus; t++ )
+            {
+                tasks.Queue( [&cnt, &todo, &scores, model = model.get(), &mview] {
+                    ExpandingBuffer eb;
+                    std::vector<uint32_t> features;
+                    for(;;)
+                    {
+                        const auto c = cnt.fetch_add( 1, std::memory_order_relaxed );
+                        if( c >= todo.size() ) break;
+                        if( ( c & 0x3FF ) == 0 )
+                        {
+                            printf( "%i/%zu\r", c, todo.size() );
+                            fflush( stdout );
+                        }
+                        const auto idx = todo[c];
+                        scores[idx] = model->Predict( mview.GetMessage( idx, eb ), features );
+                    }
+                } );
+            }
+            tasks.Sync();
+            printf( "\n" );
+        }
+
         for( uint32_t i=0; i<size; i++ )
         {
             if( ( i & 0xFF ) == 0 )
@@ -216,8 +308,7 @@ int main( int argc, char** argv )
                     auto children = cdata[3];
                     if( children == 0 )
                     {
-                        auto post = mview[i];
-                        auto score = classifier->Predict( post );
+                        auto score = scores[i];
                         if( score > 0.5 )
                         {
                             data.emplace_back( Data { i, float( score ) } );
@@ -227,12 +318,11 @@ int main( int argc, char** argv )
                     {
                         bool allBad = true;
                         auto toCheck = cdata[2];
-                        std::vector<float> scores;
-                        scores.reserve( toCheck );
+                        std::vector<float> threadScores;
+                        threadScores.reserve( toCheck );
                         for( int j=0; j<toCheck; j++ )
                         {
-                            auto post = mview[i+j];
-                            auto score = classifier->Predict( post );
+                            auto score = scores[i+j];
                             if( score < threadThreshold )
                             {
                                 allBad = false;
@@ -240,14 +330,14 @@ int main( int argc, char** argv )
                             }
                             else
                             {
-                                scores.emplace_back( float( score ) );
+                                threadScores.emplace_back( float( score ) );
                             }
                         }
                         if( allBad )
                         {
                             for( int j=0; j<toCheck; j++ )
                             {
-                                data.emplace_back( Data { i+j, scores[j] } );
+                                data.emplace_back( Data { i+j, threadScores[j] } );
                             }
                         }
                     }
@@ -381,6 +471,8 @@ int main( int argc, char** argv )
 
         printf( "Spam training mode.\n" );
 
+        auto classifier = std::make_unique<Terminator>( dbdir + "/spamdb", 16*1024*1024 );
+
         std::vector<uint32_t> indices;
         if( argc == 5 )
         {
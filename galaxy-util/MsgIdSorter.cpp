@@ -0,0 +1,179 @@
+#include <algorithm>
+#include <limits>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../contrib/xxhash/xxhash.h"
+
+#include "MsgIdSorter.hpp"
+
+static inline bool Less( uint64_t lhash, const uint8_t* lmsgid, uint32_t larch, uint64_t rhash, const uint8_t* rmsgid, uint32_t rarch )
+{
+    if( lhash != rhash ) return lhash < rhash;
+    const auto cmp = strcmp( (const char*)lmsgid, (const char*)rmsgid );
+    if( cmp != 0 ) return cmp < 0;
+    return larch < rarch;
+}
+
+MsgIdSorter::MsgIdSorter( const std::string& fn, size_t memory )
+    : m_fn( fn )
+    , m_memory( memory )
+    , m_runs( 0 )
+    , m_pos( 0 )
+{
+    // Entry offsets are 32 bit
+    m_entries.reserve( memory / 4 / sizeof( Entry ) );
+    m_arena.reserve( std::min<size_t>( memory / 4 * 3, std::numeric_limits<uint32_t>::max() ) );
+}
+
+MsgIdSorter::~MsgIdSorter()
+{
+    for( auto& c : m_heap )
+    {
+        fclose( c->f );
+        delete c;
+    }
+    for( size_t i=0; i<m_runs; i++ )
+    {
+        remove( RunName( i ).c_str() );
+    }
+}
+
+void MsgIdSorter::Add( const uint8_t* msgid, size_t size, uint32_t arch )
+{
+    if( m_entries.size() == m_entries.capacity() || m_arena.size() + size + 1 > m_arena.capacity() )
+    {
+        Flush();
+    }
+    m_entries.emplace_back( Entry { XXH64( msgid, size, 0 ), arch, uint32_t( m_arena.size() ) } );
+    m_arena.insert( m_arena.end(), msgid, msgid + size + 1 );
+}
+
+void MsgIdSorter::Finish()
+{
+    if( m_runs != 0 && !m_entries.empty() ) Flush();
+    if( m_runs == 0 )
+    {
+        // Everything fit in memory, no need to go through the disk.
+        const auto arena = m_arena.data();
+        std::sort( m_entries.begin(), m_entries.end(), [arena] ( const auto& l, const auto& r ) { return Less( l.hash, arena + l.offset, l.arch, r.hash, arena + r.offset, r.arch ); } );
+        return;
+    }
+
+    std::vector<Entry>().swap( m_entries );
+    std::vector<uint8_t>().swap( m_arena );
+
+    const auto bufsize = std::clamp<size_t>( m_memory / m_runs, 64*1024, 4*1024*1024 );
+    for( size_t i=0; i<m_runs; i++ )
+    {
+        auto c = new Cursor;
+        c->f = fopen( RunName( i ).c_str(), "rb" );
+        if( !c->f )
+        {
+            fprintf( stderr, "Cannot open %s\n", RunName( i ).c_str() );
+            exit( 1 );
+        }
+        setvbuf( c->f, nullptr, _IOFBF, bufsize );
+        if( Read( *c ) )
+        {
+            m_heap.emplace_back( c );
+        }
+        else
+        {
+            fclose( c->f );
+            delete c;
+        }
+    }
+    std::make_heap( m_heap.begin(), m_heap.end(), [] ( const auto& l, const auto& r ) { return Less( r->hash, r->msgid, r->arch, l->hash, l->msgid, l->arch ); } );
+}
+
+bool MsgIdSorter::Next( const uint8_t*& msgid, std::vector<int>& archives )
+{
+    archives.clear();
+
+    if( m_runs == 0 )
+    {
+        if( m_pos == m_entries.size() ) return false;
+        const auto& e = m_entries[m_pos];
+        msgid = m_arena.data() + e.offset;
+        archives.emplace_back( e.arch );
+        while( ++m_pos < m_entries.size() )
+        {
+            const auto& n = m_entries[m_pos];
+            if( n.hash != e.hash || strcmp( (const char*)msgid, (const char*)m_arena.data() + n.offset ) != 0 ) break;
+            if( n.arch != archives.back() ) archives.emplace_back( n.arch );
+        }
+        return true;
+    }
+
+    if( m_heap.empty() ) return false;
+    const auto greater = [] ( const auto& l, const auto& r ) { return Less( r->hash, r->msgid, r->arch, l->hash, l->msgid, l->arch ); };
+
+    auto c = m_heap.front();
+    const auto hash = c->hash;
+    strcpy( (char*)m_current, (const char*)c->msgid );
+    archives.emplace_back( c->arch );
+    for(;;)
+    {
+        std::pop_heap( m_heap.begin(), m_heap.end(), greater );
+        if( Read( *c ) )
+        {
+            std::push_heap( m_heap.begin(), m_heap.end(), greater );
+        }
+        else
+        {
+            fclose( c->f );
+            delete c;
+            m_heap.pop_back();
+            if( m_heap.empty() ) break;
+        }
+        c = m_heap.front();
+        if( c->hash != hash || strcmp( (const char*)c->msgid, (const char*)m_current ) != 0 ) break;
+        if( c->arch != archives.back() ) archives.emplace_back( c->arch );
+    }
+    msgid = m_current;
+    return true;
+}
+
+void MsgIdSorter::Flush()
+{
+    const auto arena = m_arena.data();
+    std::sort( m_entries.begin(), m_entries.end(), [arena] ( const auto& l, const auto& r ) { return Less( l.hash, arena + l.offset, l.arch, r.hash, arena + r.offset, r.arch ); } );
+
+    const auto fn = RunName( m_runs++ );
+    FILE* f = fopen( fn.c_str(), "wb" );
+    if( !f )
+    {
+        fprintf( stderr, "Cannot open %s for writing.\n", fn.c_str() );
+        exit( 1 );
+    }
+    for( auto& v : m_entries )
+    {
+        const uint16_t len = strlen( (const char*)arena + v.offset );
+        fwrite( &v.hash, 1, sizeof( v.hash ), f );
+        fwrite( &v.arch, 1, sizeof( v.arch ), f );
+        fwrite( &len, 1, sizeof( len ), f );
+        fwrite( arena + v.offset, 1, len, f );
+    }
+    fclose( f );
+
+    m_entries.clear();
+    m_arena.clear();
+}
+
+bool MsgIdSorter::Read( Cursor& c )
+{
+    uint16_t len;
+    if( fread( &c.hash, 1, sizeof( c.hash ), c.f ) != sizeof( c.hash ) ) return false;
+    fread( &c.arch, 1, sizeof( c.arch ), c.f );
+    fread( &len, 1, sizeof( len ), c.f );
+    fread( c.msgid, 1, len, c.f );
+    c.msgid[len] = '\0';
+    return true;
+}
+
+std::string MsgIdSorter::RunName( size_t idx ) const
+{
+    return m_fn + "." + std::to_string( idx );
+}
@@ -0,0 +1,62 @@
+#ifndef __MSGIDSORTER_HPP__
+#define __MSGIDSORTER_HPP__
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+// External sort of packed message ids, tagged with index of the archive they come from.
+// Ids are collected in memory until the configured limit is reached, then sorted and
+// written to disk as a run. Runs are merged to produce unique message ids, ordered by
+// hash, each with a sorted list of archives containing it.
+class MsgIdSorter
+{
+public:
+    MsgIdSorter( const std::string& fn, size_t memory );
+    ~MsgIdSorter();
+
+    void Add( const uint8_t* msgid, size_t size, uint32_t arch );
+
+    // Must be called after all message ids are added, before retrieving them.
+    void Finish();
+    bool Next( const uint8_t*& msgid, std::vector<int>& archives );
+
+    size_t NumberOfRuns() const { return m_runs; }
+
+private:
+    struct Entry
+    {
+        uint64_t hash;
+        uint32_t arch;
+        uint32_t offset;
+    };
+
+    struct Cursor
+    {
+        FILE* f;
+        uint64_t hash;
+        uint32_t arch;
+        uint8_t msgid[2048];
+    };
+
+    MsgIdSorter( const MsgIdSorter& ) = delete;
+    MsgIdSorter& operator=( const MsgIdSorter& ) = delete;
+
+    void Flush();
+    bool Read( Cursor& c );
+    std::string RunName( size_t idx ) const;
+
+    std::string m_fn;
+    size_t m_memory;
+    size_t m_runs;
+
+    std::vector<Entry> m_entries;
+    std::vector<uint8_t> m_arena;
+    size_t m_pos;
+
+    std::vector<Cursor*> m_heap;
+    uint8_t m_current[2048];
+};
+
+#endif
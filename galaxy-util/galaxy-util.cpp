@@ -1,9 +1,11 @@
 #include <algorithm>
 #include <array>
 #include <assert.h>
+#include <atomic>
 #include <inttypes.h>
 #include <limits>
 #include <map>
+#include <memory>
 #include <set>
 #include <stdint.h>
 #include <stdio.h>
@@ -15,6 +17,7 @@
 
 #include "../contrib/martinus/robin_hood.h"
 #include "../common/CharUtil.hpp"
+#include "../common/DayHistogram.hpp"
 #include "../common/ExpandingBuffer.hpp"
 #include "../common/Filesystem.hpp"
 #include "../common/FileMap.hpp"
@@ -24,91 +27,557 @@
 #include "../common/ReferencesParent.hpp"
 #include "../common/Slab.hpp"
 #include "../common/StringCompress.hpp"
+#include "../common/System.hpp"
+#include "../common/TaskDispatch.hpp"
 
 #include "../libuat/Archive.hpp"
 
-int main( int argc, char** argv )
+#include "MsgIdSorter.hpp"
+
+// Files which are replaced during galaxy update.
+static const char* UpdatedFiles[] = {
+    "str", "str.meta", "count",
+    "midhash", "midhash.meta", "msgid", "msgid.meta",
+    "midgr", "midgr.meta",
+    "indirect", "indirect.dense", "indirect.offset", "indirect.pending",
+    "timechart"
+};
+
+struct ArchiveState
 {
-    TracyNoop;
+    std::string path;
+    uint64_t size;
+    int64_t mtime;
+};
 
-    if( argc != 2 )
+struct IndirectData
+{
+    std::vector<uint32_t> parent;
+    std::vector<uint32_t> child;
+};
+
+struct IndirectResult
+{
+    int parent;
+    std::vector<std::string> missing;
+};
+
+using IndirectMap = std::map<uint32_t, IndirectData>;
+
+static ArchiveState GetArchiveState( const std::string& path )
+{
+    ArchiveState state = { path, 0, 0 };
+    if( IsFile( path ) )
     {
-        fprintf( stderr, "USAGE: %s directory\n", argv[0] );
-        exit( 1 );
+        state.size = GetFileSize( path.c_str() );
+        state.mtime = GetFileMTime( path.c_str() );
     }
-    if( !Exists( argv[1] ) )
+    else
     {
-        fprintf( stderr, "Destination directory doesn't exist.\n" );
-        exit( 1 );
+        for( auto& v : ListDirectory( path ) )
+        {
+            if( v.back() == '/' ) continue;
+            const auto fn = path + "/" + v;
+            state.size += GetFileSize( fn.c_str() );
+            state.mtime = std::max( state.mtime, GetFileMTime( fn.c_str() ) );
+        }
     }
+    return state;
+}
 
-    const auto base = std::string( argv[1] ) + "/";
-    const auto listfn = base + "archives";
-    if( !Exists( listfn ) )
+static std::vector<ArchiveState> LoadArchiveState( const std::string& fn )
+{
+    std::vector<ArchiveState> ret;
+    FILE* f = fopen( fn.c_str(), "rb" );
+    if( !f ) return ret;
+
+    uint32_t num;
+    if( fread( &num, 1, sizeof( num ), f ) == sizeof( num ) )
     {
-        fprintf( stderr, "Archive file list doesn't exist. Create %s with paths to each archive in separate lines.\n", listfn.c_str() );
-        exit( 1 );
+        ret.reserve( num );
+        for( uint32_t i=0; i<num; i++ )
+        {
+            ArchiveState state;
+            uint32_t len;
+            fread( &state.size, 1, sizeof( state.size ), f );
+            fread( &state.mtime, 1, sizeof( state.mtime ), f );
+            fread( &len, 1, sizeof( len ), f );
+            state.path.resize( len );
+            fread( state.path.data(), 1, len, f );
+            ret.emplace_back( std::move( state ) );
+        }
     }
+    fclose( f );
+    return ret;
+}
 
-    std::vector<std::string> archives;
+static void SaveArchiveState( const std::string& fn, const std::vector<ArchiveState>& state )
+{
+    FILE* f = fopen( fn.c_str(), "wb" );
+    const uint32_t num = state.size();
+    fwrite( &num, 1, sizeof( num ), f );
+    for( auto& v : state )
+    {
+        const uint32_t len = v.path.size();
+        fwrite( &v.size, 1, sizeof( v.size ), f );
+        fwrite( &v.mtime, 1, sizeof( v.mtime ), f );
+        fwrite( &len, 1, sizeof( len ), f );
+        fwrite( v.path.data(), 1, len, f );
+    }
+    fclose( f );
+}
 
-    TracyMessageL( "Loading archive list" );
+static Archive& OpenArchive( std::vector<std::unique_ptr<Archive>>& arch, const std::vector<std::string>& archives, int idx )
+{
+    if( !arch[idx] )
     {
-        const FileMap<char> listfile( listfn );
-        const char* begin = listfile;
-        auto ptr = begin;
-        auto size = listfile.DataSize();
+        auto ptr = Archive::Open( archives[idx] );
+        if( !ptr )
+        {
+            fprintf( stderr, "Cannot open archive: %s\n", archives[idx].c_str() );
+            exit( 1 );
+        }
+        arch[idx].reset( ptr );
+    }
+    return *arch[idx];
+}
 
-        FILE* out = fopen( ( base + "archives.meta" ).c_str(), "wb" );
+// Message and thread counts are stored, so that archives don't have to be opened to list them.
+static void WriteArchiveCount( FILE* f, const Archive& archive )
+{
+    const uint32_t count[2] = { uint32_t( archive.NumberOfMessages() ), uint32_t( archive.NumberOfTopLevel() ) };
+    fwrite( count, 1, sizeof( count ), f );
+}
 
-        auto end = ptr;
-        while( size > 0 )
+static void WriteArchiveStrings( FILE* data, FILE* meta, uint32_t& offset, const std::string& path, const Archive& archive )
+{
+    const uint32_t zero = 0;
+
+    auto name = archive.GetArchiveName();
+    fwrite( &offset, 1, sizeof( offset ), meta );
+    if( name.second == 0 )
+    {
+        auto pos = path.rfind( '/' );
+        if( pos == std::string::npos )
         {
-            while( size > 0 && *end != '\r' && *end != '\n' )
+            pos = path.rfind( '\\' );
+        }
+        if( pos == std::string::npos )
+        {
+            offset += fwrite( path.c_str(), 1, path.size() + 1, data );
+        }
+        else
+        {
+            offset += fwrite( path.c_str() + pos, 1, path.size() + 1 - pos, data );
+        }
+    }
+    else
+    {
+        offset += fwrite( name.first, 1, name.second, data );
+        offset += fwrite( &zero, 1, 1, data );
+    }
+
+    auto desc = archive.GetShortDescription();
+    if( desc.second == 0 )
+    {
+        fwrite( &zero, 1, sizeof( zero ), meta );
+    }
+    else
+    {
+        fwrite( &offset, 1, sizeof( offset ), meta );
+        offset += fwrite( desc.first, 1, desc.second, data );
+        offset += fwrite( &zero, 1, 1, data );
+    }
+}
+
+static void WriteMsgIdHash( const std::string& base, const char* suffix, const std::vector<const uint8_t*>& msgidvec )
+{
+    const uint64_t unique = msgidvec.size();
+    auto hashbits = MsgIdHashBits( unique, 90 );
+    auto hashsize = MsgIdHashSize( hashbits );
+    auto hashmask = MsgIdHashMask( hashbits );
+
+    printf( "Load factor: %.2f\n", float( unique ) / hashsize );
+
+    auto hashdata = new uint64_t[hashsize];
+    auto distance = new uint8_t[hashsize];
+    memset( distance, 0xFF, hashsize );
+    uint8_t distmax = 0;
+
+    for( int i=0; i<unique; i++ )
+    {
+        if( ( i & 0x3FFFF ) == 0 )
+        {
+            printf( "%i/%zu\r", i, unique );
+            fflush( stdout );
+        }
+
+        uint32_t hash = XXH32( msgidvec[i], strlen( (const char*)msgidvec[i] ), 0 ) & hashmask;
+
+        uint8_t dist = 0;
+        uint64_t idx = i;
+        for(;;)
+        {
+            if( distance[hash] == 0xFF )
             {
-                end++;
-                size--;
+                if( distmax < dist ) distmax = dist;
+                distance[hash] = dist;
+                hashdata[hash] = idx;
+                break;
             }
-            archives.emplace_back( ptr, end );
+            if( distance[hash] < dist )
+            {
+                if( distmax < dist ) distmax = dist;
+                std::swap( distance[hash], dist );
+                std::swap( hashdata[hash], idx );
+            }
+            dist++;
+            assert( dist < 0xFF );
+            hash = (hash+1) & hashmask;
+        }
+    }
+    printf( "\n" );
 
-            if( !Exists( archives.back() ) )
+    {
+        FILE* meta = fopen( ( base + "midhash.meta" + suffix ).c_str(), "wb" );
+        fwrite( &distmax, 1, 1, meta );
+        fclose( meta );
+
+        FILE* data = fopen( ( base + "midhash" + suffix ).c_str(), "wb" );
+        FILE* strdata = fopen( ( base + "msgid" + suffix ).c_str(), "wb" );
+        FILE* strmeta = fopen( ( base + "msgid.meta" + suffix ).c_str(), "wb" );
+
+        const uint64_t zero = 0;
+        uint64_t stroffset = fwrite( &zero, 1, 1, strdata );
+
+        auto msgidoffset = new uint64_t[unique];
+
+        int cnt = 0;
+        for( int i=0; i<hashsize; i++ )
+        {
+            if( ( i & 0x3FFFF ) == 0 )
             {
-                fprintf( stderr, "Archive doesn't exist: %s\n", archives.back().c_str() );
-                fclose( out );
-                exit( 1 );
+                printf( "%i/%i\r", i, hashsize );
+                fflush( stdout );
             }
 
-            uint32_t tmp;
-            tmp = ptr - begin;
-            fwrite( &tmp, 1, sizeof( tmp ), out );
-            tmp = end - begin;
-            fwrite( &tmp, 1, sizeof( tmp ), out );
+            if( distance[i] == 0xFF )
+            {
+                fwrite( &zero, 1, sizeof( uint64_t ), data );
+                fwrite( &zero, 1, sizeof( uint64_t ), data );
+            }
+            else
+            {
+                fwrite( &stroffset, 1, sizeof( uint64_t ), data );
+                fwrite( hashdata+i, 1, sizeof( uint64_t ), data );
 
-            while( size > 0 && ( *end == '\r' || *end == '\n' ) )
+                msgidoffset[hashdata[i]] = stroffset;
+                cnt++;
+                auto str = msgidvec[hashdata[i]];
+                stroffset += fwrite( str, 1, strlen( (const char*)str ) + 1, strdata );
+            }
+        }
+
+        assert( cnt == unique );
+        fwrite( msgidoffset, 1, unique * sizeof( uint64_t ), strmeta );
+        delete[] msgidoffset;
+
+        fclose( data );
+        fclose( strdata );
+        fclose( strmeta );
+    }
+
+    delete[] hashdata;
+    delete[] distance;
+
+    printf( "\n" );
+}
+
+// Writes list of archives containing each message. Identical lists are stored only once.
+class GroupWriter
+{
+    struct VectorHasher
+    {
+        size_t operator()( const std::vector<int>& vec ) const
+        {
+            return XXH64( vec.data(), vec.size() * sizeof( int ), 0 );
+        }
+    };
+
+public:
+    GroupWriter( const std::string& base, const char* suffix )
+        : m_data( fopen( ( base + "midgr" + suffix ).c_str(), "wb" ) )
+        , m_meta( fopen( ( base + "midgr.meta" + suffix ).c_str(), "wb" ) )
+        , m_offset( 0 )
+    {
+    }
+
+    ~GroupWriter()
+    {
+        fclose( m_data );
+        fclose( m_meta );
+    }
+
+    void Add( const std::vector<int>& groups )
+    {
+        auto it = m_map.find( groups );
+        if( it == m_map.end() )
+        {
+            m_map.emplace( groups, m_offset );
+            fwrite( &m_offset, 1, sizeof( m_offset ), m_meta );
+            uint32_t num = groups.size();
+            m_offset += fwrite( &num, 1, sizeof( num ), m_data );
+            m_offset += fwrite( groups.data(), 1, sizeof( uint32_t ) * num, m_data );
+        }
+        else
+        {
+            fwrite( &it->second, 1, sizeof( uint32_t ), m_meta );
+        }
+    }
+
+private:
+    robin_hood::unordered_flat_map<std::vector<int>, uint32_t, VectorHasher> m_map;
+    FILE* m_data;
+    FILE* m_meta;
+    uint32_t m_offset;
+};
+
+// Checks if none of the archives has the message already linked to the parent.
+static bool IsIndirectLink( const uint8_t* msgid, const char* parent, const int* groups, size_t num, const std::vector<std::unique_ptr<Archive>>& arch, const StringCompress& compress )
+{
+    for( size_t g=0; g<num; g++ )
+    {
+        const auto& currarch = arch[groups[g]];
+        uint8_t crepack[2048];
+        currarch->RepackMsgId( msgid, crepack, compress );
+        const auto gmidx = currarch->GetMessageIndex( crepack );
+        assert( gmidx != -1 );
+        const auto pmidx = currarch->GetParent( gmidx );
+        if( pmidx != -1 )
+        {
+            char unpack[2048];
+            currarch->UnpackMsgId( currarch->GetMessageId( pmidx ), unpack );
+            if( strcmp( unpack, parent ) == 0 )
             {
-                end++;
-                size--;
+                return false;
             }
-            ptr = end;
         }
-        fclose( out );
     }
+    return true;
+}
+
+// Returns galaxy index of parent for messages which are top level in the first archive
+// of the group, but reference a message from some other archive. Returns -1 otherwise.
+// References which could not be found are stored in the missing vector.
+// Thread safe, as long as each thread provides its own buffer and context.
+static int GetIndirectParent( const uint8_t* msgid, const std::vector<int>& groups, const std::vector<std::unique_ptr<Archive>>& arch, const StringCompress& compress, const HashSearchBig& midhash, ExpandingBuffer& eb, ZSTD_DCtx* ctx, std::vector<std::string>& missing )
+{
+    missing.clear();
+
+    assert( !groups.empty() );
+    const auto& refarch = arch[groups[0]];
+    uint8_t repack[2048];
+    refarch->RepackMsgId( msgid, repack, compress );
+    const auto idx = refarch->GetMessageIndex( repack );
+    if( refarch->GetParent( idx ) != -1 ) return -1;
+
+    char tmp[1024];
+    auto post = refarch->GetMessage( idx, eb, ctx );
+    auto parent = GetParentFromReferences( post, compress, midhash, tmp, [&missing] ( const uint8_t* pack ) { missing.emplace_back( (const char*)pack ); } );
+    if( parent < 0 ) return -1;
+    if( !IsIndirectLink( msgid, tmp, groups.data() + 1, groups.size() - 1, arch, compress ) ) return -1;
+    return parent;
+}
 
+// Calculates indirect parents of num messages, with galaxy indices provided by the
+// getIdx function. Messages are processed by all cores in batches, and results of
+// each batch are passed to the result function in order, so that the output doesn't
+// depend on thread scheduling. Archives of all processed messages must be open.
+template<class Idx, class Result>
+static void CalcIndirectParents( size_t num, Idx getIdx, const MetaView<uint64_t, uint8_t>& middb, const MetaView<uint32_t, uint32_t>& midgr, const std::vector<std::unique_ptr<Archive>>& arch, const StringCompress& compress, const HashSearchBig& midhash, Result result )
+{
+    const auto cpus = System::CPUCores();
+    const size_t batch = cpus * 16 * 1024;
+    std::vector<IndirectResult> res( std::min( num, batch ) );
+
+    TaskDispatch tasks( cpus-1 );
+    for( size_t start=0; start<num; start+=batch )
+    {
+        printf( "%zu/%zu\r", start, num );
+        fflush( stdout );
+
+        const auto size = std::min( batch, num - start );
+        std::atomic<size_t> cnt( 0 );
+        for( int t=0; t<cpus; t++ )
+        {
+            tasks.Queue( [&cnt, &res, &getIdx, &middb, &midgr, &arch, &compress, &midhash, start, size] {
+                ExpandingBuffer eb;
+                auto ctx = ZSTD_createDCtx();
+                std::vector<int> groups;
+                for(;;)
+                {
+                    const auto i = cnt.fetch_add( 1, std::memory_order_relaxed );
+                    if( i >= size ) break;
+                    const auto idx = getIdx( start + i );
+                    auto ptr = midgr[idx];
+                    const auto n = *ptr++;
+                    groups.assign( ptr, ptr+n );
+                    res[i].parent = GetIndirectParent( middb[idx], groups, arch, compress, midhash, eb, ctx, res[i].missing );
+                }
+                ZSTD_freeDCtx( ctx );
+            } );
+        }
+        tasks.Sync();
+
+        for( size_t i=0; i<size; i++ )
+        {
+            result( getIdx( start + i ), res[i] );
+        }
+    }
+}
+
+static void Link( IndirectMap& indirect, uint32_t idx, uint32_t parent )
+{
+    indirect[idx].parent.emplace_back( parent );
+    indirect[parent].child.emplace_back( idx );
+}
+
+static void Unlink( IndirectMap& indirect, uint32_t idx )
+{
+    auto it = indirect.find( idx );
+    if( it == indirect.end() || it->second.parent.empty() ) return;
+    const auto parent = it->second.parent[0];
+    it->second.parent.clear();
+    auto& child = indirect[parent].child;
+    child.erase( std::find( child.begin(), child.end(), idx ) );
+}
+
+static IndirectMap LoadIndirect( const std::string& base )
+{
+    IndirectMap ret;
+
+    const FileMap<uint64_t> dense( base + "indirect.dense" );
+    const FileMap<uint32_t> offset( base + "indirect.offset" );
+    const FileMap<uint32_t> data( base + "indirect" );
+
+    const auto size = dense.DataSize();
+    for( size_t i=0; i<size; i++ )
+    {
+        auto& v = ret[dense[i]];
+        if( offset[i*2] != 0 )
+        {
+            auto ptr = data + offset[i*2] / sizeof( uint32_t );
+            v.parent.assign( ptr+1, ptr+1+*ptr );
+        }
+        if( offset[i*2+1] != 0 )
+        {
+            auto ptr = data + offset[i*2+1] / sizeof( uint32_t );
+            v.child.assign( ptr+1, ptr+1+*ptr );
+        }
+    }
+
+    return ret;
+}
+
+static void WriteIndirect( const std::string& base, const char* suffix, const IndirectMap& indirect )
+{
+    struct DenseData
+    {
+        uint64_t msgid;
+        uint32_t parent;
+        uint32_t children;
+    };
+    std::vector<DenseData> dense;
+    dense.reserve( indirect.size() );
+
+    uint32_t offset = 0;
+    uint32_t zero = 0;
+    FILE* data = fopen( ( base + "indirect" + suffix ).c_str(), "wb" );
+    offset += fwrite( &zero, 1, sizeof( uint32_t ), data );
+    for( auto& it : indirect )
+    {
+        DenseData dd = { it.first };
+
+        const auto& parent = it.second.parent;
+        const auto& child = it.second.child;
+        if( !parent.empty() )
+        {
+            dd.parent = offset;
+            const uint32_t num = parent.size();
+            fwrite( &num, 1, sizeof( uint32_t ), data );
+            fwrite( parent.data(), 1, sizeof( uint32_t ) * num, data );
+            offset += sizeof( uint32_t ) * ( num + 1 );
+        }
+        if( !child.empty() )
+        {
+            dd.children = offset;
+            const uint32_t num = child.size();
+            fwrite( &num, 1, sizeof( uint32_t ), data );
+            fwrite( child.data(), 1, sizeof( uint32_t ) * num, data );
+            offset += sizeof( uint32_t ) * ( num + 1 );
+        }
+
+        dense.emplace_back( dd );
+    }
+    fclose( data );
+
+    std::sort( dense.begin(), dense.end(), [] ( const auto& l, const auto& r ) { return l.msgid < r.msgid; } );
+
+    FILE* meta = fopen( ( base + "indirect.dense" + suffix ).c_str(), "wb" );
+    FILE* off = fopen( ( base + "indirect.offset" + suffix ).c_str(), "wb" );
+    for( auto& v : dense )
+    {
+        fwrite( &v.msgid, 1, sizeof( v.msgid ), meta );
+        fwrite( &v.parent, 1, sizeof( v.parent ), off );
+        fwrite( &v.children, 1, sizeof( v.children ), off );
+    }
+    fclose( meta );
+    fclose( off );
+}
+
+// Pending references are references of top level messages, which were not present in
+// the galaxy. If any of these appears in a newly added archive, the message must be
+// checked again for indirect parent.
+static void WritePending( FILE* f, uint32_t idx, const std::vector<std::string>& missing )
+{
+    if( missing.empty() ) return;
+    const uint32_t num = missing.size();
+    fwrite( &idx, 1, sizeof( idx ), f );
+    fwrite( &num, 1, sizeof( num ), f );
+    for( auto& v : missing )
+    {
+        const uint16_t len = v.size();
+        fwrite( &len, 1, sizeof( len ), f );
+        fwrite( v.data(), 1, len, f );
+    }
+}
+
+static bool ReadPending( FILE* f, uint32_t& idx, std::vector<std::string>& missing )
+{
+    uint32_t num;
+    if( fread( &idx, 1, sizeof( idx ), f ) != sizeof( idx ) ) return false;
+    fread( &num, 1, sizeof( num ), f );
+    missing.resize( num );
+    for( auto& v : missing )
+    {
+        uint16_t len;
+        fread( &len, 1, sizeof( len ), f );
+        v.resize( len );
+        fread( v.data(), 1, len, f );
+    }
+    return true;
+}
+
+static void BuildGalaxy( const std::string& base, const std::vector<std::string>& archives, size_t memory )
+{
     int i = 0;
     uint64_t count = 0;
-    std::vector<std::unique_ptr<Archive>> arch;
+    std::vector<std::unique_ptr<Archive>> arch( archives.size() );
     for( auto& v : archives )
     {
-        printf( "%i/%zu\r", ++i, archives.size() );
+        printf( "%i/%zu\r", i+1, archives.size() );
         fflush( stdout );
-        auto ptr = Archive::Open( v );
-        if( !ptr )
-        {
-            fprintf( stderr, "Cannot open archive: %s\n", v.c_str() );
-            exit( 1 );
-        }
-        arch.emplace_back( ptr );
-        count += ptr->NumberOfMessages();
+        count += OpenArchive( arch, archives, i++ ).NumberOfMessages();
     }
     printf( "\nTotal message count: %" PRIu64 "\n", count );
 
@@ -120,64 +589,231 @@ int main( int argc, char** argv )
         uint32_t zero = 0;
         uint32_t offset = fwrite( &zero, 1, 1, data );
 
-        int i=0;
-        for( auto& v : arch )
+        for( size_t i=0; i<arch.size(); i++ )
         {
-            auto name = v->GetArchiveName();
-            fwrite( &offset, 1, sizeof( offset ), meta );
-            if( name.second == 0 )
+            WriteArchiveStrings( data, meta, offset, archives[i], *arch[i] );
+        }
+
+        fclose( data );
+        fclose( meta );
+    }
+
+    {
+        FILE* f = fopen( ( base + "count" ).c_str(), "wb" );
+        for( auto& a : arch ) WriteArchiveCount( f, *a );
+        fclose( f );
+    }
+
+    TracyMessageL( "Writing time chart" );
+    {
+        DayHistogram chart;
+        for( auto& a : arch ) chart.Add( a->GetDayHistogram() );
+        chart.Write( base + "timechart" );
+    }
+
+    TracyMessageL( "Building code book" );
+    printf( "Building code book\n" );
+    StringCompress::HostCount hosts;
+    uint64_t cnt = 0;
+    for( auto& a : arch )
+    {
+        const auto num = a->NumberOfMessages();
+        for( size_t j=0; j<num; j++ )
+        {
+            if( ( cnt++ & 0x3FFF ) == 0 )
             {
-                auto pos = archives[i].rfind( '/' );
-                if( pos == std::string::npos )
-                {
-                    pos = archives[i].rfind( '\\' );
-                }
-                if( pos == std::string::npos )
-                {
-                    offset += fwrite( archives[i].c_str(), 1, archives[i].size() + 1, data );
-                }
-                else
-                {
-                    offset += fwrite( archives[i].c_str() + pos, 1, archives[i].size() + 1 - pos, data );
-                }
+                printf( "%zu/%zu\r", cnt, count );
+                fflush( stdout );
             }
-            else
+
+            char unpack[2048];
+            a->UnpackMsgId( a->GetMessageId( j ), unpack );
+            StringCompress::CountHost( hosts, unpack );
+        }
+    }
+    printf( "\n" );
+    const StringCompress compress( hosts );
+    compress.WriteData( base + "msgid.codebook" );
+    hosts.clear();
+
+    // Message ids are sorted on disk, so that only the merged list of unique message
+    // ids has to be kept, instead of unpacked message ids of every archive.
+    TracyMessageL( "Sorting message ids" );
+    printf( "Sorting message ids\n" );
+    const auto tmpfn = base + "msgid.tmp";
+    uint64_t unique = 0;
+    {
+        MsgIdSorter sorter( base + "msgid.sort", memory );
+        cnt = 0;
+        for( size_t i=0; i<arch.size(); i++ )
+        {
+            const auto& a = *arch[i];
+            const auto num = a.NumberOfMessages();
+            for( size_t j=0; j<num; j++ )
             {
-                offset += fwrite( name.first, 1, name.second, data );
-                offset += fwrite( &zero, 1, 1, data );
+                if( ( cnt++ & 0x3FFF ) == 0 )
+                {
+                    printf( "%zu/%zu\r", cnt, count );
+                    fflush( stdout );
+                }
+
+                char unpack[2048];
+                uint8_t pack[2048];
+                a.UnpackMsgId( a.GetMessageId( j ), unpack );
+                const auto sz = compress.Pack( unpack, pack );
+                sorter.Add( pack, sz, i );
             }
+        }
+        sorter.Finish();
+        printf( "\nSort runs: %zu\n", sorter.NumberOfRuns() );
 
-            auto desc = v->GetShortDescription();
-            if( desc.second == 0 )
+        TracyMessageL( "Merging message ids" );
+        printf( "Merging message ids\n" );
+        FILE* tmp = fopen( tmpfn.c_str(), "wb" );
+        GroupWriter gw( base, "" );
+        const uint8_t* msgid;
+        std::vector<int> groups;
+        while( sorter.Next( msgid, groups ) )
+        {
+            if( ( unique++ & 0x3FFF ) == 0 )
             {
-                fwrite( &zero, 1, sizeof( zero ), meta );
+                printf( "%zu\r", unique );
+                fflush( stdout );
             }
-            else
+            fwrite( msgid, 1, strlen( (const char*)msgid ) + 1, tmp );
+            gw.Add( groups );
+        }
+        fclose( tmp );
+        printf( "\nUnique message count: %zu\n", unique );
+    }
+
+    TracyMessageL( "Building hash table" );
+    {
+        const FileMap<uint8_t> msgidtmp( tmpfn );
+        std::vector<const uint8_t*> msgidvec;
+        msgidvec.reserve( unique );
+        auto ptr = (const uint8_t*)msgidtmp;
+        for( uint64_t i=0; i<unique; i++ )
+        {
+            msgidvec.emplace_back( ptr );
+            ptr += strlen( (const char*)ptr ) + 1;
+        }
+        WriteMsgIdHash( base, "", msgidvec );
+    }
+    remove( tmpfn.c_str() );
+
+    TracyMessageL( "Calculating indirect references" );
+    printf( "Calculating indirect references\n" );
+    IndirectMap indirect;
+    {
+        const HashSearchBig midhash( base + "msgid", base + "midhash.meta", base + "midhash" );
+        const MetaView<uint64_t, uint8_t> middb( base + "msgid.meta", base + "msgid" );
+        const MetaView<uint32_t, uint32_t> midgr( base + "midgr.meta", base + "midgr" );
+
+        FILE* pending = fopen( ( base + "indirect.pending" ).c_str(), "wb" );
+        CalcIndirectParents( unique, [] ( size_t i ) { return uint32_t( i ); }, middb, midgr, arch, compress, midhash, [&indirect, pending] ( uint32_t idx, const IndirectResult& res ) {
+            if( res.parent >= 0 )
             {
-                fwrite( &offset, 1, sizeof( offset ), meta );
-                offset += fwrite( desc.first, 1, desc.second, data );
-                offset += fwrite( &zero, 1, 1, data );
+                Link( indirect, idx, res.parent );
             }
+            WritePending( pending, idx, res.missing );
+        } );
+        fclose( pending );
+    }
 
-            i++;
+    printf( "\nIndirect links: %zu\n", indirect.size() );
+
+    TracyMessageL( "Writing indirect data" );
+    WriteIndirect( base, "", indirect );
+}
+
+// Adds archives past the first known ones to an existing galaxy. Message indices of
+// messages already in the galaxy are preserved. Updated files are written next to
+// the current ones, and replace them when everything is done.
+static void UpdateGalaxy( const std::string& base, const std::vector<std::string>& archives, size_t known )
+{
+    const StringCompress compress( base + "msgid.codebook" );
+    const auto total = archives.size();
+
+    uint64_t count = 0;
+    std::vector<std::unique_ptr<Archive>> arch( total );
+    for( size_t i=known; i<total; i++ )
+    {
+        printf( "%zu/%zu\r", i+1-known, total-known );
+        fflush( stdout );
+        count += OpenArchive( arch, archives, i ).NumberOfMessages();
+    }
+    printf( "\nNew message count: %" PRIu64 "\n", count );
+
+    TracyMessageL( "Writing archive data – name, description" );
+    {
+        const FileMap<char> olddata( base + "str" );
+        const FileMap<char> oldmeta( base + "str.meta" );
+
+        FILE* data = fopen( ( base + "str.new" ).c_str(), "wb" );
+        FILE* meta = fopen( ( base + "str.meta.new" ).c_str(), "wb" );
+
+        uint32_t offset = fwrite( olddata, 1, olddata.Size(), data );
+        fwrite( oldmeta, 1, oldmeta.Size(), meta );
+
+        for( size_t i=known; i<total; i++ )
+        {
+            WriteArchiveStrings( data, meta, offset, archives[i], *arch[i] );
         }
 
         fclose( data );
         fclose( meta );
     }
 
-    TracyMessageL( "Building list of unique message ids" );
-    const StringCompress* compress;
+    {
+        const FileMap<char> old( base + "count" );
+        FILE* f = fopen( ( base + "count.new" ).c_str(), "wb" );
+        fwrite( old, 1, old.Size(), f );
+        for( size_t i=known; i<total; i++ ) WriteArchiveCount( f, *arch[i] );
+        fclose( f );
+    }
 
-    Slab<128*1024*1024> vecslab;
-    std::vector<const uint8_t*> msgidvec;
-    uint64_t unique;
+    TracyMessageL( "Updating time chart" );
+    DayHistogram chart;
+    if( Exists( base + "timechart" ) )
+    {
+        const FileMap<uint32_t> old( base + "timechart" );
+        chart = DayHistogram( old, old.DataSize() );
+    }
+    else
     {
+        for( size_t i=0; i<known; i++ ) chart.Add( OpenArchive( arch, archives, i ).GetDayHistogram() );
+    }
+    for( size_t i=known; i<total; i++ ) chart.Add( arch[i]->GetDayHistogram() );
+
+    FILE* pending = fopen( ( base + "indirect.pending.new" ).c_str(), "wb" );
+
+    struct Member
+    {
+        uint32_t idx;
+        uint32_t arch;
+    };
+
+    uint64_t oldUnique, unique;
+    std::vector<uint32_t> retry;
+    std::vector<uint32_t> grown;
+    {
+        const HashSearchBig midhash( base + "msgid", base + "midhash.meta", base + "midhash" );
+        const MetaView<uint64_t, uint8_t> middb( base + "msgid.meta", base + "msgid" );
+        oldUnique = middb.Size();
+
+        TracyMessageL( "Merging message ids" );
+        printf( "Merging message ids\n" );
+
+        std::vector<Member> members;
+        members.reserve( count );
+
+        Slab<128*1024*1024> slab;
+        std::vector<const uint8_t*> added;
+        robin_hood::unordered_flat_map<const char*, uint32_t, CharUtil::Hasher, CharUtil::Comparator> addedmap;
+
         uint64_t cnt = 0;
-        robin_hood::unordered_flat_set<const char*, CharUtil::Hasher, CharUtil::Comparator> msgidset;
-        msgidset.reserve( count );
-        Slab<128*1024*1024> setslab;
-        for( int i=0; i<arch.size(); i++ )
+        for( size_t i=known; i<total; i++ )
         {
             const auto& a = *arch[i];
             const auto num = a.NumberOfMessages();
@@ -189,333 +825,363 @@ int main( int argc, char** argv )
                     fflush( stdout );
                 }
 
-                const auto id = a.GetMessageId( j );
-                auto unpack = (char*)setslab.Alloc( 2048 );
-                const auto sz = a.UnpackMsgId( id, unpack );
-                auto it = msgidset.find( unpack );
-                if( it == msgidset.end() )
+                char unpack[2048];
+                a.UnpackMsgId( a.GetMessageId( j ), unpack );
+                auto pack = (uint8_t*)slab.Alloc( 2048 );
+                const auto sz = compress.Pack( unpack, pack );
+
+                const auto idx = midhash.Search( pack );
+                if( idx >= 0 )
+                {
+                    slab.Unalloc( 2048 );
+                    members.emplace_back( Member { uint32_t( idx ), uint32_t( i ) } );
+                    continue;
+                }
+                auto it = addedmap.find( (const char*)pack );
+                if( it != addedmap.end() )
                 {
-                    msgidset.emplace( unpack );
-                    setslab.Unalloc( 2048 - sz );
+                    slab.Unalloc( 2048 );
+                    members.emplace_back( Member { it->second, uint32_t( i ) } );
                 }
                 else
                 {
-                    setslab.Unalloc( 2048 );
+                    slab.Unalloc( 2048 - sz );
+                    const auto newIdx = uint32_t( oldUnique + added.size() );
+                    addedmap.emplace( (const char*)pack, newIdx );
+                    added.emplace_back( pack );
+                    members.emplace_back( Member { newIdx, uint32_t( i ) } );
                 }
             }
         }
-        unique = msgidset.size();
-        printf( "\nUnique message count: %zu\n", unique );
+        unique = oldUnique + added.size();
+        printf( "\nUnique message count: %zu (%zu new)\n", unique, added.size() );
 
-        TracyMessageL( "Building code book" );
-        printf( "Building code book...\n" );
-        fflush( stdout );
-        compress = new StringCompress( msgidset );
-        compress->WriteData( base + "msgid.codebook" );
+        TracyMessageL( "Checking pending references" );
+        {
+            FILE* f = fopen( ( base + "indirect.pending" ).c_str(), "rb" );
+            uint32_t idx;
+            std::vector<std::string> missing;
+            while( ReadPending( f, idx, missing ) )
+            {
+                bool found = false;
+                for( auto& v : missing )
+                {
+                    if( addedmap.find( v.c_str() ) != addedmap.end() )
+                    {
+                        found = true;
+                        break;
+                    }
+                }
+                if( found )
+                {
+                    retry.emplace_back( idx );
+                }
+                else
+                {
+                    WritePending( pending, idx, missing );
+                }
+            }
+            fclose( f );
+        }
 
-        TracyMessageL( "Packing msg ids" );
-        printf( "Packing msg ids\n" );
-        msgidvec.reserve( unique );
-        cnt = 0;
-        for( auto& v : msgidset )
+        TracyMessageL( "Building hash table" );
         {
-            if( ( cnt++ & 0x3FFF ) == 0 )
+            std::vector<const uint8_t*> msgidvec;
+            msgidvec.reserve( unique );
+            for( uint64_t i=0; i<oldUnique; i++ )
             {
-                printf( "%zu/%zu\r", cnt, unique );
-                fflush( stdout );
+                msgidvec.emplace_back( middb[i] );
             }
+            msgidvec.insert( msgidvec.end(), added.begin(), added.end() );
+            WriteMsgIdHash( base, ".new", msgidvec );
+        }
+
+        TracyMessageL( "Calculating message groups" );
+        std::sort( members.begin(), members.end(), [] ( const auto& l, const auto& r ) { return l.idx < r.idx || ( l.idx == r.idx && l.arch < r.arch ); } );
+        members.erase( std::unique( members.begin(), members.end(), [] ( const auto& l, const auto& r ) { return l.idx == r.idx && l.arch == r.arch; } ), members.end() );
 
-            auto pack = (uint8_t*)vecslab.Alloc( 2048 );
-            const auto sz = compress->Pack( v, pack );
-            vecslab.Unalloc( 2048 - sz );
-            msgidvec.emplace_back( pack );
+        const MetaView<uint32_t, uint32_t> midgr( base + "midgr.meta", base + "midgr" );
+        GroupWriter gw( base, ".new" );
+        std::vector<int> groups;
+        auto it = members.begin();
+        for( uint64_t i=0; i<unique; i++ )
+        {
+            groups.clear();
+            if( i < oldUnique )
+            {
+                auto ptr = midgr[i];
+                const auto num = *ptr++;
+                groups.assign( ptr, ptr+num );
+            }
+            const auto size = groups.size();
+            while( it != members.end() && it->idx == i )
+            {
+                groups.emplace_back( it->arch );
+                ++it;
+            }
+            if( i < oldUnique && groups.size() != size )
+            {
+                grown.emplace_back( i );
+            }
+            gw.Add( groups );
         }
-        printf( "\n" );
+        assert( it == members.end() );
     }
 
-    TracyMessageL( "Building hash table" );
+    TracyMessageL( "Updating indirect references" );
+    printf( "Updating indirect references (%zu pending)\n", retry.size() );
     {
-        auto hashbits = MsgIdHashBits( unique, 90 );
-        auto hashsize = MsgIdHashSize( hashbits );
-        auto hashmask = MsgIdHashMask( hashbits );
+        auto indirect = LoadIndirect( base );
 
-        printf( "Load factor: %.2f\n", float( unique ) / hashsize );
+        const HashSearchBig midhash( base + "msgid.new", base + "midhash.meta.new", base + "midhash.new" );
+        const MetaView<uint64_t, uint8_t> middb( base + "msgid.meta.new", base + "msgid.new" );
+        const MetaView<uint32_t, uint32_t> midgr( base + "midgr.meta.new", base + "midgr.new" );
 
-        auto hashdata = new uint64_t[hashsize];
-        auto distance = new uint8_t[hashsize];
-        memset( distance, 0xFF, hashsize );
-        uint8_t distmax = 0;
+        std::vector<int> groups;
+        auto GetGroups = [&midgr, &groups, &arch, &archives] ( uint32_t idx ) {
+            auto ptr = midgr[idx];
+            const auto num = *ptr++;
+            groups.assign( ptr, ptr+num );
+            for( auto& v : groups ) OpenArchive( arch, archives, v );
+        };
 
-        for( int i=0; i<unique; i++ )
+        // Links of messages which were found in new archives are still valid, unless
+        // a new archive has the parent in its own thread structure.
+        for( auto idx : grown )
         {
-            if( ( i & 0x3FFFF ) == 0 )
+            auto it = indirect.find( idx );
+            if( it == indirect.end() || it->second.parent.empty() ) continue;
+            GetGroups( idx );
+            const auto first = std::lower_bound( groups.begin(), groups.end(), int( known ) );
+            char parent[2048];
+            compress.Unpack( middb[it->second.parent[0]], parent );
+            if( !IsIndirectLink( middb[idx], parent, &*first, groups.end() - first, arch, compress ) )
             {
-                printf( "%i/%zu\r", i, unique );
-                fflush( stdout );
+                Unlink( indirect, idx );
             }
+        }
 
-            uint32_t hash = XXH32( msgidvec[i], strlen( (const char*)msgidvec[i] ), 0 ) & hashmask;
+        // New messages, and messages which reference new messages, are processed from scratch.
+        std::sort( retry.begin(), retry.end() );
+        for( uint64_t i=oldUnique; i<unique; i++ ) retry.emplace_back( i );
 
-            uint8_t dist = 0;
-            uint64_t idx = i;
-            for(;;)
+        for( auto idx : retry ) GetGroups( idx );
+        CalcIndirectParents( retry.size(), [&retry] ( size_t i ) { return retry[i]; }, middb, midgr, arch, compress, midhash, [&indirect, pending] ( uint32_t idx, const IndirectResult& res ) {
+            Unlink( indirect, idx );
+            if( res.parent >= 0 )
             {
-                if( distance[hash] == 0xFF )
-                {
-                    if( distmax < dist ) distmax = dist;
-                    distance[hash] = dist;
-                    hashdata[hash] = idx;
-                    break;
-                }
-                if( distance[hash] < dist )
-                {
-                    if( distmax < dist ) distmax = dist;
-                    std::swap( distance[hash], dist );
-                    std::swap( hashdata[hash], idx );
-                }
-                dist++;
-                assert( dist < 0xFF );
-                hash = (hash+1) & hashmask;
+                Link( indirect, idx, res.parent );
             }
-        }
-        printf( "\n" );
+            WritePending( pending, idx, res.missing );
+        } );
+        fclose( pending );
 
+        for( auto it = indirect.begin(); it != indirect.end(); )
         {
-            FILE* meta = fopen( ( base + "midhash.meta" ).c_str(), "wb" );
-            fwrite( &distmax, 1, 1, meta );
-            fclose( meta );
-
-            FILE* data = fopen( ( base + "midhash" ).c_str(), "wb" );
-            FILE* strdata = fopen( ( base + "msgid" ).c_str(), "wb" );
-            FILE* strmeta = fopen( ( base + "msgid.meta" ).c_str(), "wb" );
-
-            const uint64_t zero = 0;
-            uint64_t stroffset = fwrite( &zero, 1, 1, strdata );
-
-            auto msgidoffset = new uint64_t[unique];
-
-            int cnt = 0;
-            for( int i=0; i<hashsize; i++ )
+            if( it->second.parent.empty() && it->second.child.empty() )
             {
-                if( ( i & 0x3FFFF ) == 0 )
-                {
-                    printf( "%i/%i\r", i, hashsize );
-                    fflush( stdout );
-                }
+                it = indirect.erase( it );
+            }
+            else
+            {
+                std::sort( it->second.child.begin(), it->second.child.end() );
+                ++it;
+            }
+        }
 
-                if( distance[i] == 0xFF )
-                {
-                    fwrite( &zero, 1, sizeof( uint64_t ), data );
-                    fwrite( &zero, 1, sizeof( uint64_t ), data );
-                }
-                else
-                {
-                    fwrite( &stroffset, 1, sizeof( uint64_t ), data );
-                    fwrite( hashdata+i, 1, sizeof( uint64_t ), data );
+        printf( "\nIndirect links: %zu\n", indirect.size() );
 
-                    msgidoffset[hashdata[i]] = stroffset;
-                    cnt++;
-                    auto str = msgidvec[hashdata[i]];
-                    stroffset += fwrite( str, 1, strlen( (const char*)str ) + 1, strdata );
-                }
-            }
+        TracyMessageL( "Writing indirect data" );
+        WriteIndirect( base, ".new", indirect );
+    }
 
-            assert( cnt == unique );
-            fwrite( msgidoffset, 1, unique * sizeof( uint64_t ), strmeta );
-            delete[] msgidoffset;
+    chart.Write( base + "timechart.new" );
+}
 
-            fclose( data );
-            fclose( strdata );
-            fclose( strmeta );
-        }
+static void ReplaceFile( const std::string& fn )
+{
+    remove( fn.c_str() );
+    if( rename( ( fn + ".new" ).c_str(), fn.c_str() ) != 0 )
+    {
+        fprintf( stderr, "Cannot replace %s\n", fn.c_str() );
+        exit( 1 );
+    }
+}
 
-        delete[] hashdata;
-        delete[] distance;
+// New archive state is written only after all updated files are complete, and is
+// moved in place last. If it is present, an interrupted update is rolled forward.
+static void CommitUpdate( const std::string& base )
+{
+    for( auto& v : UpdatedFiles )
+    {
+        const auto fn = base + v;
+        if( Exists( fn + ".new" ) ) ReplaceFile( fn );
     }
+    ReplaceFile( base + "archives.state" );
+}
 
-    printf( "\n" );
+int main( int argc, char** argv )
+{
+    TracyNoop;
+
+    bool force = false;
+    size_t memory = 1024;
 
-    TracyMessageL( "Caching unpacked message id to message index mapping" );
-    std::vector<robin_hood::unordered_flat_map<std::string, uint32_t>> msgdata;
-    msgdata.resize( arch.size() );
-    for( size_t i=0; i<arch.size(); i++ )
+    for(;;)
     {
-        printf( "%zu/%zu\r", i+1, arch.size() );
-        fflush( stdout );
-        auto& map = msgdata[i];
-        auto num = arch[i]->NumberOfMessages();
-        map.reserve( num );
-        for( size_t j=0; j<num; j++ )
+        if( argc > 2 && strcmp( argv[1], "-f" ) == 0 )
+        {
+            force = true;
+            argv++;
+            argc--;
+        }
+        else if( argc > 3 && strcmp( argv[1], "-m" ) == 0 )
+        {
+            memory = atoi( argv[2] );
+            argv += 2;
+            argc -= 2;
+        }
+        else
         {
-            char unpacked[2048];
-            auto packed = arch[i]->GetMessageId( j );
-            auto size = arch[i]->UnpackMsgId( packed, unpacked );
-            map[std::string( unpacked, size )] = j;
+            break;
         }
     }
-    printf( "\n" );
+    if( argc != 2 )
+    {
+        fprintf( stderr, "USAGE: %s [-f] [-m megabytes] directory\n", argv[0] );
+        fprintf( stderr, "  -f    rebuild galaxy from scratch\n" );
+        fprintf( stderr, "  -m    memory used for sorting message ids (default: 1024 MB)\n" );
+        exit( 1 );
+    }
+    if( memory < 16 )
+    {
+        fprintf( stderr, "At least 16 MB of memory is required.\n" );
+        exit( 1 );
+    }
+    if( !Exists( argv[1] ) )
+    {
+        fprintf( stderr, "Destination directory doesn't exist.\n" );
+        exit( 1 );
+    }
 
-    TracyMessageL( "Calculating message groups and indirect references" );
-    struct IndirectData
+    const auto base = std::string( argv[1] ) + "/";
+    const auto listfn = base + "archives";
+    if( !Exists( listfn ) )
     {
-        std::vector<uint32_t> parent;
-        std::vector<uint32_t> child;
-    };
+        fprintf( stderr, "Archive file list doesn't exist. Create %s with paths to each archive in separate lines.\n", listfn.c_str() );
+        exit( 1 );
+    }
 
-    std::map<uint32_t, IndirectData> indirect;
+    std::vector<std::string> archives;
 
+    TracyMessageL( "Loading archive list" );
     {
-        const HashSearchBig midhash( base + "msgid", base + "midhash.meta", base + "midhash" );
+        const FileMap<char> listfile( listfn );
+        const char* begin = listfile;
+        auto ptr = begin;
+        auto size = listfile.DataSize();
+
+        FILE* out = fopen( ( base + "archives.meta" ).c_str(), "wb" );
 
-        struct VectorHasher
+        auto end = ptr;
+        while( size > 0 )
         {
-            size_t operator()( const std::vector<int>& vec ) const
+            while( size > 0 && *end != '\r' && *end != '\n' )
             {
-                return XXH64( vec.data(), vec.size() * sizeof( int ), 0 );
+                end++;
+                size--;
             }
-        };
-
-        robin_hood::unordered_flat_map<std::vector<int>, uint32_t, VectorHasher> mapdata;
-        std::vector<int> groups;
+            archives.emplace_back( ptr, end );
 
-        uint32_t offset32 = 0;
-        FILE* data = fopen( ( base + "midgr" ).c_str(), "wb" );
-        FILE* meta = fopen( ( base + "midgr.meta" ).c_str(), "wb" );
-        ExpandingBuffer eb;
-        for( int i=0; i<unique; i++ )
-        {
-            if( ( i & 0x3FFF ) == 0 )
+            if( !Exists( archives.back() ) )
             {
-                printf( "%i/%zu\r", i, unique );
-                fflush( stdout );
+                fprintf( stderr, "Archive doesn't exist: %s\n", archives.back().c_str() );
+                fclose( out );
+                exit( 1 );
             }
 
-            char unpk[2048];
-            auto unsz = compress->Unpack( msgidvec[i], unpk );
-            auto unstr = std::string( unpk, unsz );
+            uint32_t tmp;
+            tmp = ptr - begin;
+            fwrite( &tmp, 1, sizeof( tmp ), out );
+            tmp = end - begin;
+            fwrite( &tmp, 1, sizeof( tmp ), out );
 
-            groups.clear();
-            for( int j=0; j<arch.size(); j++ )
-            {
-                auto it = msgdata[j].find( unstr );
-                if( it != msgdata[j].end() )
-                {
-                    groups.emplace_back( j );
-                }
-            }
-            assert( !groups.empty() );
-            const auto& refarch = arch[groups[0]];
-            uint8_t repack[2048];
-            refarch->RepackMsgId( msgidvec[i], repack, *compress );
-            const auto idx = refarch->GetMessageIndex( repack );
-            if( refarch->GetParent( idx ) == -1 )
-            {
-                char tmp[1024];
-                auto post = refarch->GetMessage( idx, eb );
-                auto parent = GetParentFromReferences( post, *compress, midhash, tmp );
-                if( parent >= 0 )
-                {
-                    bool ok = true;
-                    for( int g=1; g<groups.size(); g++ )
-                    {
-                        const auto& currarch = arch[groups[g]];
-                        uint8_t crepack[2048];
-                        currarch->RepackMsgId( msgidvec[i], crepack, *compress );
-                        const auto gmidx = currarch->GetMessageIndex( crepack );
-                        assert( gmidx != -1 );
-                        const auto pmidx = currarch->GetParent( gmidx );
-                        if( pmidx != -1 )
-                        {
-                            char unpack[2048];
-                            currarch->UnpackMsgId( currarch->GetMessageId( pmidx ), unpack );
-                            if( strcmp( unpack, tmp ) == 0 )
-                            {
-                                ok = false;
-                                break;
-                            }
-                        }
-                    }
-                    if( ok )
-                    {
-                        indirect[i].parent.emplace_back( parent );
-                        indirect[parent].child.emplace_back( i );
-                    }
-                }
-            }
-            auto it = mapdata.find( groups );
-            if( it == mapdata.end() )
-            {
-                it = mapdata.emplace( groups, offset32 ).first;
-                fwrite( &offset32, 1, sizeof( offset32 ), meta );
-                uint32_t num = groups.size();
-                offset32 += fwrite( &num, 1, sizeof( num ), data );
-                offset32 += fwrite( groups.data(), 1, sizeof( uint32_t ) * num, data );
-            }
-            else
+            while( size > 0 && ( *end == '\r' || *end == '\n' ) )
             {
-                fwrite( &it->second, 1, sizeof( uint32_t ), meta );
+                end++;
+                size--;
             }
+            ptr = end;
         }
-        fclose( data );
-        fclose( meta );
+        fclose( out );
     }
 
-    printf( "\nIndirect links: %zu\n", indirect.size() );
+    TracyMessageL( "Checking archive state" );
+    std::vector<ArchiveState> state;
+    state.reserve( archives.size() );
+    for( auto& v : archives )
+    {
+        state.emplace_back( GetArchiveState( v ) );
+    }
 
-    TracyMessageL( "Writing indirect data" );
+    if( Exists( base + "archives.state.new" ) )
     {
-        struct DenseData
-        {
-            uint64_t msgid;
-            uint32_t parent;
-            uint32_t children;
-        };
-        std::vector<DenseData> dense;
-        dense.reserve( indirect.size() );
+        printf( "Completing interrupted galaxy update.\n" );
+        CommitUpdate( base );
+    }
 
-        uint32_t offset = 0;
-        uint32_t zero = 0;
-        FILE* data = fopen( ( base + "indirect" ).c_str(), "wb" );
-        offset += fwrite( &zero, 1, sizeof( uint32_t ), data );
-        for( auto& it : indirect )
+    // Galaxy can be updated in place, if archives were only added at the end of the list.
+    size_t known = 0;
+    if( !force && Exists( base + "archives.state" ) && Exists( base + "msgid.codebook" ) )
+    {
+        bool complete = true;
+        for( auto& v : UpdatedFiles )
         {
-            DenseData dd = { it.first };
-
-            const auto& parent = it.second.parent;
-            const auto& child = it.second.child;
-            if( !parent.empty() )
+            if( !Exists( base + v ) )
             {
-                dd.parent = offset;
-                const uint32_t num = parent.size();
-                fwrite( &num, 1, sizeof( uint32_t ), data );
-                fwrite( parent.data(), 1, sizeof( uint32_t ) * num, data );
-                offset += sizeof( uint32_t ) * ( num + 1 );
+                complete = false;
+                break;
             }
-            if( !child.empty() )
+        }
+
+        const auto prev = LoadArchiveState( base + "archives.state" );
+        if( complete && !prev.empty() && prev.size() <= state.size() )
+        {
+            known = prev.size();
+            for( size_t i=0; i<prev.size(); i++ )
             {
-                dd.children = offset;
-                const uint32_t num = child.size();
-                fwrite( &num, 1, sizeof( uint32_t ), data );
-                fwrite( child.data(), 1, sizeof( uint32_t ) * num, data );
-                offset += sizeof( uint32_t ) * ( num + 1 );
+                if( prev[i].path != state[i].path || prev[i].size != state[i].size || prev[i].mtime != state[i].mtime )
+                {
+                    printf( "Archive %s has changed.\n", state[i].path.c_str() );
+                    known = 0;
+                    break;
+                }
             }
-
-            dense.emplace_back( dd );
         }
-        fclose( data );
-
-        std::sort( dense.begin(), dense.end(), [] ( const auto& l, const auto& r ) { return l.msgid < r.msgid; } );
-
-        FILE* meta = fopen( ( base + "indirect.dense" ).c_str(), "wb" );
-        FILE* off = fopen( ( base + "indirect.offset" ).c_str(), "wb" );
-        for( auto& v : dense )
+        if( known == 0 )
         {
-            fwrite( &v.msgid, 1, sizeof( v.msgid ), meta );
-            fwrite( &v.parent, 1, sizeof( v.parent ), off );
-            fwrite( &v.children, 1, sizeof( v.children ), off );
+            printf( "Galaxy can't be updated, rebuilding.\n" );
         }
-        fclose( meta );
-        fclose( off );
+    }
+
+    if( known == 0 )
+    {
+        // Partially rebuilt galaxy must not be mistaken for an updatable one.
+        remove( ( base + "archives.state" ).c_str() );
+        BuildGalaxy( base, archives, memory * 1024 * 1024 );
+        SaveArchiveState( base + "archives.state", state );
+    }
+    else if( known == archives.size() )
+    {
+        printf( "Galaxy is up to date.\n" );
+        return 0;
+    }
+    else
+    {
+        printf( "Adding %zu archives to galaxy of %zu archives.\n", archives.size() - known, known );
+        UpdateGalaxy( base, archives, known );
+        SaveArchiveState( base + "archives.state.new", state );
+        CommitUpdate( base );
     }
 
     return 0;
@@ -14,6 +14,7 @@
 #include "../contrib/lzma/Types.h"
 #include "../common/ExpandingBuffer.hpp"
 #include "../common/Filesystem.hpp"
+#include "../common/Kernels.hpp"
 #include "../common/RawImportMeta.hpp"
 
 static void* MemAlloc( void* p, size_t size )
@@ -154,21 +155,7 @@ int main( int argc, char** argv )
             &s_alloc, &s_alloc );
 
         char* processed = eb.Request( outSizeProcessed );
-        auto osp = outSizeProcessed;
-        auto src = outBuffer + lzmaOffset;
-        auto dst = processed;
-        for( int i=0; i<osp; i++ )
-        {
-            if( *src == '\r' )
-            {
-                outSizeProcessed--;
-                src++;
-            }
-            else
-            {
-                *dst++ = *src++;
-            }
-        }
+        outSizeProcessed = StripCR( (const char*)outBuffer + lzmaOffset, outSizeProcessed, processed );
 
         int maxSize = LZ4_compressBound( outSizeProcessed );
         char* compressed = eb2.Request( maxSize );
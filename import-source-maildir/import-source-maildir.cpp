@@ -11,6 +11,7 @@
 
 #include "../common/ExpandingBuffer.hpp"
 #include "../common/Filesystem.hpp"
+#include "../common/Kernels.hpp"
 #include "../common/RawImportMeta.hpp"
 
 static int idx = 0;
@@ -53,21 +54,7 @@ void RecursivePack( const char* dir )
             fclose( fsrc );
 
             char* processed = eb3.Request( size );
-            auto osp = size;
-            auto src = buf;
-            auto dst = processed;
-            for( int i=0; i<osp; i++ )
-            {
-                if( *src == '\r' )
-                {
-                    size--;
-                    src++;
-                }
-                else
-                {
-                    *dst++ = *src++;
-                }
-            }
+            size = StripCR( buf, size, processed );
 
             int maxSize = LZ4_compressBound( size );
             char* compressed = eb2.Request( maxSize );
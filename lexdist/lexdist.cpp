@@ -1,7 +1,9 @@
 #include <algorithm>
 #include <assert.h>
 #include <atomic>
+#include <chrono>
 #include <codecvt>
+#include <inttypes.h>
 #include <locale>
 #include <math.h>
 #include <mutex>
@@ -12,12 +14,18 @@
 #include <string.h>
 #include <vector>
 
+#include "../contrib/xxhash/xxhash.h"
+
+#include "../common/CpuDispatch.hpp"
 #include "../common/FileMap.hpp"
+#include "../common/Kernels.hpp"
+#include "../common/LexiconMetaView.hpp"
 #include "../common/LexiconTypes.hpp"
 #include "../common/System.hpp"
 #include "../common/TaskDispatch.hpp"
+#include "../common/WideOffsets.hpp"
 
-#ifdef __AVX512F__
+#ifdef CPU_DISPATCH
 #  include <immintrin.h>
 #endif
 
@@ -80,6 +88,188 @@ static int levenshtein_distance( const char32_t* s1, const unsigned int len1, co
     return prevCol[len2];
 }
 
+// Bit-parallel edit distance, as described in "A Bit-Vector Algorithm for Computing
+// Levenshtein and Damerau Edit Distances" by Heikki Hyyrö. Each bit represents one
+// pattern character, so max word length must fit in the register.
+static_assert( LexiconMaxLen <= 32, "Pattern doesn't fit in bit vector" );
+
+struct MyersPattern
+{
+    uint32_t peq[128];
+    const char32_t* str;
+    int len;
+};
+
+static void MyersPrepare( MyersPattern& p, const char32_t* str, int len )
+{
+    memset( p.peq, 0, sizeof( p.peq ) );
+    for( int i=0; i<len; i++ )
+    {
+        if( str[i] < 128 ) p.peq[str[i]] |= 1u << i;
+    }
+    p.str = str;
+    p.len = len;
+}
+
+static inline uint32_t MyersEq( const MyersPattern& p, char32_t c )
+{
+    if( c < 128 ) return p.peq[c];
+    uint32_t eq = 0;
+    for( int i=0; i<p.len; i++ )
+    {
+        if( p.str[i] == c ) eq |= 1u << i;
+    }
+    return eq;
+}
+
+// Returns exact distance, if it is lower than threshold. Otherwise returns threshold.
+static int MyersDistance( const MyersPattern& p, const char32_t* text, int n, int threshold )
+{
+    const uint32_t hbit = 1u << ( p.len - 1 );
+    uint32_t pv = ~0u;
+    uint32_t mv = 0;
+    int score = p.len;
+    for( int j=0; j<n; j++ )
+    {
+        const auto eq = MyersEq( p, text[j] );
+        const auto xv = eq | mv;
+        const auto xh = ( ( ( eq & pv ) + pv ) ^ pv ) | eq;
+        auto ph = mv | ~( xh | pv );
+        auto mh = pv & xh;
+        if( ph & hbit ) score++;
+        else if( mh & hbit ) score--;
+        if( score - ( n - j - 1 ) >= threshold ) return threshold;
+        ph = ( ph << 1 ) | 1;
+        mh <<= 1;
+        pv = mh | ~( xv | ph );
+        mv = ph & xv;
+    }
+    return std::min( score, threshold );
+}
+
+enum { MyersBatchSize = 16 };
+
+// Calculates distance between pattern and up to MyersBatchSize texts of the same length.
+using MyersDistanceBatchFn = void(*)( const MyersPattern& p, const char32_t* const* texts, int count, int n, int threshold, int* out );
+
+static void MyersDistanceBatch_Scalar( const MyersPattern& p, const char32_t* const* texts, int count, int n, int threshold, int* out )
+{
+    for( int l=0; l<count; l++ ) out[l] = MyersDistance( p, texts[l], n, threshold );
+}
+
+#ifdef CPU_DISPATCH
+// Texts are transposed, so that each SIMD lane processes one text.
+static void MyersTranspose( uint32_t tr[LexiconMaxLen][MyersBatchSize], const char32_t* const* texts, int count, int n )
+{
+    for( int j=0; j<n; j++ )
+    {
+        for( int l=0; l<count; l++ ) tr[j][l] = texts[l][j];
+        for( int l=count; l<MyersBatchSize; l++ ) tr[j][l] = 0xFFFFFFFF;
+    }
+}
+
+CPU_TARGET_AVX2 static void MyersDistanceBatch_AVX2( const MyersPattern& p, const char32_t* const* texts, int count, int n, int threshold, int* out )
+{
+    assert( count <= MyersBatchSize );
+    alignas( 32 ) uint32_t tr[LexiconMaxLen][MyersBatchSize];
+    MyersTranspose( tr, texts, count, n );
+    const int hshift = p.len - 1;
+
+    __m256i vq[LexiconMaxLen];
+    for( int i=0; i<p.len; i++ ) vq[i] = _mm256_set1_epi32( p.str[i] );
+    const auto vone = _mm256_set1_epi32( 1 );
+    const auto vones = _mm256_set1_epi32( -1 );
+    const auto vthreshold = _mm256_set1_epi32( threshold );
+
+    for( int h=0; h<count; h+=8 )
+    {
+        const int active = ( 1 << std::min( 8, count - h ) ) - 1;
+        auto pv = vones;
+        auto mv = _mm256_setzero_si256();
+        auto score = _mm256_set1_epi32( p.len );
+        for( int j=0; j<n; j++ )
+        {
+            const auto c = _mm256_load_si256( (const __m256i*)( tr[j] + h ) );
+            auto eq = _mm256_setzero_si256();
+            for( int i=0; i<p.len; i++ )
+            {
+                eq = _mm256_or_si256( eq, _mm256_and_si256( _mm256_cmpeq_epi32( c, vq[i] ), _mm256_set1_epi32( 1 << i ) ) );
+            }
+            const auto xv = _mm256_or_si256( eq, mv );
+            const auto xh = _mm256_or_si256( _mm256_xor_si256( _mm256_add_epi32( _mm256_and_si256( eq, pv ), pv ), pv ), eq );
+            auto ph = _mm256_or_si256( mv, _mm256_xor_si256( _mm256_or_si256( xh, pv ), vones ) );
+            auto mh = _mm256_and_si256( pv, xh );
+            score = _mm256_add_epi32( score, _mm256_and_si256( _mm256_srli_epi32( ph, hshift ), vone ) );
+            score = _mm256_sub_epi32( score, _mm256_and_si256( _mm256_srli_epi32( mh, hshift ), vone ) );
+            const auto bound = _mm256_sub_epi32( score, _mm256_set1_epi32( n - j - 1 ) );
+            const auto done = _mm256_movemask_ps( _mm256_castsi256_ps( _mm256_cmpgt_epi32( bound, _mm256_sub_epi32( vthreshold, vone ) ) ) );
+            if( ( done & active ) == active )
+            {
+                score = vthreshold;
+                break;
+            }
+            ph = _mm256_or_si256( _mm256_slli_epi32( ph, 1 ), vone );
+            mh = _mm256_slli_epi32( mh, 1 );
+            pv = _mm256_or_si256( mh, _mm256_xor_si256( _mm256_or_si256( xv, ph ), vones ) );
+            mv = _mm256_and_si256( ph, xv );
+        }
+        alignas( 32 ) int res[8];
+        _mm256_store_si256( (__m256i*)res, _mm256_min_epi32( score, vthreshold ) );
+        for( int l=h; l<std::min( h+8, count ); l++ ) out[l] = res[l-h];
+    }
+}
+
+CPU_TARGET_AVX512 static void MyersDistanceBatch_AVX512( const MyersPattern& p, const char32_t* const* texts, int count, int n, int threshold, int* out )
+{
+    assert( count <= MyersBatchSize );
+    alignas( 64 ) uint32_t tr[LexiconMaxLen][MyersBatchSize];
+    MyersTranspose( tr, texts, count, n );
+    const int hshift = p.len - 1;
+
+    __m512i vq[LexiconMaxLen];
+    for( int i=0; i<p.len; i++ ) vq[i] = _mm512_set1_epi32( p.str[i] );
+    const auto vone = _mm512_set1_epi32( 1 );
+    const auto vthreshold = _mm512_set1_epi32( threshold );
+    const __mmask16 active = ( 1u << count ) - 1;
+    auto pv = _mm512_set1_epi32( -1 );
+    auto mv = _mm512_setzero_si512();
+    auto score = _mm512_set1_epi32( p.len );
+    for( int j=0; j<n; j++ )
+    {
+        const auto c = _mm512_load_si512( tr[j] );
+        auto eq = _mm512_setzero_si512();
+        for( int i=0; i<p.len; i++ )
+        {
+            eq = _mm512_mask_or_epi32( eq, _mm512_cmpeq_epi32_mask( c, vq[i] ), eq, _mm512_set1_epi32( 1 << i ) );
+        }
+        const auto xv = _mm512_or_si512( eq, mv );
+        const auto xh = _mm512_or_si512( _mm512_xor_si512( _mm512_add_epi32( _mm512_and_si512( eq, pv ), pv ), pv ), eq );
+        auto ph = _mm512_or_si512( mv, _mm512_ternarylogic_epi32( xh, pv, pv, 0x03 ) );    // ~( xh | pv )
+        auto mh = _mm512_and_si512( pv, xh );
+        score = _mm512_add_epi32( score, _mm512_and_si512( _mm512_srli_epi32( ph, hshift ), vone ) );
+        score = _mm512_sub_epi32( score, _mm512_and_si512( _mm512_srli_epi32( mh, hshift ), vone ) );
+        const auto bound = _mm512_sub_epi32( score, _mm512_set1_epi32( n - j - 1 ) );
+        if( ( _mm512_cmpge_epi32_mask( bound, vthreshold ) & active ) == active )
+        {
+            score = vthreshold;
+            break;
+        }
+        ph = _mm512_or_si512( _mm512_slli_epi32( ph, 1 ), vone );
+        mh = _mm512_slli_epi32( mh, 1 );
+        pv = _mm512_or_si512( mh, _mm512_ternarylogic_epi32( xv, ph, ph, 0x03 ) );      // ~( xv | ph )
+        mv = _mm512_and_si512( ph, xv );
+    }
+    alignas( 64 ) int res[MyersBatchSize];
+    _mm512_store_si512( res, _mm512_min_epi32( score, vthreshold ) );
+    for( int l=0; l<count; l++ ) out[l] = res[l];
+}
+#else
+#  define MyersDistanceBatch_AVX2 nullptr
+#  define MyersDistanceBatch_AVX512 nullptr
+#endif
+
+static const MyersDistanceBatchFn MyersDistanceBatch = CpuDispatch::Select<MyersDistanceBatchFn>( MyersDistanceBatch_Scalar, nullptr, MyersDistanceBatch_AVX2, MyersDistanceBatch_AVX512 );
+
 static int GetMaxLD( int len )
 {
     if( len <= 5 ) return 1;
@@ -131,82 +321,347 @@ struct CandidateData
 
 static_assert( sizeof( CandidateData ) == 2 * sizeof( uint32_t ), "CandidateData size overflow" );
 
-int main( int argc, char** argv )
+enum class Engine
 {
-    if( argc != 2 )
-    {
-        fprintf( stderr, "USAGE: %s directory\n", argv[0] );
-        exit( 1 );
-    }
+    BruteForce,
+    SymDelete
+};
 
-    std::string base = argv[1];
-    base.append( "/" );
-    FileMap<LexiconMetaPacket> meta( base + "lexmeta" );
-    FileMap<char> str( base + "lexstr" );
+enum class Kernel
+{
+    DP,
+    Myers,
+    MyersBatch
+};
 
-    const auto size = meta.DataSize();
-    auto data = new std::vector<uint32_t>[size];
-    auto stru32 = new std::u32string[size];
-    auto counts = new unsigned int[size];
-    auto offsets = new uint32_t[size];
+struct WordData
+{
+    std::u32string* stru32;
+    unsigned int* counts;
+    uint32_t* offsets;
     std::vector<uint32_t> byLen[LexiconMaxLen+1];
     std::vector<uint64_t> heurdata[LexiconMaxLen+1];
+};
 
-#ifdef _MSC_VER
-    std::wstring_convert<std::codecvt_utf8<unsigned int>, unsigned int> conv;
-#else
-    std::wstring_convert<std::codecvt_utf8<char32_t>, char32_t> conv;
-#endif
-    for( uint32_t i=0; i<size; i++ )
+struct SearchParams
+{
+    int len;
+    int maxld;
+    int ldstart;
+    int ldend;
+};
+
+struct SearchStats
+{
+    uint64_t examined = 0;
+    uint64_t verified = 0;
+};
+
+// Calculates distances between searched word and candidates, using selected kernel.
+// Candidates are reported in the order in which they were pushed.
+class Verifier
+{
+public:
+    Verifier( Kernel kernel, const WordData& wd, std::vector<CandidateData>& candidates, SearchStats& stats )
+        : m_kernel( kernel )
+        , m_wd( wd )
+        , m_candidates( candidates )
+        , m_stats( stats )
     {
-        if( ( i & 0x3FF ) == 0 )
+    }
+
+    void Start( const SearchParams& sp, const std::u32string& str )
+    {
+        m_sp = &sp;
+        m_str = &str;
+        m_maxCount = 0;
+        m_num = 0;
+        if( m_kernel != Kernel::DP ) MyersPrepare( m_pattern, str.c_str(), sp.len );
+    }
+
+    void Push( int k, uint32_t idx2 )
+    {
+        m_stats.verified++;
+        switch( m_kernel )
         {
-            printf( "%i/%zu\r", i, size );
-            fflush( stdout );
+        case Kernel::DP:
+            Emit( levenshtein_distance( m_str->c_str(), m_sp->len, m_wd.stru32[idx2].c_str(), k, m_sp->maxld+1 ), idx2 );
+            break;
+        case Kernel::Myers:
+            Emit( MyersDistance( m_pattern, m_wd.stru32[idx2].c_str(), k, m_sp->maxld+1 ), idx2 );
+            break;
+        case Kernel::MyersBatch:
+            if( m_num != 0 && ( m_batchLen != k || m_num == MyersBatchSize ) ) Flush();
+            m_batchLen = k;
+            m_batch[m_num++] = idx2;
+            break;
+        default:
+            assert( false );
+            break;
         }
+    }
 
-        auto mp = meta + i;
-        offsets[i] = mp->str;
-        auto s = str + mp->str;
-        auto len = utflen( s );
-        assert( len <= LexiconMaxLen );
+    unsigned int Finish()
+    {
+        if( m_num != 0 ) Flush();
+        return m_maxCount;
+    }
 
-#ifdef _MSC_VER
-        stru32[i] = std::u32string( (const char32_t*)conv.from_bytes( s ).data() );
-#else
-        stru32[i] = conv.from_bytes( s );
-#endif
-        byLen[len].emplace_back( i );
-        heurdata[len].emplace_back( BuildHeuristicData( s ) );
+private:
+    void Emit( int ld, uint32_t idx2 )
+    {
+        if( ld > 0 && ld <= m_sp->maxld )
+        {
+            const auto cnt2 = m_wd.counts[idx2];
+            m_candidates.emplace_back( CandidateData { uint32_t( ld ), cnt2, m_wd.offsets[idx2] } );
+            if( cnt2 > m_maxCount ) m_maxCount = cnt2;
+        }
+    }
 
-        counts[i] = mp->dataSize;
+    void Flush()
+    {
+        const char32_t* texts[MyersBatchSize];
+        int ld[MyersBatchSize];
+        for( int i=0; i<m_num; i++ ) texts[i] = m_wd.stru32[m_batch[i]].c_str();
+        MyersDistanceBatch( m_pattern, texts, m_num, m_batchLen, m_sp->maxld+1, ld );
+        for( int i=0; i<m_num; i++ ) Emit( ld[i], m_batch[i] );
+        m_num = 0;
     }
 
-    printf( "\nWord length histogram\n" );
-    for( int i=LexiconMinLen; i<=LexiconMaxLen; i++ )
+    Kernel m_kernel;
+    const WordData& m_wd;
+    std::vector<CandidateData>& m_candidates;
+    SearchStats& m_stats;
+
+    const SearchParams* m_sp;
+    const std::u32string* m_str;
+    unsigned int m_maxCount;
+    MyersPattern m_pattern;
+
+    uint32_t m_batch[MyersBatchSize];
+    int m_num;
+    int m_batchLen;
+};
+
+// Applies the same filters as the brute force engine, so that all engines produce identical output.
+static inline void TestCandidate( const WordData& wd, const SearchParams& sp, uint64_t heur1, unsigned int tcnt, int k, uint32_t l, Verifier& verifier )
+{
+    const auto hld = sp.maxld * 2 - abs( k - sp.len );
+    if( CountBits( heur1 ^ wd.heurdata[k][l] ) > hld ) return;
+    const auto idx2 = wd.byLen[k][l];
+    if( wd.counts[idx2] < tcnt ) return;
+    verifier.Push( k, idx2 );
+}
+
+static void SearchBruteForce( const WordData& wd, const SearchParams& sp, uint32_t j, Verifier& verifier, SearchStats& stats, std::vector<uint32_t>& filtered )
+{
+    const auto i = sp.len;
+    const auto idx = wd.byLen[i][j];
+    const auto heur1 = wd.heurdata[i][j];
+    const auto tcnt = wd.counts[idx] / 10;    // 10%
+
+    for( int k=sp.ldstart; k<=sp.ldend; k++ )
     {
-        printf( "%2i: %zu\n", i, byLen[i].size() );
+        const auto hld = sp.maxld * 2 - abs( k - i );
+        const auto& byLen2 = wd.byLen[k];
+        const auto& heurdata2 = wd.heurdata[k];
+        const auto size2 = byLen2.size();
+        stats.examined += size2;
+        filtered.resize( size2 );
+        const auto num = PopcountFilter( heurdata2.data(), size2, heur1, hld, filtered.data() );
+        for( uint32_t m=0; m<num; m++ )
+        {
+            TestCandidate( wd, sp, heur1, tcnt, k, filtered[m], verifier );
+        }
     }
+}
 
-    const auto cpus = System::CPUCores();
-    printf( "Working... (%i threads)\n", cpus );
+// Symmetric delete index. Two words within edit distance d share at least one
+// variant created by removing at most d characters from each of them.
+class DeleteIndex
+{
+    struct Entry
+    {
+        uint64_t hash;
+        uint32_t len;
+        uint32_t pos;
 
-    TaskDispatch tasks( cpus-1 );
+        bool operator<( const Entry& other ) const
+        {
+            if( hash != other.hash ) return hash < other.hash;
+            if( len != other.len ) return len < other.len;
+            return pos < other.pos;
+        }
+    };
+
+public:
+    static void Deletes( const char32_t* str, int len, int start, int depth, std::vector<uint64_t>& out )
+    {
+        out.emplace_back( XXH64( str, len * sizeof( char32_t ), 0 ) );
+        if( depth == 0 ) return;
+        char32_t tmp[LexiconMaxLen];
+        for( int p=start; p<len; p++ )
+        {
+            memcpy( tmp, str, p * sizeof( char32_t ) );
+            memcpy( tmp+p, str+p+1, ( len-p-1 ) * sizeof( char32_t ) );
+            Deletes( tmp, len-1, p, depth-1, out );
+        }
+    }
+
+    static void UniqueDeletes( const std::u32string& str, int depth, std::vector<uint64_t>& out )
+    {
+        out.clear();
+        Deletes( str.c_str(), str.size(), 0, depth, out );
+        std::sort( out.begin(), out.end() );
+        out.erase( std::unique( out.begin(), out.end() ), out.end() );
+    }
+
+    void Build( const WordData& wd, int depth, int minLen, int maxLen, TaskDispatch& tasks, int cpus )
+    {
+        std::vector<std::vector<Entry>> parts( cpus );
+        for( int t=0; t<cpus; t++ )
+        {
+            tasks.Queue( [&wd, &parts, t, cpus, depth, minLen, maxLen] {
+                auto& part = parts[t];
+                std::vector<uint64_t> dels;
+                for( int k=minLen; k<=maxLen; k++ )
+                {
+                    const auto& byLen2 = wd.byLen[k];
+                    const auto size2 = byLen2.size();
+                    for( uint32_t l=t; l<size2; l+=cpus )
+                    {
+                        UniqueDeletes( wd.stru32[byLen2[l]], depth, dels );
+                        for( auto& h : dels ) part.emplace_back( Entry { h, uint32_t( k ), l } );
+                    }
+                }
+                std::sort( part.begin(), part.end() );
+            } );
+        }
+        tasks.Sync();
+
+        size_t total = 0;
+        for( auto& v : parts ) total += v.size();
+        m_entries.clear();
+        m_entries.reserve( total );
+        for( auto& v : parts )
+        {
+            const auto mid = m_entries.size();
+            m_entries.insert( m_entries.end(), v.begin(), v.end() );
+            std::inplace_merge( m_entries.begin(), m_entries.begin() + mid, m_entries.end() );
+            std::vector<Entry>().swap( v );
+        }
+
+        // Directory of sorted entries, indexed by top bits of hash.
+        int bits = 1;
+        while( ( 1ull << bits ) < total && bits < 28 ) bits++;
+        m_shift = 64 - bits;
+        m_dir.resize( ( 1ull << bits ) + 1 );
+        size_t pos = 0;
+        for( uint64_t b=0; b<( 1ull << bits ); b++ )
+        {
+            m_dir[b] = pos;
+            while( pos < total && ( m_entries[pos].hash >> m_shift ) == b ) pos++;
+        }
+        m_dir.back() = pos;
+    }
+
+    // Returns candidates sorted by length, then by position in length bucket, which
+    // is the order in which brute force search visits them.
+    void Lookup( const std::vector<uint64_t>& dels, uint32_t minLen, uint32_t maxLen, std::vector<uint64_t>& out ) const
+    {
+        out.clear();
+        for( auto& h : dels )
+        {
+            const auto b = h >> m_shift;
+            auto it = m_entries.data() + m_dir[b];
+            const auto end = m_entries.data() + m_dir[b+1];
+            while( it != end && it->hash < h ) it++;
+            while( it != end && it->hash == h )
+            {
+                if( it->len >= minLen && it->len <= maxLen ) out.emplace_back( ( uint64_t( it->len ) << 32 ) | it->pos );
+                it++;
+            }
+        }
+        std::sort( out.begin(), out.end() );
+        out.erase( std::unique( out.begin(), out.end() ), out.end() );
+    }
+
+    size_t Size() const { return m_entries.size(); }
+
+private:
+    std::vector<Entry> m_entries;
+    std::vector<uint32_t> m_dir;
+    int m_shift;
+};
+
+struct SymDeleteState
+{
+    std::vector<uint64_t> dels;
+    std::vector<uint64_t> found;
+};
+
+static void SearchSymDelete( const WordData& wd, const SearchParams& sp, const DeleteIndex& index, uint32_t j, Verifier& verifier, SearchStats& stats, SymDeleteState& state )
+{
+    const auto i = sp.len;
+    const auto idx = wd.byLen[i][j];
+    const auto heur1 = wd.heurdata[i][j];
+    const auto tcnt = wd.counts[idx] / 10;    // 10%
+    const auto& str1 = wd.stru32[idx];
+
+    DeleteIndex::UniqueDeletes( str1, sp.maxld, state.dels );
+    index.Lookup( state.dels, sp.ldstart, sp.ldend, state.found );
+    stats.examined += state.found.size();
+    for( auto& v : state.found )
+    {
+        TestCandidate( wd, sp, heur1, tcnt, int( v >> 32 ), uint32_t( v ), verifier );
+    }
+}
+
+static double Calculate( Engine engine, Kernel kernel, const WordData& wd, std::vector<uint32_t>* data, TaskDispatch& tasks, int cpus, SearchStats& total )
+{
+    const auto t0 = std::chrono::steady_clock::now();
+    DeleteIndex index;
+    int indexDepth = 0;
+    std::mutex statsLock;
 
     for( int i=LexiconMinLen; i<=LexiconMaxLen; i++ )
     {
-        const auto maxld = GetMaxLD( i );
-        const auto ldstart = std::max<int>( i-maxld, LexiconMinLen );
-        const auto ldend = std::min<int>( i+maxld, LexiconMaxLen );
-        const auto& byLen1 = byLen[i];
-        const auto& heurdata1 = heurdata[i];
+        SearchParams sp;
+        sp.len = i;
+        sp.maxld = GetMaxLD( i );
+        sp.ldstart = std::max<int>( i-sp.maxld, LexiconMinLen );
+        sp.ldend = std::min<int>( i+sp.maxld, LexiconMaxLen );
 
+        const auto& byLen1 = wd.byLen[i];
         const auto size = byLen1.size();
+        if( size == 0 ) continue;
+
+        if( engine == Engine::SymDelete && indexDepth != sp.maxld )
+        {
+            // One index is shared by all word lengths with the same max distance.
+            int minLen = LexiconMaxLen;
+            int maxLen = LexiconMinLen;
+            for( int k=LexiconMinLen; k<=LexiconMaxLen; k++ )
+            {
+                if( GetMaxLD( k ) != sp.maxld ) continue;
+                minLen = std::min<int>( minLen, std::max<int>( k-sp.maxld, LexiconMinLen ) );
+                maxLen = std::max<int>( maxLen, std::min<int>( k+sp.maxld, LexiconMaxLen ) );
+            }
+            printf( "Building index (distance %i, lengths %i-%i)\r", sp.maxld, minLen, maxLen );
+            fflush( stdout );
+            index.Build( wd, sp.maxld, minLen, maxLen, tasks, cpus );
+            indexDepth = sp.maxld;
+        }
+
         std::atomic<uint32_t> cnt( 0 );
         for( int t=0; t<cpus; t++ )
         {
-            tasks.Queue( [&stru32, &byLen1, &byLen, size, &cnt, i, counts, ldstart, ldend, maxld, offsets, &data, &heurdata, heurdata1]() {
+            tasks.Queue( [&wd, &sp, &byLen1, &index, &cnt, &total, &statsLock, size, i, data, engine, kernel]() {
                 std::vector<CandidateData> candidates;
+                std::vector<uint32_t> filtered;
+                SymDeleteState state;
+                SearchStats stats;
+                Verifier verifier( kernel, wd, candidates, stats );
                 for(;;)
                 {
                     auto j = cnt.fetch_add( 1, std::memory_order_relaxed );
@@ -218,76 +673,22 @@ int main( int argc, char** argv )
                     }
 
                     const auto idx = byLen1[j];
-                    const auto heur1 = heurdata1[j];
-                    const auto cnt = counts[idx];
-                    const auto tcnt = cnt / 10;    // 10%
-                    const auto& str1 = stru32[idx];
-
-                    unsigned int maxCount = 0;
                     candidates.clear();
-                    for( int k=ldstart; k<=ldend; k++ )
+                    verifier.Start( sp, wd.stru32[idx] );
+                    switch( engine )
                     {
-                        const auto hld = maxld * 2 - abs( k - i );
-                        const auto& byLen2 = byLen[k];
-                        const auto& heurdata2 = heurdata[k];
-                        const auto size2 = byLen2.size();
-                        int l=0;
-#ifdef __AVX512F__
-                        auto vheur1 = _mm512_set1_epi64( heur1 );
-                        auto vhld = _mm512_set1_epi64( hld );
-                        for( int v=0; v<size2/8; v++, l+=8 )
-                        {
-                            auto vheur2 = _mm512_loadu_si512( heurdata2.data() + l );
-                            auto vxor = _mm512_xor_si512( vheur1, vheur2 );
-                            auto vcnt = _mm512_popcnt_epi64( vxor );
-                            auto vcmp = _mm512_cmple_epu64_mask( vcnt, vhld );
-                            if( vcmp != 0 )
-                            {
-                                int m = 0;
-                                do
-                                {
-                                    if( ( vcmp & 1 ) != 0 )
-                                    {
-                                        const auto idx2 = byLen2[l+m];
-                                        const auto cnt2 = counts[idx2];
-                                        if( cnt2 >= tcnt )
-                                        {
-                                            const auto& str2 = stru32[idx2];
-                                            const auto ld = levenshtein_distance( str1.c_str(), i, str2.c_str(), k, maxld+1 );
-                                            if( ld > 0 && ld <= maxld )
-                                            {
-                                                candidates.emplace_back( CandidateData { uint32_t( ld ), cnt2, offsets[idx2] } );
-                                                if( cnt2 > maxCount ) maxCount = cnt2;
-                                            }
-                                        }
-                                    }
-                                    vcmp >>= 1;
-                                    m++;
-                                }
-                                while( vcmp != 0 );
-                            }
-                        }
-#endif
-                        for( ; l<size2; l++ )
-                        {
-                            const auto heur2 = heurdata2[l];
-                            if( CountBits( heur1 ^ heur2 ) <= hld )
-                            {
-                                const auto idx2 = byLen2[l];
-                                const auto cnt2 = counts[idx2];
-                                if( cnt2 >= tcnt )
-                                {
-                                    const auto& str2 = stru32[idx2];
-                                    const auto ld = levenshtein_distance( str1.c_str(), i, str2.c_str(), k, maxld+1 );
-                                    if( ld > 0 && ld <= maxld )
-                                    {
-                                        candidates.emplace_back( CandidateData { uint32_t( ld ), cnt2, offsets[idx2] } );
-                                        if( cnt2 > maxCount ) maxCount = cnt2;
-                                    }
-                                }
-                            }
-                        }
+                    case Engine::BruteForce:
+                        SearchBruteForce( wd, sp, j, verifier, stats, filtered );
+                        break;
+                    case Engine::SymDelete:
+                        SearchSymDelete( wd, sp, index, j, verifier, stats, state );
+                        break;
+                    default:
+                        assert( false );
+                        break;
                     }
+                    const auto maxCount = verifier.Finish();
+
                     const auto tmc = maxCount / 5;  // 20%
                     for( auto& v : candidates )
                     {
@@ -298,12 +699,286 @@ int main( int argc, char** argv )
                         }
                     }
                 }
+                std::lock_guard<std::mutex> lock( statsLock );
+                total.examined += stats.examined;
+                total.verified += stats.verified;
             } );
         }
         tasks.Sync();
-        printf( "%2i: %zu/%zu\n", i, size, size );
+        if( engine == Engine::SymDelete )
+        {
+            printf( "%2i: %zu/%zu (index size: %zu)\n", i, size, size, index.Size() );
+        }
+        else
+        {
+            printf( "%2i: %zu/%zu\n", i, size, size );
+        }
+    }
+
+    return std::chrono::duration_cast<std::chrono::microseconds>( std::chrono::steady_clock::now() - t0 ).count() / 1000000.0;
+}
+
+static const char* KernelName( Kernel kernel )
+{
+    switch( kernel )
+    {
+    case Kernel::DP:
+        return "dp";
+    case Kernel::Myers:
+        return "myers";
+    case Kernel::MyersBatch:
+        return "batch";
+    default:
+        assert( false );
+        return "";
+    }
+}
+
+// Compares results of all kernels with the reference dynamic programming implementation.
+static bool TestKernels( const WordData& wd )
+{
+    uint64_t tested = 0;
+    uint64_t failed = 0;
+    MyersPattern pattern;
+    const char32_t* texts[MyersBatchSize];
+    int batch[MyersBatchSize];
+    for( int i=LexiconMinLen; i<=LexiconMaxLen; i++ )
+    {
+        const auto maxld = GetMaxLD( i );
+        const auto& byLen1 = wd.byLen[i];
+        for( size_t j=0; j<byLen1.size(); j+=7 )
+        {
+            const auto& str1 = wd.stru32[byLen1[j]];
+            MyersPrepare( pattern, str1.c_str(), i );
+            for( int k=std::max<int>( i-maxld, LexiconMinLen ); k<=std::min<int>( i+maxld, LexiconMaxLen ); k++ )
+            {
+                const auto& byLen2 = wd.byLen[k];
+                const auto size2 = std::min<size_t>( byLen2.size(), 64 );
+                for( size_t l=0; l<size2; l+=MyersBatchSize )
+                {
+                    const int num = std::min<int>( MyersBatchSize, size2 - l );
+                    for( int m=0; m<num; m++ ) texts[m] = wd.stru32[byLen2[l+m]].c_str();
+                    for( int threshold=1; threshold<=maxld+1; threshold++ )
+                    {
+                        MyersDistanceBatch( pattern, texts, num, k, threshold, batch );
+                        for( int m=0; m<num; m++ )
+                        {
+                            const auto ref = std::min( threshold, levenshtein_distance( str1.c_str(), i, texts[m], k, threshold ) );
+                            const auto myers = MyersDistance( pattern, texts[m], k, threshold );
+                            tested++;
+                            if( ref != myers || ref != batch[m] )
+                            {
+                                if( failed < 10 )
+                                {
+                                    printf( "Mismatch: word %i vs %i, threshold %i: dp %i, myers %i, batch %i\n", byLen1[j], byLen2[l+m], threshold, ref, myers, batch[m] );
+                                }
+                                failed++;
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+    printf( "Kernel test: %" PRIu64 " distances calculated, %" PRIu64 " mismatches.\n", tested, failed );
+    return failed == 0;
+}
+
+static const char* EngineName( Engine engine )
+{
+    switch( engine )
+    {
+    case Engine::BruteForce:
+        return "brute";
+    case Engine::SymDelete:
+        return "symdel";
+    default:
+        assert( false );
+        return "";
+    }
+}
+
+static void Usage( const char* name )
+{
+    fprintf( stderr, "USAGE: %s [params] directory\nParams:\n", name );
+    fprintf( stderr, " -e engine       - candidate search engine: brute, symdel (default: brute)\n" );
+    fprintf( stderr, " -k kernel       - edit distance kernel: dp, myers, batch (default: batch)\n" );
+    fprintf( stderr, " -b              - benchmark all engines and compare results, don't write output\n" );
+    fprintf( stderr, " -t              - test edit distance kernels against reference implementation\n" );
+    exit( 1 );
+}
+
+int main( int argc, char** argv )
+{
+    Engine engine = Engine::BruteForce;
+    Kernel kernel = Kernel::MyersBatch;
+    bool benchmark = false;
+    bool test = false;
+
+    const auto name = argv[0];
+    if( argc < 2 ) Usage( name );
+
+    for(;;)
+    {
+        if( argc < 2 ) Usage( name );
+        if( strcmp( argv[1], "-e" ) == 0 )
+        {
+            if( argc < 3 ) Usage( name );
+            if( strcmp( argv[2], "brute" ) == 0 )
+            {
+                engine = Engine::BruteForce;
+            }
+            else if( strcmp( argv[2], "symdel" ) == 0 )
+            {
+                engine = Engine::SymDelete;
+            }
+            else
+            {
+                fprintf( stderr, "Unknown engine: %s\n", argv[2] );
+                exit( 1 );
+            }
+            argv += 2;
+            argc -= 2;
+        }
+        else if( strcmp( argv[1], "-k" ) == 0 )
+        {
+            if( argc < 3 ) Usage( name );
+            if( strcmp( argv[2], "dp" ) == 0 )
+            {
+                kernel = Kernel::DP;
+            }
+            else if( strcmp( argv[2], "myers" ) == 0 )
+            {
+                kernel = Kernel::Myers;
+            }
+            else if( strcmp( argv[2], "batch" ) == 0 )
+            {
+                kernel = Kernel::MyersBatch;
+            }
+            else
+            {
+                fprintf( stderr, "Unknown kernel: %s\n", argv[2] );
+                exit( 1 );
+            }
+            argv += 2;
+            argc -= 2;
+        }
+        else if( strcmp( argv[1], "-b" ) == 0 )
+        {
+            benchmark = true;
+            argv++;
+            argc--;
+        }
+        else if( strcmp( argv[1], "-t" ) == 0 )
+        {
+            test = true;
+            argv++;
+            argc--;
+        }
+        else
+        {
+            break;
+        }
     }
 
+    std::string base = argv[1];
+    base.append( "/" );
+    const LexiconMetaView meta( base + "lexmeta", ReadWideOffsets( base ) & WideLexicon );
+    FileMap<char> str( base + "lexstr" );
+
+    const auto size = meta.Size();
+    WordData wd;
+    wd.stru32 = new std::u32string[size];
+    wd.counts = new unsigned int[size];
+    wd.offsets = new uint32_t[size];
+
+#ifdef _MSC_VER
+    std::wstring_convert<std::codecvt_utf8<unsigned int>, unsigned int> conv;
+#else
+    std::wstring_convert<std::codecvt_utf8<char32_t>, char32_t> conv;
+#endif
+    for( uint32_t i=0; i<size; i++ )
+    {
+        if( ( i & 0x3FF ) == 0 )
+        {
+            printf( "%i/%zu\r", i, size );
+            fflush( stdout );
+        }
+
+        const auto mp = meta[i];
+        wd.offsets[i] = mp.str;
+        auto s = str + mp.str;
+        auto len = utflen( s );
+        assert( len <= LexiconMaxLen );
+
+#ifdef _MSC_VER
+        wd.stru32[i] = std::u32string( (const char32_t*)conv.from_bytes( s ).data() );
+#else
+        wd.stru32[i] = conv.from_bytes( s );
+#endif
+        wd.byLen[len].emplace_back( i );
+        wd.heurdata[len].emplace_back( BuildHeuristicData( s ) );
+
+        wd.counts[i] = mp.dataSize;
+    }
+
+    printf( "\nWord length histogram\n" );
+    for( int i=LexiconMinLen; i<=LexiconMaxLen; i++ )
+    {
+        printf( "%2i: %zu\n", i, wd.byLen[i].size() );
+    }
+
+    if( test )
+    {
+        return TestKernels( wd ) ? 0 : 1;
+    }
+
+    const auto cpus = System::CPUCores();
+    TaskDispatch tasks( cpus-1 );
+
+    if( benchmark )
+    {
+        const Engine engines[] = { Engine::BruteForce, Engine::SymDelete };
+        std::vector<uint32_t>* ref = nullptr;
+        for( auto e : engines )
+        {
+            printf( "Engine %s, kernel %s, %s (%i threads)\n", EngineName( e ), KernelName( kernel ), CpuDispatch::Name(), cpus );
+            auto data = new std::vector<uint32_t>[size];
+            SearchStats stats;
+            const auto time = Calculate( e, kernel, wd, data, tasks, cpus, stats );
+            printf( "Time: %.3f s, %.0f words/s, %" PRIu64 " candidates examined (%.0f/s), %" PRIu64 " distances calculated\n", time, size / time, stats.examined, stats.examined / time, stats.verified );
+            if( !ref )
+            {
+                ref = data;
+            }
+            else
+            {
+                uint32_t diff = 0;
+                for( uint32_t i=0; i<size; i++ )
+                {
+                    if( ref[i] != data[i] ) diff++;
+                }
+                if( diff == 0 )
+                {
+                    printf( "Results identical to %s engine.\n", EngineName( engines[0] ) );
+                }
+                else
+                {
+                    printf( "Results differ from %s engine for %i words!\n", EngineName( engines[0] ), diff );
+                }
+                delete[] data;
+            }
+        }
+        delete[] ref;
+        return 0;
+    }
+
+    printf( "Working... (%s engine, %s kernel, %s, %i threads)\n", EngineName( engine ), KernelName( kernel ), CpuDispatch::Name(), cpus );
+
+    auto data = new std::vector<uint32_t>[size];
+    SearchStats stats;
+    Calculate( engine, kernel, wd, data, tasks, cpus, stats );
+
     FILE* fdata = fopen( ( base + "lexdist" ).c_str(), "wb" );
     FILE* fmeta = fopen( ( base + "lexdistmeta" ).c_str(), "wb" );
 
@@ -1,20 +1,33 @@
 #include <assert.h>
 #include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <ctype.h>
+#include <errno.h>
+#include <inttypes.h>
 #include <limits>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string>
 #include <string.h>
 #include <vector>
 
 #include "../contrib/xxhash/xxhash.h"
+#include "../common/FileMap.hpp"
+#include "../common/Filesystem.hpp"
+#include "../common/HashSearch.hpp"
 #include "../common/ICU.hpp"
+#include "../common/LexiconMetaView.hpp"
+#include "../common/LexiconSingle.hpp"
 #include "../common/LexiconTypes.hpp"
 #include "../common/MetaView.hpp"
 #include "../common/MessageLogic.hpp"
 #include "../common/MessageView.hpp"
 #include "../common/MsgIdHash.hpp"
+#include "../common/System.hpp"
+#include "../common/TaskDispatch.hpp"
+#include "../common/WideOffsets.hpp"
 
 #include "../contrib/martinus/robin_hood.h"
 
@@ -62,9 +75,10 @@ HeaderType IsHeaderAllowed( const char* hdr, const char* end )
     return HeaderType::Invalid;
 }
 
-using HitData = robin_hood::unordered_flat_map<std::string, robin_hood::unordered_flat_map<uint32_t, std::vector<uint8_t>>>;
+using Postings = robin_hood::unordered_flat_map<uint32_t, std::vector<uint8_t>>;
+using HitData = robin_hood::unordered_flat_map<std::string, Postings>;
 
-static void Add( HitData& data, std::vector<std::string>& words, uint32_t idx, int type, int basePos, int childCount )
+static void Add( HitData& data, const std::vector<std::string_view>& words, uint32_t idx, int type, int basePos, int childCount )
 {
     assert( ( idx & LexiconPostMask ) == idx );
     assert( childCount <= LexiconChildMax );
@@ -72,13 +86,15 @@ static void Add( HitData& data, std::vector<std::string>& words, uint32_t idx, i
 
     uint8_t enc = LexiconHitTypeEncoding[type];
     uint8_t max = LexiconHitPosMask[type];
+    std::string key;
     for( auto& w : words )
     {
-        auto it = data.find( w );
+        key.assign( w.data(), w.size() );
+        auto it = data.find( key );
         if( it == data.end() )
         {
             uint8_t hit = enc | std::min<uint8_t>( max, basePos++ );
-            data.emplace( std::move( w ), robin_hood::unordered_flat_map<uint32_t, std::vector<uint8_t>>( { { idx, std::vector<uint8_t> { hit } } } ) );
+            data.emplace( key, Postings( { { idx, std::vector<uint8_t> { hit } } } ) );
         }
         else
         {
@@ -103,155 +119,159 @@ static void Add( HitData& data, std::vector<std::string>& words, uint32_t idx, i
     }
 }
 
-int main( int argc, char** argv )
+static void IndexMessage( HitData& data, Tokenizer& tokenizer, const char* post, uint32_t i, int children )
 {
-    if( argc != 2 )
-    {
-        fprintf( stderr, "USAGE: %s raw\n", argv[0] );
-        exit( 1 );
-    }
-
-    std::string base = argv[1];
-    base.append( "/" );
-
-    MessageView mview( base + "meta", base + "data" );
-    MetaView<uint32_t, uint32_t> conn( base + "connmeta", base + "conndata" );
-    const auto size = mview.Size();
-    std::vector<std::string> wordbuf;
-
-    // Purposefully disable destruction to not waste time at application exit
-    HitData* dataPtr = new HitData();
-    HitData& data = *dataPtr;
-
-    for( uint32_t i=0; i<size; i++ )
+    bool headers = true;
+    bool signature = false;
+    int wrote;
+    int basePos[NUM_LEXICON_TYPES] = {};
+    for(;;)
     {
-        if( ( i & 0x3FF ) == 0 )
-        {
-            printf( "%i/%zu\r", i, size );
-            fflush( stdout );
-        }
-
-        bool headers = true;
-        bool signature = false;
-        int wrote;
-        int basePos[NUM_LEXICON_TYPES] = {};
-
-        int children = LexiconTransformChildNum( conn[i][2] - 1 );
-
-        auto post = mview[i];
-        for(;;)
+        auto end = post;
+        if( headers )
         {
-            auto end = post;
-            if( headers )
+            if( *end == '\n' )
             {
-                if( *end == '\n' )
-                {
-                    headers = false;
-                    while( *end == '\n' ) end++;
-                    post = end;
-                    wrote = DetectWrote( post );
-                    continue;
-                }
-                while( *end != ':' ) end++;
-                end += 2;
-                auto headerType = IsHeaderAllowed( post, end-2 );
-                if( headerType != HeaderType::Invalid )
-                {
-                    int type;
-                    switch( headerType )
-                    {
-                    case HeaderType::From:
-                        type = T_From;
-                        break;
-                    case HeaderType::Subject:
-                        type = T_Subject;
-                        break;
-                    default:
-                        assert( false );
-                        type = 0;
-                        break;
-                    }
-                    const char* line = end;
-                    while( *end != '\n' ) end++;
-                    SplitLine( line, end, wordbuf );
-                    Add( data, wordbuf, i, type, 0, children );
-                }
-                else
+                headers = false;
+                while( *end == '\n' ) end++;
+                post = end;
+                wrote = DetectWrote( post );
+                continue;
+            }
+            while( *end != ':' ) end++;
+            end += 2;
+            auto headerType = IsHeaderAllowed( post, end-2 );
+            if( headerType != HeaderType::Invalid )
+            {
+                int type;
+                switch( headerType )
                 {
-                    while( *end != '\n' ) end++;
+                case HeaderType::From:
+                    type = T_From;
+                    break;
+                case HeaderType::Subject:
+                    type = T_Subject;
+                    break;
+                default:
+                    assert( false );
+                    type = 0;
+                    break;
                 }
-                post = end + 1;
+                const char* line = end;
+                while( *end != '\n' ) end++;
+                Add( data, tokenizer.Split( line, end ), i, type, 0, children );
             }
             else
             {
-                const char* line = end;
-                int quotLevel = 0;
-                while( *end != '\n' && *end != '\0' ) end++;
-                if( end - line == 3 && strncmp( line, "-- ", 3 ) == 0 )
+                while( *end != '\n' ) end++;
+            }
+            post = end + 1;
+        }
+        else
+        {
+            const char* line = end;
+            int quotLevel = 0;
+            while( *end != '\n' && *end != '\0' ) end++;
+            if( end - line == 3 && strncmp( line, "-- ", 3 ) == 0 )
+            {
+                signature = true;
+            }
+            else
+            {
+                quotLevel = QuotationLevel( line, end );
+                assert( wrote <= 0 || quotLevel == 0 );
+            }
+            if( line != end )
+            {
+                auto& words = tokenizer.Split( line, end );
+                LexiconType t;
+                if( signature )
                 {
-                    signature = true;
+                    t = T_Signature;
                 }
-                else
+                else if( wrote > 0 )
                 {
-                    quotLevel = QuotationLevel( line, end );
-                    assert( wrote <= 0 || quotLevel == 0 );
+                    t = T_Wrote;
+                    wrote--;
                 }
-                if( line != end )
+                else
                 {
-                    SplitLine( line, end, wordbuf );
-                    LexiconType t;
-                    if( signature )
-                    {
-                        t = T_Signature;
-                    }
-                    else if( wrote > 0 )
-                    {
-                        t = T_Wrote;
-                        wrote--;
-                    }
-                    else
-                    {
-                        t = LexiconTypeFromQuotLevel( quotLevel );
-                    }
-                    Add( data, wordbuf, i, t, basePos[t], children );
-                    basePos[t] += wordbuf.size();
+                    t = LexiconTypeFromQuotLevel( quotLevel );
                 }
-                if( *end == '\0' ) break;
-                post = end + 1;
+                Add( data, words, i, t, basePos[t], children );
+                basePos[t] += words.size();
             }
+            if( *end == '\0' ) break;
+            post = end + 1;
         }
     }
+}
 
-    auto it = data.begin();
-    while( it != data.end() )
+struct BenchmarkResult
+{
+    double time;
+    uint64_t bytes;
+    uint64_t words;
+    Tokenizer::Stats stats;
+};
+
+static BenchmarkResult Benchmark( const MessageView& mview, int threads )
+{
+    const auto size = mview.Size();
+    std::atomic<uint32_t> cnt( 0 );
+    std::atomic<uint64_t> bytes( 0 ), words( 0 ), ascii( 0 ), latin( 0 ), icu( 0 );
+
+    const auto t0 = std::chrono::steady_clock::now();
+    TaskDispatch tasks( threads-1 );
+    for( int t=0; t<threads; t++ )
     {
-        if( it->second.size() == 1 )
-        {
-            it = data.erase( it );
-        }
-        else
-        {
-            ++it;
-        }
+        tasks.Queue( [&] {
+            ExpandingBuffer eb;
+            Tokenizer tokenizer;
+            uint64_t lbytes = 0, lwords = 0;
+            for(;;)
+            {
+                const auto i = cnt.fetch_add( 1, std::memory_order_relaxed );
+                if( i >= size ) break;
+                auto post = mview.GetMessage( i, eb );
+                for(;;)
+                {
+                    auto end = post;
+                    while( *end != '\n' && *end != '\0' ) end++;
+                    lbytes += end - post + 1;
+                    lwords += tokenizer.Split( post, end ).size();
+                    if( *end == '\0' ) break;
+                    post = end + 1;
+                }
+            }
+            bytes.fetch_add( lbytes, std::memory_order_relaxed );
+            words.fetch_add( lwords, std::memory_order_relaxed );
+            auto& stats = tokenizer.GetStats();
+            ascii.fetch_add( stats.ascii, std::memory_order_relaxed );
+            latin.fetch_add( stats.latin, std::memory_order_relaxed );
+            icu.fetch_add( stats.icu, std::memory_order_relaxed );
+        } );
     }
+    tasks.Sync();
+    const auto time = std::chrono::duration_cast<std::chrono::microseconds>( std::chrono::steady_clock::now() - t0 ).count() / 1000000.0;
 
-    printf( "\nSaving...\n" );
-    fflush( stdout );
+    return BenchmarkResult { time, bytes.load(), words.load(), Tokenizer::Stats { ascii.load(), latin.load(), icu.load() } };
+}
 
-    auto wordNum = data.size();
-    auto hashbits = MsgIdHashBits( wordNum, 90 );
-    auto hashsize = MsgIdHashSize( hashbits );
-    auto hashmask = MsgIdHashMask( hashbits );
+static void PrintBenchmark( const char* name, const BenchmarkResult& res )
+{
+    printf( "%s: %.3f s, %.1f MB/s, %.0f words/s\n", name, res.time, res.bytes / res.time / ( 1024 * 1024 ), res.words / res.time );
+}
 
-    auto hashdata = new uint32_t[hashsize];
-    auto distance = new uint8_t[hashsize];
+// Places words in Robin Hood hash table. Word indices are stored in hashdata,
+// empty slots have distance 0xFF. Returns maximum distance.
+static uint8_t PlaceWords( const std::vector<const char*>& strings, uint32_t* hashdata, uint8_t* distance, int hashsize, uint32_t hashmask )
+{
     memset( distance, 0xFF, hashsize );
     uint8_t distmax = 0;
 
-    int cnt = 0;
-    std::vector<const char*> strings;
-    strings.reserve( wordNum );
-    for( auto& v : data )
+    const auto wordNum = strings.size();
+    for( uint32_t cnt=0; cnt<wordNum; cnt++ )
     {
         if( ( cnt & 0xFFF ) == 0 )
         {
@@ -259,10 +279,8 @@ int main( int argc, char** argv )
             fflush( stdout );
         }
 
-        const auto& s = v.first;
-        strings.emplace_back( s.c_str() );
-
-        uint32_t hash = XXH32( s.c_str(), s.size(), 0 ) & hashmask;
+        const auto s = strings[cnt];
+        uint32_t hash = XXH32( s, strlen( s ), 0 ) & hashmask;
         uint8_t dist = 0;
         uint32_t idx = cnt;
         for(;;)
@@ -284,11 +302,541 @@ int main( int argc, char** argv )
             assert( dist < std::numeric_limits<uint8_t>::max() );
             hash = (hash+1) & hashmask;
         }
-
-        cnt++;
     }
 
     printf( "\n" );
+    return distmax;
+}
+
+static bool NeedsWideLexicon( const HitData& data, uint64_t datasize, uint64_t hitsize )
+{
+    for( auto& v : data )
+    {
+        datasize += sizeof( LexiconDataPacket ) * v.second.size();
+        for( auto& d : v.second )
+        {
+            const auto num = std::min<size_t>( std::numeric_limits<uint8_t>::max(), d.second.size() );
+            if( num >= 4 ) hitsize += 1 + num;
+        }
+    }
+    return NeedsWideOffsets( datasize ) || NeedsWideOffsets( hitsize, LexiconHitOffsetMask );
+}
+
+static void WritePosting( uint32_t postid, const uint8_t* hits, uint8_t num, uint64_t& ohit, uint64_t hitbase, const char* word, FILE* fdata, FILE* fhit )
+{
+    fwrite( &postid, 1, sizeof( uint32_t ), fdata );
+
+    if( num < 4 )
+    {
+        uint32_t numshift = num << LexiconHitShift;
+        uint32_t v = 0;
+        for( int i=0; i<num; i++ )
+        {
+            v <<= 8;
+            v |= hits[i];
+        }
+        v |= numshift;
+        fwrite( &v, 1, sizeof( uint32_t ), fdata );
+    }
+    else
+    {
+        if( ohit - hitbase > LexiconHitOffsetMask )
+        {
+            fprintf( stderr, "Hit data of word %s is too big.\n", word );
+            exit( 1 );
+        }
+        const uint32_t offset = ohit - hitbase;
+        fwrite( &offset, 1, sizeof( uint32_t ), fdata );
+        ohit += fwrite( &num, 1, sizeof( uint8_t ), fhit );
+        ohit += fwrite( hits, 1, sizeof( uint8_t ) * num, fhit );
+    }
+}
+
+static void WriteMeta( uint32_t str, uint32_t dsize, uint64_t odata, uint64_t ohit, bool wide, FILE* fmeta )
+{
+    if( wide )
+    {
+        // Hit offsets in data packets are relative to the first hit of the word.
+        const LexiconMetaPacketWide meta = { str, dsize, odata, ohit };
+        fwrite( &meta, 1, sizeof( meta ), fmeta );
+    }
+    else
+    {
+        const LexiconMetaPacket meta = { str, uint32_t( odata ), dsize };
+        fwrite( &meta, 1, sizeof( meta ), fmeta );
+    }
+}
+
+static FILE* OpenWrite( const std::string& fn )
+{
+    FILE* f = fopen( fn.c_str(), "wb" );
+    if( !f )
+    {
+        fprintf( stderr, "Cannot open %s for writing.\n", fn.c_str() );
+        exit( 1 );
+    }
+    return f;
+}
+
+static void CloseWrite( FILE* f, const std::string& fn )
+{
+    const bool failed = ferror( f ) != 0;
+    if( fclose( f ) != 0 || failed )
+    {
+        fprintf( stderr, "Cannot write %s.\n", fn.c_str() );
+        exit( 1 );
+    }
+}
+
+// Delta postings in the order established by lexsort: by post id, hits by rank.
+static std::vector<std::pair<uint32_t, std::vector<uint8_t>>> SortPostings( const Postings& postings )
+{
+    std::vector<std::pair<uint32_t, std::vector<uint8_t>>> ret;
+    ret.reserve( postings.size() );
+    for( auto& v : postings ) ret.emplace_back( v.first, v.second );
+    std::sort( ret.begin(), ret.end(), [] ( const auto& l, const auto& r ) { return ( l.first & LexiconPostMask ) < ( r.first & LexiconPostMask ); } );
+    for( auto& v : ret )
+    {
+        std::sort( v.second.begin(), v.second.end(), [] ( const auto& l, const auto& r ) { return LexiconHitRank( l ) > LexiconHitRank( r ); } );
+        // Hits inlined in data packet are read starting from the lowest byte.
+        if( v.second.size() < 4 ) std::reverse( v.second.begin(), v.second.end() );
+    }
+    return ret;
+}
+
+// Postings of each word are sorted by post id. Returns -1 for empty lexicon.
+static int64_t LastIndexedPost( const std::string& base )
+{
+    const LexiconMetaView meta( base + "lexmeta", ReadWideOffsets( base ) & WideLexicon );
+    const FileMap<LexiconDataPacket> ldata( base + "lexdata" );
+
+    int64_t last = -1;
+    for( size_t i=0; i<meta.Size(); i++ )
+    {
+        const auto mp = meta[i];
+        if( mp.dataSize == 0 ) continue;
+        const auto post = ldata[mp.data / sizeof( LexiconDataPacket ) + mp.dataSize - 1].postid & LexiconPostMask;
+        last = std::max<int64_t>( last, post );
+    }
+
+    const FileMap<char> lsingle( base + "lexsingle", true );
+    if( lsingle.Size() != 0 )
+    {
+        auto ptr = (const char*)lsingle;
+        const auto end = ptr + lsingle.Size();
+        while( ptr < end )
+        {
+            LexiconSingle rec;
+            ptr = ReadLexiconSingle( ptr, rec );
+            last = std::max<int64_t>( last, rec.postid );
+        }
+    }
+    return last;
+}
+
+static const char* MergedFiles[] = { "lexmeta", "lexdata", "lexhit", "lexhash", "lexhashdata", "lexstr", "lexsingle", "lexdistmeta" };
+
+// Merged files are written as .new. The commit marker, which holds the wide offsets flag
+// of the merged lexicon, is written only when all of them are complete. If it is present,
+// an interrupted merge is completed.
+static void CommitMerge( const std::string& base )
+{
+    const auto marker = base + "lexmerge.commit";
+    uint8_t wide = 0;
+    FILE* f = fopen( marker.c_str(), "rb" );
+    if( f )
+    {
+        fread( &wide, 1, 1, f );
+        fclose( f );
+    }
+    for( auto& v : MergedFiles )
+    {
+        const auto fn = base + v;
+        if( Exists( fn + ".new" ) && !MoveReplace( fn + ".new", fn ) )
+        {
+            fprintf( stderr, "Cannot replace %s\n", fn.c_str() );
+            exit( 1 );
+        }
+    }
+    WriteWideOffsets( base, WideLexicon, wide != 0 );
+    remove( marker.c_str() );
+}
+
+// Folds postings of messages appended to the archive into the existing lexicon.
+// Old words keep their indices and strings, so that lexdist stays valid. New
+// words are added at the end, unless they were seen in only one post, counting
+// the post recorded in lexsingle. Child counts of old posts are refreshed, as
+// new messages may be replies to them.
+static void Merge( const std::string& base, HitData& data, const WideMetaView<uint32_t>& conn )
+{
+    const LexiconMetaView meta( base + "lexmeta", ReadWideOffsets( base ) & WideLexicon );
+    const FileMap<LexiconDataPacket> ldata( base + "lexdata" );
+    const FileMap<uint8_t> lhit( base + "lexhit" );
+    const FileMap<char> lstr( base + "lexstr" );
+    const FileMap<char> lsingle( base + "lexsingle", true );
+    const auto oldNum = meta.Size();
+
+    // Leftovers of an interrupted merge, which didn't reach the commit marker.
+    for( auto& v : MergedFiles ) remove( ( base + v + ".new" ).c_str() );
+
+    if( !Exists( base + "lexsingle" ) )
+    {
+        printf( "Lexicon has no list of words used in a single post. Such words used again won't be indexed.\n" );
+    }
+
+    std::vector<const Postings*> delta( oldNum, nullptr );
+    std::vector<HitData::const_iterator> added;
+    std::vector<LexiconSingle> single;
+    size_t promoted = 0;
+    {
+        robin_hood::unordered_flat_map<std::string_view, LexiconSingle> old;
+        if( lsingle.Size() != 0 )
+        {
+            auto ptr = (const char*)lsingle;
+            const auto end = ptr + lsingle.Size();
+            while( ptr < end )
+            {
+                LexiconSingle rec;
+                ptr = ReadLexiconSingle( ptr, rec );
+                old.emplace( rec.word, rec );
+            }
+        }
+
+        const HashSearch<char> lhash( base + "lexstr", base + "lexhash", base + "lexhashdata" );
+        for( auto it = data.begin(); it != data.end(); ++it )
+        {
+            const auto idx = lhash.Search( it->first.c_str() );
+            if( idx >= 0 )
+            {
+                delta[idx] = &it->second;
+                continue;
+            }
+            auto sit = old.find( it->first );
+            if( sit != old.end() )
+            {
+                const auto& rec = sit->second;
+                const auto postid = rec.postid | ( LexiconTransformChildNum( conn[rec.postid][2] - 1 ) << LexiconChildShift );
+                it->second.emplace( postid, std::vector<uint8_t>( rec.hits, rec.hits + rec.hitnum ) );
+                old.erase( sit );
+                promoted++;
+            }
+            if( it->second.size() > 1 )
+            {
+                added.emplace_back( it );
+            }
+            else
+            {
+                const auto& post = *it->second.begin();
+                single.emplace_back( LexiconSingle { post.first & LexiconPostMask, uint8_t( post.second.size() ), post.second.data(), it->first.c_str() } );
+            }
+        }
+        for( auto& v : old ) single.emplace_back( v.second );
+    }
+
+    const bool wide = NeedsWideLexicon( data, ldata.Size(), lhit.Size() );
+
+    printf( "Merging %zu words, %zu new (%zu used before in a single post)...\n", data.size(), added.size(), promoted );
+    fflush( stdout );
+
+    FILE* fmeta = OpenWrite( base + "lexmeta.new" );
+    FILE* fdata = OpenWrite( base + "lexdata.new" );
+    FILE* fhit = OpenWrite( base + "lexhit.new" );
+
+    uint64_t odata = 0;
+    uint64_t ohit = 0;
+
+    const auto wordNum = oldNum + added.size();
+    std::vector<const char*> strings;
+    std::vector<uint32_t> offsetData;
+    strings.reserve( wordNum );
+    offsetData.reserve( wordNum );
+
+    for( uint32_t i=0; i<oldNum; i++ )
+    {
+        if( ( i & 0x3FF ) == 0 )
+        {
+            printf( "%i/%zu\r", i, wordNum );
+            fflush( stdout );
+        }
+
+        const auto mp = meta[i];
+        const auto str = lstr + mp.str;
+        strings.emplace_back( str );
+        offsetData.emplace_back( mp.str );
+
+        const uint32_t dsize = mp.dataSize + ( delta[i] ? delta[i]->size() : 0 );
+        WriteMeta( mp.str, dsize, odata, ohit, wide, fmeta );
+        const auto hitbase = wide ? ohit : 0;
+
+        auto dptr = ldata + ( mp.data / sizeof( LexiconDataPacket ) );
+        for( uint32_t j=0; j<mp.dataSize; j++ )
+        {
+            const auto post = dptr[j].postid & LexiconPostMask;
+            const auto postid = post | ( LexiconTransformChildNum( conn[post][2] - 1 ) << LexiconChildShift );
+            const uint8_t hnum = dptr[j].hitoffset >> LexiconHitShift;
+            if( hnum == 0 )
+            {
+                auto hptr = lhit + mp.hit + ( dptr[j].hitoffset & LexiconHitOffsetMask );
+                WritePosting( postid, hptr+1, *hptr, ohit, hitbase, str, fdata, fhit );
+            }
+            else
+            {
+                fwrite( &postid, 1, sizeof( uint32_t ), fdata );
+                fwrite( &dptr[j].hitoffset, 1, sizeof( uint32_t ), fdata );
+            }
+        }
+        if( delta[i] )
+        {
+            for( auto& d : SortPostings( *delta[i] ) )
+            {
+                const uint8_t num = std::min<size_t>( std::numeric_limits<uint8_t>::max(), d.second.size() );
+                WritePosting( d.first, d.second.data(), num, ohit, hitbase, str, fdata, fhit );
+            }
+        }
+        odata += sizeof( LexiconDataPacket ) * dsize;
+    }
+
+    FILE* fstr = OpenWrite( base + "lexstr.new" );
+    fwrite( lstr, 1, lstr.Size(), fstr );
+    uint32_t stroffset = lstr.Size();
+    for( auto& it : added )
+    {
+        const auto str = it->first.c_str();
+        strings.emplace_back( str );
+        offsetData.emplace_back( stroffset );
+        stroffset += fwrite( str, 1, it->first.size() + 1, fstr );
+
+        const uint32_t dsize = it->second.size();
+        WriteMeta( offsetData.back(), dsize, odata, ohit, wide, fmeta );
+        const auto hitbase = wide ? ohit : 0;
+        for( auto& d : SortPostings( it->second ) )
+        {
+            const uint8_t num = std::min<size_t>( std::numeric_limits<uint8_t>::max(), d.second.size() );
+            WritePosting( d.first, d.second.data(), num, ohit, hitbase, str, fdata, fhit );
+        }
+        odata += sizeof( LexiconDataPacket ) * dsize;
+    }
+    CloseWrite( fstr, base + "lexstr.new" );
+
+    printf( "%zu/%zu\n", wordNum, wordNum );
+
+    CloseWrite( fmeta, base + "lexmeta.new" );
+    CloseWrite( fdata, base + "lexdata.new" );
+    CloseWrite( fhit, base + "lexhit.new" );
+
+    FILE* fsingle = OpenWrite( base + "lexsingle.new" );
+    for( auto& v : single ) WriteLexiconSingle( v, fsingle );
+    CloseWrite( fsingle, base + "lexsingle.new" );
+
+    auto hashbits = MsgIdHashBits( wordNum, 90 );
+    auto hashsize = MsgIdHashSize( hashbits );
+    auto hashmask = MsgIdHashMask( hashbits );
+
+    std::vector<uint32_t> hashdata( hashsize );
+    std::vector<uint8_t> distance( hashsize );
+    const auto distmax = PlaceWords( strings, hashdata.data(), distance.data(), hashsize, hashmask );
+
+    FILE* fhashdata = OpenWrite( base + "lexhashdata.new" );
+    fwrite( &distmax, 1, 1, fhashdata );
+    CloseWrite( fhashdata, base + "lexhashdata.new" );
+
+    FILE* fhash = OpenWrite( base + "lexhash.new" );
+    const uint32_t zero = 0;
+    for( int i=0; i<hashsize; i++ )
+    {
+        if( distance[i] == 0xFF )
+        {
+            fwrite( &zero, 1, sizeof( uint32_t ), fhash );
+            fwrite( &zero, 1, sizeof( uint32_t ), fhash );
+        }
+        else
+        {
+            fwrite( &offsetData[hashdata[i]], 1, sizeof( uint32_t ), fhash );
+            fwrite( &hashdata[i], 1, sizeof( uint32_t ), fhash );
+        }
+    }
+    CloseWrite( fhash, base + "lexhash.new" );
+
+    // New words have no similar words until lexdist is run again.
+    if( Exists( base + "lexdistmeta" ) && GetFileSize( ( base + "lexdistmeta" ).c_str() ) == oldNum * sizeof( uint32_t ) )
+    {
+        const FileMap<char> ldist( base + "lexdistmeta" );
+        FILE* f = OpenWrite( base + "lexdistmeta.new" );
+        fwrite( ldist, 1, ldist.Size(), f );
+        for( size_t i=0; i<added.size(); i++ ) fwrite( &zero, 1, sizeof( uint32_t ), f );
+        CloseWrite( f, base + "lexdistmeta.new" );
+    }
+
+    const uint8_t widebyte = wide;
+    FILE* fcommit = OpenWrite( base + "lexmerge.commit" );
+    fwrite( &widebyte, 1, 1, fcommit );
+    CloseWrite( fcommit, base + "lexmerge.commit" );
+    CommitMerge( base );
+}
+
+static void Usage( const char* name )
+{
+    fprintf( stderr, "USAGE: %s [params] raw\nParams:\n", name );
+    fprintf( stderr, " -b              - benchmark word tokenizer, don't write output\n" );
+    fprintf( stderr, " -d first        - merge messages starting at index first into existing lexicon\n" );
+    exit( 1 );
+}
+
+int main( int argc, char** argv )
+{
+    bool benchmark = false;
+    bool delta = false;
+    uint32_t first = 0;
+
+    const auto name = argv[0];
+    for(;;)
+    {
+        if( argc < 2 ) Usage( name );
+        if( strcmp( argv[1], "-b" ) == 0 )
+        {
+            benchmark = true;
+            argv++;
+            argc--;
+        }
+        else if( strcmp( argv[1], "-d" ) == 0 )
+        {
+            if( argc < 3 ) Usage( name );
+            char* end;
+            errno = 0;
+            const auto val = strtoul( argv[2], &end, 10 );
+            if( !isdigit( (unsigned char)*argv[2] ) || *end != '\0' || errno != 0 || val > std::numeric_limits<uint32_t>::max() )
+            {
+                fprintf( stderr, "Invalid first message index: %s\n", argv[2] );
+                exit( 1 );
+            }
+            delta = true;
+            first = uint32_t( val );
+            argv += 2;
+            argc -= 2;
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    std::string base = argv[1];
+    base.append( "/" );
+
+    MessageView mview( base + "meta", base + "data" );
+
+    if( benchmark )
+    {
+        const auto cpus = System::CPUCores();
+        printf( "Tokenizing %zu messages...\n", mview.Size() );
+        fflush( stdout );
+        const auto single = Benchmark( mview, 1 );
+        PrintBenchmark( "1 thread", single );
+        const auto multi = Benchmark( mview, cpus );
+        char tmp[64];
+        sprintf( tmp, "%i threads", cpus );
+        PrintBenchmark( tmp, multi );
+        const auto& stats = single.stats;
+        const auto nonAscii = stats.latin + stats.icu;
+        printf( "Input: %.1f MB, %" PRIu64 " words, %" PRIu64 " ASCII spans, %" PRIu64 " non-ASCII words (%.1f%% without ICU)\n", single.bytes / ( 1024.0 * 1024 ), single.words, stats.ascii, nonAscii, nonAscii == 0 ? 100.0 : 100.0 * stats.latin / nonAscii );
+        return 0;
+    }
+
+    WideMetaView<uint32_t> conn( base + "connmeta", base + "conndata", ReadWideOffsets( base ) & WideConnectivity );
+    const auto size = mview.Size();
+    if( size > LexiconPostMask + 1 )
+    {
+        fprintf( stderr, "Too many messages to index (%zu, max %i).\n", size, LexiconPostMask + 1 );
+        exit( 1 );
+    }
+    if( first > size )
+    {
+        fprintf( stderr, "First message to index (%i) is past the end of archive (%zu).\n", first, size );
+        exit( 1 );
+    }
+    if( Exists( base + "lexmerge.commit" ) )
+    {
+        printf( "Completing interrupted lexicon merge.\n" );
+        CommitMerge( base );
+    }
+    if( delta && ( !Exists( base + "lexmeta" ) || !Exists( base + "lexdata" ) || !Exists( base + "lexhit" ) || !Exists( base + "lexstr" ) || !Exists( base + "lexhash" ) || !Exists( base + "lexhashdata" ) ) )
+    {
+        fprintf( stderr, "No lexicon to merge into.\n" );
+        exit( 1 );
+    }
+    if( delta )
+    {
+        const auto last = LastIndexedPost( base );
+        if( int64_t( first ) <= last )
+        {
+            fprintf( stderr, "First message to index (%i) is already in lexicon (last indexed message is %" PRIi64 ").\n", first, last );
+            exit( 1 );
+        }
+    }
+    Tokenizer tokenizer;
+
+    // Purposefully disable destruction to not waste time at application exit
+    HitData* dataPtr = new HitData();
+    HitData& data = *dataPtr;
+
+    for( uint32_t i=first; i<size; i++ )
+    {
+        if( ( i & 0x3FF ) == 0 )
+        {
+            printf( "%i/%zu\r", i, size );
+            fflush( stdout );
+        }
+        IndexMessage( data, tokenizer, mview[i], i, LexiconTransformChildNum( conn[i][2] - 1 ) );
+    }
+
+    if( delta )
+    {
+        printf( "\n" );
+
+        Merge( base, data, conn );
+        return 0;
+    }
+
+    {
+        const auto fn = base + "lexsingle";
+        FILE* f = OpenWrite( fn );
+        for( auto& v : data )
+        {
+            if( v.second.size() != 1 ) continue;
+            const auto& post = *v.second.begin();
+            WriteLexiconSingle( LexiconSingle { post.first & LexiconPostMask, uint8_t( post.second.size() ), post.second.data(), v.first.c_str() }, f );
+        }
+        CloseWrite( f, fn );
+    }
+
+    auto it = data.begin();
+    while( it != data.end() )
+    {
+        if( it->second.size() == 1 )
+        {
+            it = data.erase( it );
+        }
+        else
+        {
+            ++it;
+        }
+    }
+
+    printf( "\nSaving...\n" );
+    fflush( stdout );
+
+    auto wordNum = data.size();
+    auto hashbits = MsgIdHashBits( wordNum, 90 );
+    auto hashsize = MsgIdHashSize( hashbits );
+    auto hashmask = MsgIdHashMask( hashbits );
+
+    std::vector<const char*> strings;
+    strings.reserve( wordNum );
+    for( auto& v : data ) strings.emplace_back( v.first.c_str() );
+
+    auto hashdata = new uint32_t[hashsize];
+    auto distance = new uint8_t[hashsize];
+    const auto distmax = PlaceWords( strings, hashdata, distance, hashsize, hashmask );
 
     FILE* fhashdata = fopen( ( base + "lexhashdata" ).c_str(), "wb" );
     fwrite( &distmax, 1, 1, fhashdata );
@@ -302,7 +850,7 @@ int main( int argc, char** argv )
 
     auto offsetData = new uint32_t[wordNum];
 
-    cnt = 0;
+    int cnt = 0;
     for( int i=0; i<hashsize; i++ )
     {
         if( ( i & 0x3FFF ) == 0 )
@@ -333,12 +881,15 @@ int main( int argc, char** argv )
 
     printf( "\n" );
 
+    const bool wide = NeedsWideLexicon( data, 0, 0 );
+    WriteWideOffsets( base, WideLexicon, wide );
+
     FILE* fmeta = fopen( ( base + "lexmeta" ).c_str(), "wb" );
     FILE* fdata = fopen( ( base + "lexdata" ).c_str(), "wb" );
     FILE* fhit = fopen( ( base + "lexhit" ).c_str(), "wb" );
 
-    uint32_t odata = 0;
-    uint32_t ohit = 0;
+    uint64_t odata = 0;
+    uint64_t ohit = 0;
 
     uint32_t idx = 0;
     const auto dataSize = data.size();
@@ -351,34 +902,13 @@ int main( int argc, char** argv )
         }
 
         uint32_t dsize = v.second.size();
-        fwrite( &offsetData[idx], 1, sizeof( uint32_t ), fmeta );
-        fwrite( &odata, 1, sizeof( uint32_t ), fmeta );
-        fwrite( &dsize, 1, sizeof( uint32_t ), fmeta );
+        WriteMeta( offsetData[idx], dsize, odata, ohit, wide, fmeta );
+        const auto hitbase = wide ? ohit : 0;
 
         for( auto& d : v.second )
         {
             uint8_t num = std::min<uint8_t>( std::numeric_limits<uint8_t>::max(), d.second.size() );
-
-            fwrite( &d.first, 1, sizeof( uint32_t ), fdata );
-
-            if( num < 4 )
-            {
-                uint32_t numshift = num << LexiconHitShift;
-                uint32_t v = 0;
-                for( int i=0; i<num; i++ )
-                {
-                    v <<= 8;
-                    v |= d.second[i];
-                }
-                v |= numshift;
-                fwrite( &v, 1, sizeof( uint32_t ), fdata );
-            }
-            else
-            {
-                fwrite( &ohit, 1, sizeof( uint32_t ), fdata );
-                ohit += fwrite( &num, 1, sizeof( uint8_t ), fhit );
-                ohit += fwrite( d.second.data(), 1, sizeof( uint8_t ) * num, fhit );
-            }
+            WritePosting( d.first, d.second.data(), num, ohit, hitbase, strings[idx], fdata, fhit );
         }
         odata += sizeof( uint32_t ) * dsize * 2;
 
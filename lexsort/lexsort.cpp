@@ -1,4 +1,6 @@
 #include <algorithm>
+#include <assert.h>
+#include <atomic>
 #include <inttypes.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -8,7 +10,77 @@
 #include <vector>
 
 #include "../common/FileMap.hpp"
+#include "../common/Filesystem.hpp"
+#include "../common/LexiconMetaView.hpp"
 #include "../common/LexiconTypes.hpp"
+#include "../common/mmap.hpp"
+#include "../common/System.hpp"
+#include "../common/TaskDispatch.hpp"
+#include "../common/WideOffsets.hpp"
+
+enum { RadixThreshold = 4096 };
+enum { RadixBits = 14 };
+enum { RadixSize = 1 << RadixBits };
+enum { RadixMask = RadixSize - 1 };
+static_assert( RadixBits * 2 >= 27, "Two radix passes must cover whole post id" );
+
+static void* MapWritable( const std::string& fn, size_t size )
+{
+    if( size == 0 ) return nullptr;
+    FILE* f = fopen( fn.c_str(), "r+b" );
+    if( !f )
+    {
+        fprintf( stderr, "Cannot open %s\n", fn.c_str() );
+        exit( 1 );
+    }
+    auto ptr = mmap( nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fileno( f ), 0 );
+    fclose( f );
+    if( ptr == (void*)-1 )
+    {
+        fprintf( stderr, "Cannot map %s\n", fn.c_str() );
+        exit( 1 );
+    }
+    return ptr;
+}
+
+static void Unmap( void* ptr, size_t size )
+{
+    if( !ptr ) return;
+    msync( ptr, size, MS_SYNC );
+    munmap( ptr, size );
+}
+
+// Post ids are unique within a word, so the result is the same as with comparison sort.
+static void RadixSort( LexiconDataPacket* data, uint32_t size, std::vector<LexiconDataPacket>& tmp, std::vector<uint32_t>& hist )
+{
+    tmp.resize( size );
+    hist.resize( RadixSize );
+
+    auto src = data;
+    auto dst = tmp.data();
+    for( int pass=0; pass<2; pass++ )
+    {
+        const auto shift = pass * RadixBits;
+        std::fill( hist.begin(), hist.end(), 0 );
+        for( uint32_t i=0; i<size; i++ )
+        {
+            hist[( ( src[i].postid & LexiconPostMask ) >> shift ) & RadixMask]++;
+        }
+        uint32_t sum = 0;
+        for( auto& v : hist )
+        {
+            const auto cnt = v;
+            v = sum;
+            sum += cnt;
+        }
+        for( uint32_t i=0; i<size; i++ )
+        {
+            dst[hist[( ( src[i].postid & LexiconPostMask ) >> shift ) & RadixMask]++] = src[i];
+        }
+        std::swap( src, dst );
+    }
+    assert( src == data );
+}
 
 int main( int argc, char** argv )
 {
@@ -20,72 +92,79 @@ int main( int argc, char** argv )
 
     std::string base = argv[1];
     base.append( "/" );
-    FileMap<LexiconMetaPacket> meta( base + "lexmeta" );
-
-    LexiconDataPacket* data;
-    uint8_t* hits;
-    uint32_t datasize, hitssize;
-    {
-        FileMap<LexiconDataPacket> mdata( base + "lexdata" );
-        FileMap<uint8_t> mhits( base + "lexhit" );
+    const LexiconMetaView meta( base + "lexmeta", ReadWideOffsets( base ) & WideLexicon );
 
-        datasize = mdata.DataSize();
-        hitssize = mhits.DataSize();
+    const auto datafn = base + "lexdata";
+    const auto hitsfn = base + "lexhit";
+    const auto datasize = GetFileSize( datafn.c_str() );
+    const auto hitssize = GetFileSize( hitsfn.c_str() );
 
-        data = new LexiconDataPacket[datasize];
-        hits = new uint8_t[hitssize];
+    auto data = (LexiconDataPacket*)MapWritable( datafn, datasize );
+    auto hits = (uint8_t*)MapWritable( hitsfn, hitssize );
 
-        memcpy( data, mdata, mdata.Size() );
-        memcpy( hits, mhits, mhits.Size() );
-    }
+    const auto size = meta.Size();
+    const auto cpus = System::CPUCores();
+    TaskDispatch tasks( cpus-1 );
+    std::atomic<uint32_t> cnt( 0 );
 
-    const auto size = meta.DataSize();
-    for( uint32_t i=0; i<size; i++ )
+    for( int t=0; t<cpus; t++ )
     {
-        if( ( i & 0x1FFF ) == 0 )
-        {
-            printf( "%i/%zu\r", i, size );
-            fflush( stdout );
-        }
-
-        auto mp = meta + i;
-        auto dptr = data + ( mp->data / sizeof( LexiconDataPacket ) );
-        auto dsize = mp->dataSize;
-        std::sort( dptr, dptr + dsize, [] ( const auto& l, const auto& r ) { return ( l.postid & LexiconPostMask ) < ( r.postid & LexiconPostMask ); } );
-
-        for( int i=0; i<dsize; i++ )
-        {
-            uint8_t hnum = dptr[i].hitoffset >> LexiconHitShift;
-            uint8_t* hptr;
-            if( hnum == 0 )
-            {
-                hptr = hits + ( dptr[i].hitoffset & LexiconHitOffsetMask );
-                hnum = *hptr++;
-            }
-            else
-            {
-                hptr = (uint8_t*)&dptr[i].hitoffset;
-            }
-            if( hnum > 1 )
+        tasks.Queue( [&cnt, &meta, size, data, hits] {
+            std::vector<LexiconDataPacket> tmp;
+            std::vector<uint32_t> hist;
+            for(;;)
             {
-                std::sort( hptr, hptr + hnum, [] ( const auto& l, const auto& r ) { return LexiconHitRank( l ) > LexiconHitRank( r ); } );
+                const auto j = cnt.fetch_add( 0x100, std::memory_order_relaxed );
+                if( j >= size ) break;
+                if( ( j & 0x1FFF ) == 0 )
+                {
+                    printf( "%i/%zu\r", j, size );
+                    fflush( stdout );
+                }
+
+                const auto jend = std::min<uint64_t>( size, j + 0x100 );
+                for( uint32_t i=j; i<jend; i++ )
+                {
+                    const auto mp = meta[i];
+                    auto dptr = data + ( mp.data / sizeof( LexiconDataPacket ) );
+                    auto dsize = mp.dataSize;
+                    if( dsize >= RadixThreshold )
+                    {
+                        RadixSort( dptr, dsize, tmp, hist );
+                    }
+                    else
+                    {
+                        std::sort( dptr, dptr + dsize, [] ( const auto& l, const auto& r ) { return ( l.postid & LexiconPostMask ) < ( r.postid & LexiconPostMask ); } );
+                    }
+
+                    for( int i=0; i<dsize; i++ )
+                    {
+                        uint8_t hnum = dptr[i].hitoffset >> LexiconHitShift;
+                        uint8_t* hptr;
+                        if( hnum == 0 )
+                        {
+                            hptr = hits + mp.hit + ( dptr[i].hitoffset & LexiconHitOffsetMask );
+                            hnum = *hptr++;
+                        }
+                        else
+                        {
+                            hptr = (uint8_t*)&dptr[i].hitoffset;
+                        }
+                        if( hnum > 1 )
+                        {
+                            std::sort( hptr, hptr + hnum, [] ( const auto& l, const auto& r ) { return LexiconHitRank( l ) > LexiconHitRank( r ); } );
+                        }
+                    }
+                }
             }
-        }
+        } );
     }
+    tasks.Sync();
 
-    printf( "\n" );
-
-    FILE* fdata = fopen( ( base + "lexdata" ).c_str(), "wb" );
-    FILE* fhits = fopen( ( base + "lexhit" ).c_str(), "wb" );
-
-    fwrite( data, 1, datasize * sizeof( LexiconDataPacket ), fdata );
-    fwrite( hits, 1, hitssize * sizeof( uint8_t ), fhits );
-
-    fclose( fdata );
-    fclose( fhits );
+    printf( "%zu/%zu\n", size, size );
 
-    delete[] data;
-    delete[] hits;
+    Unmap( data, datasize );
+    Unmap( hits, hitssize );
 
     return 0;
 }
@@ -8,7 +8,9 @@
 #include <vector>
 
 #include "../common/FileMap.hpp"
+#include "../common/LexiconMetaView.hpp"
 #include "../common/LexiconTypes.hpp"
+#include "../common/WideOffsets.hpp"
 
 struct Stats
 {
@@ -27,14 +29,14 @@ int main( int argc, char** argv )
 
     std::string base = argv[1];
     base.append( "/" );
-    FileMap<LexiconMetaPacket> meta( base + "lexmeta" );
+    const LexiconMetaView meta( base + "lexmeta", ReadWideOffsets( base ) & WideLexicon );
     FileMap<char> str( base + "lexstr" );
     FileMap<uint32_t> ldata( base + "lexdata" );
     FileMap<uint8_t> hits( base + "lexhit" );
 
     std::vector<std::pair<const char*, Stats>> data;
 
-    const auto size = meta.DataSize();
+    const auto size = meta.Size();
     uint64_t sizes[6] = {};
     uint64_t totalSize = 0;
     for( uint32_t i=0; i<size; i++ )
@@ -45,15 +47,15 @@ int main( int argc, char** argv )
             fflush( stdout );
         }
 
-        auto mp = meta + i;
-        auto s = str + mp->str;
+        const auto mp = meta[i];
+        auto s = str + mp.str;
         uint32_t cnt = 0;
         uint32_t ld = 0;
         uint32_t lh = 0;
 
-        auto dptr = ldata + ( mp->data / sizeof( uint32_t ) );
-        ld += mp->dataSize;
-        for( uint32_t j=0; j<mp->dataSize; j++ )
+        auto dptr = ldata + ( mp.data / sizeof( uint32_t ) );
+        ld += mp.dataSize;
+        for( uint32_t j=0; j<mp.dataSize; j++ )
         {
             dptr++;
             auto offset = *dptr;
@@ -61,7 +63,7 @@ int main( int argc, char** argv )
             uint8_t hnum = offset >> LexiconHitShift;
             if( hnum == 0 )
             {
-                hptr = hits + ( offset & LexiconHitOffsetMask );
+                hptr = hits + mp.hit + ( offset & LexiconHitOffsetMask );
                 hnum = *hptr++;
                 lh += hnum + 1;
             }
@@ -89,8 +91,8 @@ int main( int argc, char** argv )
 
     std::sort( data.begin(), data.end(), [] ( const auto& lhs, const auto& rhs ) { return lhs.second.cnt > rhs.second.cnt; } );
 
-    uint32_t dt = 0;
-    uint32_t ht = 0;
+    uint64_t dt = 0;
+    uint64_t ht = 0;
     for( auto& v : data )
     {
         dt += v.second.lexdata * sizeof( uint32_t ) * 2;
@@ -98,7 +100,7 @@ int main( int argc, char** argv )
         fprintf( stderr, "%i\t%s\t(%zi B data, %i B hits)\n", v.second.cnt, v.first, v.second.lexdata * sizeof( uint32_t ) * 2, v.second.lexhit );
     }
 
-    printf( "Total %iKB data, %iKB hits\n", dt / 1024, ht / 1024 );
+    printf( "Total %" PRIu64 "KB data, %" PRIu64 "KB hits\n", dt / 1024, ht / 1024 );
 
     return 0;
 }
@@ -1,16 +1,15 @@
 #include <algorithm>
 #include <iterator>
 #include <time.h>
-#include <regex>
 #include <vector>
 
 #include "Archive.hpp"
 #include "PackageAccess.hpp"
-#include "Score.hpp"
+#include "ScoreMatcher.hpp"
 
 #include "../common/Filesystem.hpp"
-#include "../common/String.hpp"
 #include "../common/Package.hpp"
+#include "../common/WideOffsets.hpp"
 
 Archive* Archive::Open( const std::string& fn )
 {
@@ -18,7 +17,7 @@ Archive* Archive::Open( const std::string& fn )
     {
         auto pkg = PackageAccess::Open( fn );
         if( !pkg ) return nullptr;
-        if( pkg->Version() < PackageVersion ) return nullptr;
+        if( pkg->Version() < PackageMinVersion ) return nullptr;
         return new Archive( pkg );
     }
     else
@@ -41,14 +40,15 @@ Archive* Archive::Open( const std::string& fn )
 }
 
 Archive::Archive( const std::string& dir )
-    : m_mview( dir + "zmeta", dir + "zdata", dir + "zdict" )
+    : m_wide( ReadWideOffsets( dir ) )
+    , m_mview( dir + "zmeta", dir + "zdata", dir + "zdict" )
     , m_mcnt( m_mview.Size() )
     , m_toplevel( dir + "toplevel" )
-    , m_midhash( dir + "middata", dir + "midhash", dir + "midhashdata" )
-    , m_middb( dir + "midmeta", dir + "middata" )
-    , m_connectivity( dir + "connmeta", dir + "conndata" )
-    , m_strings( dir + "strmeta", dir + "strings" )
-    , m_lexmeta( dir + "lexmeta" )
+    , m_midhash( dir + "middata", dir + "midhash", dir + "midhashdata", m_wide & WideMsgId )
+    , m_middb( dir + "midmeta", dir + "middata", m_wide & WideMsgId )
+    , m_connectivity( dir + "connmeta", dir + "conndata", m_wide & WideConnectivity )
+    , m_strings( dir + "strmeta", dir + "strings", m_wide & WideStrings )
+    , m_lexmeta( dir + "lexmeta", m_wide & WideLexicon )
     , m_lexstr( dir + "lexstr" )
     , m_lexdata( dir + "lexdata" )
     , m_lexhit( dir + "lexhit" )
@@ -58,7 +58,10 @@ Archive::Archive( const std::string& dir )
     , m_name( dir + "name", true )
     , m_prefix( dir + "prefix", true )
     , m_compress( dir + "msgid.codebook" )
+    , m_conncol( dir + "conncol", true )
+    , m_timechart( dir + "timechart", true )
 {
+    SetupConnColumns();
     if( Exists( dir + "lexdist" ) && Exists( dir + "lexdistmeta" ) )
     {
         m_lexdist = std::make_unique<MetaView<uint32_t, uint32_t>>( dir + "lexdistmeta", dir + "lexdist" );
@@ -67,14 +70,15 @@ Archive::Archive( const std::string& dir )
 
 Archive::Archive( const PackageAccess* pkg )
     : m_pkg( pkg )
+    , m_wide( ReadWideOffsets( pkg->Get( PackageFile::wide ) ) )
     , m_mview( pkg->Get( PackageFile::zmeta ), pkg->Get( PackageFile::zdata ), pkg->Get( PackageFile::zdict ) )
     , m_mcnt( m_mview.Size() )
     , m_toplevel( pkg->Get( PackageFile::toplevel ) )
-    , m_midhash( pkg->Get( PackageFile::middata ), pkg->Get( PackageFile::midhash ), pkg->Get( PackageFile::midhashdata ) )
-    , m_middb( pkg->Get( PackageFile::midmeta ), pkg->Get( PackageFile::middata ) )
-    , m_connectivity( pkg->Get( PackageFile::connmeta ), pkg->Get( PackageFile::conndata ) )
-    , m_strings( pkg->Get( PackageFile::strmeta ), pkg->Get( PackageFile::strings ) )
-    , m_lexmeta( pkg->Get( PackageFile::lexmeta ) )
+    , m_midhash( pkg->Get( PackageFile::middata ), pkg->Get( PackageFile::midhash ), pkg->Get( PackageFile::midhashdata ), m_wide & WideMsgId )
+    , m_middb( pkg->Get( PackageFile::midmeta ), pkg->Get( PackageFile::middata ), m_wide & WideMsgId )
+    , m_connectivity( pkg->Get( PackageFile::connmeta ), pkg->Get( PackageFile::conndata ), m_wide & WideConnectivity )
+    , m_strings( pkg->Get( PackageFile::strmeta ), pkg->Get( PackageFile::strings ), m_wide & WideStrings )
+    , m_lexmeta( pkg->Get( PackageFile::lexmeta ), m_wide & WideLexicon )
     , m_lexstr( pkg->Get( PackageFile::lexstr ) )
     , m_lexdata( pkg->Get( PackageFile::lexdata ) )
     , m_lexhit( pkg->Get( PackageFile::lexhit ) )
@@ -84,7 +88,10 @@ Archive::Archive( const PackageAccess* pkg )
     , m_name( pkg->Get( PackageFile::name ) )
     , m_prefix( pkg->Get( PackageFile::prefix ) )
     , m_compress( pkg->Get( PackageFile::codebook ) )
+    , m_conncol( pkg->Get( PackageFile::conncol ) )
+    , m_timechart( pkg->Get( PackageFile::timechart ) )
 {
+    SetupConnColumns();
     const auto lexdist = pkg->Get( PackageFile::lexdist );
     const auto lexdistmeta = pkg->Get( PackageFile::lexdistmeta );
     if( lexdist.size > 0 && lexdistmeta.size > 0 )
@@ -93,70 +100,51 @@ Archive::Archive( const PackageAccess* pkg )
     }
 }
 
-static bool MatchStrings( const std::string& s1, const char* s2, bool exact, bool ignoreCase )
+void Archive::SetupConnColumns()
 {
-    if( exact )
+    // Columns not matching message count are ignored.
+    if( m_mcnt != 0 && m_conncol.DataSize() == m_mcnt * 3 )
     {
-        if( ignoreCase )
-        {
-            auto l1 = s1.size();
-            auto l2 = strlen( s2 );
-            return l1 == l2 && strnicmpl( s2, s1.c_str(), l1 ) == 0;
-        }
-        else
-        {
-            return strcmp( s1.c_str(), s2 ) == 0;
-        }
+        m_epoch = m_conncol;
+        m_parent = m_epoch + m_mcnt;
+        m_childTotal = m_parent + m_mcnt;
     }
     else
     {
-        const std::regex r( s1.c_str(), s1.size(), std::regex::flag_type( std::regex_constants::ECMAScript | ( ignoreCase ? std::regex_constants::icase : 0 ) ) );
-        return std::regex_search( s2, r );
+        m_epoch = m_parent = m_childTotal = nullptr;
     }
 }
 
-int Archive::GetMessageScore( uint32_t idx, const std::vector<ScoreEntry>& scoreList ) const
+int Archive::GetMessageScore( uint32_t idx, const ScoreMatcher& matcher ) const
 {
-    int score = 0;
-    for( auto& v : scoreList )
-    {
-        bool match = false;
-        switch( v.field )
-        {
-        case SF_RealName:
-            match = MatchStrings( v.match, GetRealName( idx ), v.exact != 0, v.ignoreCase != 0 );
-            break;
-        case SF_Subject:
-            match = MatchStrings( v.match, GetSubject( idx ), v.exact != 0, v.ignoreCase != 0 );
-            break;
-        case SF_From:
-            match = MatchStrings( v.match, GetFrom( idx ), v.exact != 0, v.ignoreCase != 0 );
-            break;
-        default:
-            assert( false );
-            break;
-        }
-        if( match )
-        {
-            score += v.score;
-        }
-    }
-    return score;
+    return matcher.Score( *this, idx );
+}
+
+void Archive::GetMessageScores( uint32_t begin, uint32_t end, const ScoreMatcher& matcher, int* out ) const
+{
+    assert( begin <= end && end <= m_mcnt );
+    matcher.Score( *this, begin, end, out );
 }
 
 std::map<std::string, uint32_t> Archive::TimeChart() const
 {
     std::map<std::string, uint32_t> ret;
 
-    const auto size = m_connectivity.Size();
-    for( size_t i=0; i<size; i++ )
-    {
-        const auto epoch = time_t( *m_connectivity[i] );
-        if( epoch == 0 ) continue;
+    GetDayHistogram().ForEachDay( [&ret] ( uint32_t day, uint32_t cnt ) {
+        const auto epoch = time_t( day ) * DayHistogram::DaySeconds;
         char buf[16];
         strftime( buf, 16, "%Y%m", gmtime( &epoch ) );
-        ret[buf]++;
-    }
+        ret[buf] += cnt;
+    } );
+
+    return ret;
+}
+
+DayHistogram Archive::GetDayHistogram() const
+{
+    if( HasTimeChart() ) return DayHistogram( m_timechart, m_timechart.DataSize() );
 
+    DayHistogram ret;
+    ForEachDate( [&ret] ( uint32_t date ) { ret.AddDate( date ); } );
     return ret;
 }
@@ -7,8 +7,10 @@
 #include <string>
 #include <vector>
 
+#include "../common/DayHistogram.hpp"
 #include "../common/FileMap.hpp"
 #include "../common/HashSearch.hpp"
+#include "../common/LexiconMetaView.hpp"
 #include "../common/LexiconTypes.hpp"
 #include "../common/MetaView.hpp"
 #include "../common/StringCompress.hpp"
@@ -17,7 +19,7 @@
 #include "PackageAccess.hpp"
 #include "ViewReference.hpp"
 
-struct ScoreEntry;
+class ScoreMatcher;
 class ExpandingBuffer;
 
 class Archive
@@ -29,6 +31,8 @@ public:
 
     const char* GetMessage( uint32_t idx, ExpandingBuffer& eb ) { return idx >= m_mcnt ? nullptr : m_mview.GetMessage( idx, eb ); }
     const char* GetMessage( const uint8_t* msgid, ExpandingBuffer& eb ) { auto idx = m_midhash.Search( msgid ); return idx >= 0 ? GetMessage( idx, eb ) : nullptr; }
+    // Thread safe, as long as each thread provides its own buffer and decompression context.
+    const char* GetMessage( uint32_t idx, ExpandingBuffer& eb, ZSTD_DCtx* ctx ) const { return idx >= m_mcnt ? nullptr : m_mview.GetMessage( idx, eb, ctx ); }
     size_t NumberOfMessages() const { return m_mcnt; }
 
     int GetMessageIndex( const uint8_t* msgid ) const { return m_midhash.Search( msgid ); }
@@ -38,18 +42,32 @@ public:
     ViewReference<uint32_t> GetTopLevel() const { return ViewReference<uint32_t> { m_toplevel, m_toplevel.DataSize() }; }
     size_t NumberOfTopLevel() const { return m_toplevel.DataSize(); }
 
-    int32_t GetParent( uint32_t idx ) const { auto data = m_connectivity[idx]; return (int32_t)*(data+1); }
+    int32_t GetParent( uint32_t idx ) const { return m_parent ? (int32_t)m_parent[idx] : (int32_t)m_connectivity[idx][1]; }
     int32_t GetParent( const uint8_t* msgid ) const { auto idx = m_midhash.Search( msgid ); return idx >= 0 ? GetParent( idx ) : -1; }
 
     ViewReference<uint32_t> GetChildren( uint32_t idx ) const { auto data = ( m_connectivity[idx] ) + 3; auto num = *data++; return ViewReference<uint32_t> { data, num }; }
     ViewReference<uint32_t> GetChildren( const uint8_t* msgid ) const { auto idx = m_midhash.Search( msgid ); return idx >= 0 ? GetChildren( idx ) : ViewReference<uint32_t> { nullptr, 0 }; }
 
-    uint32_t GetTotalChildrenCount( uint32_t idx ) const { auto data = m_connectivity[idx]; return data[2]; }
+    uint32_t GetTotalChildrenCount( uint32_t idx ) const { return m_childTotal ? m_childTotal[idx] : m_connectivity[idx][2]; }
     uint32_t GetTotalChildrenCount( const uint8_t* msgid ) const { auto idx = m_midhash.Search( msgid ); return idx >= 0 ? GetTotalChildrenCount( idx ) : 0; }
 
-    uint32_t GetDate( uint32_t idx ) const { auto data = m_connectivity[idx]; return *data; }
+    uint32_t GetDate( uint32_t idx ) const { return m_epoch ? m_epoch[idx] : *m_connectivity[idx]; }
     uint32_t GetDate( const uint8_t* msgid ) const { auto idx = m_midhash.Search( msgid ); return idx >= 0 ? GetDate( idx ) : 0; }
 
+    // Calls func( date ) for each message, in index order.
+    template<class T>
+    void ForEachDate( T&& func ) const
+    {
+        if( m_epoch )
+        {
+            for( size_t i=0; i<m_mcnt; i++ ) func( m_epoch[i] );
+        }
+        else
+        {
+            for( size_t i=0; i<m_mcnt; i++ ) func( *m_connectivity[i] );
+        }
+    }
+
     const char* GetFrom( uint32_t idx ) const { return m_strings[idx*3]; }
     const char* GetFrom( const uint8_t* msgid ) const { auto idx = m_midhash.Search( msgid ); return idx >= 0 ? GetFrom( idx ) : nullptr; }
 
@@ -59,9 +77,13 @@ public:
     const char* GetRealName( uint32_t idx ) const { return m_strings[idx*3+2]; }
     const char* GetRealName( const uint8_t* msgid ) const { auto idx = m_midhash.Search( msgid ); return idx >= 0 ? GetRealName( idx ) : nullptr; }
 
-    int GetMessageScore( uint32_t idx, const std::vector<ScoreEntry>& scoreList ) const;
+    int GetMessageScore( uint32_t idx, const ScoreMatcher& matcher ) const;
+    // Scores messages [begin, end) into out, using all cores.
+    void GetMessageScores( uint32_t begin, uint32_t end, const ScoreMatcher& matcher, int* out ) const;
 
     std::map<std::string, uint32_t> TimeChart() const;
+    // Uses precomputed histogram, if available.
+    DayHistogram GetDayHistogram() const;
 
     std::pair<const char*, uint64_t> GetShortDescription() const { return std::make_pair( (const char*)m_descShort, m_descShort.Size() ); }
     std::pair<const char*, uint64_t> GetLongDescription() const { return std::make_pair( (const char*)m_descLong, m_descLong.Size() ); }
@@ -74,21 +96,26 @@ public:
     const StringCompress& GetCompress() const { return m_compress; }
 
     bool HasLexDist() const { return (bool)m_lexdist; }
+    bool HasConnColumns() const { return m_epoch != nullptr; }
+    bool HasTimeChart() const { return m_timechart.DataSize() >= 2; }
 
 private:
     Archive( const std::string& dir );
     Archive( const PackageAccess* pkg );
 
+    void SetupConnColumns();
+
     std::unique_ptr<const PackageAccess> m_pkg;
+    const uint32_t m_wide;
 
     ZMessageView m_mview;
     const size_t m_mcnt;
     const FileMap<uint32_t> m_toplevel;
     const HashSearch<uint8_t> m_midhash;
-    const MetaView<uint32_t, uint8_t> m_middb;
-    const MetaView<uint32_t, uint32_t> m_connectivity;
-    const MetaView<uint32_t, char> m_strings;
-    const FileMap<LexiconMetaPacket> m_lexmeta;
+    const WideMetaView<uint8_t> m_middb;
+    const WideMetaView<uint32_t> m_connectivity;
+    const WideMetaView<char> m_strings;
+    const LexiconMetaView m_lexmeta;
     const FileMap<char> m_lexstr;
     const FileMap<LexiconDataPacket> m_lexdata;
     const FileMap<uint8_t> m_lexhit;
@@ -99,6 +126,14 @@ private:
     const FileMap<char> m_prefix;
     const StringCompress m_compress;
     std::unique_ptr<MetaView<uint32_t, uint32_t>> m_lexdist;
+
+    // Optional dense copy of connectivity record headers: dates, parents, total children counts.
+    const FileMap<uint32_t> m_conncol;
+    const uint32_t* m_epoch;
+    const uint32_t* m_parent;
+    const uint32_t* m_childTotal;
+
+    const FileMap<uint32_t> m_timechart;
 };
 
 #endif
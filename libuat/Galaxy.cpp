@@ -1,12 +1,10 @@
 #include <algorithm>
 
 #include "../common/Filesystem.hpp"
-#include "../common/System.hpp"
-#include "../common/TaskDispatch.hpp"
 
 #include "Galaxy.hpp"
 
-Galaxy* Galaxy::Open( const std::string& fn )
+Galaxy* Galaxy::Open( const std::string& fn, size_t maxOpen )
 {
     if( !Exists( fn ) || IsFile( fn ) ) return nullptr;
 
@@ -23,70 +21,148 @@ Galaxy* Galaxy::Open( const std::string& fn )
     }
     else
     {
-        return new Galaxy( base );
+        return new Galaxy( base, maxOpen );
     }
 }
 
-Galaxy::Galaxy( const std::string& fn )
+Galaxy::Galaxy( const std::string& fn, size_t maxOpen )
     : m_base( fn )
     , m_middb( fn + "msgid.meta", fn + "msgid" )
     , m_midhash( fn + "msgid", fn + "midhash.meta", fn + "midhash" )
     , m_archives( fn + "archives.meta", fn + "archives" )
     , m_strings( fn + "str.meta", fn + "str" )
+    , m_count( fn + "count", true )
     , m_midgr( fn + "midgr.meta", fn + "midgr" )
     , m_indirect( fn + "indirect.offset", fn + "indirect" )
     , m_indirectDense( fn + "indirect.dense" )
     , m_compress( fn + "msgid.codebook" )
+    , m_path( m_archives.Size() / 2 )
     , m_arch( m_archives.Size() / 2 )
+    , m_lastUse( m_archives.Size() / 2 )
+    , m_useCounter( 0 )
+    , m_numOpen( 0 )
+    , m_maxOpen( maxOpen )
+    , m_active( -1 )
 {
+    // Only check if archives are present. Opening is deferred until they are needed.
     const auto size = m_archives.Size() / 2;
     m_available.reserve( size );
-    std::mutex lock;
-    std::atomic<int> cnt( 0 );
-
-    const auto cpus = System::CPUCores();
-    TaskDispatch td( cpus-1 );
-    for( int i=0; i<cpus; i++ )
+    for( size_t i=0; i<size; i++ )
     {
-        td.Queue( [this, &cnt, &lock, size] {
-            for(;;)
-            {
-                const auto i = cnt.fetch_add( 1, std::memory_order_relaxed );
-                if( i >= size ) return;
-                const auto path = std::string( m_archives[i*2], m_archives[i*2+1] );
-                if( Exists( path ) )
-                {
-                    auto arch = Archive::Open( path );
-                    if( arch )
-                    {
-                        m_arch[i].reset( arch );
-                        std::lock_guard<std::mutex> lg( lock );
-                        m_available.emplace_back( i );
-                    }
-                }
-                else
-                {
-                    const auto relative = m_base + path;
-                    auto arch = Archive::Open( relative );
-                    if( arch )
-                    {
-                        m_arch[i].reset( arch );
-                        std::lock_guard<std::mutex> lg( lock );
-                        m_available.emplace_back( i );
-                    }
-                }
-            }
-        } );
+        auto path = GetArchiveFilename( i );
+        if( !Exists( path ) )
+        {
+            path = m_base + path;
+            if( !Exists( path ) ) continue;
+        }
+        m_path[i] = std::move( path );
+        m_available.emplace_back( i );
     }
-    td.Sync();
 }
 
-const std::shared_ptr<Archive>& Galaxy::GetArchive( int idx, bool change )
+std::vector<int> Galaxy::GetAvailableArchives() const
 {
-    if( change )
+    std::lock_guard<std::mutex> lock( m_lock );
+    return m_available;
+}
+
+std::shared_ptr<Archive> Galaxy::GetArchive( int idx, bool change )
+{
+    auto arch = LoadArchive( idx );
+    if( change && arch )
     {
+        std::lock_guard<std::mutex> lock( m_lock );
         m_active = idx;
     }
+    return arch;
+}
+
+int Galaxy::GetActiveArchive() const
+{
+    std::lock_guard<std::mutex> lock( m_lock );
+    return m_active;
+}
+
+int Galaxy::NumberOfMessages( int idx ) const
+{
+    if( HasArchiveCounts() ) return m_count[idx*2];
+    const auto arch = LoadArchive( idx );
+    return arch ? arch->NumberOfMessages() : 0;
+}
+
+int Galaxy::NumberOfTopLevel( int idx ) const
+{
+    if( HasArchiveCounts() ) return m_count[idx*2+1];
+    const auto arch = LoadArchive( idx );
+    return arch ? arch->NumberOfTopLevel() : 0;
+}
+
+DayHistogram Galaxy::GetDayHistogram() const
+{
+    if( Exists( m_base + "timechart" ) )
+    {
+        const FileMap<uint32_t> chart( m_base + "timechart" );
+        return DayHistogram( chart, chart.DataSize() );
+    }
+
+    DayHistogram ret;
+    for( auto& idx : GetAvailableArchives() )
+    {
+        const auto arch = LoadArchive( idx );
+        if( arch ) ret.Add( arch->GetDayHistogram() );
+    }
+    return ret;
+}
+
+bool Galaxy::IsArchiveAvailable( int idx ) const
+{
+    std::lock_guard<std::mutex> lock( m_lock );
+    return !m_path[idx].empty();
+}
+
+std::shared_ptr<Archive> Galaxy::LoadArchive( int idx ) const
+{
+    std::string path;
+    {
+        std::lock_guard<std::mutex> lock( m_lock );
+        m_lastUse[idx] = ++m_useCounter;
+        if( m_arch[idx] ) return m_arch[idx];
+        if( m_path[idx].empty() ) return nullptr;
+        path = m_path[idx];
+    }
+
+    // Opening may take a while, other queries are not blocked meanwhile.
+    std::shared_ptr<Archive> arch( Archive::Open( path ) );
+
+    std::lock_guard<std::mutex> lock( m_lock );
+    if( m_arch[idx] ) return m_arch[idx];
+    if( !arch )
+    {
+        m_path[idx].clear();
+        auto it = std::find( m_available.begin(), m_available.end(), idx );
+        if( it != m_available.end() ) m_available.erase( it );
+        return nullptr;
+    }
+    m_arch[idx] = std::move( arch );
+    m_numOpen++;
+
+    if( m_maxOpen != 0 && m_numOpen > m_maxOpen )
+    {
+        int lru = -1;
+        for( int i=0; i<m_arch.size(); i++ )
+        {
+            if( m_arch[i] && i != idx && i != m_active && ( lru < 0 || m_lastUse[i] < m_lastUse[lru] ) )
+            {
+                lru = i;
+            }
+        }
+        if( lru >= 0 )
+        {
+            m_arch[lru].reset();
+            m_numOpen--;
+        }
+    }
+
     return m_arch[idx];
 }
 
@@ -95,14 +171,11 @@ bool Galaxy::AreChildrenSame( uint32_t idx, const uint8_t* msgid ) const
     auto ptr = m_midgr[idx];
     auto num = *ptr++;
 
-    std::vector<Archive*> arch;
+    std::vector<std::shared_ptr<Archive>> arch;
     for( int i=0; i<num; i++ )
     {
-        if( IsArchiveAvailable( *ptr ) )
-        {
-            arch.emplace_back( m_arch[*ptr].get() );
-        }
-        ptr++;
+        auto a = LoadArchive( *ptr++ );
+        if( a ) arch.emplace_back( std::move( a ) );
     }
     assert( !arch.empty() );
     if( arch.size() == 1 ) return true;
@@ -162,14 +235,11 @@ bool Galaxy::AreParentsSame( uint32_t idx, const uint8_t* msgid ) const
     auto ptr = m_midgr[idx];
     auto num = *ptr++;
 
-    std::vector<Archive*> arch;
+    std::vector<std::shared_ptr<Archive>> arch;
     for( int i=0; i<num; i++ )
     {
-        if( IsArchiveAvailable( *ptr ) )
-        {
-            arch.emplace_back( m_arch[*ptr].get() );
-        }
-        ptr++;
+        auto a = LoadArchive( *ptr++ );
+        if( a ) arch.emplace_back( std::move( a ) );
     }
     assert( !arch.empty() );
     if( arch.size() == 1 ) return true;
@@ -233,12 +303,14 @@ int32_t Galaxy::GetIndirectIndex( uint32_t idx ) const
 
 int Galaxy::ParentDepth( const uint8_t* msgid, uint32_t arch ) const
 {
+    const auto archive = LoadArchive( arch );
+    if( !archive ) return 0;
     int num = -1;
-    auto idx = m_arch[arch]->GetMessageIndex( msgid );
+    auto idx = archive->GetMessageIndex( msgid );
     do
     {
         num++;
-        idx = m_arch[arch]->GetParent( idx );
+        idx = archive->GetParent( idx );
     }
     while( idx != -1 );
     return num;
@@ -246,10 +318,12 @@ int Galaxy::ParentDepth( const uint8_t* msgid, uint32_t arch ) const
 
 int Galaxy::NumberOfChildren( const uint8_t* msgid, uint32_t arch ) const
 {
-    return m_arch[arch]->GetChildren( msgid ).size;
+    const auto archive = LoadArchive( arch );
+    return archive ? archive->GetChildren( msgid ).size : 0;
 }
 
 int Galaxy::TotalNumberOfChildren( const uint8_t* msgid, uint32_t arch ) const
 {
-    return m_arch[arch]->GetTotalChildrenCount( msgid );
+    const auto archive = LoadArchive( arch );
+    return archive ? archive->GetTotalChildrenCount( msgid ) : 0;
 }
\ No newline at end of file
@@ -3,6 +3,7 @@
 
 #include <assert.h>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <vector>
 
@@ -14,23 +15,28 @@
 #include "Archive.hpp"
 #include "ViewReference.hpp"
 
+// Archives are opened on first use. If the maximum number of open archives is set,
+// least recently used archives are closed when the limit is exceeded. Archives stay
+// mapped for as long as someone holds the returned pointer. Archives which fail to
+// open are no longer available, and null is returned for them.
 class Galaxy
 {
 public:
-    static Galaxy* Open( const std::string& fn );
+    static Galaxy* Open( const std::string& fn, size_t maxOpen = 0 );
 
     size_t GetNumberOfArchives() const { return m_arch.size(); }
-    const std::vector<int>& GetAvailableArchives() const { return m_available; }
-    const std::shared_ptr<Archive>& GetArchive( int idx, bool change = true );
+    std::vector<int> GetAvailableArchives() const;
+    std::shared_ptr<Archive> GetArchive( int idx, bool change = true );
 
-    bool IsArchiveAvailable( int idx ) const { return bool( m_arch[idx] ); }
+    bool IsArchiveAvailable( int idx ) const;
     std::string GetArchiveFilename( int idx ) const { return std::string( m_archives[idx*2], m_archives[idx*2+1] ); }
     const char* GetArchiveName( int idx ) const { return m_strings[idx*2]; }
     const char* GetArchiveDescription( int idx ) const { return m_strings[idx*2+1]; }
-    int NumberOfMessages( int idx ) const { return m_arch[idx]->NumberOfMessages(); }
-    int NumberOfTopLevel( int idx ) const { return m_arch[idx]->NumberOfTopLevel(); }
+    bool HasArchiveCounts() const { return m_count.DataSize() == m_archives.Size(); }
+    int NumberOfMessages( int idx ) const;
+    int NumberOfTopLevel( int idx ) const;
 
-    int GetActiveArchive() const { return m_active; }
+    int GetActiveArchive() const;
 
     int GetMessageIndex( const uint8_t* msgid ) const { return m_midhash.Search( msgid ); }
     const uint8_t* GetMessageId( uint32_t idx ) const { return m_middb[idx]; }
@@ -49,25 +55,38 @@ public:
     ViewReference<uint32_t> GetIndirectParents( uint32_t indirect_idx ) const { assert( indirect_idx != -1 ); auto ptr = m_indirect[indirect_idx*2]; auto num = *ptr++; return ViewReference<uint32_t> { ptr, num }; }
     ViewReference<uint32_t> GetIndirectChildren( uint32_t indirect_idx ) const { assert( indirect_idx != -1 ); auto ptr = m_indirect[indirect_idx*2+1]; auto num = *ptr++; return ViewReference<uint32_t> { ptr, num }; }
 
+    // Sum of histograms of all archives. Uses precomputed histogram, if available.
+    DayHistogram GetDayHistogram() const;
+
     int ParentDepth( const uint8_t* msgid, uint32_t arch ) const;
     int NumberOfChildren( const uint8_t* msgid, uint32_t arch ) const;
     int TotalNumberOfChildren( const uint8_t* msgid, uint32_t arch ) const;
 
 private:
-    Galaxy( const std::string& dir );
+    Galaxy( const std::string& dir, size_t maxOpen );
+
+    std::shared_ptr<Archive> LoadArchive( int idx ) const;
 
     std::string m_base;
     const MetaView<uint64_t, uint8_t> m_middb;
     const HashSearchBig m_midhash;
     const MetaView<uint32_t, char> m_archives;
     const MetaView<uint32_t, char> m_strings;
+    const FileMap<uint32_t> m_count;
     const MetaView<uint32_t, uint32_t> m_midgr;
     const MetaView<uint32_t, uint32_t> m_indirect;
     const FileMap<uint64_t> m_indirectDense;
     const StringCompress m_compress;
 
-    std::vector<std::shared_ptr<Archive>> m_arch;
-    std::vector<int> m_available;
+    mutable std::vector<int> m_available;
+
+    mutable std::vector<std::string> m_path;    // empty, if archive is not available
+    mutable std::vector<std::shared_ptr<Archive>> m_arch;
+    mutable std::vector<uint64_t> m_lastUse;
+    mutable uint64_t m_useCounter;
+    mutable size_t m_numOpen;
+    mutable std::mutex m_lock;
+    const size_t m_maxOpen;
 
     int m_active;
 };
@@ -25,13 +25,19 @@ PackageAccess::PackageAccess( const std::string& fn, uint32_t version )
     : m_file( fn )
     , m_version( version )
 {
-    memcpy( m_sizes, m_file + PackageHeaderSize, PackageFiles * sizeof( uint64_t ) );
-    uint64_t offset = PackageHeaderSize + PackageFiles * sizeof( uint64_t );
-    for( int i=0; i<PackageFiles; i++ )
+    const auto numfiles = PackageNumberOfFiles( version );
+    memcpy( m_sizes, m_file + PackageHeaderSize, numfiles * sizeof( uint64_t ) );
+    uint64_t offset = PackageHeaderSize + numfiles * sizeof( uint64_t );
+    for( int i=0; i<numfiles; i++ )
     {
         m_offsets[i] = offset;
         offset = PackageAlign( offset + m_sizes[i] );
     }
+    for( int i=numfiles; i<PackageFiles; i++ )
+    {
+        m_sizes[i] = 0;
+        m_offsets[i] = 0;
+    }
 }
 
 FileMapPtrs PackageAccess::Get( PackageFile::type fn ) const
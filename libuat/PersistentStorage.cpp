@@ -1,23 +1,34 @@
+#include <algorithm>
 #include <ctype.h>
+#include <iterator>
 #include <stdlib.h>
 #include <sstream>
 #include <mutex>
 
+#include "../contrib/xxhash/xxhash.h"
 #include "../common/FileMap.hpp"
 #include "../common/Filesystem.hpp"
 #include "../common/String.hpp"
 
 #include "PersistentStorage.hpp"
 #include "Score.hpp"
+#include "ScoreMatcher.hpp"
 
-enum { BufSize = 1024 * 1024 };
+enum { VisitedCompactThreshold = 16 * 1024 };
 
 static const char* LastOpenArchive = "lastopen";
 static const char* LastOpenGalaxyArchive = "lastgalaxy";
 static const char* LastArticle = "article-";
 static const char* Visited = "visited";
+static const char* VisitedTable = "visited.table";
+static const char* VisitedLog = "visited.log";
 static const char* Score = "score";
 
+static uint64_t HashMsgId( const char* msgid )
+{
+    return XXH64( msgid, strlen( msgid ), 0 );
+}
+
 static std::string GetSavePath()
 {
 #if defined _MSC_VER || defined __CYGWIN__ || defined __MINGW32__
@@ -51,21 +62,15 @@ static std::string GetSavePath()
 
 PersistentStorage::PersistentStorage()
     : m_base( GetSavePath() )
-    , m_visitedTimestamp( 0 )
+    , m_visitedGeneration( 0 )
+    , m_visitedLogRead( 0 )
     , m_visitedGuard( ( m_base + Visited ).c_str() )
-    , m_currBuf( nullptr )
-    , m_bufLeft( 0 )
     , m_articleHistory( 256 )
 {
-    m_visited.reserve( 64 * 1024 );
 }
 
 PersistentStorage::~PersistentStorage()
 {
-    for( auto& buf : m_buffers )
-    {
-        delete[] buf;
-    }
 }
 
 void PersistentStorage::WriteLastOpenArchive( const char* archive )
@@ -185,72 +190,199 @@ bool PersistentStorage::ReadArticleHistory( const char* archive )
 
 bool PersistentStorage::WasVisited( const char* msgid )
 {
-    if( std::chrono::duration_cast<std::chrono::milliseconds>( std::chrono::steady_clock::now() - m_visitedLastVerify ).count() < 500 )
-    {
-        return m_visited.find( msgid ) != m_visited.end();
-    }
-    if( m_visited.find( msgid ) != m_visited.end() ) return true;
+    const auto hash = HashMsgId( msgid );
+    if( IsVisited( hash ) ) return true;
+    if( std::chrono::duration_cast<std::chrono::milliseconds>( std::chrono::steady_clock::now() - m_visitedLastVerify ).count() < 500 ) return false;
     std::lock_guard<LockedFile> lg( m_visitedGuard );
-    VerifyVisitedAreValid( m_visitedGuard );
-    return m_visited.find( msgid ) != m_visited.end();
+    VerifyVisitedAreValid();
+    return IsVisited( hash );
 }
 
 bool PersistentStorage::MarkVisited( const char* msgid )
 {
-    if( m_visited.find( msgid ) != m_visited.end() ) return false;
+    const auto hash = HashMsgId( msgid );
+    if( IsVisited( hash ) ) return false;
     std::lock_guard<LockedFile> lg( m_visitedGuard );
-    VerifyVisitedAreValid( m_visitedGuard );
-    m_visited.emplace( StoreString( msgid ) );
+    VerifyVisitedAreValid();
+    if( IsVisited( hash ) ) return false;
+    m_visitedLog.emplace( hash );
     CreateDirStruct( m_base );
-    FILE* f = fopen( m_visitedGuard, "ab" );
+    FILE* f = fopen( ( m_base + VisitedLog ).c_str(), m_visitedLogRead == 0 ? "wb" : "ab" );
     if( f )
     {
-        fwrite( msgid, 1, strlen( msgid ) + 1, f );
+        if( m_visitedLogRead == 0 )
+        {
+            fwrite( &m_visitedGeneration, 1, sizeof( m_visitedGeneration ), f );
+            m_visitedLogRead = sizeof( m_visitedGeneration );
+        }
+        fwrite( &hash, 1, sizeof( hash ), f );
         fclose( f );
-        m_visitedTimestamp = GetFileMTime( m_visitedGuard );
+        m_visitedLogRead += sizeof( hash );
     }
+    if( m_visitedLog.size() >= VisitedCompactThreshold ) CompactVisited();
     return true;
 }
 
-const char* PersistentStorage::StoreString( const char* str )
+bool PersistentStorage::IsVisited( uint64_t hash ) const
+{
+    if( m_visitedLog.find( hash ) != m_visitedLog.end() ) return true;
+    if( !m_visitedTable ) return false;
+    const uint64_t* table = *m_visitedTable;
+    return std::binary_search( table + 1, table + m_visitedTable->DataSize(), hash );
+}
+
+// Table file starts with generation number, followed by sorted hashes. Log file
+// starts with generation of the table it extends, followed by appended hashes.
+// Each compaction increases generation, which tells other processes to remap
+// the table and read the log from start. Otherwise only log tail is read.
+void PersistentStorage::VerifyVisitedAreValid()
 {
-    const auto size = strlen( str ) + 1;
-    if( size > m_bufLeft )
+    bool compact = false;
+    bool partial = false;
+    uint64_t generation;
+    FILE* f = fopen( ( m_base + VisitedLog ).c_str(), "rb" );
+    if( f && fread( &generation, 1, sizeof( generation ), f ) == sizeof( generation ) )
     {
-        m_currBuf = new char[BufSize];
-        m_bufLeft = BufSize;
-        m_buffers.emplace_back( m_currBuf );
+        if( m_visitedLogRead == 0 || generation != m_visitedGeneration )
+        {
+            LoadVisitedTable();
+            m_visitedLog.clear();
+            m_visitedLogRead = sizeof( generation );
+        }
+        ReadVisitedLog( f );
+        fseek( f, 0, SEEK_END );
+        // Generation mismatch or partial entry at end of log are left by
+        // interrupted compaction or write.
+        partial = uint64_t( ftell( f ) ) != m_visitedLogRead;
+        compact = generation != m_visitedGeneration || partial;
     }
-    memcpy( m_currBuf, str, size );
-    const auto ret = m_currBuf;
-    m_currBuf += size;
-    m_bufLeft -= size;
-    return ret;
+    else
+    {
+        // Table may still have been replaced by other process.
+        uint64_t tableGeneration = 0;
+        FILE* t = fopen( ( m_base + VisitedTable ).c_str(), "rb" );
+        if( t )
+        {
+            if( fread( &tableGeneration, 1, sizeof( tableGeneration ), t ) != sizeof( tableGeneration ) ) tableGeneration = 0;
+            fclose( t );
+        }
+        if( tableGeneration != m_visitedGeneration ) LoadVisitedTable();
+        m_visitedLog.clear();
+        m_visitedLogRead = 0;
+    }
+    if( f ) fclose( f );
+    // Partial entry is dropped, so that appends stay aligned even if compaction fails.
+    if( partial ) TruncateFile( m_base + VisitedLog, m_visitedLogRead );
+
+    if( IsFile( m_visitedGuard ) )
+    {
+        ConvertVisitedStrings();
+    }
+    else if( compact )
+    {
+        CompactVisited();
+    }
+    m_visitedLastVerify = std::chrono::steady_clock::now();
 }
 
-void PersistentStorage::VerifyVisitedAreValid( const std::string& fn )
+void PersistentStorage::LoadVisitedTable()
 {
-    if( !Exists( fn ) ) return;
+    m_visitedTable.reset();
+    m_visitedGeneration = 0;
+    const auto fn = m_base + VisitedTable;
+    if( GetFileSize( fn.c_str() ) < sizeof( uint64_t ) ) return;
+    m_visitedTable = std::make_unique<FileMap<uint64_t>>( fn, true );
+    if( !*m_visitedTable )
+    {
+        m_visitedTable.reset();
+        return;
+    }
+    m_visitedGeneration = **m_visitedTable;
+}
 
-    const auto timestamp = GetFileMTime( fn.c_str() );
-    if( timestamp > m_visitedTimestamp )
+void PersistentStorage::ReadVisitedLog( FILE* f )
+{
+    uint64_t buf[1024];
+    fseek( f, m_visitedLogRead, SEEK_SET );
+    size_t num;
+    while( ( num = fread( buf, sizeof( uint64_t ), 1024, f ) ) != 0 )
+    {
+        for( size_t i=0; i<num; i++ )
+        {
+            m_visitedLog.emplace( buf[i] );
+        }
+        m_visitedLogRead += num * sizeof( uint64_t );
+    }
+}
+
+bool PersistentStorage::CompactVisited()
+{
+    std::vector<uint64_t> log( m_visitedLog.begin(), m_visitedLog.end() );
+    std::sort( log.begin(), log.end() );
+
+    std::vector<uint64_t> data;
+    data.emplace_back( m_visitedGeneration + 1 );
+    if( m_visitedTable )
+    {
+        const uint64_t* table = *m_visitedTable;
+        data.reserve( m_visitedTable->DataSize() + log.size() );
+        std::set_union( table + 1, table + m_visitedTable->DataSize(), log.begin(), log.end(), std::back_inserter( data ) );
+    }
+    else
+    {
+        data.insert( data.end(), log.begin(), log.end() );
+    }
+
+    CreateDirStruct( m_base );
+    const auto fn = m_base + VisitedTable;
+    const auto tmp = fn + ".new";
+    FILE* f = fopen( tmp.c_str(), "wb" );
+    if( !f ) return false;
+    const auto size = data.size() * sizeof( uint64_t );
+    const auto written = fwrite( data.data(), 1, size, f );
+    fclose( f );
+    m_visitedTable.reset();
+    // Table may be mapped by other process, preventing the replace. Old table and log
+    // are kept in such case and compaction is retried later.
+    if( written != size || !MoveReplace( tmp, fn ) )
+    {
+        remove( tmp.c_str() );
+        LoadVisitedTable();
+        return false;
+    }
+
+    m_visitedLog.clear();
+    m_visitedLogRead = 0;
+    LoadVisitedTable();
+    f = fopen( ( m_base + VisitedLog ).c_str(), "wb" );
+    if( f )
     {
-        m_visitedTimestamp = timestamp;
-        FileMap<char> fmap( fn );
+        if( fwrite( &m_visitedGeneration, 1, sizeof( m_visitedGeneration ), f ) == sizeof( m_visitedGeneration ) ) m_visitedLogRead = sizeof( m_visitedGeneration );
+        fclose( f );
+    }
+    return true;
+}
+
+// Converts list of message id strings used by previous versions.
+void PersistentStorage::ConvertVisitedStrings()
+{
+    const std::string& fn = m_visitedGuard;
+    if( GetFileSize( fn.c_str() ) != 0 )
+    {
+        FileMap<char> fmap( fn, true );
         auto ptr = (const char*)fmap;
+        if( !ptr ) return;
         auto datasize = fmap.Size();
         while( datasize > 0 )
         {
-            const auto size = strlen( ptr );
-            if( m_visited.find( ptr ) == m_visited.end() )
-            {
-                m_visited.emplace( StoreString( ptr ) );
-            }
-            ptr += size + 1;
-            datasize -= size + 1;
+            const auto size = strnlen( ptr, datasize );
+            m_visitedLog.emplace( XXH64( ptr, size, 0 ) );
+            const auto adv = std::min<uint64_t>( size + 1, datasize );
+            ptr += adv;
+            datasize -= adv;
         }
     }
-    m_visitedLastVerify = std::chrono::steady_clock::now();
+    if( CompactVisited() ) remove( fn.c_str() );
 }
 
 void PersistentStorage::LoadScore()
@@ -351,8 +483,9 @@ void PersistentStorage::Preload()
 {
     m_preloadThread = std::thread( [this] {
         LoadScore();
+        m_scoreMatcher = std::make_unique<ScoreMatcher>( m_scoreList );
         std::lock_guard<LockedFile> lg( m_visitedGuard );
-        VerifyVisitedAreValid( m_visitedGuard );
+        VerifyVisitedAreValid();
     } );
 }
 
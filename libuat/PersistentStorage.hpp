@@ -2,19 +2,22 @@
 #define __PERSISTENTSTORAGE_HPP__
 
 #include <chrono>
+#include <memory>
 #include <stdint.h>
+#include <stdio.h>
 #include <string>
 #include <string.h>
 #include <thread>
 #include <vector>
 
 #include "../contrib/martinus/robin_hood.h"
-#include "../contrib/xxhash/xxhash.h"
+#include "../common/FileMap.hpp"
 #include "../common/ring_buffer.hpp"
 
 #include "LockedFile.hpp"
 
 struct ScoreEntry;
+class ScoreMatcher;
 
 class PersistentStorage
 {
@@ -38,32 +41,36 @@ public:
     bool MarkVisited( const char* msgid );
 
     const std::vector<ScoreEntry>& GetScoreList() const { return m_scoreList; }
+    const ScoreMatcher& GetScoreMatcher() const { return *m_scoreMatcher; }
 
     void Preload();
     void WaitPreload();
 
 private:
-    struct hash { size_t operator()( const char* v ) const { return XXH32( v, strlen( v ), 0 ); } };
-    struct equal_to { bool operator()( const char* l, const char* r ) const { return strcmp( l, r ) == 0; } };
-
     std::string CreateLastArticleFilename( const char* archive );
-    const char* StoreString( const char* str );
-    void VerifyVisitedAreValid( const std::string& fn );
+
+    bool IsVisited( uint64_t hash ) const;
+    void VerifyVisitedAreValid();
+    void LoadVisitedTable();
+    void ReadVisitedLog( FILE* f );
+    bool CompactVisited();
+    void ConvertVisitedStrings();
 
     void LoadScore();
 
     std::string m_base;
-    robin_hood::unordered_flat_set<const char*, hash, equal_to> m_visited;
-    uint64_t m_visitedTimestamp;
+    // Visited messages are identified by 64 bit hashes of message ids. Sorted
+    // table is mapped from disk, hashes added since last compaction are in log.
+    std::unique_ptr<FileMap<uint64_t>> m_visitedTable;
+    uint64_t m_visitedGeneration;
+    robin_hood::unordered_flat_set<uint64_t> m_visitedLog;
+    uint64_t m_visitedLogRead;
     LockedFile m_visitedGuard;
     std::chrono::steady_clock::time_point m_visitedLastVerify;
 
-    std::vector<char*> m_buffers;
-    char* m_currBuf;
-    size_t m_bufLeft;
-
     ring_buffer<uint32_t> m_articleHistory;
     std::vector<ScoreEntry> m_scoreList;
+    std::unique_ptr<ScoreMatcher> m_scoreMatcher;
 
     std::thread m_preloadThread;
 };
@@ -0,0 +1,135 @@
+#include <assert.h>
+#include <atomic>
+#include <ctype.h>
+#include <string.h>
+
+#include "../common/System.hpp"
+#include "../common/TaskDispatch.hpp"
+
+#include "Archive.hpp"
+#include "ScoreMatcher.hpp"
+
+static void FoldCase( char* dst, const char* src, size_t len )
+{
+    for( size_t i=0; i<len; i++ ) dst[i] = tolower( (unsigned char)src[i] );
+}
+
+ScoreMatcher::ScoreMatcher( const std::vector<ScoreEntry>& scoreList )
+    : m_jobs( 0 )
+    , m_empty( true )
+{
+    // Keys of exact match tables point to these strings, which must not be reallocated.
+    m_strings.reserve( scoreList.size() );
+
+    for( auto& v : scoreList )
+    {
+        assert( v.field >= 0 && v.field < 3 );
+        auto& field = m_field[v.field];
+        if( v.exact )
+        {
+            m_strings.emplace_back( v.match );
+            auto& str = m_strings.back();
+            if( v.ignoreCase )
+            {
+                FoldCase( str.data(), str.data(), str.size() );
+                field.exactIgnoreCase[str] += v.score;
+            }
+            else
+            {
+                field.exact[str] += v.score;
+            }
+        }
+        else
+        {
+            try
+            {
+                field.regex.emplace_back( Regex { std::regex( v.match, std::regex::flag_type( std::regex_constants::ECMAScript | ( v.ignoreCase ? std::regex_constants::icase : 0 ) ) ), v.score } );
+            }
+            catch( const std::regex_error& )
+            {
+                continue;
+            }
+        }
+        m_empty = false;
+    }
+
+    // Exact matches are cheap. Only regular expressions are worth spreading to other cores.
+    const auto cpus = System::CPUCores();
+    if( cpus > 1 && ( !m_field[SF_RealName].regex.empty() || !m_field[SF_From].regex.empty() || !m_field[SF_Subject].regex.empty() ) )
+    {
+        m_tasks = std::make_unique<TaskDispatch>( cpus - 1 );
+        m_jobs = cpus;
+    }
+}
+
+ScoreMatcher::~ScoreMatcher()
+{
+}
+
+int ScoreMatcher::Score( const Archive& archive, uint32_t idx ) const
+{
+    if( m_empty ) return 0;
+    return Score( m_field[SF_RealName], archive.GetRealName( idx ) ) +
+           Score( m_field[SF_From], archive.GetFrom( idx ) ) +
+           Score( m_field[SF_Subject], archive.GetSubject( idx ) );
+}
+
+void ScoreMatcher::Score( const Archive& archive, uint32_t begin, uint32_t end, int* out ) const
+{
+    if( !m_tasks )
+    {
+        for( uint32_t i=begin; i<end; i++ ) *out++ = Score( archive, i );
+        return;
+    }
+
+    std::atomic<uint32_t> cnt( begin );
+    for( size_t t=0; t<m_jobs; t++ )
+    {
+        m_tasks->Queue( [this, &cnt, &archive, begin, end, out] {
+            for(;;)
+            {
+                const auto j = cnt.fetch_add( 0x40, std::memory_order_relaxed );
+                if( j >= end ) break;
+                const auto jend = std::min( end, j + 0x40 );
+                for( uint32_t i=j; i<jend; i++ )
+                {
+                    out[i-begin] = Score( archive, i );
+                }
+            }
+        } );
+    }
+    m_tasks->Sync();
+}
+
+int ScoreMatcher::Score( const Field& field, const char* str ) const
+{
+    int score = 0;
+    if( !field.exact.empty() || !field.exactIgnoreCase.empty() )
+    {
+        const auto len = strlen( str );
+        if( !field.exact.empty() )
+        {
+            auto it = field.exact.find( std::string_view( str, len ) );
+            if( it != field.exact.end() ) score += it->second;
+        }
+        if( !field.exactIgnoreCase.empty() )
+        {
+            char tmp[1024];
+            std::string heap;
+            char* folded = tmp;
+            if( len > sizeof( tmp ) )
+            {
+                heap.resize( len );
+                folded = heap.data();
+            }
+            FoldCase( folded, str, len );
+            auto it = field.exactIgnoreCase.find( std::string_view( folded, len ) );
+            if( it != field.exactIgnoreCase.end() ) score += it->second;
+        }
+    }
+    for( auto& v : field.regex )
+    {
+        if( std::regex_search( str, v.regex ) ) score += v.score;
+    }
+    return score;
+}
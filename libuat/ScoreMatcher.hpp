@@ -0,0 +1,61 @@
+#ifndef __SCOREMATCHER_HPP__
+#define __SCOREMATCHER_HPP__
+
+#include <memory>
+#include <regex>
+#include <stdint.h>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "../contrib/martinus/robin_hood.h"
+
+#include "Score.hpp"
+
+class Archive;
+class TaskDispatch;
+
+// Score list compiled for matching. Exact matches are looked up in per-field hash
+// tables (with case folded keys for case insensitive entries), regular expressions
+// are built once. Thread safe.
+class ScoreMatcher
+{
+public:
+    ScoreMatcher( const std::vector<ScoreEntry>& scoreList );
+    ~ScoreMatcher();
+
+    bool Empty() const { return m_empty; }
+
+    int Score( const Archive& archive, uint32_t idx ) const;
+    // Scores messages [begin, end) in parallel. Must not be called from multiple threads at once.
+    void Score( const Archive& archive, uint32_t begin, uint32_t end, int* out ) const;
+
+private:
+    using ExactMap = robin_hood::unordered_flat_map<std::string_view, int>;
+
+    struct Regex
+    {
+        std::regex regex;
+        int score;
+    };
+
+    struct Field
+    {
+        ExactMap exact;
+        ExactMap exactIgnoreCase;
+        std::vector<Regex> regex;
+    };
+
+    ScoreMatcher( const ScoreMatcher& ) = delete;
+    ScoreMatcher& operator=( const ScoreMatcher& ) = delete;
+
+    int Score( const Field& field, const char* str ) const;
+
+    Field m_field[3];
+    std::vector<std::string> m_strings;
+    std::unique_ptr<TaskDispatch> m_tasks;
+    size_t m_jobs;
+    bool m_empty;
+};
+
+#endif
@@ -6,9 +6,14 @@
 #include "SearchEngine.hpp"
 
 #include "../contrib/martinus/robin_hood.h"
+#include "../common/CpuDispatch.hpp"
 #include "../common/Slab.hpp"
 #include "../common/String.hpp"
 
+#ifdef CPU_DISPATCH
+#  include <immintrin.h>
+#endif
+
 enum { SlabSize = 128*1024*1024 };
 static thread_local Slab<SlabSize> slab;
 
@@ -29,6 +34,112 @@ struct PostData
     const uint8_t* hits;
 };
 
+// Unfiltered posting list decode. Returns end of output data.
+using DecodePostingsFn = PostData*(*)( const LexiconDataPacket* data, uint32_t size, const uint8_t* lexhit, PostData* out );
+
+static PostData* DecodePostings_Scalar( const LexiconDataPacket* data, uint32_t size, const uint8_t* lexhit, PostData* out )
+{
+    for( uint32_t i=0; i<size; i++ )
+    {
+        uint8_t children = data->postid >> LexiconChildShift;
+        uint8_t hitnum = data->hitoffset >> LexiconHitShift;
+        const uint8_t* hits;
+        if( hitnum == 0 )
+        {
+            hits = lexhit + ( data->hitoffset & LexiconHitOffsetMask );
+            hitnum = *hits++;
+        }
+        else
+        {
+            hits = (const uint8_t*)&data->hitoffset;
+        }
+        *out++ = PostData { data->postid & LexiconPostMask, hitnum, children, hits };
+        data++;
+    }
+    return out;
+}
+
+#ifdef CPU_DISPATCH
+static_assert( sizeof( PostData ) == 16, "Vectorized posting decode requires 16 byte PostData" );
+static_assert( sizeof( LexiconDataPacket ) == 8, "Vectorized posting decode requires 8 byte LexiconDataPacket" );
+
+// Each 64 bit lane holds one packet: post id in low half, hit offset in high half.
+// Out of line hit counts are gathered with 32 bit loads, which is safe, as such
+// hit lists always have at least four hits following the count byte.
+
+CPU_TARGET_AVX2 static PostData* DecodePostings_AVX2( const LexiconDataPacket* data, uint32_t size, const uint8_t* lexhit, PostData* out )
+{
+    const auto vpostmask = _mm256_set1_epi64x( LexiconPostMask );
+    const auto vchildmask = _mm256_set1_epi64x( LexiconChildMax );
+    const auto voffmask = _mm256_set1_epi64x( LexiconHitOffsetMask );
+    const auto vbytemask = _mm256_set1_epi64x( 0xFF );
+    const auto vlexhit = _mm256_set1_epi64x( (int64_t)lexhit );
+    const auto vone = _mm256_set1_epi64x( 1 );
+    const auto vinline = _mm256_setr_epi64x( 4, 12, 20, 28 );
+    const auto vzero = _mm256_setzero_si256();
+    const auto veven = _mm256_setr_epi32( 0, 2, 4, 6, 0, 2, 4, 6 );
+
+    uint32_t i = 0;
+    for( ; i+4<=size; i+=4 )
+    {
+        const auto v = _mm256_loadu_si256( (const __m256i*)( data + i ) );
+        const auto postid = _mm256_and_si256( v, vpostmask );
+        const auto children = _mm256_and_si256( _mm256_srli_epi64( v, LexiconChildShift ), vchildmask );
+        const auto hitnum = _mm256_srli_epi64( v, 32 + LexiconHitShift );
+        const auto offset = _mm256_and_si256( _mm256_srli_epi64( v, 32 ), voffmask );
+        const auto indirect = _mm256_cmpeq_epi64( hitnum, vzero );
+        const auto gmask = _mm256_castsi256_si128( _mm256_permutevar8x32_epi32( indirect, veven ) );
+        const auto gathered = _mm256_cvtepu32_epi64( _mm256_mask_i64gather_epi32( _mm_setzero_si128(), (const int*)lexhit, offset, gmask, 1 ) );
+        const auto num = _mm256_blendv_epi8( hitnum, _mm256_and_si256( gathered, vbytemask ), indirect );
+        const auto inl = _mm256_add_epi64( _mm256_set1_epi64x( (int64_t)( data + i ) ), vinline );
+        const auto ptr = _mm256_blendv_epi8( inl, _mm256_add_epi64( _mm256_add_epi64( vlexhit, offset ), vone ), indirect );
+        const auto w0 = _mm256_or_si256( postid, _mm256_or_si256( _mm256_slli_epi64( num, 32 ), _mm256_slli_epi64( children, 40 ) ) );
+        const auto lo = _mm256_unpacklo_epi64( w0, ptr );
+        const auto hi = _mm256_unpackhi_epi64( w0, ptr );
+        _mm256_storeu_si256( (__m256i*)( out + i ), _mm256_permute2x128_si256( lo, hi, 0x20 ) );
+        _mm256_storeu_si256( (__m256i*)( out + i + 2 ), _mm256_permute2x128_si256( lo, hi, 0x31 ) );
+    }
+    return DecodePostings_Scalar( data + i, size - i, lexhit, out + i );
+}
+
+CPU_TARGET_AVX512 static PostData* DecodePostings_AVX512( const LexiconDataPacket* data, uint32_t size, const uint8_t* lexhit, PostData* out )
+{
+    const auto vpostmask = _mm512_set1_epi64( LexiconPostMask );
+    const auto vchildmask = _mm512_set1_epi64( LexiconChildMax );
+    const auto voffmask = _mm512_set1_epi64( LexiconHitOffsetMask );
+    const auto vbytemask = _mm512_set1_epi64( 0xFF );
+    const auto vlexhit = _mm512_set1_epi64( (int64_t)lexhit );
+    const auto vone = _mm512_set1_epi64( 1 );
+    const auto vinline = _mm512_setr_epi64( 4, 12, 20, 28, 36, 44, 52, 60 );
+    const auto vidx0 = _mm512_setr_epi64( 0, 8, 1, 9, 2, 10, 3, 11 );
+    const auto vidx1 = _mm512_setr_epi64( 4, 12, 5, 13, 6, 14, 7, 15 );
+
+    uint32_t i = 0;
+    for( ; i+8<=size; i+=8 )
+    {
+        const auto v = _mm512_loadu_si512( data + i );
+        const auto postid = _mm512_and_si512( v, vpostmask );
+        const auto children = _mm512_and_si512( _mm512_srli_epi64( v, LexiconChildShift ), vchildmask );
+        const auto hitnum = _mm512_srli_epi64( v, 32 + LexiconHitShift );
+        const auto offset = _mm512_and_si512( _mm512_srli_epi64( v, 32 ), voffmask );
+        const __mmask8 indirect = _mm512_testn_epi64_mask( hitnum, hitnum );
+        const auto gathered = _mm512_cvtepu32_epi64( _mm512_mask_i64gather_epi32( _mm256_setzero_si256(), indirect, offset, lexhit, 1 ) );
+        const auto num = _mm512_mask_and_epi64( hitnum, indirect, gathered, vbytemask );
+        const auto inl = _mm512_add_epi64( _mm512_set1_epi64( (int64_t)( data + i ) ), vinline );
+        const auto ptr = _mm512_mask_add_epi64( inl, indirect, _mm512_add_epi64( vlexhit, offset ), vone );
+        const auto w0 = _mm512_or_si512( postid, _mm512_or_si512( _mm512_slli_epi64( num, 32 ), _mm512_slli_epi64( children, 40 ) ) );
+        _mm512_storeu_si512( out + i, _mm512_permutex2var_epi64( w0, vidx0, ptr ) );
+        _mm512_storeu_si512( out + i + 4, _mm512_permutex2var_epi64( w0, vidx1, ptr ) );
+    }
+    return DecodePostings_Scalar( data + i, size - i, lexhit, out + i );
+}
+#else
+#  define DecodePostings_AVX2 nullptr
+#  define DecodePostings_AVX512 nullptr
+#endif
+
+static const DecodePostingsFn DecodePostings = CpuDispatch::Select<DecodePostingsFn>( DecodePostings_Scalar, nullptr, DecodePostings_AVX2, DecodePostings_AVX512 );
+
 
 SearchEngine::SearchEngine( const Archive& archive )
     : m_archive( archive )
@@ -189,15 +300,17 @@ static SearchResult PrepareResults( uint32_t postid, float rank, int hitsize )
     return ret;
 }
 
-uint32_t SearchEngine::ExtractWords( const std::vector<std::string>& terms, int flags, std::vector<WordData>& words, std::vector<const char*>& matched ) const
+uint32_t SearchEngine::ExtractWords( const std::vector<std::string_view>& terms, int flags, std::vector<WordData>& words, std::vector<const char*>& matched ) const
 {
     robin_hood::unordered_flat_set<uint32_t> wordset;
     uint32_t group = 0;
     words.reserve( terms.size() );
+    std::string term;
+    std::vector<const char*> processed;
     for( auto& v : terms )
     {
         uint32_t wf = WF_None;
-        const char* str = v.c_str();
+        const char* str = v.data();
         const char* strend = str + v.size();
         bool strictMatch = false;
         bool matchAll = false;
@@ -250,20 +363,20 @@ uint32_t SearchEngine::ExtractWords( const std::vector<std::string>& terms, int
             }
         }
 
-        std::vector<std::string> processed;
+        processed.clear();
         if( !matchAll )
         {
-            processed.emplace_back( str, strend );
+            term.assign( str, strend );
+            processed.emplace_back( term.c_str() );
         }
         else
         {
             auto& meta = m_archive.m_lexmeta;
             auto& data = m_archive.m_lexstr;
-            const auto dataSize = meta.DataSize();
+            const auto dataSize = meta.Size();
             for( uint32_t i=0; i<dataSize; i++ )
             {
-                auto mp = meta + i;
-                auto s = data + mp->str;
+                auto s = data + meta[i].str;
                 if( strncmp( s, str, strend - str ) == 0 )
                 {
                     processed.emplace_back( s );
@@ -274,7 +387,7 @@ uint32_t SearchEngine::ExtractWords( const std::vector<std::string>& terms, int
         bool added = false;
         for( auto& word : processed )
         {
-            auto res = m_archive.m_lexhash.Search( word.c_str() );
+            auto res = m_archive.m_lexhash.Search( word );
             if( res >= 0 && wordset.find( res ) == wordset.end() )
             {
                 words.emplace_back( WordData { uint32_t( res ), 1.f, wf, group, strictMatch } );
@@ -337,6 +450,7 @@ std::vector<SearchEngine::PostDataVec> SearchEngine::GetPostsForWords( const std
 
         auto meta = m_archive.m_lexmeta[v];
         auto data = m_archive.m_lexdata + ( meta.data / sizeof( LexiconDataPacket ) );
+        auto lexhit = m_archive.m_lexhit + meta.hit;
 
         const auto allocSize = meta.dataSize;
         if( allocSize * sizeof( PostData ) > SlabSize )
@@ -347,14 +461,18 @@ std::vector<SearchEngine::PostDataVec> SearchEngine::GetPostsForWords( const std
         auto pdata = (PostData*)slab.Alloc( sizeof( PostData ) * allocSize );
         auto ptr = pdata;
 
-        for( uint32_t i=0; i<meta.dataSize; i++ )
+        if( filter == T_All && !( wf & ( WF_From | WF_Subject ) ) )
+        {
+            ptr = DecodePostings( data, meta.dataSize, lexhit, pdata );
+        }
+        else for( uint32_t i=0; i<meta.dataSize; i++ )
         {
             uint8_t children = data->postid >> LexiconChildShift;
             uint8_t hitnum = data->hitoffset >> LexiconHitShift;
             const uint8_t* hits;
             if( hitnum == 0 )
             {
-                hits = m_archive.m_lexhit + ( data->hitoffset & LexiconHitOffsetMask );
+                hits = lexhit + ( data->hitoffset & LexiconHitOffsetMask );
                 hitnum = *hits++;
             }
             else
@@ -828,6 +946,14 @@ std::vector<SearchResult> SearchEngine::GetFullResult( const std::vector<SearchE
 }
 
 SearchData SearchEngine::Search( const std::vector<std::string>& terms, int flags, int filter ) const
+{
+    std::vector<std::string_view> views;
+    views.reserve( terms.size() );
+    for( auto& v : terms ) views.emplace_back( v );
+    return Search( views, flags, filter );
+}
+
+SearchData SearchEngine::Search( const std::vector<std::string_view>& terms, int flags, int filter ) const
 {
     SearchData ret;
 
@@ -3,6 +3,7 @@
 
 #include <stdint.h>
 #include <string>
+#include <string_view>
 #include <vector>
 
 #include "../common/LexiconTypes.hpp"
@@ -55,11 +56,12 @@ public:
 
     SearchData Search( const char* query, int flags = SF_FlagsNone, int filter = T_All ) const;
     SearchData Search( const std::vector<std::string>& terms, int flags = SF_FlagsNone, int filter = T_All ) const;
+    SearchData Search( const std::vector<std::string_view>& terms, int flags = SF_FlagsNone, int filter = T_All ) const;
 
 private:
     using PostDataVec = std::pair<uint32_t, PostData*>;
 
-    uint32_t ExtractWords( const std::vector<std::string>& terms, int flags, std::vector<WordData>& words, std::vector<const char*>& matched ) const;
+    uint32_t ExtractWords( const std::vector<std::string_view>& terms, int flags, std::vector<WordData>& words, std::vector<const char*>& matched ) const;
     std::vector<PostDataVec> GetPostsForWords( const std::vector<WordData>& words, int filter ) const;
     int FixupFlags( int flags ) const;
 
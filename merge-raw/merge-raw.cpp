@@ -1,8 +1,12 @@
+#include <algorithm>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string>
 #include <string.h>
+#include <vector>
+
+#include "../contrib/martinus/robin_hood.h"
 
 #include "../common/Filesystem.hpp"
 #include "../common/HashSearch.hpp"
@@ -10,13 +14,101 @@
 #include "../common/MetaView.hpp"
 #include "../common/RawImportMeta.hpp"
 #include "../common/StringCompress.hpp"
+#include "../common/System.hpp"
+#include "../common/TaskDispatch.hpp"
+#include "../common/WideOffsets.hpp"
+
+enum { BatchSize = 64 * 1024 };
+enum { WriteBufferSize = 4 * 1024 * 1024 };
+
+// Frames of consecutive messages are usually adjacent in source data file and
+// are written with a single call.
+class Output
+{
+public:
+    Output( const std::string& base, uint64_t offset )
+        : m_meta( Open( base + "meta" ) )
+        , m_data( Open( base + "data" ) )
+        , m_offset( offset )
+    {
+    }
+
+    ~Output()
+    {
+        Flush();
+        fclose( m_meta );
+        fclose( m_data );
+    }
+
+    void WriteData( const void* ptr, size_t size ) { Write( ptr, size, m_data ); }
+    void WriteMeta( const void* ptr, size_t size ) { Write( ptr, size, m_meta ); }
+
+    void Add( const MessageView::RawMessage& raw )
+    {
+        if( m_run + m_runSize != raw.ptr )
+        {
+            FlushRun();
+            m_run = raw.ptr;
+        }
+        m_runSize += raw.compressedSize;
+        m_metaBuf.emplace_back( RawImportMeta { m_offset, uint32_t( raw.size ), uint32_t( raw.compressedSize ) } );
+        m_offset += raw.compressedSize;
+    }
+
+    // Must be called before source data is unmapped.
+    void Flush()
+    {
+        FlushRun();
+        if( !m_metaBuf.empty() )
+        {
+            WriteMeta( m_metaBuf.data(), sizeof( RawImportMeta ) * m_metaBuf.size() );
+            m_metaBuf.clear();
+        }
+    }
+
+private:
+    static void Write( const void* ptr, size_t size, FILE* f )
+    {
+        if( fwrite( ptr, 1, size, f ) != size )
+        {
+            fprintf( stderr, "Cannot write to destination.\n" );
+            exit( 1 );
+        }
+    }
+
+    static FILE* Open( const std::string& fn )
+    {
+        FILE* f = fopen( fn.c_str(), "wb" );
+        if( !f )
+        {
+            fprintf( stderr, "Cannot open %s for writing.\n", fn.c_str() );
+            exit( 1 );
+        }
+        setvbuf( f, nullptr, _IOFBF, WriteBufferSize );
+        return f;
+    }
+
+    void FlushRun()
+    {
+        if( m_runSize != 0 ) WriteData( m_run, m_runSize );
+        m_run = nullptr;
+        m_runSize = 0;
+    }
+
+    FILE* m_meta;
+    FILE* m_data;
+    uint64_t m_offset;
+
+    const char* m_run = nullptr;
+    size_t m_runSize = 0;
+    std::vector<RawImportMeta> m_metaBuf;
+};
 
 int main( int argc, char** argv )
 {
     if( argc < 4 )
     {
         fprintf( stderr, "USAGE: %s destination source1 source2 [source3...]\n", argv[0] );
-        fprintf( stderr, "NOTE: Specifying more than 2 sources will introduce duplicates in destination directory.\n" );
         exit( 1 );
     }
     if( Exists( argv[1] ) )
@@ -41,19 +133,26 @@ int main( int argc, char** argv )
     basedst += "/";
 
     const MessageView mview1( base1 + "meta", base1 + "data" );
-    const HashSearch<uint8_t> hash1( base1 + "middata", base1 + "midhash", base1 + "midhashdata" );
+    const HashSearch<uint8_t> hash1( base1 + "middata", base1 + "midhash", base1 + "midhashdata", ReadWideOffsets( base1 ) & WideMsgId );
     StringCompress compress1( base1 + "msgid.codebook" );
 
-    std::string metadstfn = basedst + "meta";
-    std::string datadstfn = basedst + "data";
+    auto ptrs = mview1.Pointers();
+    Output out( basedst, ptrs.datasize );
+    out.WriteMeta( ptrs.meta, ptrs.metasize );
+    out.WriteData( ptrs.data, ptrs.datasize );
 
-    FILE* meta3 = fopen( metadstfn.c_str(), "wb" );
-    FILE* data3 = fopen( datadstfn.c_str(), "wb" );
+    const auto cpus = System::CPUCores();
+    TaskDispatch tasks( cpus-1 );
 
-    auto ptrs = mview1.Pointers();
-    uint64_t offset1 = ptrs.datasize;
-    fwrite( ptrs.meta, 1, ptrs.metasize, meta3 );
-    fwrite( ptrs.data, 1, ptrs.datasize, data3 );
+    // Message ids added from sources other than the first one, in code book
+    // of the first source. Messages of the first source are found in hash1.
+    robin_hood::unordered_flat_set<std::string> added;
+    std::vector<std::string> batch( BatchSize );
+
+    const auto size1 = mview1.Size();
+    size_t total = size1;
+    printf( "Src1 size: %zu.\n", size1 );
+    fflush( stdout );
 
     for( int k=3; k<argc; k++ )
     {
@@ -61,46 +160,68 @@ int main( int argc, char** argv )
         base2 += "/";
 
         const MessageView mview2( base2 + "meta", base2 + "data" );
-        const MetaView<uint32_t, uint8_t> mid2( base2 + "midmeta", base2 + "middata" );
+        const WideMetaView<uint8_t> mid2( base2 + "midmeta", base2 + "middata", ReadWideOffsets( base2 ) & WideMsgId );
         StringCompress compress2( base2 + "msgid.codebook" );
 
-        printf( "Src1 size: %zu. Src2 size: %zu.\n", mview1.Size(), mview2.Size() );
-        fflush( stdout );
-
-        uint32_t added = 0;
-        uint32_t dupes = 0;
-        const auto size1 = mview1.Size();
         const auto size2 = mid2.Size();
-        for( int i=0; i<size2; i++ )
+        uint32_t dupes1 = 0;
+        uint32_t dupes = 0;
+        for( size_t i=0; i<size2; i+=BatchSize )
         {
-            if( ( i & 0x1FFF ) == 0 )
+            printf( "%zu/%zu\r", i, size2 );
+            fflush( stdout );
+
+            // Probing the first source is read-only and done in parallel. Empty
+            // string marks messages found there.
+            const auto bsize = std::min<size_t>( BatchSize, size2 - i );
+            const auto chunk = ( bsize + cpus - 1 ) / cpus;
+            for( size_t j=0; j<bsize; j+=chunk )
             {
-                printf( "%i/%zu\r", i, size2 );
-                fflush( stdout );
+                const auto jend = std::min( bsize, j + chunk );
+                tasks.Queue( [&batch, &mid2, &hash1, &compress1, &compress2, i, j, jend] {
+                    uint8_t repack[2048];
+                    for( size_t l=j; l<jend; l++ )
+                    {
+                        const auto len = compress1.Repack( mid2[i+l], repack, compress2 );
+                        if( hash1.Search( repack ) >= 0 )
+                        {
+                            batch[l].clear();
+                        }
+                        else
+                        {
+                            batch[l].assign( (const char*)repack, len - 1 );
+                        }
+                    }
+                } );
             }
+            tasks.Sync();
 
-            uint8_t repack[2048];
-            compress1.Repack( mid2[i], repack, compress2 );
-            if( hash1.Search( repack ) >= 0 )
+            for( size_t l=0; l<bsize; l++ )
             {
-                dupes++;
-            }
-            else
-            {
-                added++;
-                const auto raw = mview2.Raw( i );
-                fwrite( raw.ptr, 1, raw.compressedSize, data3 );
-                RawImportMeta metaPacket = { offset1, uint32_t( raw.size ), uint32_t( raw.compressedSize ) };
-                fwrite( &metaPacket, 1, sizeof( RawImportMeta ), meta3 );
-                offset1 += raw.compressedSize;
+                if( batch[l].empty() )
+                {
+                    dupes1++;
+                }
+                else if( !added.emplace( std::move( batch[l] ) ).second )
+                {
+                    dupes++;
+                }
+                else
+                {
+                    out.Add( mview2.Raw( i+l ) );
+                }
             }
         }
+        out.Flush();
+        printf( "%zu/%zu\n", size2, size2 );
 
-        printf( "%zu posts checked. %i added, %i dupes. %zu unique in src1.\n", size2, added, dupes, size1 - dupes );
+        const auto num = size2 - dupes1 - dupes;
+        total += num;
+        printf( "Src%i: %zu posts checked. %zu added, %i dupes in src1, %i dupes in other sources.\n", k-1, size2, num, dupes1, dupes );
+        fflush( stdout );
     }
 
-    fclose( meta3 );
-    fclose( data3 );
+    printf( "Destination size: %zu.\n", total );
 
     return 0;
 }
@@ -7,6 +7,7 @@
 #include "Socket.hpp"
 
 #include "../common/Filesystem.hpp"
+#include "../common/Kernels.hpp"
 #include "../common/ParseDate.hpp"
 #include "../common/String.hpp"
 
@@ -62,20 +63,7 @@ static bool ReceiveMessage( Socket& sock, const std::string& dir, int article, t
 
     if( dateLimit != 0 )
     {
-        auto src = ptr;
-        auto dst = buf2;
-        while( src < ptr + len )
-        {
-            if( *src != '\r' )
-            {
-                *dst++ = *src++;
-            }
-            else
-            {
-                src++;
-            }
-        }
-        *dst = '\0';
+        buf2[StripCR( ptr, len, buf2 )] = '\0';
 
         auto date = ParseDate( buf2, stats, cache );
         if( date < dateLimit )
@@ -56,19 +56,7 @@ int main( int argc, char** argv )
             fprintf( stderr, "Archive version %i is not supported. Update your tools.\n", tmp[PackageMagicSize] );
         }
 
-        int numfiles = PackageFiles;
-        if( version < 3 )
-        {
-            numfiles -= AdditionalFilesV3;
-            if( version < 2 )
-            {
-                numfiles -= AdditionalFilesV2;
-                if( version < 1 )
-                {
-                    numfiles -= AdditionalFilesV1;
-                }
-            }
-        }
+        const int numfiles = PackageNumberOfFiles( version );
 
         uint64_t sizes[PackageFiles];
         for( int i=0; i<numfiles; i++ )
@@ -10,6 +10,7 @@
 #include "../common/MessageView.hpp"
 #include "../common/MetaView.hpp"
 #include "../common/StringCompress.hpp"
+#include "../common/WideOffsets.hpp"
 
 #define CSTR(x) strcmp( argv[2], x ) == 0
 
@@ -78,8 +79,9 @@ int main( int argc, char** argv )
     base.append( "/" );
 
     MessageView mview( base + "meta", base + "data" );
-    const MetaView<uint32_t, uint8_t> mid( base + "midmeta", base + "middata" );
-    const HashSearch<uint8_t> hash( base + "middata", base + "midhash", base + "midhashdata" );
+    const auto wide = ReadWideOffsets( base );
+    const WideMetaView<uint8_t> mid( base + "midmeta", base + "middata", wide & WideMsgId );
+    const HashSearch<uint8_t> hash( base + "middata", base + "midhash", base + "midhashdata", wide & WideMsgId );
     const StringCompress compress( base + "msgid.codebook" );
 
     const auto size = mview.Size();
@@ -10,6 +10,7 @@
 #include "../common/MetaView.hpp"
 #include "../common/RawImportMeta.hpp"
 #include "../common/StringCompress.hpp"
+#include "../common/WideOffsets.hpp"
 
 int main( int argc, char** argv )
 {
@@ -44,10 +45,10 @@ int main( int argc, char** argv )
     basedst += "/";
 
     const MessageView mview1( base1 + "meta", base1 + "data" );
-    const MetaView<uint32_t, uint8_t> mid1( base1 + "midmeta", base1 + "middata" );
+    const WideMetaView<uint8_t> mid1( base1 + "midmeta", base1 + "middata", ReadWideOffsets( base1 ) & WideMsgId );
     const StringCompress compress1( base1 + "msgid.codebook" );
     const MessageView mview2( base2 + "meta", base2 + "data" );
-    const HashSearch<uint8_t> hash2( base2 + "middata", base2 + "midhash", base2 + "midhashdata" );
+    const HashSearch<uint8_t> hash2( base2 + "middata", base2 + "midhash", base2 + "midhashdata", ReadWideOffsets( base2 ) & WideMsgId );
     const StringCompress compress2( base2 + "msgid.codebook" );
 
     std::string metadstfn = basedst + "meta";
@@ -1,6 +1,6 @@
 #include <algorithm>
 #include <assert.h>
-#include <mutex>
+#include <atomic>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -154,23 +154,20 @@ int main( int argc, char** argv )
 
     Buffer* data = new Buffer[size];
 
-    std::mutex mtx, cntmtx;
     TaskDispatch tasks( cpus-1 );
     uint32_t start = 0;
     uint32_t inPass = ( size + cpus - 1 ) / cpus;
     uint32_t left = size;
-    uint32_t cnt = 0;
+    std::atomic<uint32_t> cnt( 0 );
     for( int i=0; i<cpus; i++ )
     {
         uint32_t todo = std::min( left, inPass );
-        tasks.Queue( [data, zdict, start, todo, &mview, &mtx, &cnt, &cntmtx, size] () {
+        tasks.Queue( [data, zdict, start, todo, &mview, &cnt, size] () {
             auto zctx = ZSTD_createCCtx();
             ExpandingBuffer eb1, eb2;
             for( uint32_t i=start; i<start+todo; i++ )
             {
-                cntmtx.lock();
-                auto c = cnt++;
-                cntmtx.unlock();
+                auto c = cnt.fetch_add( 1, std::memory_order_relaxed );
                 if( ( c & 0x3FF ) == 0 )
                 {
                     printf( "%i/%zu\r", c, size );
@@ -178,11 +175,7 @@ int main( int argc, char** argv )
                 }
 
                 auto raw = mview.Raw( i );
-                auto post = eb1.Request( raw.size );
-                mtx.lock();
-                auto _post = mview[i];
-                memcpy( post, _post, raw.size );
-                mtx.unlock();
+                auto post = mview.GetMessage( i, eb1 );
 
                 auto predSize = ZSTD_compressBound( raw.size );
                 auto dst = eb2.Request( predSize );
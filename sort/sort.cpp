@@ -8,12 +8,15 @@
 
 #include "../common/Filesystem.hpp"
 #include "../common/FileMap.hpp"
+#include "../common/LexiconMetaView.hpp"
+#include "../common/LexiconSingle.hpp"
 #include "../common/LexiconTypes.hpp"
 #include "../common/MessageView.hpp"
 #include "../common/MetaView.hpp"
 #include "../common/RawImportMeta.hpp"
+#include "../common/WideOffsets.hpp"
 
-int Expand( int idx, std::vector<uint32_t>& order, const uint32_t* data, const MetaView<uint32_t, uint32_t>& conn )
+int Expand( int idx, std::vector<uint32_t>& order, const uint32_t* data, const WideMetaView<uint32_t>& conn )
 {
     int cskip = 1;
     data += 3;
@@ -54,7 +57,9 @@ int main( int argc, char** argv )
     std::string base = argv[1];
     base.append( "/" );
 
-    MetaView<uint32_t, uint32_t> conn( base + "connmeta", base + "conndata" );
+    // Reordering doesn't change data sizes, so offset widths of source are kept.
+    const auto wide = ReadWideOffsets( base );
+    WideMetaView<uint32_t> conn( base + "connmeta", base + "conndata", wide & WideConnectivity );
     FileMap<uint32_t> toplevel( base + "toplevel" );
 
     printf( "Sorting..." );
@@ -88,6 +93,8 @@ int main( int argc, char** argv )
     fflush( stdout );
 
     CopyCommonFiles( base, dbase );
+    if( Exists( base + "wide" ) ) CopyFile( base + "wide", dbase + "wide" );
+    if( Exists( base + "timechart" ) ) CopyFile( base + "timechart", dbase + "timechart" );
 
     CopyFile( base + "strings", dbase + "strings" );
 
@@ -185,7 +192,7 @@ int main( int argc, char** argv )
     {
         FILE* data = fopen( ( dbase + "conndata" ).c_str(), "wb" );
         FILE* meta = fopen( ( dbase + "connmeta" ).c_str(), "wb" );
-        uint32_t offset = 0;
+        uint64_t offset = 0;
         for( int i=0; i<conn.Size(); i++ )
         {
             if( ( i & 0x3FF ) == 0 )
@@ -193,7 +200,7 @@ int main( int argc, char** argv )
                 printf( "conn %i/%zu\r", i, size );
                 fflush( stdout );
             }
-            fwrite( &offset, 1, sizeof( offset ), meta );
+            WriteOffset( offset, conn.IsWide(), meta );
 
             auto src = conn[order[i]];
             offset += fwrite( src++, 1, sizeof( uint32_t ), data );     // epoch
@@ -215,7 +222,20 @@ int main( int argc, char** argv )
     }
 
     {
-        FileMap<uint32_t> midmeta( base + "midmeta" );
+        FILE* dst = fopen( ( dbase + "conncol" ).c_str(), "wb" );
+        for( int i=0; i<size; i++ ) fwrite( conn[order[i]], 1, sizeof( uint32_t ), dst );
+        for( int i=0; i<size; i++ )
+        {
+            int32_t parent = conn[order[i]][1];
+            if( parent != -1 ) parent = rev[parent];
+            fwrite( &parent, 1, sizeof( int32_t ), dst );
+        }
+        for( int i=0; i<size; i++ ) fwrite( conn[order[i]] + 2, 1, sizeof( uint32_t ), dst );
+        fclose( dst );
+    }
+
+    {
+        const WideMetaView<uint8_t> midmeta( base + "midmeta", base + "middata", wide & WideMsgId );
         FILE* dst = fopen( ( dbase + "midmeta" ).c_str(), "wb" );
         for( int i=0; i<size; i++ )
         {
@@ -224,15 +244,19 @@ int main( int argc, char** argv )
                 printf( "midmeta %i/%zu\r", i, size );
                 fflush( stdout );
             }
-            fwrite( midmeta + order[i], 1, sizeof( uint32_t ), dst );
+            WriteOffset( midmeta.Offset( order[i] ), midmeta.IsWide(), dst );
         }
         fclose( dst );
         printf( "\n" );
     }
 
     {
-        FileMap<uint32_t> midhash( base + "midhash" );
-        const auto hsize = midhash.DataSize() / 2;
+        // Hash entries are offset and index pairs, either 32 or 64 bit.
+        const bool midwide = wide & WideMsgId;
+        FileMap<char> midhash( base + "midhash" );
+        const auto hsize = midhash.Size() / ( midwide ? sizeof( uint64_t ) * 2 : sizeof( uint32_t ) * 2 );
+        const auto hash32 = (const uint32_t*)(const char*)midhash;
+        const auto hash64 = (const uint64_t*)(const char*)midhash;
         FILE* dst = fopen( ( dbase + "midhash" ).c_str(), "wb" );
         for( int i=0; i<hsize; i++ )
         {
@@ -241,16 +265,17 @@ int main( int argc, char** argv )
                 printf( "midhash %i/%zu\r", i, hsize );
                 fflush( stdout );
             }
-            if( midhash[i*2] > 0 )
+            const uint64_t offset = midwide ? hash64[i*2] : hash32[i*2];
+            if( offset > 0 )
             {
-                uint32_t idx = rev[midhash[i*2+1]];
-                fwrite( midhash+i*2, 1, sizeof( uint32_t ), dst );
-                fwrite( &idx, 1, sizeof( uint32_t ), dst );
+                const uint64_t idx = rev[midwide ? hash64[i*2+1] : hash32[i*2+1]];
+                WriteOffset( offset, midwide, dst );
+                WriteOffset( idx, midwide, dst );
             }
             else
             {
-                uint64_t zero = 0;
-                fwrite( &zero, 1, sizeof( uint64_t ), dst );
+                WriteOffset( 0, midwide, dst );
+                WriteOffset( 0, midwide, dst );
             }
         }
         fclose( dst );
@@ -258,15 +283,15 @@ int main( int argc, char** argv )
     }
 
     {
-        FileMap<LexiconMetaPacket> lexmeta( base + "lexmeta" );
+        const LexiconMetaView lexmeta( base + "lexmeta", wide & WideLexicon );
         FileMap<LexiconDataPacket> lexdata( base + "lexdata" );
 
         FILE* dst = fopen( ( dbase + "lexdata" ).c_str(), "wb" );
-        for( int i=0; i<lexmeta.DataSize(); i++ )
+        for( int i=0; i<lexmeta.Size(); i++ )
         {
             if( ( i & 0x3FF ) == 0 )
             {
-                printf( "lexdata %i/%zu\r", i, lexmeta.DataSize() );
+                printf( "lexdata %i/%zu\r", i, lexmeta.Size() );
                 fflush( stdout );
             }
             auto meta = lexmeta[i];
@@ -283,8 +308,27 @@ int main( int argc, char** argv )
         printf( "\n" );
     }
 
+    if( Exists( base + "lexsingle" ) )
     {
-        FileMap<uint32_t> strmeta( base + "strmeta" );
+        const FileMap<char> lexsingle( base + "lexsingle", true );
+        FILE* dst = fopen( ( dbase + "lexsingle" ).c_str(), "wb" );
+        if( lexsingle.Size() != 0 )
+        {
+            auto ptr = (const char*)lexsingle;
+            const auto end = ptr + lexsingle.Size();
+            while( ptr < end )
+            {
+                LexiconSingle rec;
+                ptr = ReadLexiconSingle( ptr, rec );
+                rec.postid = rev[rec.postid];
+                WriteLexiconSingle( rec, dst );
+            }
+        }
+        fclose( dst );
+    }
+
+    {
+        const WideMetaView<char> strmeta( base + "strmeta", base + "strings", wide & WideStrings );
 
         FILE* dst = fopen( ( dbase + "strmeta" ).c_str(), "wb" );
         for( int i=0; i<size; i++ )
@@ -294,7 +338,10 @@ int main( int argc, char** argv )
                 printf( "strmeta %i/%zu\r", i, size );
                 fflush( stdout );
             }
-            fwrite( strmeta + order[i] * 3, 1, sizeof( uint32_t ) * 3, dst );
+            for( int j=0; j<3; j++ )
+            {
+                WriteOffset( strmeta.Offset( order[i] * 3 + j ), strmeta.IsWide(), dst );
+            }
         }
         fclose( dst );
         printf( "\n" );
@@ -12,14 +12,18 @@
 #include "GalaxyOpen.hpp"
 #include "GalaxyWarp.hpp"
 
+enum { PrefetchAhead = 4 };
+enum { PrefetchBehind = 2 };
+
 Browser::Browser( std::shared_ptr<Archive>&& archive, PersistentStorage& storage, Galaxy* galaxy, const std::string& fn )
     : m_archive( std::move( archive ) )
     , m_storage( storage )
     , m_galaxy( galaxy )
     , m_header( m_archive->GetArchiveName(), m_archive->GetShortDescription().second > 0 ? m_archive->GetShortDescription().first : nullptr, fn.c_str(), galaxy != nullptr )
     , m_bottom( this )
-    , m_mview( *m_archive, m_storage )
-    , m_tview( *m_archive, m_storage, m_galaxy, m_mview )
+    , m_prefetcher( *m_archive, m_galaxy, m_storage.GetScoreMatcher() )
+    , m_mview( *m_archive, m_storage, m_prefetcher )
+    , m_tview( *m_archive, m_storage, m_galaxy, m_mview, m_prefetcher )
     , m_sview( this, m_bottom, *m_archive, m_storage )
     , m_textview( this )
     , m_chartview( this, *m_archive, m_bottom, m_galaxy )
@@ -80,6 +84,8 @@ bool Browser::MoveOrEnterAction( int move )
             m_storage.AddToHistory( idx );
             m_historyIdx = history.size()-1;
         }
+
+        m_mview.PrefetchMessages( m_tview.GetNeighbours( cursor, PrefetchAhead, PrefetchBehind ) );
     }
     return ret;
 }
@@ -329,9 +335,18 @@ void Browser::Entry()
                                     if( key == 'y' || key == 'Y' || key == KEY_ENTER || key == '\n' || key == 459 )
                                     {
                                         auto archive = m_galaxy->GetArchive( *groups.ptr );
-                                        SwitchArchive( archive, m_galaxy->GetArchiveFilename( *groups.ptr ) );
-                                        archive->RepackMsgId( gpack, pack, m_galaxy->GetCompress() );
-                                        SwitchToMessage( archive->GetMessageIndex( pack ) );
+                                        if( archive )
+                                        {
+                                            SwitchArchive( archive, m_galaxy->GetArchiveFilename( *groups.ptr ) );
+                                            archive->RepackMsgId( gpack, pack, m_galaxy->GetCompress() );
+                                            SwitchToMessage( archive->GetMessageIndex( pack ) );
+                                        }
+                                        else
+                                        {
+                                            std::string s = m_galaxy->GetArchiveName( *groups.ptr );
+                                            s += " is not available.";
+                                            m_bottom.Status( s.c_str() );
+                                        }
                                     }
                                 }
                                 else
@@ -564,6 +579,7 @@ void Browser::SwitchArchive( const std::shared_ptr<Archive>& archive, std::strin
     m_storage.WriteArticleHistory( m_fn.c_str() );
 
     std::swap( fn, m_fn );
+    m_prefetcher.Reset( *archive );
     m_archive = archive;
 
     m_header.Change( m_archive->GetArchiveName(), m_archive->GetShortDescription().second > 0 ? m_archive->GetShortDescription().first : nullptr, m_fn.c_str() );
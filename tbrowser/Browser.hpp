@@ -8,6 +8,7 @@
 #include "ChartView.hpp"
 #include "HeaderBar.hpp"
 #include "MessageView.hpp"
+#include "Prefetcher.hpp"
 #include "TextView.hpp"
 #include "ThreadView.hpp"
 #include "SearchView.hpp"
@@ -46,6 +47,7 @@ private:
 
     HeaderBar m_header;
     BottomBar m_bottom;
+    Prefetcher m_prefetcher;
     MessageView m_mview;
     ThreadView m_tview;
     SearchView m_sview;
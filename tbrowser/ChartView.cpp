@@ -284,51 +284,40 @@ void ChartView::Prepare()
     int w, h;
     getmaxyx( m_win, h, w );
 
-    uint32_t tbegin = std::numeric_limits<uint32_t>::max();
-    uint32_t tend = std::numeric_limits<uint32_t>::min();
-
-    size_t msgsz;
+    // Whole archive and galaxy charts are binned from day histograms, which are cached.
+    const DayHistogram* chart = nullptr;
     if( m_galaxyMode )
     {
         assert( m_galaxy );
-        msgsz = 0;
-        const auto archsz = m_galaxy->GetNumberOfArchives();
-        for( size_t i=0; i<archsz; i++ )
-        {
-            if( !m_galaxy->IsArchiveAvailable( i ) ) continue;
-            auto& arch = m_galaxy->GetArchive( i, false );
-            const auto sz = arch->NumberOfMessages();
-            for( uint32_t i=0; i<sz; i++ )
-            {
-                const auto t = arch->GetDate( i );
-                if( t != 0 )
-                {
-                    if( t < tbegin ) tbegin = t;
-                    if( t > tend ) tend = t;
-                }
-            }
-            msgsz += sz;
-        }
+        if( !m_galaxyChart ) m_galaxyChart = std::make_unique<DayHistogram>( m_galaxy->GetDayHistogram() );
+        chart = m_galaxyChart.get();
     }
     else if( m_posts.empty() || m_trend )
     {
-        msgsz = m_archive->NumberOfMessages();
-        for( uint32_t i=0; i<msgsz; i++ )
+        if( !m_archiveChart ) m_archiveChart = std::make_unique<DayHistogram>( m_archive->GetDayHistogram() );
+        chart = m_archiveChart.get();
+    }
+
+    uint32_t tbegin = std::numeric_limits<uint32_t>::max();
+    uint32_t tend = std::numeric_limits<uint32_t>::min();
+
+    if( chart )
+    {
+        if( chart->Empty() )
         {
-            const auto t = m_archive->GetDate( i );
-            if( t != 0 )
-            {
-                if( t < tbegin ) tbegin = t;
-                if( t > tend ) tend = t;
-            }
+            tbegin = tend = 0;
+        }
+        else
+        {
+            tbegin = chart->FirstDay() * DayHistogram::DaySeconds;
+            tend = chart->LastDay() * DayHistogram::DaySeconds + DayHistogram::DaySeconds - 1;
         }
     }
     else
     {
-        msgsz = m_posts.size();
-        for( uint32_t i=0; i<msgsz; i++ )
+        for( auto& post : m_posts )
         {
-            const auto t = m_archive->GetDate( m_posts[i] );
+            const auto t = m_archive->GetDate( post );
             if( t != 0 )
             {
                 if( t < tbegin ) tbegin = t;
@@ -346,44 +335,19 @@ void ChartView::Prepare()
 
     std::vector<uint32_t> seg( segments );
 
-    if( m_galaxyMode )
-    {
-        const auto archsz = m_galaxy->GetNumberOfArchives();
-        for( size_t i=0; i<archsz; i++ )
-        {
-            if( !m_galaxy->IsArchiveAvailable( i ) ) continue;
-            auto& arch = m_galaxy->GetArchive( i, false );
-            const auto sz = arch->NumberOfMessages();
-            for( uint32_t i=0; i<sz; i++ )
-            {
-                const auto t = arch->GetDate( i );
-                if( t != 0 )
-                {
-                    const auto s = uint32_t( ( t - tbegin ) * tinv );
-                    assert( s >= 0 && s < segments );
-                    seg[s]++;
-                }
-            }
-        }
-    }
-    else if( m_posts.empty() || m_trend )
+    if( chart )
     {
-        for( uint32_t i=0; i<msgsz; i++ )
-        {
-            const auto t = m_archive->GetDate( i );
-            if( t != 0 )
-            {
-                const auto s = uint32_t( ( t - tbegin ) * tinv );
-                assert( s >= 0 && s < segments );
-                seg[s]++;
-            }
-        }
+        chart->ForEachDay( [&seg, tbegin, tinv, segments] ( uint32_t day, uint32_t cnt ) {
+            const auto s = uint32_t( ( day * DayHistogram::DaySeconds - tbegin ) * tinv );
+            assert( s >= 0 && s < segments );
+            seg[s] += cnt;
+        } );
     }
     else
     {
-        for( uint32_t i=0; i<msgsz; i++ )
+        for( auto& post : m_posts )
         {
-            const auto t = m_archive->GetDate( m_posts[i] );
+            const auto t = m_archive->GetDate( post );
             if( t != 0 )
             {
                 const auto s = uint32_t( ( t - tbegin ) * tinv );
@@ -414,10 +378,9 @@ void ChartView::Prepare()
     if( !m_posts.empty() && m_trend )
     {
         memset( seg.data(), 0, sizeof( uint32_t ) * segments );
-        msgsz = m_posts.size();
-        for( uint32_t i=0; i<msgsz; i++ )
+        for( auto& post : m_posts )
         {
-            const auto t = m_archive->GetDate( m_posts[i] );
+            const auto t = m_archive->GetDate( post );
             if( t != 0 )
             {
                 const auto s = uint32_t( ( t - tbegin ) * tinv );
@@ -438,6 +401,7 @@ void ChartView::Reset( Archive& archive )
 {
     m_archive = &archive;
     m_search = std::make_unique<SearchEngine>( archive );
+    m_archiveChart.reset();
     m_query.clear();
     m_posts.clear();
 }
@@ -1,8 +1,11 @@
 #ifndef __CHARTVIEW_HPP__
 #define __CHARTVIEW_HPP__
 
+#include <memory>
 #include <vector>
 
+#include "../common/DayHistogram.hpp"
+
 #include "View.hpp"
 
 class Archive;
@@ -40,6 +43,9 @@ private:
         char data[7];
     };
 
+    std::unique_ptr<DayHistogram> m_archiveChart;
+    std::unique_ptr<DayHistogram> m_galaxyChart;
+
     std::vector<uint32_t> m_posts;
     std::vector<uint16_t> m_data;
     std::vector<uint16_t> m_trendData;
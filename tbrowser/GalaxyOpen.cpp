@@ -74,18 +74,22 @@ void GalaxyOpen::Entry()
         case KEY_ENTER:
         case '\n':
         case 459:   // numpad enter
-            if( m_galaxy.IsArchiveAvailable( m_cursor ) )
+        {
+            auto archive = m_galaxy.GetArchive( m_cursor );
+            if( archive )
             {
-                m_parent->SwitchArchive( m_galaxy.GetArchive( m_cursor ), m_galaxy.GetArchiveFilename( m_cursor ) );
+                m_parent->SwitchArchive( archive, m_galaxy.GetArchiveFilename( m_cursor ) );
                 m_active = false;
                 return;
             }
             else
             {
                 m_bar.Status( "Archive unavailable!" );
+                Draw();
                 doupdate();
             }
             break;
+        }
         case 's':
         case '/':
             FilterItems( "" );
@@ -153,7 +157,8 @@ void GalaxyOpen::Draw()
         if( !available ) wattron( m_win, COLOR_PAIR( 5 ) );
         wprintw( m_win, "%.*s", int( end - name ), name );
 
-        if( available )
+        // Counts stored in galaxy are used, as opening each listed archive would defeat lazy loading.
+        if( available && m_galaxy.HasArchiveCounts() )
         {
             wattron( m_win, COLOR_PAIR( 8 ) );
             char tmp[64];
@@ -45,10 +45,11 @@ void GalaxyWarp::Entry( const uint8_t* glxid, GalaxyState state, bool showIndire
     for( int i=0; i<groups.size; i++ )
     {
         const auto idx = groups.ptr[i];
-        if( m_galaxy.IsArchiveAvailable( idx ) )
+        const auto archive = m_galaxy.GetArchive( idx, false );
+        if( archive )
         {
             uint8_t local[2048];
-            m_galaxy.GetArchive( idx, false )->RepackMsgId( glxid, local, m_galaxy.GetCompress() );
+            archive->RepackMsgId( glxid, local, m_galaxy.GetCompress() );
 
             m_list.emplace_back( WarpEntry { idx, true, current == idx, false, m_msgid,
                 m_galaxy.ParentDepth( local, idx ),
@@ -84,10 +85,11 @@ void GalaxyWarp::Entry( const uint8_t* glxid, GalaxyState state, bool showIndire
                 for( int j=0; j<igroups.size; j++ )
                 {
                     const auto idx = igroups.ptr[j];
-                    if( m_galaxy.IsArchiveAvailable( idx ) )
+                    const auto archive = m_galaxy.GetArchive( idx, false );
+                    if( archive )
                     {
                         uint8_t local[2048];
-                        m_galaxy.GetArchive( idx, false )->RepackMsgId( imsgid, local, m_galaxy.GetCompress() );
+                        archive->RepackMsgId( imsgid, local, m_galaxy.GetCompress() );
 
                         m_list.emplace_back( WarpEntry { idx, true, false, true, strdup( unpack ),
                             m_galaxy.ParentDepth( local, idx ),
@@ -115,10 +117,11 @@ void GalaxyWarp::Entry( const uint8_t* glxid, GalaxyState state, bool showIndire
                 for( int j=0; j<igroups.size; j++ )
                 {
                     const auto idx = igroups.ptr[j];
-                    if( m_galaxy.IsArchiveAvailable( idx ) )
+                    const auto archive = m_galaxy.GetArchive( idx, false );
+                    if( archive )
                     {
                         uint8_t local[2048];
-                        m_galaxy.GetArchive( idx, false )->RepackMsgId( imsgid, local, m_galaxy.GetCompress() );
+                        archive->RepackMsgId( imsgid, local, m_galaxy.GetCompress() );
 
                         m_list.emplace_back( WarpEntry { idx, true, false, true, strdup( unpack ),
                             m_galaxy.ParentDepth( local, idx ),
@@ -182,6 +185,14 @@ void GalaxyWarp::Entry( const uint8_t* glxid, GalaxyState state, bool showIndire
             if( m_list[m_cursor].available )
             {
                 auto archive = m_galaxy.GetArchive( m_list[m_cursor].id );
+                if( !archive )
+                {
+                    m_list[m_cursor].available = false;
+                    m_bar.Status( "Archive unavailable!" );
+                    Draw();
+                    doupdate();
+                    break;
+                }
                 uint8_t pack[2048];
                 archive->PackMsgId( m_list[m_cursor].msgid, pack );
                 m_parent->SwitchArchive( archive, m_galaxy.GetArchiveFilename( m_list[m_cursor].id ) );
@@ -216,6 +227,7 @@ void GalaxyWarp::Cleanup()
     m_preview.clear();
     m_treeCache.clear();
     m_treeCacheMap.clear();
+    m_treeArchive.clear();
 }
 
 void GalaxyWarp::Resize()
@@ -382,9 +394,10 @@ void GalaxyWarp::DrawPreview( int size )
     size--;
 
     if( !m_list[m_cursor].available ) return;
-    if( m_preview[m_cursor].end == 0 )
+    if( m_preview[m_cursor].end == 0 && !PreparePreview( m_cursor ) )
     {
-        PreparePreview( m_cursor );
+        m_list[m_cursor].available = false;
+        return;
     }
 
     auto idx = m_preview[m_cursor].idx;
@@ -407,10 +420,11 @@ void GalaxyWarp::DrawPreview( int size )
     }
 }
 
-void GalaxyWarp::PreparePreview( int cursor )
+bool GalaxyWarp::PreparePreview( int cursor )
 {
     const auto aid = m_list[cursor].id;
-    auto& archive = m_galaxy.GetArchive( aid, false );
+    const auto archive = m_galaxy.GetArchive( aid, false );
+    if( !archive ) return false;
     uint8_t pack[2048];
     archive->PackMsgId( m_list[cursor].msgid, pack );
     auto idx = archive->GetMessageIndex( pack );
@@ -423,6 +437,7 @@ void GalaxyWarp::PreparePreview( int cursor )
         treeid = m_treeCache.size();
         m_treeCacheMap.emplace( aid, treeid );
         m_treeCache.emplace_back( std::make_unique<ThreadTree>( *archive, m_storage, &m_galaxy ) );
+        m_treeArchive.emplace_back( archive );
     }
     else
     {
@@ -439,6 +454,7 @@ void GalaxyWarp::PreparePreview( int cursor )
     }
 
     m_preview[cursor] = PreviewEntry { treeid, begin, (int)end, idx };
+    return true;
 }
 
 void GalaxyWarp::MoveCursor( int offset )
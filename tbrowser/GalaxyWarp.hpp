@@ -9,6 +9,7 @@
 #include "GalaxyState.hpp"
 #include "View.hpp"
 
+class Archive;
 class BottomBar;
 class Browser;
 class Galaxy;
@@ -50,7 +51,7 @@ private:
     void DrawPreview( int size );
 
     void Cleanup();
-    void PreparePreview( int cursor );
+    bool PreparePreview( int cursor );
 
     Browser* m_parent;
     BottomBar& m_bar;
@@ -60,6 +61,7 @@ private:
     std::vector<WarpEntry> m_list;
     std::vector<PreviewEntry> m_preview;
     std::vector<std::unique_ptr<ThreadTree>> m_treeCache;
+    std::vector<std::shared_ptr<Archive>> m_treeArchive;    // keeps archives of cached trees open
     std::map<uint32_t, uint32_t> m_treeCacheMap;
 
     bool m_active;
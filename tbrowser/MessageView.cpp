@@ -8,12 +8,14 @@
 
 #include "LevelColors.hpp"
 #include "MessageView.hpp"
+#include "Prefetcher.hpp"
 #include "Utf8Print.hpp"
 
-MessageView::MessageView( Archive& archive, PersistentStorage& storage )
+MessageView::MessageView( Archive& archive, PersistentStorage& storage, Prefetcher& prefetcher )
     : View( 0, 0, 1, 1 )
     , m_archive( &archive )
     , m_storage( storage )
+    , m_prefetcher( prefetcher )
     , m_idx( -1 )
     , m_linesWidth( -1 )
     , m_active( false )
@@ -75,8 +77,17 @@ bool MessageView::Display( uint32_t idx, int move )
     if( idx != m_idx )
     {
         m_idx = idx;
-        m_text = m_archive->GetMessage( idx, m_eb );
-        PrepareLines();
+        const auto width = CalcLinesWidth();
+        if( width >= 2 && m_prefetcher.GetMessage( idx, width, !m_allHeaders, m_prefetched, m_lines ) )
+        {
+            m_text = m_prefetched.c_str();
+            m_linesWidth = width;
+        }
+        else
+        {
+            m_text = m_archive->GetMessage( idx, m_eb );
+            PrepareLines();
+        }
         m_top = 0;
         // If view is not active, drawing will be performed during resize.
         if( m_active )
@@ -132,6 +143,12 @@ void MessageView::SwitchROT13()
     }
 }
 
+void MessageView::PrefetchMessages( std::vector<uint32_t>&& list )
+{
+    if( m_linesWidth < 2 ) return;
+    m_prefetcher.QueueMessages( std::move( list ), m_linesWidth, !m_allHeaders );
+}
+
 void MessageView::Draw()
 {
     int w, h;
@@ -331,14 +348,16 @@ void MessageView::Draw()
     wnoutrefresh( m_win );
 }
 
-void MessageView::PrepareLines()
+int MessageView::CalcLinesWidth() const
 {
     // window width may be invalid here
-    m_linesWidth = getmaxx( stdscr );
-    if( m_vertical )
-    {
-        m_linesWidth = m_linesWidth - (m_linesWidth/2) - 1;
-    }
+    const auto width = getmaxx( stdscr );
+    return m_vertical ? width - (width/2) - 1 : width;
+}
+
+void MessageView::PrepareLines()
+{
+    m_linesWidth = CalcLinesWidth();
 
     m_lines.Reset();
     if( m_linesWidth < 2 ) return;
@@ -1,6 +1,8 @@
 #ifndef __MESSAGEVIEW_HPP__
 #define __MESSAGEVIEW_HPP__
 
+#include <stdint.h>
+#include <string>
 #include <vector>
 
 #include "View.hpp"
@@ -10,6 +12,7 @@
 
 class Archive;
 class PersistentStorage;
+class Prefetcher;
 
 enum class ViewSplit
 {
@@ -23,7 +26,7 @@ enum class ViewSplit
 class MessageView : public View
 {
 public:
-    MessageView( Archive& archive, PersistentStorage& storage );
+    MessageView( Archive& archive, PersistentStorage& storage, Prefetcher& prefetcher );
 
     void Reset( Archive& archive );
 
@@ -33,6 +36,7 @@ public:
     void Close();
     void SwitchHeaders();
     void SwitchROT13();
+    void PrefetchMessages( std::vector<uint32_t>&& list );
 
     bool IsActive() const { return m_active; }
     uint32_t DisplayedMessage() const { return m_idx; }
@@ -41,13 +45,16 @@ public:
     ViewSplit GetViewSplit() const { return m_viewSplit; }
 
 private:
+    int CalcLinesWidth() const;
     void PrepareLines();
     void PrintRot13( const char* start, const char* end );
 
     ExpandingBuffer m_eb;
     Archive* m_archive;
     PersistentStorage& m_storage;
+    Prefetcher& m_prefetcher;
     MessageLines m_lines;
+    std::string m_prefetched;
     const char* m_text;
     int32_t m_idx;
     int m_top;
@@ -0,0 +1,153 @@
+#include <algorithm>
+
+#include "../common/ExpandingBuffer.hpp"
+#include "../libuat/Archive.hpp"
+#include "../libuat/ScoreMatcher.hpp"
+
+#include "Prefetcher.hpp"
+#include "ThreadTree.hpp"
+
+enum { LineBatch = 64 };
+
+Prefetcher::Prefetcher( const Archive& archive, const Galaxy* galaxy, const ScoreMatcher& matcher )
+    : m_archive( &archive )
+    , m_galaxy( galaxy )
+    , m_matcher( matcher )
+    , m_msgPos( 0 )
+    , m_width( 0 )
+    , m_skipHeaders( true )
+    , m_linePos( 0 )
+    , m_busy( false )
+    , m_exit( false )
+{
+    m_worker = std::thread( [this] { Worker(); } );
+}
+
+Prefetcher::~Prefetcher()
+{
+    m_lock.lock();
+    m_exit = true;
+    m_cvWork.notify_one();
+    m_lock.unlock();
+    m_worker.join();
+}
+
+void Prefetcher::Reset( const Archive& archive )
+{
+    std::unique_lock<std::mutex> lock( m_lock );
+    m_cvIdle.wait( lock, [this] { return !m_busy; } );
+    m_archive = &archive;
+    m_msgQueue.clear();
+    m_msgPos = 0;
+    m_cache.clear();
+    m_lineQueue.clear();
+    m_linePos = 0;
+    m_lineResults.clear();
+}
+
+void Prefetcher::QueueMessages( std::vector<uint32_t>&& list, int width, bool skipHeaders )
+{
+    std::lock_guard<std::mutex> lock( m_lock );
+    m_cache.erase( std::remove_if( m_cache.begin(), m_cache.end(), [&list, width, skipHeaders] ( const Message& v ) {
+        return v.width != width || v.skipHeaders != skipHeaders || std::find( list.begin(), list.end(), v.idx ) == list.end();
+    } ), m_cache.end() );
+    m_msgQueue = std::move( list );
+    m_msgPos = 0;
+    m_width = width;
+    m_skipHeaders = skipHeaders;
+    m_cvWork.notify_one();
+}
+
+bool Prefetcher::GetMessage( uint32_t idx, int width, bool skipHeaders, std::string& text, MessageLines& lines )
+{
+    std::lock_guard<std::mutex> lock( m_lock );
+    auto it = std::find_if( m_cache.begin(), m_cache.end(), [idx] ( const Message& v ) { return v.idx == idx; } );
+    if( it == m_cache.end() || it->width != width || it->skipHeaders != skipHeaders ) return false;
+    std::swap( text, it->text );
+    std::swap( lines, it->lines );
+    m_cache.erase( it );
+    return true;
+}
+
+void Prefetcher::QueueLines( std::vector<uint32_t>&& list )
+{
+    std::lock_guard<std::mutex> lock( m_lock );
+    m_lineQueue = std::move( list );
+    m_linePos = 0;
+    m_cvWork.notify_one();
+}
+
+std::vector<Prefetcher::LineState> Prefetcher::GetLines()
+{
+    std::vector<LineState> ret;
+    std::lock_guard<std::mutex> lock( m_lock );
+    std::swap( ret, m_lineResults );
+    return ret;
+}
+
+bool Prefetcher::IsCached( uint32_t idx ) const
+{
+    return std::find_if( m_cache.begin(), m_cache.end(), [idx] ( const Message& v ) { return v.idx == idx; } ) != m_cache.end();
+}
+
+void Prefetcher::Worker()
+{
+    auto ctx = ZSTD_createDCtx();
+    ExpandingBuffer eb;
+    std::vector<LineState> states;
+
+    std::unique_lock<std::mutex> lock( m_lock );
+    for(;;)
+    {
+        m_cvWork.wait( lock, [this] { return m_exit || m_msgPos < m_msgQueue.size() || m_linePos < m_lineQueue.size(); } );
+        if( m_exit ) break;
+
+        const auto archive = m_archive;
+        if( m_msgPos < m_msgQueue.size() )
+        {
+            const auto idx = m_msgQueue[m_msgPos++];
+            if( IsCached( idx ) ) continue;
+            Message msg { idx, m_width, m_skipHeaders };
+            m_busy = true;
+            lock.unlock();
+
+            auto text = archive->GetMessage( idx, eb, ctx );
+            if( text ) msg.text = text;
+            msg.lines.SetWidth( msg.width );
+            msg.lines.PrepareLines( msg.text.c_str(), msg.skipHeaders );
+
+            lock.lock();
+            m_busy = false;
+            // Message list may have been replaced in the meantime.
+            if( std::find( m_msgQueue.begin(), m_msgQueue.end(), idx ) != m_msgQueue.end() &&
+                msg.width == m_width && msg.skipHeaders == m_skipHeaders && !IsCached( idx ) )
+            {
+                m_cache.emplace_back( std::move( msg ) );
+            }
+        }
+        else
+        {
+            const auto end = std::min<size_t>( m_linePos + LineBatch, m_lineQueue.size() );
+            std::vector<uint32_t> batch( m_lineQueue.begin() + m_linePos, m_lineQueue.begin() + end );
+            m_linePos = end;
+            m_busy = true;
+            lock.unlock();
+
+            states.clear();
+            const bool score = !m_matcher.Empty();
+            for( auto idx : batch )
+            {
+                const auto galaxy = m_galaxy ? ThreadTree::CalcGalaxyState( *archive, *m_galaxy, idx ) : GalaxyState::Unknown;
+                const auto ss = score ? GetScoreStateForValue( m_matcher.Score( *archive, idx ) ) : ScoreState::Neutral;
+                states.emplace_back( LineState { idx, galaxy, ss } );
+            }
+
+            lock.lock();
+            m_busy = false;
+            m_lineResults.insert( m_lineResults.end(), states.begin(), states.end() );
+        }
+        m_cvIdle.notify_all();
+    }
+
+    ZSTD_freeDCtx( ctx );
+}
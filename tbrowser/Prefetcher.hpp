@@ -0,0 +1,84 @@
+#ifndef __PREFETCHER_HPP__
+#define __PREFETCHER_HPP__
+
+#include <condition_variable>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../common/MessageLines.hpp"
+
+#include "GalaxyState.hpp"
+#include "ThreadData.hpp"
+
+class Archive;
+class Galaxy;
+class ScoreMatcher;
+
+// Background worker, which decompresses and lays out messages that will be most
+// probably opened next, and calculates state of thread view lines that are about
+// to be scrolled into view. Results are handed over to the main thread, which
+// is the only one modifying view state.
+class Prefetcher
+{
+public:
+    struct LineState
+    {
+        uint32_t idx;
+        GalaxyState galaxy;
+        ScoreState score;
+    };
+
+    Prefetcher( const Archive& archive, const Galaxy* galaxy, const ScoreMatcher& matcher );
+    ~Prefetcher();
+
+    // Must be called before currently used archive is released.
+    void Reset( const Archive& archive );
+
+    // Replaces list of messages to prefetch. Cached messages not on the list are dropped.
+    void QueueMessages( std::vector<uint32_t>&& list, int width, bool skipHeaders );
+    // Moves message out of cache, if it was prepared with matching parameters.
+    bool GetMessage( uint32_t idx, int width, bool skipHeaders, std::string& text, MessageLines& lines );
+
+    // Replaces list of lines to calculate state of.
+    void QueueLines( std::vector<uint32_t>&& list );
+    std::vector<LineState> GetLines();
+
+private:
+    struct Message
+    {
+        uint32_t idx;
+        int width;
+        bool skipHeaders;
+        std::string text;
+        MessageLines lines;
+    };
+
+    void Worker();
+    bool IsCached( uint32_t idx ) const;
+
+    const Archive* m_archive;
+    const Galaxy* m_galaxy;
+    const ScoreMatcher& m_matcher;
+
+    std::vector<uint32_t> m_msgQueue;
+    size_t m_msgPos;
+    int m_width;
+    bool m_skipHeaders;
+    std::vector<Message> m_cache;
+
+    std::vector<uint32_t> m_lineQueue;
+    size_t m_linePos;
+    std::vector<LineState> m_lineResults;
+
+    std::mutex m_lock;
+    std::condition_variable m_cvWork, m_cvIdle;
+    bool m_busy;
+    bool m_exit;
+
+    std::thread m_worker;
+};
+
+#endif
@@ -382,7 +382,7 @@ void SearchView::FillPreview( int idx )
         return;
     }
 
-    std::vector<std::string> wordbuf;
+    Tokenizer tokenizer;
     for( int h=0; h<res.hitnum; h++ )
     {
         const auto htype = LexiconDecodeType( res.hits[h] );
@@ -400,7 +400,7 @@ void SearchView::FillPreview( int idx )
             QuotationLevel( ptr, end ); // just to walk ptr
             if( linetype[i] == htype )
             {
-                SplitLine( ptr, end, wordbuf, hpos == max );
+                auto& wordbuf = tokenizer.Split( ptr, end, hpos == max );
                 if( basePos + wordbuf.size() > hpos )
                 {
                     auto wptr = ptr;
@@ -409,7 +409,7 @@ void SearchView::FillPreview( int idx )
                         const auto& word = wordbuf[hpos - basePos];
                         for(;;)
                         {
-                            while( strncmp( wptr, word.c_str(), word.size() ) != 0 )
+                            while( strncmp( wptr, word.data(), word.size() ) != 0 )
                             {
                                 wptr++;
                                 assert( wptr <= end - word.size() );
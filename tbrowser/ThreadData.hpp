@@ -28,4 +28,20 @@ enum class ScoreState
     Negative
 };
 
+static inline ScoreState GetScoreStateForValue( int score )
+{
+    if( score == 0 )
+    {
+        return ScoreState::Neutral;
+    }
+    else if( score < 0 )
+    {
+        return ScoreState::Negative;
+    }
+    else
+    {
+        return ScoreState::Positive;
+    }
+}
+
 #endif
@@ -7,6 +7,7 @@
 #include "../libuat/Archive.hpp"
 #include "../libuat/Galaxy.hpp"
 #include "../libuat/PersistentStorage.hpp"
+#include "../libuat/ScoreMatcher.hpp"
 #include "../libuat/ViewReference.hpp"
 #include "../common/UTF8.hpp"
 
@@ -76,84 +77,112 @@ GalaxyState ThreadTree::CheckGalaxyState( int idx ) const
     return current;
 }
 
-GalaxyState ThreadTree::GetGalaxyState( int idx )
+GalaxyState ThreadTree::CalcGalaxyState( const Archive& archive, const Galaxy& galaxy, int idx )
 {
-    assert( m_galaxy );
-    auto state = GetGalaxyStateRaw( idx );
-    if( state == GalaxyState::Unknown )
+    const auto msgid = archive.GetMessageId( idx );
+    uint8_t glxid[2048];
+    galaxy.RepackMsgId( msgid, glxid, archive.GetCompress() );
+    const auto gidx  = galaxy.GetMessageIndex( glxid );
+    assert( strcmp( (const char*)galaxy.GetMessageId( gidx ), (const char*)glxid ) == 0 );
+    const auto groups = galaxy.GetNumberOfGroups( gidx );
+    assert( groups > 0 );
+
+    ViewReference<uint32_t> ip = {};
+    ViewReference<uint32_t> ic = {};
+    const auto ind_idx = galaxy.GetIndirectIndex( gidx );
+    if( ind_idx != -1 )
+    {
+        ip = galaxy.GetIndirectParents( ind_idx );
+        ic = galaxy.GetIndirectChildren( ind_idx );
+    }
+
+    if( groups == 1 && ip.size == 0 && ic.size == 0 )
     {
-        const auto msgid = m_archive->GetMessageId( idx );
-        uint8_t glxid[2048];
-        m_galaxy->RepackMsgId( msgid, glxid, m_archive->GetCompress() );
-        const auto gidx  = m_galaxy->GetMessageIndex( glxid );
-        assert( strcmp( (const char*)m_galaxy->GetMessageId( gidx ), (const char*)glxid ) == 0 );
-        const auto groups = m_galaxy->GetNumberOfGroups( gidx );
-        assert( groups > 0 );
-
-        ViewReference<uint32_t> ip = {};
-        ViewReference<uint32_t> ic = {};
-        const auto ind_idx = m_galaxy->GetIndirectIndex( gidx );
-        if( ind_idx != -1 )
+        return GalaxyState::Nothing;
+    }
+
+    bool parents = ip.size != 0 || !galaxy.AreParentsSame( gidx, glxid );
+    bool children = ic.size != 0 || !galaxy.AreChildrenSame( gidx, glxid );
+    if( parents )
+    {
+        if( children )
         {
-            ip = m_galaxy->GetIndirectParents( ind_idx );
-            ic = m_galaxy->GetIndirectChildren( ind_idx );
+            return GalaxyState::BothDifferent;
         }
-
-        if( groups == 1 && ip.size == 0 && ic.size == 0 )
+        else
         {
-            state = GalaxyState::Nothing;
+            return GalaxyState::ParentDifferent;
+        }
+    }
+    else
+    {
+        if( children )
+        {
+            return GalaxyState::ChildrenDifferent;
         }
         else
         {
-            bool parents = ip.size != 0 || !m_galaxy->AreParentsSame( gidx, glxid );
-            bool children = ic.size != 0 || !m_galaxy->AreChildrenSame( gidx, glxid );
-            if( parents )
-            {
-                if( children )
-                {
-                    state = GalaxyState::BothDifferent;
-                }
-                else
-                {
-                    state = GalaxyState::ParentDifferent;
-                }
-            }
-            else
-            {
-                if( children )
-                {
-                    state = GalaxyState::ChildrenDifferent;
-                }
-                else
-                {
-                    state = GalaxyState::Crosspost;
-                }
-            }
+            return GalaxyState::Crosspost;
         }
+    }
+}
+
+GalaxyState ThreadTree::GetGalaxyState( int idx )
+{
+    assert( m_galaxy );
+    auto state = GetGalaxyStateRaw( idx );
+    if( state == GalaxyState::Unknown )
+    {
+        state = CalcGalaxyState( *m_archive, *m_galaxy, idx );
         SetGalaxyState( idx, state );
     }
     return state;
 }
 
+bool ThreadTree::IsLineStateKnown( int idx ) const
+{
+    return ( !m_galaxy || GetGalaxyStateRaw( idx ) != GalaxyState::Unknown ) && GetScoreStateRaw( idx ) != ScoreState::Unknown;
+}
+
+void ThreadTree::SetLineStates( const std::vector<Prefetcher::LineState>& states )
+{
+    const auto size = m_archive->NumberOfMessages();
+    for( auto& v : states )
+    {
+        if( v.idx >= size ) continue;
+        if( m_galaxy && GetGalaxyStateRaw( v.idx ) == GalaxyState::Unknown ) SetGalaxyState( v.idx, v.galaxy );
+        if( GetScoreStateRaw( v.idx ) == ScoreState::Unknown ) SetScoreState( v.idx, v.score );
+    }
+}
+
 ScoreState ThreadTree::GetScoreState( int idx )
 {
     auto state = GetScoreStateRaw( idx );
     if( state == ScoreState::Unknown )
     {
-        int score = m_archive->GetMessageScore( idx, m_storage.GetScoreList() );
-        if( score == 0 )
+        const auto& matcher = m_storage.GetScoreMatcher();
+        if( matcher.Empty() )
         {
             state = ScoreState::Neutral;
+            SetScoreState( idx, state );
+            return state;
         }
-        else if( score < 0 )
-        {
-            state = ScoreState::Negative;
-        }
-        else
+
+        // Sorted archives keep threads in consecutive messages, so neighbours of
+        // this message will most probably be displayed next.
+        enum { ScoreBlock = 1024 };
+        const auto begin = uint32_t( idx ) & ~uint32_t( ScoreBlock - 1 );
+        const auto end = std::min<uint32_t>( begin + ScoreBlock, m_archive->NumberOfMessages() );
+        int scores[ScoreBlock];
+        m_archive->GetMessageScores( begin, end, matcher, scores );
+        for( uint32_t i=begin; i<end; i++ )
         {
-            state = ScoreState::Positive;
+            if( GetScoreStateRaw( i ) == ScoreState::Unknown )
+            {
+                SetScoreState( i, GetScoreStateForValue( scores[i-begin] ) );
+            }
         }
-        SetScoreState( idx, state );
+        state = GetScoreStateRaw( idx );
     }
     return state;
 }
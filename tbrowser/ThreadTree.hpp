@@ -8,6 +8,7 @@
 
 #include "BitSet.hpp"
 #include "GalaxyState.hpp"
+#include "Prefetcher.hpp"
 #include "ThreadData.hpp"
 
 class Archive;
@@ -25,7 +26,11 @@ public:
     void Reset( const Archive& archive );
     void Cleanup();
 
+    static GalaxyState CalcGalaxyState( const Archive& archive, const Galaxy& galaxy, int idx );
+
     GalaxyState CheckGalaxyState( int idx ) const;
+    bool IsLineStateKnown( int idx ) const;
+    void SetLineStates( const std::vector<Prefetcher::LineState>& states );
     bool WasVisited( int idx );
     int GetRoot( int idx ) const;
     bool CanExpand( int idx ) const;
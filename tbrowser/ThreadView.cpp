@@ -1,15 +1,18 @@
+#include <algorithm>
 #include <assert.h>
 #include <stdlib.h>
 
 #include "../libuat/Archive.hpp"
 
 #include "MessageView.hpp"
+#include "Prefetcher.hpp"
 #include "ThreadView.hpp"
 
-ThreadView::ThreadView( const Archive& archive, PersistentStorage& storage, const Galaxy* galaxy, const MessageView& mview )
+ThreadView::ThreadView( const Archive& archive, PersistentStorage& storage, const Galaxy* galaxy, const MessageView& mview, Prefetcher& prefetcher )
     : View( 0, 1, 0, -2 )
     , m_archive( &archive )
     , m_mview( mview )
+    , m_prefetcher( prefetcher )
     , m_tree( archive, storage, galaxy )
     , m_top( 0 )
     , m_cursor( 0 )
@@ -80,6 +83,7 @@ void ThreadView::Draw()
     getmaxyx( m_win, h, w );
 
     werase( m_win );
+    m_tree.SetLineStates( m_prefetcher.GetLines() );
 
     int cursorLine = -1;
     const char* prev = nullptr;
@@ -124,6 +128,52 @@ void ThreadView::Draw()
     }
 
     wnoutrefresh( m_win );
+
+    PrefetchLines( h-1 );
+}
+
+// Lines of the next and previous page will be most probably displayed next.
+void ThreadView::PrefetchLines( int lines )
+{
+    const int size = m_archive->NumberOfMessages();
+    std::vector<uint32_t> list;
+    list.reserve( lines * 2 );
+    auto next = m_bottom;
+    for( int i=0; i<lines && next < size; i++ )
+    {
+        if( !m_tree.IsLineStateKnown( next ) ) list.emplace_back( next );
+        next = GetNext( next );
+    }
+    auto prev = m_top;
+    for( int i=0; i<lines && prev > 0; i++ )
+    {
+        prev = GetPrev( prev );
+        if( !m_tree.IsLineStateKnown( prev ) ) list.emplace_back( prev );
+    }
+    m_prefetcher.QueueLines( std::move( list ) );
+}
+
+std::vector<uint32_t> ThreadView::GetNeighbours( int cursor, int ahead, int behind )
+{
+    const int size = m_archive->NumberOfMessages();
+    std::vector<uint32_t> ret;
+    ret.reserve( ahead + behind );
+    auto next = cursor;
+    auto prev = cursor;
+    for( int i=0; i<std::max( ahead, behind ); i++ )
+    {
+        if( i < ahead && next < size )
+        {
+            next = GetNext( next );
+            if( next < size ) ret.emplace_back( next );
+        }
+        if( i < behind && prev > 0 )
+        {
+            prev = GetPrev( prev );
+            ret.emplace_back( prev );
+        }
+    }
+    return ret;
 }
 
 void ThreadView::RecalcTopBottom()
@@ -1,6 +1,9 @@
 #ifndef __THREADVIEW_HPP__
 #define __THREADVIEW_HPP__
 
+#include <stdint.h>
+#include <vector>
+
 #include "GalaxyState.hpp"
 #include "ThreadTree.hpp"
 #include "View.hpp"
@@ -9,11 +12,12 @@ class Archive;
 class Galaxy;
 class MessageView;
 class PersistentStorage;
+class Prefetcher;
 
 class ThreadView : public View
 {
 public:
-    ThreadView( const Archive& archive, PersistentStorage& storage, const Galaxy* galaxy, const MessageView& mview );
+    ThreadView( const Archive& archive, PersistentStorage& storage, const Galaxy* galaxy, const MessageView& mview, Prefetcher& prefetcher );
 
     void Reset( const Archive& archive );
 
@@ -32,6 +36,7 @@ public:
     int GetCursor() const { return m_cursor; }
     void SetCursor( int cursor ) { m_cursor = cursor; }
     int GetRoot( int cursor ) const { return m_tree.GetRoot( cursor ); }
+    std::vector<uint32_t> GetNeighbours( int cursor, int ahead, int behind );
 
     void PageForward();
     void PageBackward();
@@ -44,10 +49,12 @@ public:
 private:
     int GetNext( int idx );
     int GetPrev( int idx ) const;
+    void PrefetchLines( int lines );
 
     const Archive* m_archive;
 
     const MessageView& m_mview;
+    Prefetcher& m_prefetcher;
     ThreadTree m_tree;
     int m_top, m_bottom;
     int m_cursor;
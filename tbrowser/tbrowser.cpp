@@ -53,8 +53,19 @@ int main( int argc, char** argv )
         {
             storage.WriteLastOpenArchive( lastOpen.c_str() );
         }
-        lastOpen = galaxy->GetArchiveFilename( galaxyLast );
         archive = galaxy->GetArchive( galaxyLast );
+        for( auto idx : available )
+        {
+            if( archive ) break;
+            galaxyLast = idx;
+            archive = galaxy->GetArchive( galaxyLast );
+        }
+        if( !archive )
+        {
+            fprintf( stderr, "No available archives in galaxy!\n" );
+            return 1;
+        }
+        lastOpen = galaxy->GetArchiveFilename( galaxyLast );
     }
     else
     {
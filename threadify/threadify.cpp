@@ -1,6 +1,7 @@
 #include <assert.h>
 #include <algorithm>
 #include <atomic>
+#include <chrono>
 #include <ctype.h>
 #include <limits>
 #include <memory>
@@ -14,13 +15,16 @@
 #include "../libuat/Archive.hpp"
 #include "../libuat/SearchEngine.hpp"
 #include "../common/ExpandingBuffer.hpp"
+#include "../common/Filesystem.hpp"
 #include "../common/ICU.hpp"
 #include "../common/KillRe.hpp"
 #include "../common/MessageLogic.hpp"
 #include "../common/ReferencesParent.hpp"
 #include "../common/System.hpp"
 #include "../common/TaskDispatch.hpp"
+#include "../common/WideOffsets.hpp"
 #include "../contrib/martinus/robin_hood.h"
+#include "../contrib/xxhash/xxhash.h"
 
 struct Message
 {
@@ -87,17 +91,491 @@ static bool HasUniqueElements( std::vector<T>& v )
     return std::adjacent_find( v.begin(), v.end() ) == v.end();
 }
 
+enum class Verdict : uint8_t
+{
+    None,       // no matching message
+    Time,       // date difference too large
+    Subject,    // subjects do not match
+    Match
+};
+
+struct Candidate
+{
+    uint32_t best;
+    Verdict verdict;
+};
+
+enum class Method
+{
+    Search,     // full search of each quoted line
+    Quote       // quote fingerprint lookup, verified with a single search
+};
+
+using LineList = std::vector<std::pair<const char*, const char*>>;
+
+// Returns up to 16 first level quoted lines, skipping attribution. Quotation marks are not included.
+static void GetQuotedLines( const char* post, LineList& lines )
+{
+    bool headers = true;
+    bool wroteDone = false;
+
+    lines.clear();
+    for(;;)
+    {
+        auto end = post;
+        if( headers )
+        {
+            if( *end == '\n' )
+            {
+                headers = false;
+                continue;
+            }
+
+            while( *end != '\n' ) end++;
+            post = end + 1;
+        }
+        else
+        {
+            const char* line = end;
+            while( *end != '\n' && *end != '\0' ) end++;
+            int quotLevel = QuotationLevel( line, end );
+            if( line != end && quotLevel == 1 )
+            {
+                const char* wrote = line;
+                if( !wroteDone )
+                {
+                    wrote = DetectWroteEnd( line, 1 );
+                    wroteDone = true;
+                }
+                if( wrote == line )
+                {
+                    lines.emplace_back( line, end );
+                    if( lines.size() == 16 ) break;
+                }
+                else
+                {
+                    end = wrote;
+                    while( *end != '\n' ) end--;
+                }
+            }
+            if( *end == '\0' ) break;
+            post = end + 1;
+        }
+    }
+}
+
+static uint32_t PickBest( const robin_hood::unordered_flat_map<uint32_t, float>& hits )
+{
+    // Hash map iteration order is not stable, ties are resolved by message index
+    uint32_t best = 0;
+    float rank = 0;
+    for( auto& h : hits )
+    {
+        if( h.second > rank || ( h.second == rank && h.first < best ) )
+        {
+            rank = h.second;
+            best = h.first;
+        }
+    }
+    return best;
+}
+
+static Verdict Evaluate( const Archive& archive, uint32_t idx, uint32_t best, const KillRe& kr )
+{
+    time_t t1 = archive.GetDate( idx );
+    time_t t2 = archive.GetDate( best );
+    if( ( t1 > t2 + 60 * 60 * 24 * 365 ) ||     // child message is year+ younger than parent
+        ( t1 < t2 - 60 * 60 * 24 * 30 ) )       // child message is month+ older than parent
+    {
+        return Verdict::Time;
+    }
+    if( IsSubjectMatch( archive.GetSubject( idx ), archive.GetSubject( best ), kr ) )
+    {
+        return Verdict::Match;
+    }
+    return Verdict::Subject;
+}
+
+
+// Quote fingerprint index maps hashes of word n-grams (shingles) found in unquoted
+// message content to messages containing them. Only a fixed subset of hash values
+// is stored, which is consistent between indexing and lookup.
+
+enum { ShingleSize = 3 };
+enum { ShingleSampleMask = 0x3 };       // one in four shingles is kept
+enum { QuoteMaxPostings = 64 };         // shingles more common than this are dropped
+enum { QuoteBucketBits = 16 };
+enum { QuotePartitionBits = 6 };
+enum { QuotePartitions = 1 << QuotePartitionBits };
+enum { QuoteFlushSize = 16 * 1024 };    // entries buffered per partition, per thread
+
+struct QuoteEntry
+{
+    uint32_t hash;
+    uint32_t postid;
+
+    bool operator<( const QuoteEntry& other ) const { return hash < other.hash || ( hash == other.hash && postid < other.postid ); }
+    bool operator==( const QuoteEntry& other ) const { return hash == other.hash && postid == other.postid; }
+};
+
+template<class T>
+static void ForEachShingle( const std::vector<std::string_view>& words, T&& cb )
+{
+    if( words.size() < ShingleSize ) return;
+    uint32_t wh[ShingleSize];
+    for( int i=0; i<ShingleSize-1; i++ )
+    {
+        wh[i] = XXH32( words[i].data(), words[i].size(), 0 );
+    }
+    for( size_t i=ShingleSize-1; i<words.size(); i++ )
+    {
+        wh[ShingleSize-1] = XXH32( words[i].data(), words[i].size(), 0 );
+        const auto hash = XXH32( wh, sizeof( wh ), 0 );
+        if( ( hash & ShingleSampleMask ) == 0 ) cb( hash );
+        memmove( wh, wh+1, sizeof( uint32_t ) * ( ShingleSize-1 ) );
+    }
+}
+
+// Entries are distributed to temporary partition files by hash, so that only one
+// partition has to be sorted in memory at a time.
+static void BuildQuoteIndex( const Archive& archive, const std::string& base )
+{
+    const auto size = archive.NumberOfMessages();
+    const auto cpus = System::CPUCores();
+    std::atomic<uint32_t> cnt( 0 );
+    std::mutex lock;
+
+    FILE* part[QuotePartitions];
+    for( int i=0; i<QuotePartitions; i++ )
+    {
+        part[i] = fopen( ( base + "quotetmp" + std::to_string( i ) ).c_str(), "w+b" );
+        if( !part[i] )
+        {
+            fprintf( stderr, "Cannot write quote index\n" );
+            exit( 1 );
+        }
+    }
+
+    TaskDispatch tasks( cpus-1 );
+    for( int t=0; t<cpus; t++ )
+    {
+        tasks.Queue( [&archive, &cnt, &lock, &part, size] {
+            ExpandingBuffer eb;
+            auto ctx = ZSTD_createDCtx();
+            Tokenizer tokenizer;
+            std::vector<QuoteEntry> msg;
+            std::vector<QuoteEntry> out[QuotePartitions];
+
+            auto flush = [&lock, &part] ( std::vector<QuoteEntry>& v, int p ) {
+                std::lock_guard<std::mutex> lg( lock );
+                fwrite( v.data(), 1, sizeof( QuoteEntry ) * v.size(), part[p] );
+                v.clear();
+            };
+
+            for(;;)
+            {
+                const auto i = cnt.fetch_add( 1, std::memory_order_relaxed );
+                if( i >= size ) break;
+                if( ( i & 0x3FF ) == 0 )
+                {
+                    printf( "%i/%zu\r", i, size );
+                    fflush( stdout );
+                }
+
+                auto post = archive.GetMessage( i, eb, ctx );
+                while( *post != '\n' )
+                {
+                    while( *post != '\n' ) post++;
+                    post++;
+                }
+
+                msg.clear();
+                for(;;)
+                {
+                    auto line = post;
+                    auto end = post;
+                    while( *end != '\n' && *end != '\0' ) end++;
+                    if( end - line == 3 && strncmp( line, "-- ", 3 ) == 0 ) break;
+                    if( QuotationLevel( line, end ) == 0 && line != end )
+                    {
+                        ForEachShingle( tokenizer.Split( line, end ), [&msg, i] ( uint32_t hash ) { msg.emplace_back( QuoteEntry { hash, i } ); } );
+                    }
+                    if( *end == '\0' ) break;
+                    post = end + 1;
+                }
+
+                std::sort( msg.begin(), msg.end() );
+                msg.erase( std::unique( msg.begin(), msg.end() ), msg.end() );
+                for( auto& v : msg )
+                {
+                    const auto p = v.hash >> ( 32 - QuotePartitionBits );
+                    out[p].emplace_back( v );
+                    if( out[p].size() == QuoteFlushSize ) flush( out[p], p );
+                }
+            }
+            for( int p=0; p<QuotePartitions; p++ )
+            {
+                if( !out[p].empty() ) flush( out[p], p );
+            }
+            ZSTD_freeDCtx( ctx );
+        } );
+    }
+    tasks.Sync();
+    printf( "%zu/%zu\n", size, size );
+
+    FILE* fmeta = fopen( ( base + "quotemeta" ).c_str(), "wb" );
+    FILE* fdata = fopen( ( base + "quotedata" ).c_str(), "wb" );
+    if( !fmeta || !fdata )
+    {
+        fprintf( stderr, "Cannot write quote index\n" );
+        exit( 1 );
+    }
+
+    uint32_t written = 0;
+    uint32_t bucket = 0;
+    fwrite( &written, 1, sizeof( uint32_t ), fmeta );
+    std::vector<QuoteEntry> entries;
+    for( int p=0; p<QuotePartitions; p++ )
+    {
+        printf( "%i/%i\r", p, QuotePartitions );
+        fflush( stdout );
+
+        entries.resize( ftell( part[p] ) / sizeof( QuoteEntry ) );
+        fseek( part[p], 0, SEEK_SET );
+        if( fread( entries.data(), 1, sizeof( QuoteEntry ) * entries.size(), part[p] ) != sizeof( QuoteEntry ) * entries.size() )
+        {
+            fprintf( stderr, "Cannot read quote index partition\n" );
+            exit( 1 );
+        }
+        fclose( part[p] );
+        remove( ( base + "quotetmp" + std::to_string( p ) ).c_str() );
+
+        std::sort( entries.begin(), entries.end() );
+        entries.erase( std::unique( entries.begin(), entries.end() ), entries.end() );
+
+        auto it = entries.begin();
+        while( it != entries.end() )
+        {
+            auto end = it;
+            while( end != entries.end() && end->hash == it->hash ) end++;
+            if( end - it <= QuoteMaxPostings )
+            {
+                const auto b = it->hash >> ( 32 - QuoteBucketBits );
+                while( bucket < b )
+                {
+                    fwrite( &written, 1, sizeof( uint32_t ), fmeta );
+                    bucket++;
+                }
+                fwrite( &*it, 1, sizeof( QuoteEntry ) * ( end - it ), fdata );
+                written += end - it;
+            }
+            it = end;
+        }
+    }
+    while( bucket < ( 1 << QuoteBucketBits ) )
+    {
+        fwrite( &written, 1, sizeof( uint32_t ), fmeta );
+        bucket++;
+    }
+
+    fclose( fmeta );
+    fclose( fdata );
+
+    printf( "%i/%i\n", QuotePartitions, QuotePartitions );
+    printf( "Quote index: %u entries (%.1f MB)\n", written, written * sizeof( QuoteEntry ) / ( 1024.0 * 1024 ) );
+}
+
+class QuoteIndex
+{
+public:
+    QuoteIndex( const std::string& base )
+        : m_meta( base + "quotemeta" )
+        , m_data( base + "quotedata" )
+    {
+    }
+
+    template<class T>
+    void Lookup( uint32_t hash, T&& cb ) const
+    {
+        const auto bucket = hash >> ( 32 - QuoteBucketBits );
+        const QuoteEntry* data = m_data;
+        auto it = data + m_meta[bucket];
+        auto end = data + m_meta[bucket+1];
+        it = std::lower_bound( it, end, hash, [] ( const auto& l, uint32_t r ) { return l.hash < r; } );
+        while( it != end && it->hash == hash )
+        {
+            cb( it->postid );
+            ++it;
+        }
+    }
+
+private:
+    FileMap<uint32_t> m_meta;
+    FileMap<QuoteEntry> m_data;
+};
+
+// Search phase. Each top level message is processed independently, without
+// looking at the thread structure, which is only resolved afterwards.
+static double FindCandidates( Method method, const Archive& archive, const SearchEngine& search, const QuoteIndex* qidx, const KillRe& kr, const std::vector<uint32_t>& toplevel, std::vector<Candidate>& candidates )
+{
+    const auto topsize = toplevel.size();
+    candidates.resize( topsize );
+
+    const auto t0 = std::chrono::steady_clock::now();
+    const auto cpus = System::CPUCores();
+    TaskDispatch tasks( cpus-1 );
+    std::atomic<uint32_t> cnt( 0 );
+
+    for( int t=0; t<cpus; t++ )
+    {
+        tasks.Queue( [method, &cnt, &topsize, &toplevel, &candidates, &archive, &search, qidx, &kr] {
+            ExpandingBuffer eb;
+            auto ctx = ZSTD_createDCtx();
+            robin_hood::unordered_flat_map<uint32_t, float> hits;
+            Tokenizer tokenizer;
+            LineList lines;
+
+            for(;;)
+            {
+                auto j = cnt.fetch_add( 1, std::memory_order_relaxed );
+                if( j >= topsize ) break;
+                if( ( j & 0x1F ) == 0 )
+                {
+                    printf( "%i/%zu\r", j, topsize );
+                    fflush( stdout );
+                }
+
+                auto i = toplevel[j];
+                GetQuotedLines( archive.GetMessage( i, eb, ctx ), lines );
+
+                auto& cand = candidates[j];
+                cand.verdict = Verdict::None;
+
+                if( method == Method::Search )
+                {
+                    for( auto& line : lines )
+                    {
+                        auto& wordbuf = tokenizer.Split( line.first, line.second );
+                        if( wordbuf.empty() ) continue;
+                        auto results = search.Search( wordbuf, SearchEngine::SF_RequireAllWords | SearchEngine::SF_SimpleSearch, T_Content );
+                        auto& res = results.results;
+                        if( !res.empty() )
+                        {
+                            auto terminate = res[0].rank * 0.02;
+                            auto matched = results.matched.size();
+                            for( auto& r : res )
+                            {
+                                if( r.rank < terminate ) break;
+                                hits[r.postid] += r.rank * matched * matched;
+                            }
+                        }
+                    }
+                    if( hits.empty() ) continue;
+                    cand.best = PickBest( hits );
+                    hits.clear();
+                }
+                else
+                {
+                    for( auto& line : lines )
+                    {
+                        ForEachShingle( tokenizer.Split( line.first, line.second ), [qidx, &hits, i] ( uint32_t hash ) {
+                            qidx->Lookup( hash, [&hits, i] ( uint32_t postid ) { if( postid != i ) hits[postid] += 1; } );
+                        } );
+                    }
+                    if( hits.empty() ) continue;
+                    const auto best = PickBest( hits );
+                    hits.clear();
+
+                    // Verify with a single search of the first line which points to the candidate
+                    bool verified = false;
+                    for( auto& line : lines )
+                    {
+                        auto& wordbuf = tokenizer.Split( line.first, line.second );
+                        bool contains = false;
+                        ForEachShingle( wordbuf, [qidx, best, &contains] ( uint32_t hash ) {
+                            qidx->Lookup( hash, [best, &contains] ( uint32_t postid ) { if( postid == best ) contains = true; } );
+                        } );
+                        if( !contains ) continue;
+                        auto results = search.Search( wordbuf, SearchEngine::SF_RequireAllWords | SearchEngine::SF_SimpleSearch, T_Content );
+                        for( auto& r : results.results )
+                        {
+                            if( r.postid == best )
+                            {
+                                verified = true;
+                                break;
+                            }
+                        }
+                        break;
+                    }
+                    if( !verified ) continue;
+                    cand.best = best;
+                }
+
+                cand.verdict = Evaluate( archive, i, cand.best, kr );
+            }
+            ZSTD_freeDCtx( ctx );
+        } );
+    }
+    tasks.Sync();
+    printf( "%zu/%zu\n", topsize, topsize );
+
+    return std::chrono::duration_cast<std::chrono::microseconds>( std::chrono::steady_clock::now() - t0 ).count() / 1000000.0;
+}
+
+static void Compare( const std::vector<Candidate>& search, double searchTime, const std::vector<Candidate>& quote, double quoteTime )
+{
+    assert( search.size() == quote.size() );
+    uint32_t sc = 0, qc = 0, same = 0, differ = 0, sonly = 0, qonly = 0;
+    uint32_t sm = 0, qm = 0, bm = 0;
+    for( size_t i=0; i<search.size(); i++ )
+    {
+        const auto& s = search[i];
+        const auto& q = quote[i];
+        const bool hs = s.verdict != Verdict::None;
+        const bool hq = q.verdict != Verdict::None;
+        if( hs ) sc++;
+        if( hq ) qc++;
+        if( hs && hq )
+        {
+            if( s.best == q.best ) same++;
+            else differ++;
+        }
+        else if( hs ) sonly++;
+        else if( hq ) qonly++;
+
+        const bool ms = s.verdict == Verdict::Match;
+        const bool mq = q.verdict == Verdict::Match;
+        if( ms ) sm++;
+        if( mq ) qm++;
+        if( ms && mq && s.best == q.best ) bm++;
+    }
+
+    printf( "Search:      %.3f s, %u candidates, %u subject matches\n", searchTime, sc, sm );
+    printf( "Quote index: %.3f s, %u candidates, %u subject matches (%.1fx faster)\n", quoteTime, qc, qm, searchTime / quoteTime );
+    printf( "Candidates: %u same, %u different, %u search only, %u quote index only\n", same, differ, sonly, qonly );
+    printf( "Subject matches found by both: %u (%.1f%% of search)\n", bm, sm == 0 ? 100.0 : 100.0 * bm / sm );
+}
+
 
 int main( int argc, char** argv )
 {
-    if( argc < 2 || ( argc != 3 && ( argc % 2 ) == 1 ) )
+    if( argc < 2 )
     {
-        fprintf( stderr, "USAGE: %s raw ( [-i ignore]* | [-g] )\n", argv[0] );
+        fprintf( stderr, "USAGE: %s raw ( [-i ignore]* [-q | -c] | [-g] )\n", argv[0] );
         fprintf( stderr, "  -i: add string to re:-list filter\n" );
+        fprintf( stderr, "  -q: match quotes using fingerprint index\n" );
+        fprintf( stderr, "  -c: compare search and fingerprint index matching, don't write output\n" );
         fprintf( stderr, "  -g: group threads by scanning for missing references\n" );
         exit( 1 );
     }
 
+    // Quote index and updated thread structure are written into archive directory.
+    if( IsFile( argv[1] ) )
+    {
+        fprintf( stderr, "Packaged archives can't be modified. Extract %s using uat-package -x first.\n", argv[1] );
+        return 1;
+    }
+
     std::string base = argv[1];
     base.append( "/" );
 
@@ -113,10 +591,12 @@ int main( int argc, char** argv )
     kr.LoadPrefixList( *archive );
 
     bool groupMode = false;
+    bool compare = false;
+    Method method = Method::Search;
 
     while( argc > 2 )
     {
-        if( strcmp( argv[2], "-i" ) == 0 )
+        if( strcmp( argv[2], "-i" ) == 0 && argc > 3 )
         {
             kr.Add( argv[3] );
             argv += 2;
@@ -128,6 +608,18 @@ int main( int argc, char** argv )
             argv++;
             argc--;
         }
+        else if( strcmp( argv[2], "-q" ) == 0 )
+        {
+            method = Method::Quote;
+            argv++;
+            argc--;
+        }
+        else if( strcmp( argv[2], "-c" ) == 0 )
+        {
+            compare = true;
+            argv++;
+            argc--;
+        }
         else
         {
             fprintf( stderr, "Bad params!\n" );
@@ -157,7 +649,7 @@ int main( int argc, char** argv )
     fflush( stdout );
     msgdata = new Message[size];
     {
-        MetaView<uint32_t, uint32_t> conn( base + "connmeta", base + "conndata" );
+        WideMetaView<uint32_t> conn( base + "connmeta", base + "conndata", ReadWideOffsets( base ) & WideConnectivity );
         for( int i=0; i<size; i++ )
         {
             if( ( i & 0x3FF ) == 0 )
@@ -294,6 +786,7 @@ int main( int argc, char** argv )
                 }
             }
         }
+        printf( "%zu/%zu\n", topsize, topsize );
     }
     else
     {
@@ -311,155 +804,64 @@ int main( int argc, char** argv )
             root[i] = idx;
         }
 
-        printf( "\nMatching messages...\n" );
-
-        const auto cpus = System::CPUCores();
-        TaskDispatch tasks( cpus-1 );
-        std::atomic<uint32_t> cnt( 0 );
-
-        std::mutex viewLock, resLock, splitLock;
-
-        for( int t=0; t<cpus; t++ )
+        std::unique_ptr<QuoteIndex> qidx;
+        if( method == Method::Quote || compare )
         {
-            tasks.Queue( [&cnt, &topsize, &toplevel, &viewLock, &resLock, &splitLock, &archive, &search, &found, &cntnew, &cntsure, &cntbad, &cnttime, &kr] {
-                ExpandingBuffer eb;
-                robin_hood::unordered_flat_map<uint32_t, float> hits;
-                std::vector<std::string> wordbuf;
-
-                for(;;)
-                {
-                    auto j = cnt.fetch_add( 1, std::memory_order_relaxed );
-                    if( j >= topsize ) break;
-                    if( ( j & 0x1F ) == 0 )
-                    {
-                        printf( "%i/%zu\r", j, topsize );
-                        fflush( stdout );
-                    }
-
-                    auto i = toplevel[j];
-                    bool headers = true;
-                    bool wroteDone = false;
-                    int remaining = 16;
-
-                    viewLock.lock();
-                    auto post = archive->GetMessage( i, eb );
-                    viewLock.unlock();
+            if( !Exists( base + "quotemeta" ) || !Exists( base + "quotedata" ) ||
+                GetFileMTime( ( base + "quotemeta" ).c_str() ) < GetFileMTime( ( base + "zdata" ).c_str() ) )
+            {
+                printf( "\nBuilding quote index...\n" );
+                fflush( stdout );
+                BuildQuoteIndex( *archive, base );
+            }
+            qidx = std::make_unique<QuoteIndex>( base );
+        }
 
-                    for(;;)
-                    {
-                        auto end = post;
-                        if( headers )
-                        {
-                            if( *end == '\n' )
-                            {
-                                headers = false;
-                                continue;
-                            }
+        printf( "\nMatching messages...\n" );
+        fflush( stdout );
 
-                            while( *end != '\n' ) end++;
-                            post = end + 1;
-                        }
-                        else
-                        {
-                            const char* line = end;
-                            while( *end != '\n' && *end != '\0' ) end++;
-                            int quotLevel = QuotationLevel( line, end );
-                            if( line != end && quotLevel == 1 )
-                            {
-                                const char* wrote = line;
-                                if( !wroteDone )
-                                {
-                                    wrote = DetectWroteEnd( line, 1 );
-                                    wroteDone = true;
-                                }
-                                if( wrote == line )
-                                {
-                                    splitLock.lock();
-                                    SplitLine( line, end, wordbuf );
-                                    splitLock.unlock();
-                                    if( !wordbuf.empty() )
-                                    {
-                                        auto results = search.Search( wordbuf, SearchEngine::SF_RequireAllWords | SearchEngine::SF_SimpleSearch, T_Content );
-                                        auto& res = results.results;
-                                        if( !res.empty() )
-                                        {
-                                            auto terminate = res[0].rank * 0.02;
-                                            auto matched = results.matched.size();
-                                            for( auto& r : res )
-                                            {
-                                                if( r.rank < terminate ) break;
-                                                hits[r.postid] += r.rank * matched * matched;
-                                            }
-                                        }
-                                        wordbuf.clear();
-                                    }
-                                    if( --remaining == 0 ) break;
-                                }
-                                else
-                                {
-                                    end = wrote;
-                                    while( *end != '\n' ) end--;
-                                }
-                            }
-                            if( *end == '\0' ) break;
-                            post = end + 1;
-                        }
-                    }
+        std::vector<Candidate> candidates;
+        if( compare )
+        {
+            std::vector<Candidate> quote;
+            const auto searchTime = FindCandidates( Method::Search, *archive, search, nullptr, kr, toplevel, candidates );
+            const auto quoteTime = FindCandidates( Method::Quote, *archive, search, qidx.get(), kr, toplevel, quote );
+            Compare( candidates, searchTime, quote, quoteTime );
+            return 0;
+        }
+        FindCandidates( method, *archive, search, qidx.get(), kr, toplevel, candidates );
 
-                    resLock.lock();
-                    if( hits.empty() )
-                    {
-                        cntnew++;
-                    }
-                    else
-                    {
-                        uint32_t best = 0;
-                        float rank = 0;
-                        for( auto& h : hits )
-                        {
-                            if( h.second > rank )
-                            {
-                                rank = h.second;
-                                best = h.first;
-                            }
-                        }
-                        hits.clear();
-                        if( root[i] == root[best] )
-                        {
-                            cntnew++;
-                        }
-                        else
-                        {
-                            time_t t1 = archive->GetDate( i );
-                            time_t t2 = archive->GetDate( best );
-                            if( ( t1 > t2 + 60 * 60 * 24 * 365 ) ||     // child message is year+ younger than parent
-                                ( t1 < t2 - 60 * 60 * 24 * 30 ) )       // child message is month+ older than parent
-                            {
-                                cnttime++;
-                            }
-                            else
-                            {
-                                if( IsSubjectMatch( archive->GetSubject( i ), archive->GetSubject( best ), kr ) )
-                                {
-                                    cntsure++;
-                                    found.emplace_back( i, best );
-                                    SetRootTo( i, root[best] );
-                                }
-                                else
-                                {
-                                    cntbad++;
-                                }
-                            }
-                        }
-                    }
-                    resLock.unlock();
-                }
-            } );
+        // Resolve phase. Messages are linked in top level order, so that the outcome
+        // does not depend on thread scheduling.
+        for( uint32_t j=0; j<topsize; j++ )
+        {
+            const auto i = toplevel[j];
+            const auto& cand = candidates[j];
+            if( cand.verdict == Verdict::None || root[i] == root[cand.best] )
+            {
+                cntnew++;
+                continue;
+            }
+            switch( cand.verdict )
+            {
+            case Verdict::Time:
+                cnttime++;
+                break;
+            case Verdict::Subject:
+                cntbad++;
+                break;
+            case Verdict::Match:
+                cntsure++;
+                found.emplace_back( i, cand.best );
+                SetRootTo( i, root[cand.best] );
+                break;
+            default:
+                assert( false );
+                break;
+            }
         }
-        tasks.Sync();
         std::sort( found.begin(), found.end(), [] ( const auto& l, const auto& r ) { return l.first < r.first; } );
     }
-    printf( "%zu/%zu\n", topsize, topsize );
 
     robin_hood::unordered_flat_set<uint32_t> bad;
 
@@ -507,9 +909,17 @@ int main( int argc, char** argv )
         fwrite( toplevel.data(), 1, sizeof( uint32_t ) * toplevel.size(), tlout );
         fclose( tlout );
 
+        uint64_t datasize = 0;
+        for( uint32_t i=0; i<size; i++ )
+        {
+            datasize += sizeof( uint32_t ) * ( 4 + msgdata[i].children.size() );
+        }
+        const bool wide = NeedsWideOffsets( datasize );
+        WriteWideOffsets( base, WideConnectivity, wide );
+
         FILE* cdata = fopen( ( base + "conndata" ).c_str(), "wb" );
         FILE* cmeta = fopen( ( base + "connmeta" ).c_str(), "wb" );
-        uint32_t offset = 0;
+        uint64_t offset = 0;
         for( uint32_t i=0; i<size; i++ )
         {
             if( ( i & 0x1FFF ) == 0 )
@@ -518,7 +928,7 @@ int main( int argc, char** argv )
                 fflush( stdout );
             }
 
-            fwrite( &offset, 1, sizeof( uint32_t ), cmeta );
+            WriteOffset( offset, wide, cmeta );
 
             offset += fwrite( &msgdata[i].epoch, 1, sizeof( Message::epoch ), cdata );
             offset += fwrite( &msgdata[i].parent, 1, sizeof( Message::parent ), cdata );
@@ -533,6 +943,12 @@ int main( int argc, char** argv )
         fclose( cdata );
         fclose( cmeta );
 
+        FILE* ccol = fopen( ( base + "conncol" ).c_str(), "wb" );
+        for( uint32_t i=0; i<size; i++ ) fwrite( &msgdata[i].epoch, 1, sizeof( Message::epoch ), ccol );
+        for( uint32_t i=0; i<size; i++ ) fwrite( &msgdata[i].parent, 1, sizeof( Message::parent ), ccol );
+        for( uint32_t i=0; i<size; i++ ) fwrite( &msgdata[i].childTotal, 1, sizeof( Message::childTotal ), ccol );
+        fclose( ccol );
+
         size_t lexsize;
         LexiconDataPacket* lexdata;
         {
@@ -1,7 +1,10 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
+#include "../common/CpuDispatch.hpp"
+
 static const char* s_help =
 "Usenet Archive Toolkit\n\n"
 "Created by Bartosz Taudul <wolf@nereid.pl>\n"
@@ -62,6 +65,12 @@ void PrintHelp()
     printf( "\nRefer to uat-command man pages for more help.\n" );
 }
 
+void PrintVersion()
+{
+    printf( "Usenet Archive Toolkit\n" );
+    printf( "SIMD code path: %s\n", CpuDispatch::Name() );
+}
+
 int main( int argc, char** argv )
 {
     if( argc == 1 )
@@ -69,6 +78,11 @@ int main( int argc, char** argv )
         PrintHelp();
         return 0;
     }
+    if( strcmp( argv[1], "--version" ) == 0 || strcmp( argv[1], "-v" ) == 0 )
+    {
+        PrintVersion();
+        return 0;
+    }
 
     char tmp[1024];
     sprintf( tmp, "%s/%s", "/usr/lib/uat/", argv[1] );
@@ -1,6 +1,8 @@
 #include <algorithm>
 #include <assert.h>
-#include <mutex>
+#include <atomic>
+#include <limits>
+#include <map>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -14,44 +16,742 @@
 #  include <unistd.h>
 #endif
 
+#include "../contrib/martinus/robin_hood.h"
+#include "../contrib/xxhash/xxhash.h"
 #include "../contrib/zstd/zstd.h"
 
+#include "../common/CharUtil.hpp"
+#include "../common/DayHistogram.hpp"
 #include "../common/ExpandingBuffer.hpp"
 #include "../common/Filesystem.hpp"
 #include "../common/FileMap.hpp"
 #include "../common/HashSearch.hpp"
 #include "../common/MessageView.hpp"
 #include "../common/MetaView.hpp"
+#include "../common/MsgIdHash.hpp"
+#include "../common/ParseDate.hpp"
 #include "../common/RawImportMeta.hpp"
+#include "../common/ReferencesParent.hpp"
+#include "../common/Slab.hpp"
 #include "../common/StringCompress.hpp"
 #include "../common/System.hpp"
 #include "../common/TaskDispatch.hpp"
+#include "../common/WideOffsets.hpp"
 #include "../common/ZMessageView.hpp"
 
-int main( int argc, char** argv )
+struct Buffer
 {
-    int zlevel = 16;
-    bool overwrite = false;
+    uint32_t compressedSize;
+    uint32_t size;
+    const char* data;
+};
+
+// Compresses messages given on the list, or all messages, if the list is empty.
+static Buffer* CompressMessages( const MessageView& uview, const std::vector<uint32_t>& list, const ZSTD_CDict* zdict )
+{
+    const auto cpus = System::CPUCores();
+    const size_t usize = list.empty() ? uview.Size() : list.size();
+
+    printf( "Repacking (%i threads)\n", cpus );
+
+    Buffer* data = new Buffer[usize];
+
+    TaskDispatch tasks( cpus-1 );
+    uint32_t start = 0;
+    uint32_t inPass = ( usize + cpus - 1 ) / cpus;
+    uint32_t left = usize;
+    std::atomic<uint32_t> cnt( 0 );
+    for( int i=0; i<cpus; i++ )
+    {
+        uint32_t todo = std::min( left, inPass );
+        tasks.Queue( [data, zdict, start, todo, &uview, &list, &cnt, usize] () {
+            auto zctx = ZSTD_createCCtx();
+            ExpandingBuffer eb1, eb2;
+            for( uint32_t i=start; i<start+todo; i++ )
+            {
+                auto c = cnt.fetch_add( 1, std::memory_order_relaxed );
+                if( ( c & 0x3FF ) == 0 )
+                {
+                    printf( "%i/%zu\r", c, usize );
+                    fflush( stdout );
+                }
+
+                const auto idx = list.empty() ? i : list[i];
+                auto raw = uview.Raw( idx );
+                auto post = uview.GetMessage( idx, eb1 );
+
+                auto predSize = ZSTD_compressBound( raw.size );
+                auto dst = eb2.Request( predSize );
+                auto dstSize = ZSTD_compress_usingCDict( zctx, dst, predSize, post, raw.size, zdict );
+
+                char* buf = new char[dstSize];
+                memcpy( buf, dst, dstSize );
+
+                data[i].compressedSize = dstSize;
+                data[i].size = raw.size;
+                data[i].data = buf;
+            }
+            ZSTD_freeCCtx( zctx );
+        } );
+        start += todo;
+        left -= todo;
+    }
+    tasks.Sync();
+
+    return data;
+}
+
+// Files extended by append. Their sizes are recorded in the journal before any of
+// them is modified, so that an interrupted append can be rolled back.
+static const char* AppendedFiles[] = {
+    "zmeta", "zdata", "meta", "data",
+    "midmeta", "middata", "strmeta", "strings",
+    "connmeta", "conndata"
+};
+enum { NumAppendedFiles = sizeof( AppendedFiles ) / sizeof( const char* ) };
+
+// Files rewritten by append. They are written as .new and moved in place at commit.
+static const char* ReplacedFiles[] = { "midhash", "midhashdata", "toplevel", "conncol", "timechart" };
+
+static void RollbackAppend( const std::string& base )
+{
+    const auto journal = base + "append.journal";
+    FILE* f = fopen( journal.c_str(), "rb" );
+    if( f )
+    {
+        uint64_t size[NumAppendedFiles];
+        if( fread( size, 1, sizeof( size ), f ) == sizeof( size ) )
+        {
+            for( int i=0; i<NumAppendedFiles; i++ )
+            {
+                const auto fn = base + AppendedFiles[i];
+                if( size[i] == std::numeric_limits<uint64_t>::max() || GetFileSize( fn.c_str() ) == size[i] ) continue;
+                if( !TruncateFile( fn, size[i] ) )
+                {
+                    fprintf( stderr, "Cannot restore %s. The archive is damaged.\n", fn.c_str() );
+                    exit( 1 );
+                }
+            }
+        }
+        fclose( f );
+    }
+    for( auto& v : ReplacedFiles ) remove( ( base + v + ".new" ).c_str() );
+    remove( journal.c_str() );
+}
+
+static void CommitAppend( const std::string& base )
+{
+    for( auto& v : ReplacedFiles )
+    {
+        const auto fn = base + v;
+        if( Exists( fn + ".new" ) && !MoveReplace( fn + ".new", fn ) )
+        {
+            fprintf( stderr, "Cannot replace %s\n", fn.c_str() );
+            exit( 1 );
+        }
+    }
+    remove( ( base + "append.commit" ).c_str() );
+}
+
+// Interrupted append is rolled back, unless all data was written before the interruption.
+static void RecoverAppend( const std::string& base )
+{
+    if( Exists( base + "append.commit" ) )
+    {
+        printf( "Completing interrupted append.\n" );
+        CommitAppend( base );
+    }
+    else if( Exists( base + "append.journal" ) )
+    {
+        printf( "Rolling back interrupted append.\n" );
+        RollbackAppend( base );
+    }
+}
+
+static FILE* OpenFile( const std::string& base, const std::string& fn, const char* mode )
+{
+    FILE* f = fopen( fn.c_str(), mode );
+    if( !f )
+    {
+        fprintf( stderr, "Cannot open %s for writing.\n", fn.c_str() );
+        RollbackAppend( base );
+        exit( 1 );
+    }
+    return f;
+}
+
+static void CloseFile( const std::string& base, const std::string& fn, FILE* f )
+{
+    const bool failed = ferror( f ) != 0;
+    if( fclose( f ) != 0 || failed )
+    {
+        fprintf( stderr, "Cannot write %s.\n", fn.c_str() );
+        RollbackAppend( base );
+        exit( 1 );
+    }
+}
+
+template<typename T>
+struct MsgIdHashEntry
+{
+    T offset;
+    T idx;
+};
+
+// Robin hood insertion, as in extract-msgid. Distances of stored entries are recalculated from their hashes.
+// Returns false, if the table overflows.
+template<typename T>
+static bool InsertMsgId( MsgIdHashEntry<T>* table, uint32_t mask, const uint8_t* strdata, MsgIdHashEntry<T> entry, uint8_t& distmax )
+{
+    auto str = strdata + entry.offset;
+    uint32_t hash = XXH32( str, strlen( (const char*)str ), 0 ) & mask;
+    uint32_t dist = 0;
+    for(;;)
+    {
+        auto& h = table[hash];
+        if( h.offset == 0 )
+        {
+            if( distmax < dist ) distmax = dist;
+            h = entry;
+            return true;
+        }
+        str = strdata + h.offset;
+        const uint32_t hdist = ( hash - XXH32( str, strlen( (const char*)str ), 0 ) ) & mask;
+        if( hdist < dist )
+        {
+            if( distmax < dist ) distmax = dist;
+            std::swap( h, entry );
+            dist = hdist;
+        }
+        dist++;
+        if( dist >= std::numeric_limits<uint8_t>::max() ) return false;
+        hash = ( hash + 1 ) & mask;
+    }
+}
+
+// Adds message ids at given middata offsets, with indices starting at first, to the hash table.
+// The table is grown, if needed to keep the load factor.
+template<typename T>
+static void UpdateMsgIdHash( const std::string& base, const std::vector<uint64_t>& offsets, uint32_t first )
+{
+    using Entry = MsgIdHashEntry<T>;
+
+    const FileMap<uint8_t> strdata( base + "middata" );
+    uint8_t distmax;
+    {
+        const FileMap<uint8_t> hashdata( base + "midhashdata" );
+        distmax = hashdata[0];
+    }
+
+    const auto oldsize = GetFileSize( ( base + "midhash" ).c_str() ) / sizeof( Entry );
+    const uint32_t hashsize = std::max<uint64_t>( oldsize, MsgIdHashSize( MsgIdHashBits( first + offsets.size(), 90 ) ) );
+    const uint32_t mask = hashsize - 1;
+    std::vector<Entry> table( hashsize );
+    bool ok = true;
+    {
+        const FileMap<Entry> old( base + "midhash" );
+        if( hashsize == oldsize )
+        {
+            memcpy( table.data(), (const Entry*)old, sizeof( Entry ) * oldsize );
+        }
+        else
+        {
+            printf( "Growing message ID hash table...\n" );
+            fflush( stdout );
+            distmax = 0;
+            for( size_t i=0; i<old.DataSize(); i++ )
+            {
+                if( old[i].offset != 0 ) ok = ok && InsertMsgId<T>( table.data(), mask, strdata, old[i], distmax );
+            }
+        }
+    }
+    for( size_t i=0; i<offsets.size() && ok; i++ )
+    {
+        ok = InsertMsgId<T>( table.data(), mask, strdata, Entry { T( offsets[i] ), T( first + i ) }, distmax );
+    }
+    if( !ok )
+    {
+        fprintf( stderr, "Message ID hash table overflow.\n" );
+        RollbackAppend( base );
+        exit( 1 );
+    }
+
+    const auto hashfn = base + "midhash.new";
+    FILE* f = OpenFile( base, hashfn, "wb" );
+    fwrite( table.data(), 1, sizeof( Entry ) * hashsize, f );
+    CloseFile( base, hashfn, f );
+
+    const auto datafn = base + "midhashdata.new";
+    f = OpenFile( base, datafn, "wb" );
+    fwrite( &distmax, 1, 1, f );
+    CloseFile( base, datafn, f );
+}
+
+static void CheckNarrow( const char* what, uint64_t size, bool wide )
+{
+    if( !wide && size > std::numeric_limits<uint32_t>::max() )
+    {
+        fprintf( stderr, "%s would exceed 32 bit offsets. Rebuild the archive instead of appending.\n", what );
+        exit( 1 );
+    }
+}
+
+// Appends messages of update, which are not present in archive, to the end of archive.
+// Message ids, string metadata, connectivity and time chart are extended in place.
+// New messages are stored in thread order, after all old threads, so that each
+// thread stays contiguous. Replies to messages already in the archive start new
+// threads, as old threads can't grow without renumbering the archive.
+static void Append( const std::string& base, const std::string& update, int zlevel )
+{
+    if( !Exists( update + "strmeta" ) || !Exists( update + "strings" ) )
+    {
+        fprintf( stderr, "Update doesn't have uat-extract-msgmeta data available.\n" );
+        exit( 1 );
+    }
+
+    RecoverAppend( base );
+
+    const auto wide = ReadWideOffsets( base );
+    const auto uwide = ReadWideOffsets( update );
+
+    const MessageView uview( update + "meta", update + "data" );
+    const auto usize = uview.Size();
+    const WideMetaView<uint8_t> umiddb( update + "midmeta", update + "middata", uwide & WideMsgId );
+    const WideMetaView<char> ustrings( update + "strmeta", update + "strings", uwide & WideStrings );
+    const StringCompress ucomp( update + "msgid.codebook" );
+    const StringCompress scomp( base + "msgid.codebook" );
+
+    using MsgIdMap = robin_hood::unordered_flat_map<const char*, uint32_t, CharUtil::Hasher, CharUtil::Comparator>;
+
+    struct Message
+    {
+        uint32_t epoch;
+        int32_t parent;
+        uint32_t childTotal;
+        std::vector<uint32_t> children;
+    };
+
+    const uint32_t ssize = GetFileSize( ( base + "zmeta" ).c_str() ) / sizeof( RawImportMeta );
+
+    Slab<32*1024*1024> slab;
+    std::vector<uint32_t> added;            // indices in update
+    std::vector<const uint8_t*> msgid;      // packed with code book of archive
+    MsgIdMap addedmap;                      // indices in archive, in order of update
+
+    printf( "Finding new messages...\n" );
+    {
+        const HashSearch<uint8_t> hash( base + "middata", base + "midhash", base + "midhashdata", wide & WideMsgId );
+        for( uint32_t i=0; i<usize; i++ )
+        {
+            if( ( i & 0x3FFF ) == 0 )
+            {
+                printf( "%i/%zu\r", i, usize );
+                fflush( stdout );
+            }
+
+            auto pack = (uint8_t*)slab.Alloc( 2048 );
+            const auto sz = scomp.Repack( umiddb[i], pack, ucomp );
+            if( hash.Search( pack ) >= 0 || addedmap.find( (const char*)pack ) != addedmap.end() )
+            {
+                slab.Unalloc( 2048 );
+                continue;
+            }
+            slab.Unalloc( 2048 - sz );
+            addedmap.emplace( (const char*)pack, uint32_t( ssize + added.size() ) );
+            added.emplace_back( i );
+            msgid.emplace_back( pack );
+        }
+    }
+
+    const auto nadd = added.size();
+    printf( "\nNew messages: %zu\n", nadd );
+    if( nadd == 0 ) return;
+
+    std::vector<Message> msg( nadd );
+    std::vector<uint32_t> toplevel;
+    std::vector<uint32_t> conndata;
+    std::vector<uint64_t> connoffset( nadd );
+    uint32_t detached = 0;
+    const auto conndataSize = GetFileSize( ( base + "conndata" ).c_str() );
+
+    printf( "Building graph...\n" );
+    fflush( stdout );
+    {
+        struct CombinedSearch
+        {
+            int Search( const uint8_t* str ) const
+            {
+                const auto idx = hash.Search( str );
+                if( idx >= 0 ) return idx;
+                auto it = added.find( (const char*)str );
+                return it != added.end() ? int( it->second ) : -1;
+            }
+
+            const HashSearch<uint8_t>& hash;
+            const MsgIdMap& added;
+        };
+
+        const HashSearch<uint8_t> hash( base + "middata", base + "midhash", base + "midhashdata", wide & WideMsgId );
+        const CombinedSearch search { hash, addedmap };
+        const WideMetaView<uint32_t> conn( base + "connmeta", base + "conndata", wide & WideConnectivity );
+        if( conn.Size() != ssize )
+        {
+            fprintf( stderr, "Connectivity data doesn't match messages.\n" );
+            exit( 1 );
+        }
+
+        ExpandingBuffer eb;
+        std::vector<const char*> cache;
+        ParseDateStats stats = {};
+        for( uint32_t i=0; i<nadd; i++ )
+        {
+            auto post = uview.GetMessage( added[i], eb );
+            char tmp[1024];
+            const auto parent = GetParentFromReferences( post, scomp, search, tmp );
+            msg[i].epoch = ParseDate( post, stats, cache );
+            msg[i].childTotal = 1;
+            if( parent < 0 )
+            {
+                msg[i].parent = -1;
+            }
+            else if( parent < int32_t( ssize ) )
+            {
+                msg[i].parent = -1;
+                detached++;
+            }
+            else
+            {
+                msg[i].parent = parent;
+            }
+        }
 
-    if( argc < 4 )
+        // Only chains of new messages can loop.
+        robin_hood::unordered_flat_set<uint32_t> visited;
+        for( uint32_t i=0; i<nadd; i++ )
+        {
+            visited.clear();
+            auto idx = ssize + i;
+            for(;;)
+            {
+                const auto parent = msg[idx - ssize].parent;
+                if( parent < int32_t( ssize ) ) break;
+                if( visited.find( parent ) != visited.end() )
+                {
+                    msg[idx - ssize].parent = -1;
+                    break;
+                }
+                idx = parent;
+                visited.emplace( idx );
+            }
+        }
+
+        auto Epoch = [&conn, &msg, ssize] ( uint32_t idx ) { return idx < ssize ? *conn[idx] : msg[idx - ssize].epoch; };
+        auto Earlier = [&Epoch] ( uint32_t l, uint32_t r ) { return Epoch( l ) < Epoch( r ); };
+
+        std::vector<uint32_t> roots;
+        for( uint32_t i=0; i<nadd; i++ )
+        {
+            const auto parent = msg[i].parent;
+            if( parent == -1 )
+            {
+                roots.emplace_back( ssize + i );
+            }
+            else
+            {
+                msg[parent - ssize].children.emplace_back( ssize + i );
+            }
+        }
+        std::sort( roots.begin(), roots.end(), Earlier );
+        for( auto& m : msg ) std::sort( m.children.begin(), m.children.end(), Earlier );
+
+        // Depth first order of threads, as established by uat-sort.
+        std::vector<uint32_t> order;
+        order.reserve( nadd );
+        std::vector<uint32_t> stack;
+        for( auto& r : roots )
+        {
+            stack.emplace_back( r );
+            while( !stack.empty() )
+            {
+                const auto idx = stack.back();
+                stack.pop_back();
+                order.emplace_back( idx - ssize );
+                auto& children = msg[idx - ssize].children;
+                for( auto it = children.rbegin(); it != children.rend(); ++it ) stack.emplace_back( *it );
+            }
+        }
+        assert( order.size() == nadd );
+
+        std::vector<uint32_t> pos( nadd );
+        for( uint32_t i=0; i<nadd; i++ ) pos[order[i]] = ssize + i;
+
+        std::vector<Message> sorted( nadd );
+        std::vector<uint32_t> sortedAdded( nadd );
+        std::vector<const uint8_t*> sortedMsgId( nadd );
+        for( uint32_t i=0; i<nadd; i++ )
+        {
+            auto& m = msg[order[i]];
+            auto& s = sorted[i];
+            s.epoch = m.epoch;
+            s.parent = m.parent == -1 ? -1 : pos[m.parent - ssize];
+            s.childTotal = 1;
+            s.children.reserve( m.children.size() );
+            for( auto& c : m.children ) s.children.emplace_back( pos[c - ssize] );
+            sortedAdded[i] = added[order[i]];
+            sortedMsgId[i] = msgid[order[i]];
+        }
+        for( uint32_t i=nadd; i>0; i-- )
+        {
+            const auto parent = sorted[i-1].parent;
+            if( parent != -1 ) sorted[parent - ssize].childTotal += sorted[i-1].childTotal;
+        }
+        for( auto& r : roots ) r = pos[r - ssize];
+        std::swap( msg, sorted );
+        std::swap( added, sortedAdded );
+        std::swap( msgid, sortedMsgId );
+
+        for( uint32_t i=0; i<nadd; i++ )
+        {
+            auto& m = msg[i];
+            connoffset[i] = conndataSize + conndata.size() * sizeof( uint32_t );
+            conndata.emplace_back( m.epoch );
+            conndata.emplace_back( m.parent );
+            conndata.emplace_back( m.childTotal );
+            conndata.emplace_back( m.children.size() );
+            conndata.insert( conndata.end(), m.children.begin(), m.children.end() );
+        }
+
+        const FileMap<uint32_t> oldtop( base + "toplevel" );
+        toplevel.resize( oldtop.DataSize() + roots.size() );
+        std::merge( (const uint32_t*)oldtop, oldtop + oldtop.DataSize(), roots.begin(), roots.end(), toplevel.begin(), Earlier );
+    }
+
+    if( detached != 0 ) printf( "Replies to messages already in archive, added as new threads: %u\n", detached );
+
+    CheckNarrow( "Connectivity data", conndataSize + conndata.size() * sizeof( uint32_t ), wide & WideConnectivity );
+
+    uint64_t midsize = 0;
+    for( auto& v : msgid ) midsize += strlen( (const char*)v ) + 1;
+    const auto middataSize = GetFileSize( ( base + "middata" ).c_str() );
+    CheckNarrow( "Message ID data", middataSize + midsize, wide & WideMsgId );
+
+    uint64_t strsize = 0;
+    for( auto& v : added )
     {
-        fprintf( stderr, "USAGE: %s [params] source update destination\nParams:\n", argv[0] );
-        fprintf( stderr, " -z level        - set compression level (default: %i)\n", zlevel );
-        fprintf( stderr, " -o              - overwrite previously existing messages\n" );
+        for( int j=0; j<3; j++ ) strsize += strlen( ustrings[v*3+j] ) + 1;
+    }
+    const auto stringsSize = GetFileSize( ( base + "strings" ).c_str() );
+    CheckNarrow( "String data", stringsSize + strsize, wide & WideStrings );
+
+    ZSTD_CDict* zdict;
+    {
+        FileMap<char> dict( base + "zdict" );
+        zdict = ZSTD_createCDict( dict, dict.Size(), zlevel );
+    }
+    Buffer* data = CompressMessages( uview, added, zdict );
+    ZSTD_freeCDict( zdict );
+
+    printf( "\nWriting to disk...\n" );
+    fflush( stdout );
+
+    // Raw data is kept in sync, so that tools working on it see the new messages.
+    const bool syncRaw = Exists( base + "data" ) && GetFileSize( ( base + "meta" ).c_str() ) == uint64_t( ssize ) * sizeof( RawImportMeta );
+
+    {
+        uint64_t size[NumAppendedFiles];
+        for( int i=0; i<NumAppendedFiles; i++ )
+        {
+            const auto fn = base + AppendedFiles[i];
+            size[i] = Exists( fn ) ? GetFileSize( fn.c_str() ) : std::numeric_limits<uint64_t>::max();
+        }
+        const auto fn = base + "append.journal.new";
+        FILE* f = OpenFile( base, fn, "wb" );
+        fwrite( size, 1, sizeof( size ), f );
+        CloseFile( base, fn, f );
+        if( !MoveReplace( fn, base + "append.journal" ) )
+        {
+            fprintf( stderr, "Cannot write %sappend.journal.\n", base.c_str() );
+            exit( 1 );
+        }
+    }
+
+    {
+        uint64_t offset = GetFileSize( ( base + "zdata" ).c_str() );
+        FILE* zmeta = OpenFile( base, base + "zmeta", "ab" );
+        FILE* zdata = OpenFile( base, base + "zdata", "ab" );
+        for( size_t i=0; i<nadd; i++ )
+        {
+            RawImportMeta packet = { offset, data[i].size, data[i].compressedSize };
+            fwrite( &packet, 1, sizeof( RawImportMeta ), zmeta );
+            fwrite( data[i].data, 1, data[i].compressedSize, zdata );
+            offset += data[i].compressedSize;
+            delete[] data[i].data;
+        }
+        CloseFile( base, base + "zmeta", zmeta );
+        CloseFile( base, base + "zdata", zdata );
+        delete[] data;
+    }
+
+    if( syncRaw )
+    {
+        uint64_t offset = GetFileSize( ( base + "data" ).c_str() );
+        FILE* meta = OpenFile( base, base + "meta", "ab" );
+        FILE* rdata = OpenFile( base, base + "data", "ab" );
+        for( auto& v : added )
+        {
+            const auto raw = uview.Raw( v );
+            RawImportMeta packet = { offset, uint32_t( raw.size ), uint32_t( raw.compressedSize ) };
+            fwrite( &packet, 1, sizeof( RawImportMeta ), meta );
+            fwrite( raw.ptr, 1, raw.compressedSize, rdata );
+            offset += raw.compressedSize;
+        }
+        CloseFile( base, base + "meta", meta );
+        CloseFile( base, base + "data", rdata );
+    }
+
+    {
+        std::vector<uint64_t> offsets;
+        offsets.reserve( nadd );
+        uint64_t offset = middataSize;
+        FILE* meta = OpenFile( base, base + "midmeta", "ab" );
+        FILE* mdata = OpenFile( base, base + "middata", "ab" );
+        for( auto& v : msgid )
+        {
+            WriteOffset( offset, wide & WideMsgId, meta );
+            offsets.emplace_back( offset );
+            offset += fwrite( v, 1, strlen( (const char*)v ) + 1, mdata );
+        }
+        CloseFile( base, base + "midmeta", meta );
+        CloseFile( base, base + "middata", mdata );
+
+        if( wide & WideMsgId )
+        {
+            UpdateMsgIdHash<uint64_t>( base, offsets, ssize );
+        }
+        else
+        {
+            UpdateMsgIdHash<uint32_t>( base, offsets, ssize );
+        }
+    }
+
+    {
+        uint64_t offset = stringsSize;
+        FILE* meta = OpenFile( base, base + "strmeta", "ab" );
+        FILE* sdata = OpenFile( base, base + "strings", "ab" );
+        for( auto& v : added )
+        {
+            for( int j=0; j<3; j++ )
+            {
+                const auto str = ustrings[v*3+j];
+                WriteOffset( offset, wide & WideStrings, meta );
+                offset += fwrite( str, 1, strlen( str ) + 1, sdata );
+            }
+        }
+        CloseFile( base, base + "strmeta", meta );
+        CloseFile( base, base + "strings", sdata );
+    }
+
+    {
+        FILE* cdata = OpenFile( base, base + "conndata", "ab" );
+        fwrite( conndata.data(), 1, conndata.size() * sizeof( uint32_t ), cdata );
+        CloseFile( base, base + "conndata", cdata );
+
+        FILE* cmeta = OpenFile( base, base + "connmeta", "ab" );
+        for( auto& v : connoffset ) WriteOffset( v, wide & WideConnectivity, cmeta );
+        CloseFile( base, base + "connmeta", cmeta );
+
+        FILE* tlout = OpenFile( base, base + "toplevel.new", "wb" );
+        fwrite( toplevel.data(), 1, sizeof( uint32_t ) * toplevel.size(), tlout );
+        CloseFile( base, base + "toplevel.new", tlout );
+    }
+
+    // Columns are dense, so they have to be rewritten.
+    if( GetFileSize( ( base + "conncol" ).c_str() ) == uint64_t( ssize ) * 3 * sizeof( uint32_t ) )
+    {
+        const FileMap<uint32_t> old( base + "conncol" );
+        FILE* ccol = OpenFile( base, base + "conncol.new", "wb" );
+        for( int i=0; i<3; i++ )
+        {
+            fwrite( old + ssize * i, 1, sizeof( uint32_t ) * ssize, ccol );
+            for( auto& v : msg )
+            {
+                const uint32_t val = i == 0 ? v.epoch : ( i == 1 ? uint32_t( v.parent ) : v.childTotal );
+                fwrite( &val, 1, sizeof( uint32_t ), ccol );
+            }
+        }
+        CloseFile( base, base + "conncol.new", ccol );
+    }
+    else
+    {
+        remove( ( base + "conncol" ).c_str() );
+    }
+
+    if( Exists( base + "timechart" ) )
+    {
+        DayHistogram chart;
+        {
+            const FileMap<uint32_t> old( base + "timechart" );
+            chart = DayHistogram( old, old.DataSize() );
+        }
+        for( auto& v : msg ) chart.AddDate( v.epoch );
+        if( !chart.Write( base + "timechart.new" ) )
+        {
+            fprintf( stderr, "Cannot write %stimechart.new.\n", base.c_str() );
+            RollbackAppend( base );
+            exit( 1 );
+        }
+    }
+
+    // All data is written. From now on interrupted append is completed instead of rolled back.
+    if( !MoveReplace( base + "append.journal", base + "append.commit" ) )
+    {
+        fprintf( stderr, "Cannot commit append.\n" );
+        RollbackAppend( base );
         exit( 1 );
     }
+    CommitAppend( base );
 
+    printf( "Lexicon doesn't include new messages. Run uat-lexicon -d %u to update it.\n", ssize );
+}
+
+static void Usage( const char* image, int zlevel )
+{
+    fprintf( stderr, "USAGE: %s [params] source update destination\n", image );
+    fprintf( stderr, "       %s -a [params] archive update\nParams:\n", image );
+    fprintf( stderr, " -z level        - set compression level (default: %i)\n", zlevel );
+    fprintf( stderr, " -o              - overwrite previously existing messages\n" );
+    fprintf( stderr, " -a              - append new messages to archive in place\n" );
+    exit( 1 );
+}
+
+int main( int argc, char** argv )
+{
+    int zlevel = 16;
+    bool overwrite = false;
+    bool append = false;
+
+    if( argc < 4 ) Usage( argv[0], zlevel );
+
+    const auto image = argv[0];
     for(;;)
     {
-        if( strcmp( argv[1], "-z" ) == 0 )
+        if( argc > 2 && strcmp( argv[1], "-z" ) == 0 )
         {
             zlevel = atoi( argv[2] );
             argv += 2;
+            argc -= 2;
         }
-        if( strcmp( argv[1], "-o" ) == 0 )
+        if( argc > 1 && strcmp( argv[1], "-o" ) == 0 )
         {
             overwrite = true;
             argv++;
+            argc--;
+        }
+        else if( argc > 1 && strcmp( argv[1], "-a" ) == 0 )
+        {
+            append = true;
+            argv++;
+            argc--;
         }
         else
         {
@@ -59,6 +759,24 @@ int main( int argc, char** argv )
         }
     }
 
+    if( append )
+    {
+        if( argc != 3 || overwrite ) Usage( image, zlevel );
+        if( !Exists( argv[1] ) )
+        {
+            fprintf( stderr, "Archive directory doesn't exist.\n" );
+            exit( 1 );
+        }
+        if( !Exists( argv[2] ) )
+        {
+            fprintf( stderr, "Update directory doesn't exist.\n" );
+            exit( 1 );
+        }
+        Append( std::string( argv[1] ) + "/", std::string( argv[2] ) + "/", zlevel );
+        return 0;
+    }
+    if( argc != 4 ) Usage( image, zlevel );
+
     if( !Exists( argv[1] ) )
     {
         fprintf( stderr, "Source directory doesn't exist.\n" );
@@ -82,7 +800,7 @@ int main( int argc, char** argv )
     std::string target = argv[3];
     target.append( "/" );
 
-    MessageView uview( update + "meta", update + "data" );
+    const MessageView uview( update + "meta", update + "data" );
     auto usize = uview.Size();
 
     std::string szmetafn = source + "zmeta";
@@ -90,10 +808,12 @@ int main( int argc, char** argv )
     std::string szdictfn = source + "zdict";
 
     const ZMessageView zview( szmetafn, szdatafn, szdictfn );
-    const HashSearch<uint8_t> shash( source + "middata", source + "midhash", source + "midhashdata" );
-    const HashSearch<uint8_t> uhash( update + "middata", update + "midhash", update + "midhashdata" );
-    const MetaView<uint32_t, uint8_t> smiddb( source + "midmeta", source + "middata" );
-    const MetaView<uint32_t, uint8_t> umiddb( update + "midmeta", update + "middata" );
+    const bool swide = ReadWideOffsets( source ) & WideMsgId;
+    const bool uwide = ReadWideOffsets( update ) & WideMsgId;
+    const HashSearch<uint8_t> shash( source + "middata", source + "midhash", source + "midhashdata", swide );
+    const HashSearch<uint8_t> uhash( update + "middata", update + "midhash", update + "midhashdata", uwide );
+    const WideMetaView<uint8_t> smiddb( source + "midmeta", source + "middata", swide );
+    const WideMetaView<uint8_t> umiddb( update + "midmeta", update + "middata", uwide );
     const StringCompress scomp( source + "msgid.codebook" );
     const StringCompress ucomp( update + "msgid.codebook" );
 
@@ -103,66 +823,7 @@ int main( int argc, char** argv )
         zdict = ZSTD_createCDict( szdict, szdict.Size(), zlevel );
     }
 
-    const auto cpus = System::CPUCores();
-
-    printf( "Repacking (%i threads)\n", cpus );
-
-    struct Buffer
-    {
-        uint32_t compressedSize;
-        uint32_t size;
-        const char* data;
-    };
-
-    Buffer* data = new Buffer[usize];
-
-    std::mutex mtx, cntmtx;
-    TaskDispatch tasks( cpus-1 );
-    uint32_t start = 0;
-    uint32_t inPass = ( usize + cpus - 1 ) / cpus;
-    uint32_t left = usize;
-    uint32_t cnt = 0;
-    for( int i=0; i<cpus; i++ )
-    {
-        uint32_t todo = std::min( left, inPass );
-        tasks.Queue( [data, zdict, start, todo, &uview, &mtx, &cnt, &cntmtx, usize] () {
-            auto zctx = ZSTD_createCCtx();
-            ExpandingBuffer eb1, eb2;
-            for( uint32_t i=start; i<start+todo; i++ )
-            {
-                cntmtx.lock();
-                auto c = cnt++;
-                cntmtx.unlock();
-                if( ( c & 0x3FF ) == 0 )
-                {
-                    printf( "%i/%zu\r", c, usize );
-                    fflush( stdout );
-                }
-
-                auto raw = uview.Raw( i );
-                auto post = eb1.Request( raw.size );
-                mtx.lock();
-                auto _post = uview[i];
-                memcpy( post, _post, raw.size );
-                mtx.unlock();
-
-                auto predSize = ZSTD_compressBound( raw.size );
-                auto dst = eb2.Request( predSize );
-                auto dstSize = ZSTD_compress_usingCDict( zctx, dst, predSize, post, raw.size, zdict );
-
-                char* buf = new char[dstSize];
-                memcpy( buf, dst, dstSize );
-
-                data[i].compressedSize = dstSize;
-                data[i].size = raw.size;
-                data[i].data = buf;
-            }
-            ZSTD_freeCCtx( zctx );
-        } );
-        start += todo;
-        left -= todo;
-    }
-    tasks.Sync();
+    Buffer* data = CompressMessages( uview, {}, zdict );
 
     ZSTD_freeCDict( zdict );
 
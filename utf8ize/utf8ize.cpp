@@ -1,5 +1,7 @@
 #include <algorithm>
 #include <assert.h>
+#include <atomic>
+#include <chrono>
 #include <lz4.h>
 #include <lz4hc.h>
 #include <stdint.h>
@@ -8,9 +10,9 @@
 #include <string>
 #include <string.h>
 #include <strings.h>
-#include <sstream>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <vector>
 
 #include <gmime/gmime.h>
 
@@ -18,6 +20,11 @@
 #include "../common/Filesystem.hpp"
 #include "../common/MessageView.hpp"
 #include "../common/RawImportMeta.hpp"
+#include "../common/System.hpp"
+#include "../common/TaskDispatch.hpp"
+#include "../common/UTF8.hpp"
+
+enum { BatchSize = 16 * 1024 };
 
 static const char* userEncodings[] = {
     "ISO8859-2",
@@ -35,7 +42,7 @@ static const unsigned char plChars[][18] = {
 
 int weights[18]= { 1, 1, 1, 1, 1, 1, 1, 1, 1, 15, 10, 16, 19, 1, 13, 13, 1, 18 };
 
-static int deductions[sizeof(userEncodings)/sizeof(const char*)] = {};
+static std::atomic<int> deductions[sizeof(userEncodings)/sizeof(const char*)] = {};
 
 struct EncodingFixupEntry
 {
@@ -256,6 +263,205 @@ static std::string mime_part_to_text( GMimeObject* obj )
     return ret;
 }
 
+struct Stats
+{
+    int mimeFails = 0;
+    int passThrough = 0;
+    uint64_t check = 0;
+    uint64_t parse = 0;
+    uint64_t headers = 0;
+    uint64_t body = 0;
+    uint64_t compress = 0;
+};
+
+// Returns microseconds since t and restarts the measurement.
+static uint64_t Elapsed( std::chrono::steady_clock::time_point& t )
+{
+    const auto now = std::chrono::steady_clock::now();
+    const auto ret = std::chrono::duration_cast<std::chrono::microseconds>( now - t ).count();
+    t = now;
+    return ret;
+}
+
+// Charsets, in which 7-bit text needs no conversion.
+static const char* asciiCharsets[] = {
+    "us-ascii",
+    "utf-8",
+    "iso-8859-",
+    "windows-125",
+    "cp125",
+    "koi8-",
+    nullptr
+};
+
+static bool IsAsciiCharset( const char* str, size_t len )
+{
+    auto test = asciiCharsets;
+    while( *test )
+    {
+        const auto tlen = strlen( *test );
+        if( len >= tlen && strncasecmp( str, *test, tlen ) == 0 ) return true;
+        test++;
+    }
+    return false;
+}
+
+// Conversion doesn't change messages with single text/plain part in 7-bit or
+// UTF-8 text, which have only plain, unfolded 7-bit headers without encoded
+// words. Such messages are detected here, without involving GMime.
+static bool IsPassThrough( const char* post, size_t size )
+{
+    bool ascii;
+    if( !utfvalid( post, size, ascii ) ) return false;
+    if( memchr( post, '\r', size ) ) return false;
+
+    const auto end = post + size;
+    const char* charset = nullptr;
+    size_t charsetLen = 0;
+    int headers = 0;
+    auto ptr = post;
+    while( ptr < end && *ptr != '\n' )
+    {
+        const auto eol = (const char*)memchr( ptr, '\n', end - ptr );
+        if( !eol ) return false;
+
+        const auto name = ptr;
+        while( ptr < eol && *ptr > ' ' && *ptr < 0x7F && *ptr != ':' ) ptr++;
+        if( ptr == name || eol - ptr < 3 || ptr[0] != ':' || ptr[1] != ' ' ) return false;
+        const auto nlen = ptr - name;
+        const auto value = ptr + 2;
+        const auto vlen = eol - value;
+        if( value[0] == ' ' || value[0] == '\t' || eol[-1] == ' ' || eol[-1] == '\t' ) return false;
+        for( auto p = value; p < eol; p++ )
+        {
+            if( *p & 0x80 ) return false;
+            if( p[0] == '=' && p[1] == '?' ) return false;
+        }
+
+        if( nlen == 12 && strncasecmp( name, "Content-Type", 12 ) == 0 )
+        {
+            if( vlen < 10 || strncasecmp( value, "text/plain", 10 ) != 0 ) return false;
+            if( vlen > 10 && value[10] != ';' ) return false;
+            for( auto p = value + 10; p + 8 <= eol; p++ )
+            {
+                if( strncasecmp( p, "charset=", 8 ) == 0 )
+                {
+                    p += 8;
+                    if( p < eol && *p == '"' ) p++;
+                    charset = p;
+                    while( p < eol && *p != '"' && *p != ';' && *p != ' ' ) p++;
+                    charsetLen = p - charset;
+                    break;
+                }
+            }
+        }
+        else if( nlen == 25 && strncasecmp( name, "Content-Transfer-Encoding", 25 ) == 0 )
+        {
+            if( vlen != 4 || ( strncasecmp( value, "7bit", 4 ) != 0 && strncasecmp( value, "8bit", 4 ) != 0 ) ) return false;
+        }
+
+        headers++;
+        ptr = eol + 1;
+    }
+    if( headers == 0 || end - ptr < 2 ) return false;
+
+    // Messages with 8-bit text are only passed as valid UTF-8, regardless of charset.
+    if( ascii && charset && !IsAsciiCharset( charset, charsetLen ) ) return false;
+
+    return true;
+}
+
+static void Convert( const char* post, size_t size, GMimeParserOptions* opts, std::string& ss, Stats& stats )
+{
+    auto t = std::chrono::steady_clock::now();
+
+    GMimeStream* istream = g_mime_stream_mem_new_with_buffer( post, size );
+    GMimeParser* parser = g_mime_parser_new_with_stream( istream );
+    g_object_unref( istream );
+
+    GMimeMessage* message = g_mime_parser_construct_message( parser, opts );
+    g_object_unref( parser );
+
+    stats.parse += Elapsed( t );
+
+    GMimeHeaderList* ls = GMIME_OBJECT( message )->headers;
+    const auto hdrcnt = g_mime_header_list_get_count( ls );
+
+    for( int i=0; i<hdrcnt; i++ )
+    {
+        auto header = g_mime_header_list_get_header_at( ls, i );
+        auto name = g_mime_header_get_name( header );
+        auto value = g_mime_header_get_value( header );
+        auto tmp = g_mime_utils_header_decode_text( opts, value );
+        auto decode = g_mime_utils_header_decode_phrase( opts, tmp );
+        if( strcmp( value, decode ) == 0 && IsValidUTF8( (const unsigned char*)value, strlen( value ) ) )
+        {
+            FixBrokenEncoding( decode );
+        }
+        g_free( tmp );
+        ss.append( name );
+        ss.append( ": " );
+        ss.append( decode );
+        ss.append( "\n" );
+        g_free( decode );
+    }
+
+    stats.headers += Elapsed( t );
+
+    std::string content;
+    GMimeObject* last = nullptr;
+    GMimePartIter* pit = g_mime_part_iter_new( (GMimeObject*)message );
+    do
+    {
+        GMimeObject* part = g_mime_part_iter_get_current( pit );
+        if( GMIME_IS_OBJECT( part ) && GMIME_IS_PART( part ) )
+        {
+            GMimeContentType* content_type = g_mime_object_get_content_type( part );
+            if( content.empty() && ( !content_type || g_mime_content_type_is_type( content_type, "text", "plain" ) ) )
+            {
+                content = mime_part_to_text( part );
+            }
+            if( g_mime_content_type_is_type( content_type, "text", "html" ) )
+            {
+                last = part;
+            }
+        }
+    }
+    while( g_mime_part_iter_next( pit ) );
+    g_mime_part_iter_free( pit );
+    if( content.empty() )
+    {
+        if( last )
+        {
+            content = mime_part_to_text( last );
+        }
+    }
+    if( content.empty() )
+    {
+        GMimeObject* body = g_mime_message_get_body( message );
+        content = mime_part_to_text( body );
+    }
+    if( content.empty() )
+    {
+        stats.mimeFails++;
+        auto buf = post;
+        for(;;)
+        {
+            auto end = buf;
+            if( *end == '\n' ) break;
+            while( *end != '\n' ) end++;
+            buf = end + 1;
+        }
+        content = buf + 1;
+    }
+
+    ss.append( "\n" );
+    ss.append( content );
+    g_object_unref( message );
+
+    stats.body += Elapsed( t );
+}
+
 int main( int argc, char** argv )
 {
     if( argc != 3 )
@@ -279,7 +485,7 @@ int main( int argc, char** argv )
     std::string base = argv[1];
     base.append( "/" );
 
-    MessageView mview( base + "meta", base + "data" );
+    const MessageView mview( base + "meta", base + "data" );
     const auto size = mview.Size();
 
     std::string dbase = argv[2];
@@ -298,129 +504,135 @@ int main( int argc, char** argv )
     };
 
     g_mime_init();
-    GMimeParserOptions* opts = g_mime_parser_options_new();
-    g_mime_parser_options_set_fallback_charsets( opts, charsets );
-
-    int mime_fails = 0;
-    std::ostringstream ss;
-    ExpandingBuffer eb;
-    uint64_t offset = 0;
-    for( uint32_t i=0; i<size; i++ )
-    {
-        if( ( i & 0x3FF ) == 0 )
-        {
-            printf( "%i/%zu\r", i, size );
-            fflush( stdout );
-        }
-
-        auto post = mview[i];
-        auto raw = mview.Raw( i );
 
-        GMimeStream* istream = g_mime_stream_mem_new_with_buffer( post, raw.size );
-        GMimeParser* parser = g_mime_parser_new_with_stream( istream );
-        g_object_unref( istream );
+    // Each worker has its own parser options, buffers and statistics. Messages
+    // are processed in batches, which are then written in order by the main
+    // thread, so the output doesn't depend on the number of threads.
+    const auto cpus = System::CPUCores();
+    printf( "Converting (%i threads)\n", cpus );
 
-        GMimeMessage* message = g_mime_parser_construct_message( parser, opts );
-        g_object_unref( parser );
+    struct Worker
+    {
+        GMimeParserOptions* opts;
+        ExpandingBuffer eb;
+        ExpandingBuffer lz4;
+        std::string ss;
+        Stats stats;
+    };
+    std::vector<Worker> workers( cpus );
+    for( auto& w : workers )
+    {
+        w.opts = g_mime_parser_options_new();
+        g_mime_parser_options_set_fallback_charsets( w.opts, charsets );
+    }
 
-        GMimeHeaderList* ls = GMIME_OBJECT( message )->headers;
-        const auto hdrcnt = g_mime_header_list_get_count( ls );
+    struct Output
+    {
+        std::string data;
+        uint32_t size;
+    };
+    std::vector<Output> batch( BatchSize );
 
-        for( int i=0; i<hdrcnt; i++ )
-        {
-            auto header = g_mime_header_list_get_header_at( ls, i );
-            auto name = g_mime_header_get_name( header );
-            auto value = g_mime_header_get_value( header );
-            auto tmp = g_mime_utils_header_decode_text( opts, value );
-            auto decode = g_mime_utils_header_decode_phrase( opts, tmp );
-            if( strcmp( value, decode ) == 0 && IsValidUTF8( (const unsigned char*)value, strlen( value ) ) )
-            {
-                FixBrokenEncoding( decode );
-            }
-            g_free( tmp );
-            ss << name << ": " << decode << "\n";
-            g_free( decode );
-        }
+    TaskDispatch tasks( cpus-1 );
+    uint64_t writeTime = 0;
+    uint64_t offset = 0;
+    const auto t0 = std::chrono::steady_clock::now();
+    for( size_t i=0; i<size; i+=BatchSize )
+    {
+        printf( "%zu/%zu\r", i, size );
+        fflush( stdout );
 
-        std::string content;
-        GMimeObject* last = nullptr;
-        GMimePartIter* pit = g_mime_part_iter_new( (GMimeObject*)message );
-        do
+        const auto bsize = std::min<size_t>( BatchSize, size - i );
+        std::atomic<uint32_t> cnt( 0 );
+        for( int t=0; t<cpus; t++ )
         {
-            GMimeObject* part = g_mime_part_iter_get_current( pit );
-            if( GMIME_IS_OBJECT( part ) && GMIME_IS_PART( part ) )
-            {
-                GMimeContentType* content_type = g_mime_object_get_content_type( part );
-                if( content.empty() && ( !content_type || g_mime_content_type_is_type( content_type, "text", "plain" ) ) )
-                {
-                    content = mime_part_to_text( part );
-                }
-                if( g_mime_content_type_is_type( content_type, "text", "html" ) )
+            tasks.Queue( [&cnt, &mview, &batch, &w = workers[t], i, bsize] {
+                for(;;)
                 {
-                    last = part;
+                    const auto j = cnt.fetch_add( 1, std::memory_order_relaxed );
+                    if( j >= bsize ) break;
+
+                    const auto raw = mview.Raw( i+j );
+                    const auto post = mview.GetMessage( i+j, w.eb );
+
+                    auto t = std::chrono::steady_clock::now();
+                    const auto pass = IsPassThrough( post, raw.size );
+                    w.stats.check += Elapsed( t );
+                    if( pass )
+                    {
+                        w.stats.passThrough++;
+                        batch[j].data.assign( raw.ptr, raw.compressedSize );
+                        batch[j].size = raw.size;
+                        continue;
+                    }
+
+                    w.ss.clear();
+                    Convert( post, raw.size, w.opts, w.ss, w.stats );
+
+                    t = std::chrono::steady_clock::now();
+                    const uint64_t size = w.ss.size();
+                    int maxSize = LZ4_compressBound( size );
+                    char* compressed = w.lz4.Request( maxSize );
+                    int csize = LZ4_compress_HC( w.ss.c_str(), compressed, size, maxSize, 16 );
+                    batch[j].data.assign( compressed, csize );
+                    batch[j].size = size;
+                    w.stats.compress += Elapsed( t );
                 }
-            }
+            } );
         }
-        while( g_mime_part_iter_next( pit ) );
-        g_mime_part_iter_free( pit );
-        if( content.empty() )
-        {
-            if( last )
-            {
-                content = mime_part_to_text( last );
-            }
-        }
-        if( content.empty() )
-        {
-            GMimeObject* body = g_mime_message_get_body( message );
-            content = mime_part_to_text( body );
-        }
-        if( content.empty() )
-        {
-            mime_fails++;
-            auto buf = post;
-            for(;;)
-            {
-                auto end = buf;
-                if( *end == '\n' ) break;
-                while( *end != '\n' ) end++;
-                buf = end + 1;
-            }
-            content = buf + 1;
-        }
-
-        ss << "\n" << content;
-        g_object_unref( message );
-
-        uint64_t size = ss.str().size();
-        int maxSize = LZ4_compressBound( size );
-        char* compressed = eb.Request( maxSize );
-        int csize = LZ4_compress_HC( ss.str().c_str(), compressed, size, maxSize, 16 );
+        tasks.Sync();
 
-        fwrite( compressed, 1, csize, ddata );
-
-        RawImportMeta packet = { offset, uint32_t( size ), uint32_t( csize ) };
-        fwrite( &packet, 1, sizeof( RawImportMeta ), dmeta );
-        offset += csize;
+        auto t = std::chrono::steady_clock::now();
+        for( size_t j=0; j<bsize; j++ )
+        {
+            const auto& out = batch[j];
+            fwrite( out.data.data(), 1, out.data.size(), ddata );
 
-        ss.str( "" );
+            RawImportMeta packet = { offset, out.size, uint32_t( out.data.size() ) };
+            fwrite( &packet, 1, sizeof( RawImportMeta ), dmeta );
+            offset += out.data.size();
+        }
+        writeTime += Elapsed( t );
     }
+    const auto total = std::chrono::duration_cast<std::chrono::microseconds>( std::chrono::steady_clock::now() - t0 ).count();
 
     printf( "Processed %zu files.\n", size );
 
     fclose( dmeta );
     fclose( ddata );
 
+    Stats stats;
+    for( auto& w : workers )
+    {
+        stats.mimeFails += w.stats.mimeFails;
+        stats.passThrough += w.stats.passThrough;
+        stats.check += w.stats.check;
+        stats.parse += w.stats.parse;
+        stats.headers += w.stats.headers;
+        stats.body += w.stats.body;
+        stats.compress += w.stats.compress;
+        g_mime_parser_options_free( w.opts );
+    }
+
     g_mime_shutdown();
 
     int idx = 0;
     while( userEncodings[idx] )
     {
-        printf( "Deductions of %s encoding: %i\n", userEncodings[idx], deductions[idx] );
+        printf( "Deductions of %s encoding: %i\n", userEncodings[idx], deductions[idx].load() );
         idx++;
     }
-    printf( "Deductions failed: %i\n", deductions[idx] );
-    printf( "Completly broken messages: %i\n", mime_fails );
+    printf( "Deductions failed: %i\n", deductions[idx].load() );
+    printf( "Completly broken messages: %i\n", stats.mimeFails );
+    printf( "Passed through without conversion: %i (%.1f%%)\n", stats.passThrough, size == 0 ? 0.0 : 100.0 * stats.passThrough / size );
+
+    printf( "Time spent in stages, summed over threads:\n" );
+    printf( "  Pass-through check: %.3f s\n", stats.check / 1000000.0 );
+    printf( "  MIME parsing: %.3f s\n", stats.parse / 1000000.0 );
+    printf( "  Header decoding: %.3f s\n", stats.headers / 1000000.0 );
+    printf( "  Body conversion: %.3f s\n", stats.body / 1000000.0 );
+    printf( "  Compression: %.3f s\n", stats.compress / 1000000.0 );
+    printf( "Writing: %.3f s. Total: %.3f s.\n", writeTime / 1000000.0, total / 1000000.0 );
 
     return 0;
 }
@@ -262,6 +262,35 @@ int main( int argc, char** argv )
         PrintInfo( State::Info, "No lexicon distance data" );
     }
 
+    // conncol
+    if( archive->HasConnColumns() )
+    {
+        PrintInfo( State::Ok, "Columnar connectivity data available" );
+    }
+    else
+    {
+        PrintInfo( State::Info, "No columnar connectivity data" );
+    }
+
+    // timechart
+    if( archive->HasTimeChart() )
+    {
+        DayHistogram chart;
+        archive->ForEachDate( [&chart] ( uint32_t date ) { chart.AddDate( date ); } );
+        if( chart == archive->GetDayHistogram() )
+        {
+            PrintInfo( State::Ok, "Time chart matches message dates" );
+        }
+        else
+        {
+            PrintInfo( State::Fail, "Time chart doesn't match message dates" );
+        }
+    }
+    else
+    {
+        PrintInfo( State::Info, "No time chart data" );
+    }
+
     // children total counts
     {
         std::vector<int> v( size, -1 );
@@ -217,9 +217,10 @@ static void Handler( struct mg_connection* nc, int ev, void* data )
                 auto groups = galaxy->GetGroups( idx );
                 for( uint64_t i=0; i<groups.size; i++ )
                 {
-                    if( galaxy->IsArchiveAvailable( groups.ptr[i] ) )
+                    const auto ptr = galaxy->GetArchive( groups.ptr[i] );
+                    if( ptr )
                     {
-                        auto& archive = *galaxy->GetArchive( groups.ptr[i] );
+                        auto& archive = *ptr;
                         uint8_t archivePacked[4096];
                         archive.RepackMsgId( packed, archivePacked, galaxy->GetCompress() );
                         const auto idx = archive.GetMessageIndex( archivePacked );
@@ -344,6 +345,7 @@ int main( int argc, char** argv )
     const char* bind = "127.0.0.1";
     const char* port = "8119";
     const char* galaxyPath = "news/galaxy";
+    const char* maxOpenStr = "0";
     const char* chompStr = "0";
 
     TryIni( bind, config, "server", "bind" );
@@ -351,11 +353,12 @@ int main( int argc, char** argv )
     TryIni( chompStr, config, "server", "chomp" );
     TryIni( tracker, config, "server", "tracker" );
     TryIni( galaxyPath, config, "galaxy", "path" );
+    TryIni( maxOpenStr, config, "galaxy", "maxopen" );
 
     chomp = atoi( chompStr );
     trackerLen = strlen( tracker );
 
-    galaxy.reset( Galaxy::Open( galaxyPath ) );
+    galaxy.reset( Galaxy::Open( galaxyPath, atoi( maxOpenStr ) ) );
     if( !galaxy )
     {
         fprintf( stderr, "Cannot access galaxy at %s!\n", galaxyPath );